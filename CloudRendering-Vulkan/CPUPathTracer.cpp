@@ -0,0 +1,538 @@
+#include "stdafx.h"
+#include "CPUPathTracer.h"
+
+namespace
+{
+	constexpr uint32_t TILE_SIZE = 32; // Same as the shader work group
+	constexpr float PI = 3.14159265359f;
+	constexpr float INV_4PI = 1.0f / (4.0f * PI);
+	const glm::vec4 SUNLIGHT_COLOR = glm::vec4(1.0f);
+	const glm::vec4 BG_COLORS[5] =
+	{
+		glm::vec4(0.00f, 0.0f, 0.02f, 1.0f), // GROUND DARKER BLUE
+		glm::vec4(0.01f, 0.05f, 0.2f, 1.0f), // HORIZON GROUND DARK BLUE
+		glm::vec4(0.7f, 0.9f, 1.0f, 1.0f), // HORIZON SKY WHITE
+		glm::vec4(0.1f, 0.3f, 1.0f, 1.0f), // SKY LIGHT BLUE
+		glm::vec4(0.01f, 0.1f, 0.7f, 1.0f) // SKY BLUE
+	};
+	const float BG_DISTS[5] = { -1.0f, -0.04f, 0.0f, 0.5f, 1.0f };
+
+	// https://www.shadertoy.com/view/lldGRM
+	void CreateOrthonormalBasis(const glm::vec3& n, glm::vec3& xp, glm::vec3& yp)
+	{
+		float sz = n.z >= 0.0f ? 1.0f : -1.0f;
+		float a = n.y / (1.0f + std::abs(n.z));
+		float b = n.y * a;
+		float c = -n.x * a;
+
+		xp = glm::vec3(n.z + sz * b, sz * c, -n.x);
+		yp = glm::vec3(c, 1.0f - b, -sz * n.y);
+	}
+}
+
+//---------------------------------------------------------
+// Random
+//---------------------------------------------------------
+CPUPathTracer::Random::Random(uint32_t seed)
+{
+	state = seed;
+	for (uint32_t i = 0; i < seed % 7 + 2; i++)
+	{
+		Next();
+	}
+}
+
+uint32_t CPUPathTracer::Random::NextUInt()
+{
+	// Xorshift algorithm from George Marsaglia's paper
+	state ^= (state << 13);
+	state ^= (state >> 17);
+	state ^= (state << 5);
+	return state;
+}
+
+float CPUPathTracer::Random::Next()
+{
+	return float(NextUInt()) / 4294967296.0f;
+}
+
+//---------------------------------------------------------
+// Path Tracer
+//---------------------------------------------------------
+CPUPathTracer::CPUPathTracer(Grid3D<float>* cloud, unsigned int threadCount /*= 0*/, bool packetTracking /*= false*/)
+{
+	m_cloud = cloud;
+	m_threadCount = threadCount > 0 ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+	m_packetTracking = packetTracking;
+}
+
+CPUPathTracer::~CPUPathTracer()
+{
+	delete m_packetTracker;
+	delete m_shadowVolume;
+}
+
+void CPUPathTracer::UpdateShadowVolume(const CloudProperties& cloudProperties, const ShadowVolumeProperties& shadowVolumeProperties)
+{
+	m_cloudProperties = cloudProperties;
+	m_shadowVolumeProperties = shadowVolumeProperties;
+
+	const uint32_t axisCount = m_shadowVolumeProperties.voxelAxisCount;
+	if (!m_shadowVolume || m_shadowVolume->GetVoxelCount() != glm::uvec3(axisCount))
+	{
+		delete m_shadowVolume;
+		m_shadowVolume = new Grid3D<float>(axisCount, axisCount, axisCount);
+	}
+
+	// One column along the light direction per job, like one invocation of ShadowVolume.comp
+	utilities::ParallelFor(static_cast<size_t>(axisCount) * axisCount, [this, axisCount](size_t begin, size_t end)
+		{
+			for (size_t column = begin; column < end; column++)
+			{
+				BuildShadowVolumeColumn(static_cast<uint32_t>(column % axisCount), static_cast<uint32_t>(column / axisCount));
+			}
+		});
+}
+
+float CPUPathTracer::EstimateTransmittance(const Ray& ray, Random& random) const
+{
+	float tmax = 0, tmin = 0;
+	if (!IntersectCloud(ray, tmax, tmin) || tmax < 0 || m_cloudProperties.densityScaling <= 0)
+	{
+		return 1.0f;
+	}
+
+	// Ratio tracking against the global majorant, unbiased for any step count
+	float majorant = m_cloudProperties.maxExtinction * m_cloudProperties.densityScaling / m_cloudProperties.baseScaling;
+	float transmittance = 1.0f;
+	float t = std::max(tmin, 0.0f);
+	while (true)
+	{
+		t += -std::log(random.Next()) / majorant;
+		if (t >= tmax)
+		{
+			return transmittance;
+		}
+		transmittance *= 1.0f - SampleCloud(ray.pos + t * ray.dir) / m_cloudProperties.maxExtinction;
+	}
+}
+
+void CPUPathTracer::Render(const CameraProperties& cameraProperties, const CloudProperties& cloudProperties, const Parameters& parameters, const PushConstants& pushConstants)
+{
+	assert(m_shadowVolume && "UpdateShadowVolume has to be called before rendering");
+
+	m_cameraProperties = cameraProperties;
+	m_cloudProperties = cloudProperties;
+	m_parameters = parameters;
+
+	// The tracker caches the majorant and texel transform of the cloud properties
+	if (m_packetTracking)
+	{
+		delete m_packetTracker;
+		m_packetTracker = new PacketTracker(m_cloud, m_cloudProperties);
+	}
+
+	uint32_t width = static_cast<uint32_t>(m_cameraProperties.GetWidth());
+	uint32_t height = static_cast<uint32_t>(m_cameraProperties.GetHeight());
+	if (width != m_width || height != m_height)
+	{
+		m_width = width;
+		m_height = height;
+		m_result.assign(static_cast<size_t>(m_width) * m_height, glm::vec4(0.0f));
+	}
+
+	// Tiles are handed out one by one, so threads that hit cheap background tiles pick up more work
+	const uint32_t tileCount = ((m_width + TILE_SIZE - 1) / TILE_SIZE) * ((m_height + TILE_SIZE - 1) / TILE_SIZE);
+	std::atomic<uint32_t> nextTile{ 0 };
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < m_threadCount; i++)
+	{
+		workers.emplace_back([this, &nextTile, tileCount, &pushConstants]()
+			{
+				for (uint32_t tile = nextTile++; tile < tileCount; tile = nextTile++)
+				{
+					RenderTile(tile, pushConstants);
+				}
+			});
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+const std::vector<glm::vec4>& CPUPathTracer::GetResult() const
+{
+	return m_result;
+}
+
+uint32_t CPUPathTracer::GetWidth() const
+{
+	return m_width;
+}
+
+uint32_t CPUPathTracer::GetHeight() const
+{
+	return m_height;
+}
+
+void CPUPathTracer::RenderTile(uint32_t tileIdx, const PushConstants& pushConstants)
+{
+	const uint32_t tileCountX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+	const uint32_t x0 = (tileIdx % tileCountX) * TILE_SIZE;
+	const uint32_t y0 = (tileIdx / tileCountX) * TILE_SIZE;
+
+	// Running mean as in PathTracer.comp, the first frame restarts it
+	const float sampleCount = float(std::max(pushConstants.frameCount, 1u));
+	auto accumulate = [this, sampleCount](uint32_t x, uint32_t y, const glm::vec4& result)
+	{
+		utilities::AccumulateMean(m_result[x + static_cast<size_t>(y) * m_width], result, sampleCount);
+	};
+
+	for (uint32_t y = y0; y < std::min(y0 + TILE_SIZE, m_height); y++)
+	{
+		const uint32_t x1 = std::min(x0 + TILE_SIZE, m_width);
+		if (m_packetTracker)
+		{
+			// Rows are traced in packets, pixels past the image edge are traced and dropped
+			for (uint32_t x = x0; x < x1; x += RayPacket::SIZE)
+			{
+				glm::ivec2 pixelCoords[RayPacket::SIZE];
+				Random randoms[RayPacket::SIZE];
+				glm::vec4 results[RayPacket::SIZE];
+				for (uint32_t lane = 0; lane < RayPacket::SIZE; lane++)
+				{
+					pixelCoords[lane] = glm::ivec2(x + lane, y);
+					randoms[lane] = Random(static_cast<uint32_t>(pushConstants.seed) * (x + lane + y * m_width));
+				}
+
+				TracePacket(pixelCoords, randoms, results);
+				for (uint32_t lane = 0; lane < RayPacket::SIZE && x + lane < x1; lane++)
+				{
+					accumulate(x + lane, y, results[lane]);
+				}
+			}
+			continue;
+		}
+
+		for (uint32_t x = x0; x < x1; x++)
+		{
+			// Same per pixel seed as PathTracer.comp
+			Random random(static_cast<uint32_t>(pushConstants.seed) * (x + y * m_width));
+			accumulate(x, y, TracePixel(glm::ivec2(x, y), random));
+		}
+	}
+}
+
+glm::vec4 CPUPathTracer::TracePixel(glm::ivec2 pixelCoord, Random& random) const
+{
+	const CameraProperties& camera = m_cameraProperties;
+
+	// Get ray direction and volume entry point
+	Ray ray;
+	ray.dir = camera.forward * camera.nearPlane
+		+ camera.right * camera.pixelSizeX * float(pixelCoord.x - camera.halfWidth)
+		- camera.up * camera.pixelSizeY * float(pixelCoord.y - camera.halfHeight);
+	ray.pos = ray.dir + camera.position;
+	ray.dir = glm::normalize(ray.dir);
+
+	// We just want intersections in front of the ray
+	float tmax = 0, tmin = 0;
+	if (!IntersectCloud(ray, tmax, tmin) || tmax < 0 || m_cloudProperties.densityScaling <= 0)
+	{
+		return SampleBackground(ray.dir);
+	}
+
+	// Ray outside the cloud, pointing torwards it - move to cloud
+	ray.pos = ray.pos + ray.dir * (tmax < tmin ? tmax : tmin);
+
+	glm::vec4 result(0.0f);
+	glm::vec3 lightDirection = glm::vec3(m_shadowVolumeProperties.lightDirection);
+	Ray currentRay = ray;
+	while (true)
+	{
+		// Move along current ray direction and check if ray is still in the cloud
+		if (!FindScatterPoint(ray, random))
+		{
+			result += SampleBackground(ray.dir);
+			break;
+		}
+
+		// Direct light from the shadow volume
+		float pdf = SamplePhase(-ray.dir, lightDirection);
+		result += SUNLIGHT_COLOR * m_parameters.lightIntensity * pdf * SampleShadowVolume(ray.pos);
+
+		ScatterRay(currentRay.dir, ray.dir, random);
+		currentRay = ray;
+	}
+
+	return result;
+}
+
+void CPUPathTracer::TracePacket(const glm::ivec2* pixelCoords, Random* randoms, glm::vec4* results) const
+{
+	assert(m_packetTracker && "Packet tracking has to be enabled on construction");
+
+	Ray rays[RayPacket::SIZE];
+	bool active[RayPacket::SIZE];
+	for (int lane = 0; lane < RayPacket::SIZE; lane++)
+	{
+		active[lane] = false;
+		results[lane] = glm::vec4(0.0f);
+
+		const CameraProperties& camera = m_cameraProperties;
+		Ray& ray = rays[lane];
+		ray.dir = camera.forward * camera.nearPlane
+			+ camera.right * camera.pixelSizeX * float(pixelCoords[lane].x - camera.halfWidth)
+			- camera.up * camera.pixelSizeY * float(pixelCoords[lane].y - camera.halfHeight);
+		ray.pos = ray.dir + camera.position;
+		ray.dir = glm::normalize(ray.dir);
+
+		float tmax = 0, tmin = 0;
+		if (!IntersectCloud(ray, tmax, tmin) || tmax < 0 || m_cloudProperties.densityScaling <= 0)
+		{
+			results[lane] = SampleBackground(ray.dir);
+			continue;
+		}
+
+		ray.pos = ray.pos + ray.dir * (tmax < tmin ? tmax : tmin);
+		active[lane] = true;
+	}
+
+	// Same path loop as TracePixel, lanes drop out as their paths leave the cloud
+	glm::vec3 lightDirection = glm::vec3(m_shadowVolumeProperties.lightDirection);
+	RayPacket packet;
+	while (std::find(active, active + RayPacket::SIZE, true) != active + RayPacket::SIZE)
+	{
+		for (int lane = 0; lane < RayPacket::SIZE; lane++)
+		{
+			const Ray& ray = rays[lane];
+			float tmax = 0, tmin = 0;
+			packet.posX[lane] = ray.pos.x;
+			packet.posY[lane] = ray.pos.y;
+			packet.posZ[lane] = ray.pos.z;
+			packet.dirX[lane] = ray.dir.x;
+			packet.dirY[lane] = ray.dir.y;
+			packet.dirZ[lane] = ray.dir.z;
+			packet.maxT[lane] = active[lane] && IntersectCloud(ray, tmax, tmin) ? tmax : 0.0f;
+			packet.rngState[lane] = randoms[lane].state;
+		}
+
+		m_packetTracker->Track(packet);
+
+		for (int lane = 0; lane < RayPacket::SIZE; lane++)
+		{
+			if (!active[lane])
+			{
+				continue;
+			}
+
+			Ray& ray = rays[lane];
+			randoms[lane].state = packet.rngState[lane];
+			if (!packet.hit[lane])
+			{
+				results[lane] += SampleBackground(ray.dir);
+				active[lane] = false;
+				continue;
+			}
+			ray.pos = ray.pos + packet.t[lane] * ray.dir;
+
+			// Direct light from the shadow volume
+			float pdf = SamplePhase(-ray.dir, lightDirection);
+			results[lane] += SUNLIGHT_COLOR * m_parameters.lightIntensity * pdf * SampleShadowVolume(ray.pos);
+
+			glm::vec3 incomingDirection = ray.dir;
+			ScatterRay(incomingDirection, ray.dir, randoms[lane]);
+		}
+	}
+}
+
+bool CPUPathTracer::FindScatterPoint(Ray& ray, Random& random) const
+{
+	float tmax = 0, tmin = 0;
+	if (!IntersectCloud(ray, tmax, tmin))
+	{
+		return false;
+	}
+
+	// Delta tracking against the global majorant
+	float dist = glm::distance(ray.pos, ray.pos + ray.dir * tmax);
+	float majorant = m_cloudProperties.maxExtinction * m_cloudProperties.densityScaling / m_cloudProperties.baseScaling;
+	float t = 0;
+	glm::vec3 currentPoint(0);
+	while (true)
+	{
+		t += -std::log(random.Next()) / majorant;
+		if (t >= dist)
+		{
+			return false; // Left the cloud
+		}
+
+		currentPoint = ray.pos + t * ray.dir;
+		if (random.Next() < SampleCloud(currentPoint) / m_cloudProperties.maxExtinction)
+		{
+			break;
+		}
+	}
+
+	ray.pos = currentPoint;
+	return true;
+}
+
+//https://www.scratchapixel.com/lessons/3d-basic-rendering/minimal-ray-tracer-rendering-simple-shapes/ray-box-intersection
+bool CPUPathTracer::IntersectCloud(const Ray& ray, float& tmax, float& tmin) const
+{
+	const glm::vec4* bounds = m_cloudProperties.bounds;
+	glm::vec3 invdir = 1.0f / ray.dir;
+	int sign[3] = { tests::isNegativeSign(invdir.x), tests::isNegativeSign(invdir.y), tests::isNegativeSign(invdir.z) };
+
+	tmin = (bounds[sign[0]].x - ray.pos.x) * invdir.x;
+	tmax = (bounds[1 - sign[0]].x - ray.pos.x) * invdir.x;
+	float tymin = (bounds[sign[1]].y - ray.pos.y) * invdir.y;
+	float tymax = (bounds[1 - sign[1]].y - ray.pos.y) * invdir.y;
+
+	if ((tmin > tymax) || (tymin > tmax))
+		return false;
+	if (tymin > tmin)
+		tmin = tymin;
+	if (tymax < tmax)
+		tmax = tymax;
+
+	float tzmin = (bounds[sign[2]].z - ray.pos.z) * invdir.z;
+	float tzmax = (bounds[1 - sign[2]].z - ray.pos.z) * invdir.z;
+
+	if ((tmin > tzmax) || (tzmin > tmax))
+		return false;
+	if (tzmin > tmin)
+		tmin = tzmin;
+	if (tzmax < tmax)
+		tmax = tzmax;
+
+	return true;
+}
+
+float CPUPathTracer::SampleCloud(const glm::vec3& pos) const
+{
+	glm::vec4 normalizedIdx = (glm::vec4(pos, 0) - m_cloudProperties.bounds[0]) / (m_cloudProperties.bounds[1] - m_cloudProperties.bounds[0]);
+	return m_cloud->SampleLinear(glm::vec3(normalizedIdx));
+}
+
+float CPUPathTracer::SampleShadowVolume(const glm::vec3& pos) const
+{
+	const ShadowVolumeProperties& properties = m_shadowVolumeProperties;
+	glm::vec4 normalizedIdx =
+		(properties.basisChange * (glm::vec4(pos, 1) - properties.bounds[0])) /
+		(properties.basisChange * (properties.bounds[1] - properties.bounds[0]));
+	return m_shadowVolume->SampleLinear(glm::vec3(normalizedIdx));
+}
+
+float CPUPathTracer::GetShadowVolumeVoxel(uint32_t x, uint32_t y, uint32_t z) const
+{
+	return (*m_shadowVolume)(x, y, z);
+}
+
+void CPUPathTracer::BuildShadowVolumeColumn(uint32_t x, uint32_t y)
+{
+	const ShadowVolumeProperties& properties = m_shadowVolumeProperties;
+	const uint32_t axisCount = properties.voxelAxisCount;
+	const float voxelSize = properties.voxelSize;
+	Ray column{ glm::vec3(properties.bounds[0] + (float(x) * properties.right + float(y) * properties.up) * voxelSize), glm::vec3(properties.lightDirection) };
+
+	// Range of voxels whose step towards the previous voxel crosses the cloud
+	uint32_t firstZ = axisCount;
+	uint32_t lastZ = axisCount;
+	float tmax = 0, tmin = 0;
+	if (IntersectCloud(column, tmax, tmin) && tmax > 0 && m_cloudProperties.densityScaling > 0)
+	{
+		tmin = std::max(tmin, 0.0f);
+		firstZ = std::min(static_cast<uint32_t>(std::ceil(tmin / voxelSize)), axisCount);
+		lastZ = std::min(static_cast<uint32_t>(std::ceil(tmax / voxelSize)), axisCount - 1);
+	}
+
+	uint32_t z = 0;
+	for (; z < firstZ; z++)
+	{
+		(*m_shadowVolume)(x, y, z) = 1.0f;
+	}
+
+	// Each step is clipped to the cloud and sampled at its midpoint
+	float densityToExtinction = m_cloudProperties.densityScaling / m_cloudProperties.baseScaling;
+	float opticalDepth = 0.0f;
+	for (; z <= lastZ && z < axisCount; z++)
+	{
+		float segmentStart = std::max(float(z) * voxelSize - voxelSize, tmin);
+		float segmentEnd = std::min(float(z) * voxelSize, tmax);
+		if (segmentEnd > segmentStart)
+		{
+			float segmentMid = 0.5f * (segmentStart + segmentEnd);
+			opticalDepth += SampleCloud(column.pos + segmentMid * column.dir) * densityToExtinction * (segmentEnd - segmentStart);
+		}
+		(*m_shadowVolume)(x, y, z) = std::exp(-opticalDepth);
+	}
+
+	float transmittance = std::exp(-opticalDepth);
+	for (; z < axisCount; z++)
+	{
+		(*m_shadowVolume)(x, y, z) = transmittance;
+	}
+}
+
+// Henyey-Greenstein
+float CPUPathTracer::SamplePhase(const glm::vec3& incomingDirection, const glm::vec3& sampleDirection) const
+{
+	if (m_parameters.isotropic)
+	{
+		return INV_4PI;
+	}
+
+	float cosTheta = glm::dot(incomingDirection, sampleDirection);
+	return INV_4PI * m_parameters.phaseOneMinusG2 / std::pow(m_parameters.phaseOnePlusG2 - 2.0f * m_parameters.phaseG * cosTheta, 1.5f);
+}
+
+void CPUPathTracer::ScatterRay(const glm::vec3& incomingDirection, glm::vec3& sampleDirection, Random& random) const
+{
+	if (m_parameters.isotropic)
+	{
+		float xi = random.Next();
+		sampleDirection.z = xi * 2.0f - 1.0f; // cosTheta
+		float sinTheta = 1.0f - sampleDirection.z * sampleDirection.z; // actually square of sinTheta
+		if (sinTheta > 0.0f)
+		{
+			sinTheta = std::sqrt(std::max(0.0f, sinTheta));
+			xi = random.Next();
+			float phi = xi * 2.0f * PI;
+			sampleDirection.x = sinTheta * std::cos(phi);
+			sampleDirection.y = sinTheta * std::sin(phi);
+		}
+		else
+		{
+			sampleDirection.x = sampleDirection.y = 0.0f;
+		}
+	}
+	else
+	{
+		// Inverted CDF, assumes non-isotropic due to division by phaseG
+		float phi = random.Next() * 2 * PI;
+		float sqrTerm = m_parameters.phaseOneMinusG2 / (1.0f - m_parameters.phaseG + 2.0f * m_parameters.phaseG * random.Next());
+		float cosTheta = m_parameters.phaseOneOver2G * (m_parameters.phaseOnePlusG2 - sqrTerm * sqrTerm);
+		float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+		glm::vec3 t0, t1;
+
+		CreateOrthonormalBasis(incomingDirection, t0, t1);
+
+		sampleDirection =
+			sinTheta * std::cos(phi) * t0 +
+			sinTheta * std::sin(phi) * t1 +
+			cosTheta * incomingDirection;
+	}
+}
+
+glm::vec4 CPUPathTracer::SampleBackground(const glm::vec3& dir)
+{
+	glm::vec4 color = BG_COLORS[0];
+	for (int i = 1; i < 5; ++i)
+	{
+		color = glm::mix(color, BG_COLORS[i], glm::smoothstep(BG_DISTS[i - 1], BG_DISTS[i], dir.y));
+	}
+	return color;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Grid3D.h"
+#include "PacketTracker.h"
+
+/*
+ * CPU implementation of PathTracer.comp: reference for the shader maths and GPU-less previews
+ */
+class CPUPathTracer
+{
+public:
+	// Same xorshift generator and seeding as the shaders
+	struct Random
+	{
+		uint32_t state = 0;
+
+		Random() = default;
+		explicit Random(uint32_t seed);
+		uint32_t NextUInt();
+		float Next();
+	};
+
+	struct Ray
+	{
+		glm::vec3 pos;
+		glm::vec3 dir;
+	};
+
+public:
+	// Packet tracking runs delta tracking for 8 pixels at once with SIMD, statistically equal to the scalar shader mirror
+	CPUPathTracer(Grid3D<float>* cloud, unsigned int threadCount = 0, bool packetTracking = false);
+	~CPUPathTracer();
+
+	// Bakes the light transmittance like ShadowVolume.comp, needed after cloud or light changes
+	void UpdateShadowVolume(const CloudProperties& cloudProperties, const ShadowVolumeProperties& shadowVolumeProperties);
+
+	// Ratio tracking through the cloud along the ray, the reference the shadow volume converges to
+	float EstimateTransmittance(const Ray& ray, Random& random) const;
+
+	// Traces one sample per pixel and accumulates it into the result image like PathTracer.comp
+	void Render(const CameraProperties& cameraProperties, const CloudProperties& cloudProperties, const Parameters& parameters, const PushConstants& pushConstants);
+
+	const std::vector<glm::vec4>& GetResult() const;
+	uint32_t GetWidth() const;
+	uint32_t GetHeight() const;
+
+	// Shader functions, exposed for tests
+	glm::vec4 TracePixel(glm::ivec2 pixelCoord, Random& random) const;
+	void TracePacket(const glm::ivec2* pixelCoords, Random* randoms, glm::vec4* results) const; // RayPacket::SIZE pixels
+	bool FindScatterPoint(Ray& ray, Random& random) const;
+	bool IntersectCloud(const Ray& ray, float& tmax, float& tmin) const;
+	float SampleCloud(const glm::vec3& pos) const;
+	float SampleShadowVolume(const glm::vec3& pos) const;
+	float GetShadowVolumeVoxel(uint32_t x, uint32_t y, uint32_t z) const;
+	float SamplePhase(const glm::vec3& incomingDirection, const glm::vec3& sampleDirection) const;
+	void ScatterRay(const glm::vec3& incomingDirection, glm::vec3& sampleDirection, Random& random) const;
+
+	static glm::vec4 SampleBackground(const glm::vec3& dir);
+
+private:
+	void RenderTile(uint32_t tileIdx, const PushConstants& pushConstants);
+	void BuildShadowVolumeColumn(uint32_t x, uint32_t y);
+
+private:
+	Grid3D<float>* m_cloud = nullptr;
+	Grid3D<float>* m_shadowVolume = nullptr;
+	PacketTracker* m_packetTracker = nullptr;
+	unsigned int m_threadCount = 0;
+	bool m_packetTracking = false;
+
+	CameraProperties m_cameraProperties;
+	CloudProperties m_cloudProperties;
+	Parameters m_parameters;
+	ShadowVolumeProperties m_shadowVolumeProperties;
+
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	std::vector<glm::vec4> m_result;
+};
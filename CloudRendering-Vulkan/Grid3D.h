@@ -2,17 +2,34 @@
 
 #include <stdexcept>
 
+#include "GridFormat.h"
+#include "MappedFile.h"
+
 template<typename T>
 class Grid3D
 {
 public:
 	static Grid3D<T>* Load(const std::string& filename);
 
+	// Decodes the z slices [zBegin, zEnd) of a mapped .xyz file in x fastest order, returns the largest value
+	static T ReadSlab(const MappedFile& file, const GridFileHeader& header, uint32_t zBegin, uint32_t zEnd, T* outData);
+
+	// Coarse grid with one majorant per brickSize^3 voxels, filled by AccumulateBrickMajorants
+	static Grid3D<T>* CreateBrickGrid(glm::uvec3 voxelCount, glm::dvec3 voxelSize, unsigned int brickSize);
+	// Raises the brick majorants with the z slices [zBegin, zEnd) of an x fastest slab. Bricks are grown by
+	// one voxel on each side, so they also bound trilinear lookups that blend in the neighbouring voxels
+	static void AccumulateBrickMajorants(const T* slab, glm::uvec3 voxelCount, uint32_t zBegin, uint32_t zEnd, unsigned int brickSize, Grid3D<T>& bricks);
+	// Brick majorants of every mip level stacked along z, level 0 first. The level 0 bricks are dilated until they cover
+	// every voxel a trilinear lookup of the level can blend in from inside the brick, mips being halving linear blits
+	static Grid3D<T>* CreateLevelMajorants(Grid3D<T>& bricks, glm::uvec3 voxelCount, unsigned int brickSize, uint32_t levelCount);
+
 public:
 	Grid3D(unsigned int sizeX, unsigned int sizeY, unsigned int sizeZ, double voxelSizeX = 1, double voxelSizeY = 1, double voxelSizeZ = 1);
 	~Grid3D();
 
 	T& operator()(size_t x, size_t y, size_t z);
+	// Trilinear lookup at normalized coordinates, same as a linear clamp to edge sampler
+	T SampleLinear(const glm::vec3& normalizedCoord) const;
 
 	size_t GetByteSize();
 	size_t GetElementSize();
@@ -27,6 +44,7 @@ public:
 	void Save(const std::string& filename);
 
 	T GetMajorant();
+	Grid3D<T>* CreateBrickMajorants(unsigned int brickSize);
 
 private:
 	std::vector<T> m_data;
@@ -44,49 +62,199 @@ private:
 template<typename T>
 inline Grid3D<T>* Grid3D<T>::Load(const std::string& filename)
 {
-	unsigned int sizeX = 0;
-	unsigned int sizeY = 0;
-	unsigned int sizeZ = 0;
-	double voxelSizeX = 0;
-	double voxelSizeY = 0;
-	double voxelSizeZ = 0;
-
-	std::ifstream in(filename, std::ifstream::in | std::ifstream::binary);
-	if (!in.good())
+	MappedFile file(filename);
+	GridFileHeader header;
+	if (!file.IsOpen() || !ReadGridFileHeader(file.GetData(), file.GetSize(), header))
 	{
 		return nullptr;
 	}
 
+	Grid3D<T>* grid = new Grid3D<T>(header.sizeX, header.sizeY, header.sizeZ, header.voxelSizeX, header.voxelSizeY, header.voxelSizeZ);
+	ReadSlab(file, header, 0, header.sizeZ, grid->m_data.data());
 
-	in.read(reinterpret_cast<char*>(&sizeX), sizeof(unsigned int));
-	in.read(reinterpret_cast<char*>(&sizeY), sizeof(unsigned int));
-	in.read(reinterpret_cast<char*>(&sizeZ), sizeof(unsigned int));
-	in.read(reinterpret_cast<char*>(&voxelSizeX), sizeof(double));
-	in.read(reinterpret_cast<char*>(&voxelSizeY), sizeof(double));
-	in.read(reinterpret_cast<char*>(&voxelSizeZ), sizeof(double));
+	return grid;
+}
 
-	Grid3D<T>* grid = new Grid3D<T>(sizeX, sizeY, sizeZ, voxelSizeX, voxelSizeY, voxelSizeZ);
+template<typename T>
+inline T Grid3D<T>::ReadSlab(const MappedFile& file, const GridFileHeader& header, uint32_t zBegin, uint32_t zEnd, T* outData)
+{
+	const size_t countX = header.sizeX;
+	const size_t countY = header.sizeY;
+	const size_t countZ = header.sizeZ;
+	const size_t sliceSize = countX * countY;
 
-	//size_t size = sizeof(T) * sizeX * sizeY * sizeZ;
-	//in.read(reinterpret_cast<char*>(grid->m_data.data()), size);
+	// Header size is a multiple of 4 and the mapping is page aligned
+	const float* voxels = reinterpret_cast<const float*>(file.GetData() + header.dataOffset);
 
-	for (unsigned int x = 0; x < sizeX; x++)
+	std::mutex maxMutex;
+	T maxValue = T();
+	auto reduceMax = [&maxMutex, &maxValue](T value)
 	{
-		for (unsigned int y = 0; y < sizeY; y++)
+		std::lock_guard<std::mutex> lock(maxMutex);
+		maxValue = std::max(maxValue, value);
+	};
+
+	if (header.order == EGridOrder::XFastest)
+	{
+		// Already in memory order
+		const float* slab = voxels + zBegin * sliceSize;
+		utilities::ParallelFor((zEnd - zBegin) * sliceSize, [slab, outData, &reduceMax](size_t begin, size_t end)
+			{
+				T rangeMax = T();
+				for (size_t i = begin; i < end; i++)
+				{
+					outData[i] = static_cast<T>(slab[i]);
+					rangeMax = std::max(rangeMax, outData[i]);
+				}
+				reduceMax(rangeMax);
+			});
+		return maxValue;
+	}
+
+	// Every y slice is a (x, z) matrix transpose. It is done in tiles so both the
+	// strided reads and the strided writes of a tile stay in cache, one tile row per job
+	constexpr size_t TILE_SIZE = 32;
+	const size_t tilesZ = (zEnd - zBegin + TILE_SIZE - 1) / TILE_SIZE;
+
+	utilities::ParallelFor(countY * tilesZ, [&](size_t begin, size_t end)
 		{
-			for (unsigned int z = 0; z < sizeZ; z++)
+			T rangeMax = T();
+			for (size_t job = begin; job < end; job++)
 			{
-				float value;
-				in.read(reinterpret_cast<char*>(&value), sizeof(float));
-				unsigned int idx = x + sizeX * y + sizeX * sizeY * z;
-				grid->m_data[idx] = value;
+				size_t y = job / tilesZ;
+				size_t z0 = zBegin + (job % tilesZ) * TILE_SIZE;
+				size_t z1 = std::min(z0 + TILE_SIZE, static_cast<size_t>(zEnd));
+
+				for (size_t x0 = 0; x0 < countX; x0 += TILE_SIZE)
+				{
+					size_t x1 = std::min(x0 + TILE_SIZE, countX);
+					for (size_t z = z0; z < z1; z++)
+					{
+						T* dst = outData + countX * y + sliceSize * (z - zBegin);
+						const float* src = voxels + z + countZ * y + countZ * countY * x0;
+						for (size_t x = x0; x < x1; x++, src += countZ * countY)
+						{
+							dst[x] = static_cast<T>(*src);
+							rangeMax = std::max(rangeMax, dst[x]);
+						}
+					}
+				}
 			}
-		}
-	}
+			reduceMax(rangeMax);
+		});
 
-	in.close();
+	return maxValue;
+}
 
-	return grid;
+template<typename T>
+inline Grid3D<T>* Grid3D<T>::CreateBrickGrid(glm::uvec3 voxelCount, glm::dvec3 voxelSize, unsigned int brickSize)
+{
+	glm::uvec3 brickCount = (voxelCount + brickSize - 1u) / brickSize;
+	glm::dvec3 brickExtent = voxelSize * static_cast<double>(brickSize);
+	return new Grid3D<T>(brickCount.x, brickCount.y, brickCount.z, brickExtent.x, brickExtent.y, brickExtent.z);
+}
+
+template<typename T>
+inline void Grid3D<T>::AccumulateBrickMajorants(const T* slab, glm::uvec3 voxelCount, uint32_t zBegin, uint32_t zEnd, unsigned int brickSize, Grid3D<T>& bricks)
+{
+	const glm::uvec3 brickCount = bricks.GetVoxelCount();
+	const size_t sliceSize = static_cast<size_t>(voxelCount.x) * voxelCount.y;
+
+	// Voxel range of a grown brick along one axis
+	auto brickRange = [brickSize](unsigned int brick, unsigned int count, unsigned int& outBegin, unsigned int& outEnd)
+	{
+		outBegin = brick * brickSize > 0 ? brick * brickSize - 1 : 0;
+		outEnd = std::min((brick + 1) * brickSize + 1, count);
+	};
+
+	// Bricks whose grown range touches the slab
+	const unsigned int brickZBegin = zBegin / brickSize > 0 ? zBegin / brickSize - 1 : 0;
+	const unsigned int brickZEnd = std::min((zEnd - 1) / brickSize + 2, brickCount.z);
+
+	// One job per brick column, so every brick is written by a single thread
+	utilities::ParallelFor(static_cast<size_t>(brickCount.x) * brickCount.y, [&](size_t begin, size_t end)
+		{
+			for (size_t job = begin; job < end; job++)
+			{
+				unsigned int bx = static_cast<unsigned int>(job % brickCount.x);
+				unsigned int by = static_cast<unsigned int>(job / brickCount.x);
+				unsigned int x0, x1, y0, y1;
+				brickRange(bx, voxelCount.x, x0, x1);
+				brickRange(by, voxelCount.y, y0, y1);
+
+				for (unsigned int bz = brickZBegin; bz < brickZEnd; bz++)
+				{
+					unsigned int z0, z1;
+					brickRange(bz, voxelCount.z, z0, z1);
+					z0 = std::max(z0, zBegin);
+					z1 = std::min(z1, zEnd);
+
+					T& majorant = bricks(bx, by, bz);
+					for (unsigned int z = z0; z < z1; z++)
+					{
+						for (unsigned int y = y0; y < y1; y++)
+						{
+							const T* row = slab + sliceSize * (z - zBegin) + static_cast<size_t>(voxelCount.x) * y;
+							for (unsigned int x = x0; x < x1; x++)
+							{
+								majorant = std::max(majorant, row[x]);
+							}
+						}
+					}
+				}
+			}
+		});
+}
+
+template<typename T>
+inline Grid3D<T>* Grid3D<T>::CreateLevelMajorants(Grid3D<T>& bricks, glm::uvec3 voxelCount, unsigned int brickSize, uint32_t levelCount)
+{
+	const glm::uvec3 brickCount = bricks.GetVoxelCount();
+	const glm::dvec3 brickExtent = bricks.GetVoxelSize();
+	const size_t levelSize = bricks.GetSize();
+	Grid3D<T>* levels = new Grid3D<T>(brickCount.x, brickCount.y, brickCount.z * levelCount, brickExtent.x, brickExtent.y, brickExtent.z);
+	T* data = static_cast<T*>(levels->GetData());
+	std::copy_n(static_cast<const T*>(bricks.GetData()), levelSize, data);
+
+	// Raises every brick to the majorant of its neighbours along one axis
+	const glm::uvec3 stride(1, brickCount.x, brickCount.x * brickCount.y);
+	std::vector<T> previous(levelSize);
+	auto dilate = [&](T* level, int axis)
+	{
+		std::copy_n(level, levelSize, previous.begin());
+		for (size_t i = 0; i < levelSize; i++)
+		{
+			unsigned int brick = static_cast<unsigned int>(i / stride[axis] % brickCount[axis]);
+			if (brick > 0)
+			{
+				level[i] = std::max(level[i], previous[i - stride[axis]]);
+			}
+			if (brick + 1 < brickCount[axis])
+			{
+				level[i] = std::max(level[i], previous[i + stride[axis]]);
+			}
+		}
+	};
+
+	// A texel of a level spans voxelCount / extent voxels. Its blits reach at most one finer texel past that span,
+	// and a trilinear lookup blends texels up to 1.5 texels away, so 2.5 texels around the lookup are covered.
+	// Level 0 bricks are already grown by one voxel.
+	glm::uvec3 radius(0);
+	for (uint32_t level = 1; level < levelCount; level++)
+	{
+		T* current = data + level * levelSize;
+		std::copy_n(current - levelSize, levelSize, current);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			double span = double(voxelCount[axis]) / std::max(voxelCount[axis] >> level, 1u);
+			unsigned int levelRadius = static_cast<unsigned int>(std::ceil(std::ceil(2.5 * span) / brickSize));
+			for (; radius[axis] < std::min(levelRadius, brickCount[axis]); radius[axis]++)
+			{
+				dilate(current, axis);
+			}
+		}
+	}
+	return levels;
 }
 
 template<typename T>
@@ -120,6 +288,28 @@ inline T& Grid3D<T>::operator()(size_t x, size_t y, size_t z)
 	return T();
 }
 
+template<typename T>
+inline T Grid3D<T>::SampleLinear(const glm::vec3& normalizedCoord) const
+{
+	const glm::ivec3 count(m_countX, m_countY, m_countZ);
+	const glm::vec3 texel = normalizedCoord * glm::vec3(count) - 0.5f;
+	const glm::vec3 base = glm::floor(texel);
+	const glm::vec3 weight = texel - base;
+	const glm::ivec3 index0 = glm::clamp(glm::ivec3(base), glm::ivec3(0), count - 1);
+	const glm::ivec3 index1 = glm::clamp(glm::ivec3(base) + 1, glm::ivec3(0), count - 1);
+
+	auto at = [this](int x, int y, int z)
+	{
+		return m_data[x + y * static_cast<size_t>(m_countX) + z * static_cast<size_t>(m_countX) * m_countY];
+	};
+
+	T c00 = glm::mix(at(index0.x, index0.y, index0.z), at(index1.x, index0.y, index0.z), weight.x);
+	T c10 = glm::mix(at(index0.x, index1.y, index0.z), at(index1.x, index1.y, index0.z), weight.x);
+	T c01 = glm::mix(at(index0.x, index0.y, index1.z), at(index1.x, index0.y, index1.z), weight.x);
+	T c11 = glm::mix(at(index0.x, index1.y, index1.z), at(index1.x, index1.y, index1.z), weight.x);
+	return glm::mix(glm::mix(c00, c10, weight.y), glm::mix(c01, c11, weight.y), weight.z);
+}
+
 template<typename T>
 inline size_t Grid3D<T>::GetByteSize()
 {
@@ -166,7 +356,12 @@ inline void Grid3D<T>::Copy(void* src, size_t size)
 template<typename T>
 inline void Grid3D<T>::Save(const std::string& filename)
 {
+	uint32_t magic = GRID_FILE_MAGIC;
+	EGridOrder order = EGridOrder::XFastest;
+
 	std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+	out.write(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+	out.write(reinterpret_cast<char*>(&order), sizeof(EGridOrder));
 	out.write(reinterpret_cast<char*>(&m_countX), sizeof(unsigned int));
 	out.write(reinterpret_cast<char*>(&m_countY), sizeof(unsigned int));
 	out.write(reinterpret_cast<char*>(&m_countZ), sizeof(unsigned int));
@@ -190,3 +385,11 @@ inline T Grid3D<T>::GetMajorant()
 	}
 	return majorant;
 }
+
+template<typename T>
+inline Grid3D<T>* Grid3D<T>::CreateBrickMajorants(unsigned int brickSize)
+{
+	Grid3D<T>* bricks = CreateBrickGrid(GetVoxelCount(), GetVoxelSize(), brickSize);
+	AccumulateBrickMajorants(m_data.data(), GetVoxelCount(), 0, m_countZ, brickSize, *bricks);
+	return bricks;
+}
@@ -3,6 +3,8 @@
 #include <vector>
 #include <fstream>
 
+#include "GridFormat.h"
+
 struct GridData
 {
 	unsigned int sizeX, sizeY, sizeZ;
@@ -13,7 +15,12 @@ struct GridData
 
 	void save(const std::string& filename) //save in my .xyz format
 	{
+		uint32_t magic = GRID_FILE_MAGIC;
+		EGridOrder order = EGridOrder::ZFastest;
+
 		std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+		out.write(reinterpret_cast<char*>(&magic), sizeof(uint32_t));
+		out.write(reinterpret_cast<char*>(&order), sizeof(EGridOrder));
 		out.write(reinterpret_cast<char*>(&sizeX), sizeof(unsigned int));
 		out.write(reinterpret_cast<char*>(&sizeY), sizeof(unsigned int));
 		out.write(reinterpret_cast<char*>(&sizeZ), sizeof(unsigned int));
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// .xyz cloud file header:
+//   [uint32 magic, uint32 order]  (optional, absent in legacy files)
+//   uint32 sizeX, sizeY, sizeZ
+//   double voxelSizeX, voxelSizeY, voxelSizeZ
+//   float  data[sizeX * sizeY * sizeZ]
+// Legacy files (no magic) are stored z fastest, as written by GridData::save.
+// The magic value can not be mistaken for a voxel count ("XYZ1" ~ 827 million voxels along x).
+constexpr uint32_t GRID_FILE_MAGIC = 0x315A5958; // "XYZ1"
+
+enum class EGridOrder : uint32_t
+{
+	ZFastest = 0,	// z + sizeZ * (y + sizeY * x), GridData
+	XFastest = 1	// x + sizeX * (y + sizeY * z), Grid3D
+};
+
+struct GridFileHeader
+{
+	uint32_t sizeX = 0;
+	uint32_t sizeY = 0;
+	uint32_t sizeZ = 0;
+	double voxelSizeX = 0;
+	double voxelSizeY = 0;
+	double voxelSizeZ = 0;
+	EGridOrder order = EGridOrder::ZFastest;
+	size_t dataOffset = 0;
+
+	size_t GetVoxelCount() const
+	{
+		return static_cast<size_t>(sizeX) * static_cast<size_t>(sizeY) * static_cast<size_t>(sizeZ);
+	}
+};
+
+// Parses the header of a file in memory, false if the file is too small for header and payload
+inline bool ReadGridFileHeader(const char* data, size_t size, GridFileHeader& outHeader)
+{
+	size_t offset = 0;
+	auto read = [data, size, &offset](void* dst, size_t byteCount)
+	{
+		if (offset + byteCount > size)
+		{
+			return false;
+		}
+		memcpy(dst, data + offset, byteCount);
+		offset += byteCount;
+		return true;
+	};
+
+	// Files without the magic value are legacy files in z fastest order
+	outHeader = GridFileHeader();
+	if (!read(&outHeader.sizeX, sizeof(uint32_t)))
+	{
+		return false;
+	}
+	if (outHeader.sizeX == GRID_FILE_MAGIC && (!read(&outHeader.order, sizeof(EGridOrder)) || !read(&outHeader.sizeX, sizeof(uint32_t))))
+	{
+		return false;
+	}
+	if (!read(&outHeader.sizeY, sizeof(uint32_t)) ||
+		!read(&outHeader.sizeZ, sizeof(uint32_t)) ||
+		!read(&outHeader.voxelSizeX, sizeof(double)) ||
+		!read(&outHeader.voxelSizeY, sizeof(double)) ||
+		!read(&outHeader.voxelSizeZ, sizeof(double)))
+	{
+		return false;
+	}
+
+	outHeader.dataOffset = offset;
+	return size - offset >= outHeader.GetVoxelCount() * sizeof(float);
+}
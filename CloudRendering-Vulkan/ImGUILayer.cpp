@@ -90,3 +90,19 @@ VulkanImGUIRenderPass* ImGUILayer::GetRenderPass()
 {
     return m_renderPass;
 }
+
+void ImGUILayer::ShowPassTimes(const std::vector<VulkanTimestampProfiler::PassTime>& passTimes)
+{
+    ImGui::Begin("GPU Timings");
+    {
+        float total = 0;
+        for (const auto& passTime : passTimes)
+        {
+            ImGui::Text("%s: %.3f ms", passTime.name.c_str(), passTime.milliseconds);
+            total += passTime.milliseconds;
+        }
+        ImGui::Separator();
+        ImGui::Text("Total: %.3f ms", total);
+    }
+    ImGui::End();
+}
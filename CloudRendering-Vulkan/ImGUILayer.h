@@ -1,5 +1,7 @@
 #pragma once
 
+#include "VulkanTimestampProfiler.h"
+
 class VulkanDevice;
 class VulkanDescriptorPool;
 class VulkanImGUIRenderPass;
@@ -13,6 +15,9 @@ public:
 
 	VulkanImGUIRenderPass* GetRenderPass();
 
+	// Window with the GPU time of each pass of the last profiled frame
+	void ShowPassTimes(const std::vector<VulkanTimestampProfiler::PassTime>& passTimes);
+
 private:
 	VulkanDevice* m_device = nullptr;
 	VulkanDescriptorPool* m_descriptorPool = nullptr;
@@ -164,7 +164,7 @@ VkSwapchainCreateInfoKHR initializers::SwapchainCreateInfo(VkSurfaceKHR surface,
 	return info;
 }
 
-VkImageViewCreateInfo initializers::ImageViewCreateInfo(VkImage image, VkImageViewType viewType, VkFormat format)
+VkImageViewCreateInfo initializers::ImageViewCreateInfo(VkImage image, VkImageViewType viewType, VkFormat format, uint32_t levelCount /*= 1*/)
 {
 	VkImageViewCreateInfo info{};
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -179,20 +179,20 @@ VkImageViewCreateInfo initializers::ImageViewCreateInfo(VkImage image, VkImageVi
 
 	info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.levelCount = levelCount;
 	info.subresourceRange.baseArrayLayer = 0;
 	info.subresourceRange.layerCount = 1;
 
 	return info;
 }
 
-VkShaderModuleCreateInfo initializers::ShaderModuleCreateInfo(std::vector<char>& code)
+VkShaderModuleCreateInfo initializers::ShaderModuleCreateInfo(const uint32_t* code, size_t codeSize)
 {
 	VkShaderModuleCreateInfo info{};
 
 	info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	info.codeSize = code.size();
-	info.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	info.codeSize = codeSize;
+	info.pCode = code;
 
 	return info;
 }
@@ -238,7 +238,7 @@ VkDescriptorSetLayoutBinding initializers::DescriptorSetLayoutBinding(uint32_t b
 
 	info.binding = binding;
 	info.descriptorType = type;
-	info.descriptorCount = 1;
+	info.descriptorCount = count;
 	info.stageFlags = flags;
 
 	return info;
@@ -405,15 +405,18 @@ VkImageCreateInfo initializers::ImageCreateInfo(VkImageType imageType, VkFormat
 	return info;
 }
 
-VkSamplerCreateInfo initializers::SamplerCreateInfo()
+VkSamplerCreateInfo initializers::SamplerCreateInfo(float maxLod /*= 0.0f*/)
 {
 	VkSamplerCreateInfo info{};
 	info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	info.magFilter = VK_FILTER_LINEAR;
 	info.minFilter = VK_FILTER_LINEAR;
+	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 	info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
 	info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	info.minLod = 0.0f;
+	info.maxLod = maxLod;
 	return info;
 }
 
@@ -30,15 +30,15 @@ namespace initializers
 
 	VkSwapchainCreateInfoKHR SwapchainCreateInfo(VkSurfaceKHR surface, QueueFamilyIndices& indices, SwapchainSupportDetails swapchainSupport, uint32_t imageCount, VkSurfaceFormatKHR surfaceFormat, VkPresentModeKHR presentMode, VkExtent2D extent);
 
-	VkImageViewCreateInfo ImageViewCreateInfo(VkImage image, VkImageViewType viewType, VkFormat format);
+	VkImageViewCreateInfo ImageViewCreateInfo(VkImage image, VkImageViewType viewType, VkFormat format, uint32_t levelCount = 1);
 
 	VkImageCreateInfo ImageCreateInfo(VkImageType imageType, VkFormat format, VkExtent3D extent, uint32_t mipLevels, uint32_t arrayLayers, VkSampleCountFlagBits samples, VkImageUsageFlags usage, VkImageCreateFlags flags = 0);
 
-	VkSamplerCreateInfo SamplerCreateInfo();
+	VkSamplerCreateInfo SamplerCreateInfo(float maxLod = 0.0f);
 
 	VkPushConstantRange PushConstantRange(VkShaderStageFlags stageFlags, uint32_t offset, uint32_t size);
 
-	VkShaderModuleCreateInfo ShaderModuleCreateInfo(std::vector<char>& code);
+	VkShaderModuleCreateInfo ShaderModuleCreateInfo(const uint32_t* code, size_t codeSize);
 
 	VkPipelineShaderStageCreateInfo PipelineShaderStageCreateInfo(VkShaderModule module, VkShaderStageFlagBits stage);
 
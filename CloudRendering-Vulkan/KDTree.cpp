@@ -3,17 +3,53 @@
 
 #include "UniformBuffers.h"
 
-KDTree::KDTree(Photon* photons, size_t count)
+namespace
 {
-	m_photons = photons;
-	m_count = count;
-	m_axes.resize(m_count);
+	constexpr size_t PARALLEL_BUILD_MIN = 1 << 16; // Smaller ranges are built by one thread
+	constexpr unsigned int PIVOT_SAMPLE_COUNT = 63;
 
-	Balance(0, m_count);
+	bool CompareNeighbors(const KDTree::Neighbor& a, const KDTree::Neighbor& b)
+	{
+		return a.distanceSquared < b.distanceSquared;
+	}
 }
 
+// Position and source index, 16 bytes instead of a full photon to keep partitioning cache friendly
+struct KDTree::BuildRecord
+{
+	glm::vec3 position;
+	uint32_t idx;
+};
 
-void KDTree::Balance(size_t begin, size_t end)
+KDTree::KDTree(const Photon* photons, size_t count, unsigned int threadCount /*= 0*/)
+{
+	assert(count <= UINT32_MAX);
+	if (threadCount == 0)
+	{
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	std::vector<BuildRecord> records(count);
+	std::vector<BuildRecord> scratch(count);
+	utilities::ParallelFor(count, [photons, &records](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				records[i] = { glm::vec3(photons[i].position), static_cast<uint32_t>(i) };
+			}
+		}, threadCount);
+
+	m_photons.resize(count);
+	for (std::vector<float>& positions : m_positions)
+	{
+		positions.resize(count);
+	}
+	m_axes.resize(count);
+
+	Balance(photons, records.data(), scratch.data(), 0, count, 0, threadCount);
+}
+
+void KDTree::Balance(const Photon* photons, BuildRecord* records, BuildRecord* scratch, size_t begin, size_t end, size_t node, unsigned int threadCount)
 {
 	// Array fully sorted
 	if (end <= begin)
@@ -22,40 +58,138 @@ void KDTree::Balance(size_t begin, size_t end)
 	}
 
 	// Find axis
-	glm::vec3 cubeSize = CubeSize(begin, end);
+	glm::vec3 cubeSize = CubeSize(records, begin, end, threadCount);
 	unsigned int axisIdx = GreatestAxis(cubeSize);
 
-	// Swap photon position to build the heap
-	size_t median = begin + (end - begin) / 2;
-	//m_sortedPhotons[position] = m_photons[median];
+	// Split so that the left subtree fills its levels first, which keeps every heap index below the photon count
+	size_t median = begin + LeftSubtreeSize(end - begin);
+	SelectMedian(records, scratch, begin, median, end, axisIdx, threadCount);
 
-	// Build subtrees
-	Balance(begin, median);
-	Balance(median + 1, end);
+	const BuildRecord& record = records[median];
+	m_photons[node] = photons[record.idx];
+	for (unsigned int axis = 0; axis < 3; axis++)
+	{
+		m_positions[axis][node] = record.position[axis];
+	}
+	m_axes[node] = static_cast<uint8_t>(axisIdx);
+
+	// Build subtrees, the top levels as independent tasks sharing the threads
+	if (threadCount > 1 && end - begin > PARALLEL_BUILD_MIN)
+	{
+		unsigned int leftThreadCount = threadCount / 2;
+		std::thread left(&KDTree::Balance, this, photons, records, scratch, begin, median, 2 * node + 1, leftThreadCount);
+		Balance(photons, records, scratch, median + 1, end, 2 * node + 2, threadCount - leftThreadCount);
+		left.join();
+	}
+	else
+	{
+		Balance(photons, records, scratch, begin, median, 2 * node + 1, 1);
+		Balance(photons, records, scratch, median + 1, end, 2 * node + 2, 1);
+	}
 }
 
-glm::vec3 KDTree::CubeSize(size_t begin, size_t end)
+void KDTree::SelectMedian(BuildRecord* records, BuildRecord* scratch, size_t begin, size_t median, size_t end, unsigned int axis, unsigned int threadCount)
 {
-	glm::vec3 min(FLT_MAX);
-	glm::vec3 max(FLT_MIN);
+	auto less = [axis](const BuildRecord& a, const BuildRecord& b) { return a.position[axis] < b.position[axis]; };
 
-	for (size_t i = begin; i < end; i++)
+	// Quickselect with parallel three way partitions until the range is small enough for one thread
+	while (threadCount > 1 && end - begin > PARALLEL_BUILD_MIN)
 	{
-		const glm::vec3& pos = m_photons[i].position;
-		for (unsigned int i = 0; i < 3; i++)
+		const size_t count = end - begin;
+
+		// Pivot from the median of evenly spaced samples
+		float samples[PIVOT_SAMPLE_COUNT];
+		for (unsigned int i = 0; i < PIVOT_SAMPLE_COUNT; i++)
 		{
-			if (pos[i] < min[i])
+			samples[i] = records[begin + (count - 1) * i / (PIVOT_SAMPLE_COUNT - 1)].position[axis];
+		}
+		std::nth_element(samples, samples + PIVOT_SAMPLE_COUNT / 2, samples + PIVOT_SAMPLE_COUNT);
+		const float pivot = samples[PIVOT_SAMPLE_COUNT / 2];
+
+		// Count less, equal and greater per chunk, then scatter each chunk to its offsets
+		const size_t chunkSize = (count + threadCount - 1) / threadCount;
+		std::vector<size_t> counts(static_cast<size_t>(threadCount) * 3, 0);
+		utilities::ParallelFor(threadCount, [&](size_t chunkBegin, size_t chunkEnd)
 			{
-				min[i] = pos[i];
-			}
+				for (size_t chunk = chunkBegin; chunk < chunkEnd; chunk++)
+				{
+					for (size_t i = begin + chunk * chunkSize; i < std::min(begin + (chunk + 1) * chunkSize, end); i++)
+					{
+						float value = records[i].position[axis];
+						counts[chunk * 3 + (value < pivot ? 0 : value == pivot ? 1 : 2)]++;
+					}
+				}
+			}, threadCount);
 
-			if (pos[i] > max[i])
+		size_t totals[3] = { 0, 0, 0 };
+		std::vector<size_t> offsets(counts.size());
+		for (size_t part = 0; part < 3; part++)
+		{
+			for (size_t chunk = 0; chunk < threadCount; chunk++)
 			{
-				max[i] = pos[i];
+				offsets[chunk * 3 + part] = totals[part];
+				totals[part] += counts[chunk * 3 + part];
 			}
 		}
+		const size_t partBegin[3] = { begin, begin + totals[0], begin + totals[0] + totals[1] };
+
+		utilities::ParallelFor(threadCount, [&](size_t chunkBegin, size_t chunkEnd)
+			{
+				for (size_t chunk = chunkBegin; chunk < chunkEnd; chunk++)
+				{
+					size_t next[3] = { partBegin[0] + offsets[chunk * 3], partBegin[1] + offsets[chunk * 3 + 1], partBegin[2] + offsets[chunk * 3 + 2] };
+					for (size_t i = begin + chunk * chunkSize; i < std::min(begin + (chunk + 1) * chunkSize, end); i++)
+					{
+						float value = records[i].position[axis];
+						scratch[next[value < pivot ? 0 : value == pivot ? 1 : 2]++] = records[i];
+					}
+				}
+			}, threadCount);
+
+		utilities::ParallelFor(count, [&](size_t copyBegin, size_t copyEnd)
+			{
+				std::copy(scratch + begin + copyBegin, scratch + begin + copyEnd, records + begin + copyBegin);
+			}, threadCount);
+
+		// Continue in the part holding the median, done if it landed among the pivot values
+		if (median < partBegin[1])
+		{
+			end = partBegin[1];
+		}
+		else if (median < partBegin[2])
+		{
+			return;
+		}
+		else
+		{
+			begin = partBegin[2];
+		}
 	}
 
+	std::nth_element(records + begin, records + median, records + end, less);
+}
+
+glm::vec3 KDTree::CubeSize(const BuildRecord* records, size_t begin, size_t end, unsigned int threadCount)
+{
+	glm::vec3 min(FLT_MAX);
+	glm::vec3 max(-FLT_MAX);
+	std::mutex mutex;
+
+	utilities::ParallelFor(end - begin, [&](size_t rangeBegin, size_t rangeEnd)
+		{
+			glm::vec3 rangeMin(FLT_MAX);
+			glm::vec3 rangeMax(-FLT_MAX);
+			for (size_t i = begin + rangeBegin; i < begin + rangeEnd; i++)
+			{
+				rangeMin = glm::min(rangeMin, records[i].position);
+				rangeMax = glm::max(rangeMax, records[i].position);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			min = glm::min(min, rangeMin);
+			max = glm::max(max, rangeMax);
+		}, end - begin > PARALLEL_BUILD_MIN ? threadCount : 1);
+
 	return max - min;
 }
 
@@ -73,8 +207,119 @@ unsigned int KDTree::GreatestAxis(const glm::vec3& cubeSize)
 	return axis;
 }
 
-const void KDTree::NearestNeighbors(const glm::vec3& point, unsigned int count, std::vector<glm::vec3> outPoints)
+size_t KDTree::LeftSubtreeSize(size_t count)
+{
+	if (count <= 1)
+	{
+		return 0;
+	}
+
+	// Full levels above the last one, the left subtree takes the first half of the last level
+	size_t lastLevel = 1;
+	while (2 * lastLevel <= count)
+	{
+		lastLevel *= 2;
+	}
+	size_t lastLevelCount = count - (lastLevel - 1);
+	return (lastLevel / 2 - 1) + std::min(lastLevelCount, lastLevel / 2);
+}
+
+void KDTree::NearestNeighbors(const glm::vec3& point, unsigned int count, std::vector<Neighbor>& outNeighbors, float maxDistance /*= FLT_MAX*/) const
 {
+	outNeighbors.clear();
+	if (count == 0 || m_photons.empty())
+	{
+		return;
+	}
+
+	// Max heap of the closest photons so far, its top is the search radius once it is full
+	float maxDistanceSquared = maxDistance < FLT_MAX ? maxDistance * maxDistance : FLT_MAX;
+	LocateNeighbors(0, point, count, maxDistanceSquared, outNeighbors);
+	std::sort_heap(outNeighbors.begin(), outNeighbors.end(), CompareNeighbors);
+}
 
-	return void();
-}
\ No newline at end of file
+void KDTree::RadiusSearch(const glm::vec3& point, float radius, std::vector<Neighbor>& outNeighbors) const
+{
+	outNeighbors.clear();
+	if (m_photons.empty())
+	{
+		return;
+	}
+
+	LocateInRadius(0, point, radius * radius, outNeighbors);
+}
+
+const std::vector<Photon>& KDTree::GetPhotons() const
+{
+	return m_photons;
+}
+
+size_t KDTree::GetSize() const
+{
+	return m_photons.size();
+}
+
+void KDTree::LocateNeighbors(size_t node, const glm::vec3& point, unsigned int count, float& maxDistanceSquared, std::vector<Neighbor>& outNeighbors) const
+{
+	const unsigned int axis = m_axes[node];
+	const float planeDistance = point[axis] - m_positions[axis][node];
+
+	// Near side first so the radius shrinks before the far side is tested
+	size_t nearChild = 2 * node + (planeDistance < 0 ? 1 : 2);
+	size_t farChild = 2 * node + (planeDistance < 0 ? 2 : 1);
+	if (nearChild < m_photons.size())
+	{
+		LocateNeighbors(nearChild, point, count, maxDistanceSquared, outNeighbors);
+	}
+	if (farChild < m_photons.size() && planeDistance * planeDistance < maxDistanceSquared)
+	{
+		LocateNeighbors(farChild, point, count, maxDistanceSquared, outNeighbors);
+	}
+
+	glm::vec3 position(m_positions[0][node], m_positions[1][node], m_positions[2][node]);
+	float distanceSquared = glm::distance2(position, point);
+	if (distanceSquared >= maxDistanceSquared)
+	{
+		return;
+	}
+
+	if (outNeighbors.size() == count)
+	{
+		std::pop_heap(outNeighbors.begin(), outNeighbors.end(), CompareNeighbors);
+		outNeighbors.back() = { &m_photons[node], distanceSquared };
+	}
+	else
+	{
+		outNeighbors.push_back({ &m_photons[node], distanceSquared });
+	}
+	std::push_heap(outNeighbors.begin(), outNeighbors.end(), CompareNeighbors);
+
+	if (outNeighbors.size() == count)
+	{
+		maxDistanceSquared = outNeighbors.front().distanceSquared;
+	}
+}
+
+void KDTree::LocateInRadius(size_t node, const glm::vec3& point, float radiusSquared, std::vector<Neighbor>& outNeighbors) const
+{
+	const unsigned int axis = m_axes[node];
+	const float planeDistance = point[axis] - m_positions[axis][node];
+
+	size_t nearChild = 2 * node + (planeDistance < 0 ? 1 : 2);
+	size_t farChild = 2 * node + (planeDistance < 0 ? 2 : 1);
+	if (nearChild < m_photons.size())
+	{
+		LocateInRadius(nearChild, point, radiusSquared, outNeighbors);
+	}
+	if (farChild < m_photons.size() && planeDistance * planeDistance <= radiusSquared)
+	{
+		LocateInRadius(farChild, point, radiusSquared, outNeighbors);
+	}
+
+	glm::vec3 position(m_positions[0][node], m_positions[1][node], m_positions[2][node]);
+	float distanceSquared = glm::distance2(position, point);
+	if (distanceSquared <= radiusSquared)
+	{
+		outNeighbors.push_back({ &m_photons[node], distanceSquared });
+	}
+}
@@ -2,24 +2,50 @@
 
 struct Photon;
 
+/*
+ * Left-balanced kd-tree stored as an implicit heap: the children of node i are 2i+1 and 2i+2.
+ * Positions are also kept as SoA arrays in heap order for traversal.
+ * Queries write into caller owned vectors, so reusing them avoids allocations per query.
+ */
 class KDTree
 {
+public:
+	struct Neighbor
+	{
+		const Photon* photon;
+		float distanceSquared;
+	};
 
 public:
 	KDTree(const KDTree&) = delete;
 	KDTree& operator=(const KDTree&) = delete;
 
-	KDTree(Photon* photons, size_t count);
+	// Copies the photons into heap order, the top levels are built in parallel
+	KDTree(const Photon* photons, size_t count, unsigned int threadCount = 0);
+
+	// Up to count closest photons within maxDistance, sorted by distance
+	void NearestNeighbors(const glm::vec3& point, unsigned int count, std::vector<Neighbor>& outNeighbors, float maxDistance = FLT_MAX) const;
+
+	// All photons within radius, unsorted
+	void RadiusSearch(const glm::vec3& point, float radius, std::vector<Neighbor>& outNeighbors) const;
 
-	const void NearestNeighbors(const glm::vec3& point, unsigned int count, std::vector<glm::vec3> outPoints);
+	const std::vector<Photon>& GetPhotons() const;
+	size_t GetSize() const;
 
 private:
-	void Balance(size_t begin, size_t end);
-	glm::vec3 CubeSize(size_t begin, size_t end);
+	struct BuildRecord;
+
+	void Balance(const Photon* photons, BuildRecord* records, BuildRecord* scratch, size_t begin, size_t end, size_t node, unsigned int threadCount);
+	void SelectMedian(BuildRecord* records, BuildRecord* scratch, size_t begin, size_t median, size_t end, unsigned int axis, unsigned int threadCount);
+	glm::vec3 CubeSize(const BuildRecord* records, size_t begin, size_t end, unsigned int threadCount);
 	unsigned int GreatestAxis(const glm::vec3& cubeSize);
+	size_t LeftSubtreeSize(size_t count);
+
+	void LocateNeighbors(size_t node, const glm::vec3& point, unsigned int count, float& maxDistanceSquared, std::vector<Neighbor>& outNeighbors) const;
+	void LocateInRadius(size_t node, const glm::vec3& point, float radiusSquared, std::vector<Neighbor>& outNeighbors) const;
 
 private:
-	Photon* m_photons;
-	size_t m_count;
-	std::vector<unsigned int> m_axes;
-};
\ No newline at end of file
+	std::vector<Photon> m_photons;
+	std::vector<float> m_positions[3];
+	std::vector<uint8_t> m_axes;
+};
@@ -0,0 +1,263 @@
+#include "stdafx.h"
+#include "LBVH.h"
+
+#include "UniformBuffers.h"
+
+#include <glm/gtc/packing.hpp>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	constexpr uint32_t NO_PARENT = UINT32_MAX;
+	constexpr float HALF_MAX = 65504.f;
+
+	int CountLeadingZeroes(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long msb;
+		return _BitScanReverse(&msb, value) ? 31 - static_cast<int>(msb) : 32;
+#else
+		return value ? __builtin_clz(value) : 32;
+#endif
+	}
+
+	// Expand 10 bits into 30 bits by inserting two zeroes between each bit
+	uint32_t ExpandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	// Same order as GLSL packHalf2x16, the first value in the low bits
+	uint32_t PackHalfPair(uint16_t low, uint16_t high)
+	{
+		return static_cast<uint32_t>(low) | (static_cast<uint32_t>(high) << 16);
+	}
+}
+
+LBVH::LBVH(const PhotonBeam* beams, size_t count, float beamRadius, unsigned int threadCount /*= 0*/)
+{
+	assert(count < INT32_MAX);
+	if (count == 0)
+	{
+		return;
+	}
+
+	m_innerCount = static_cast<uint32_t>(count - 1);
+	m_nodes.resize(m_innerCount + count);
+	m_mortonCodes.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		m_mortonCodes[i] = beams[i].mortonCode;
+	}
+
+	// Leaves
+	utilities::ParallelFor(count, [this, beams, beamRadius](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				TreeNode& leaf = m_nodes[m_innerCount + i];
+				leaf.left = static_cast<uint32_t>(i);
+				leaf.right = static_cast<uint32_t>(i);
+				leaf.isLeaf = 1;
+				CalculateBeamBounds(beams[i], beamRadius, leaf.bounds);
+			}
+		}, threadCount);
+	m_nodes[0].parent = NO_PARENT;
+
+	// Inner nodes are independent of each other
+	utilities::ParallelFor(m_innerCount, [this](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				GenerateNode(static_cast<int>(i));
+			}
+		}, threadCount);
+
+	// Bottom-up fitting - the second child to reach a node fits it, as in PPB_CalculateAABB.comp
+	std::vector<std::atomic<uint32_t>> processed(m_innerCount);
+	utilities::ParallelFor(count, [this, &processed](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				uint32_t currentIdx = m_nodes[m_innerCount + i].parent;
+				while (currentIdx != NO_PARENT && processed[currentIdx].fetch_add(1, std::memory_order_acq_rel) == 1)
+				{
+					TreeNode& node = m_nodes[currentIdx];
+					node.bounds[0] = glm::min(m_nodes[node.left].bounds[0], m_nodes[node.right].bounds[0]);
+					node.bounds[1] = glm::max(m_nodes[node.left].bounds[1], m_nodes[node.right].bounds[1]);
+					currentIdx = node.parent;
+				}
+			}
+		}, threadCount);
+
+	for (uint32_t i = 0; i < m_innerCount; i++)
+	{
+		m_nodes[i].processed = processed[i].load();
+	}
+	m_mortonCodes.clear();
+	m_mortonCodes.shrink_to_fit();
+}
+
+const std::vector<TreeNode>& LBVH::GetNodes() const
+{
+	return m_nodes;
+}
+
+uint32_t LBVH::GetInnerCount() const
+{
+	return m_innerCount;
+}
+
+void LBVH::Pack(std::vector<CompactTreeNode>& outNodes, glm::vec3& outOffset, unsigned int threadCount /*= 0*/) const
+{
+	outNodes.resize(m_innerCount);
+	outOffset = m_nodes.empty() ? glm::vec3(0) : glm::vec3(m_nodes[0].bounds[0] + m_nodes[0].bounds[1]) / 2.f;
+
+	// Same steps as PPB_PackTree.comp
+	glm::vec3 offset = outOffset;
+	utilities::ParallelFor(m_innerCount, [this, offset, &outNodes](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				const TreeNode& node = m_nodes[i];
+				CompactTreeNode& packed = outNodes[i];
+				for (unsigned int child = 0; child < 2; child++)
+				{
+					uint32_t childIdx = child == 0 ? node.left : node.right;
+					const TreeNode& childNode = m_nodes[childIdx];
+					packed.children[child] = childNode.isLeaf ? (childNode.left | CompactTreeNode::LEAF_FLAG) : childIdx;
+
+					glm::vec3 minBound = glm::vec3(childNode.bounds[0]) - offset;
+					glm::vec3 maxBound = glm::vec3(childNode.bounds[1]) - offset;
+					packed.bounds[3 * child + 0] = PackHalfPair(PackHalfBelow(minBound.x), PackHalfBelow(minBound.y));
+					packed.bounds[3 * child + 1] = PackHalfPair(PackHalfBelow(minBound.z), PackHalfAbove(maxBound.x));
+					packed.bounds[3 * child + 2] = PackHalfPair(PackHalfAbove(maxBound.y), PackHalfAbove(maxBound.z));
+				}
+			}
+		}, threadCount);
+}
+
+uint32_t LBVH::GetMortonCode(const glm::vec3& normalizedPosition)
+{
+	glm::uvec3 cell = glm::uvec3(glm::clamp(normalizedPosition * 1024.f, glm::vec3(0.f), glm::vec3(1023.f)));
+	return (ExpandBits(cell.x) << 2) + (ExpandBits(cell.y) << 1) + ExpandBits(cell.z);
+}
+
+void LBVH::CalculateBeamBounds(const PhotonBeam& beam, float radius, glm::vec4 outBounds[2])
+{
+	// https://iquilezles.org/www/articles/diskbbox/diskbbox.htm
+	glm::vec3 a = beam.endPos - beam.startPos;
+	glm::vec3 e = radius * glm::sqrt(glm::max(1.f - (a * a / std::max(glm::dot(a, a), FLT_MIN)), 0.f));
+
+	outBounds[0] = glm::vec4(glm::min(beam.startPos - e, beam.endPos - e), 0);
+	outBounds[1] = glm::vec4(glm::max(beam.startPos + e, beam.endPos + e), 0);
+}
+
+// The conversion may round either way, step one ulp towards minus infinity if it rounded up
+uint16_t LBVH::PackHalfBelow(float value)
+{
+	float clamped = glm::clamp(value, -HALF_MAX, HALF_MAX);
+	uint16_t h = glm::packHalf1x16(clamped);
+	if (glm::unpackHalf1x16(h) > clamped)
+	{
+		h = static_cast<uint16_t>((h & 0x8000) != 0 ? h + 1 : (h == 0 ? 0x8001 : h - 1));
+	}
+	return h;
+}
+
+uint16_t LBVH::PackHalfAbove(float value)
+{
+	float clamped = glm::clamp(value, -HALF_MAX, HALF_MAX);
+	uint16_t h = glm::packHalf1x16(clamped);
+	if (glm::unpackHalf1x16(h) < clamped)
+	{
+		h = static_cast<uint16_t>((h & 0x8000) == 0 ? h + 1 : (h == 0x8000 ? 0x0001 : h - 1));
+	}
+	return h;
+}
+
+void LBVH::UnpackChildBounds(const CompactTreeNode& node, unsigned int child, glm::vec3 outBounds[2])
+{
+	assert(child < 2);
+	const uint32_t* bounds = node.bounds + 3 * child;
+	outBounds[0] = glm::vec3(glm::unpackHalf1x16(bounds[0] & 0xFFFF), glm::unpackHalf1x16(bounds[0] >> 16), glm::unpackHalf1x16(bounds[1] & 0xFFFF));
+	outBounds[1] = glm::vec3(glm::unpackHalf1x16(bounds[1] >> 16), glm::unpackHalf1x16(bounds[2] & 0xFFFF), glm::unpackHalf1x16(bounds[2] >> 16));
+}
+
+// Length of the common prefix of two sorted keys, -1 outside of the leaf range
+// Duplicate morton codes are made unique by appending the key index
+int LBVH::GetCommonPrefix(int first, int second) const
+{
+	if (second < 0 || second > static_cast<int>(m_innerCount))
+	{
+		return -1;
+	}
+
+	uint32_t firstCode = m_mortonCodes[first];
+	uint32_t secondCode = m_mortonCodes[second];
+	if (firstCode == secondCode)
+	{
+		return 32 + CountLeadingZeroes(static_cast<uint32_t>(first ^ second));
+	}
+	return CountLeadingZeroes(firstCode ^ secondCode);
+}
+
+// Same steps as PPB_GenerateHierarchy.comp
+void LBVH::GenerateNode(int idx)
+{
+	// Determine direction of the range (+1 or -1) - the one with the largest common prefix
+	int direction = (GetCommonPrefix(idx, idx + 1) - GetCommonPrefix(idx, idx - 1)) >= 0 ? 1 : -1;
+
+	// Compute upper bound for the length of the range
+	int minPrefix = GetCommonPrefix(idx, idx - direction);
+	int upperBound = 2;
+	while (GetCommonPrefix(idx, idx + upperBound * direction) > minPrefix)
+	{
+		upperBound *= 2;
+	}
+
+	// Find the other end using binary search
+	int range = 0;
+	for (int t = upperBound / 2; t >= 1; t /= 2)
+	{
+		if (GetCommonPrefix(idx, idx + (range + t) * direction) > minPrefix)
+		{
+			range += t;
+		}
+	}
+	int endIdx = idx + range * direction;
+
+	// Find the split position using binary search
+	int nodePrefix = GetCommonPrefix(idx, endIdx);
+	int split = 0;
+	int divisor = 2;
+	int step;
+	do
+	{
+		step = (range + divisor - 1) / divisor;
+		if (GetCommonPrefix(idx, idx + (split + step) * direction) > nodePrefix)
+		{
+			split += step;
+		}
+		divisor *= 2;
+	} while (step > 1);
+	split = idx + split * direction + std::min(direction, 0);
+
+	// Record parent-child relationships
+	uint32_t leftIdx = (std::min(idx, endIdx) == split) ? m_innerCount + split : split;
+	uint32_t rightIdx = (std::max(idx, endIdx) == split + 1) ? m_innerCount + split + 1 : split + 1;
+
+	TreeNode& node = m_nodes[idx];
+	node.left = leftIdx;
+	node.right = rightIdx;
+	node.isLeaf = 0;
+	m_nodes[leftIdx].parent = static_cast<uint32_t>(idx);
+	m_nodes[rightIdx].parent = static_cast<uint32_t>(idx);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+struct PhotonBeam;
+struct TreeNode;
+struct CompactTreeNode;
+
+/*
+ * Linear BVH over photon beams sorted by morton code (Karras - 2012).
+ * Same node layout as the GPU tree buffer: the inner nodes come first, then one leaf per beam.
+ * The root is node 0, a leaf's left and right hold its beam index.
+ * Pack converts the build-time nodes into the compact traversal layout of PPB_PackTree.comp.
+ */
+class LBVH
+{
+public:
+	LBVH(const LBVH&) = delete;
+	LBVH& operator=(const LBVH&) = delete;
+
+	// Beams must be sorted by morton code, inner nodes and fitting are processed in parallel
+	LBVH(const PhotonBeam* beams, size_t count, float beamRadius, unsigned int threadCount = 0);
+
+	const std::vector<TreeNode>& GetNodes() const;
+	uint32_t GetInnerCount() const;
+
+	// One node per inner node, child bounds relative to outOffset (the center of the root)
+	void Pack(std::vector<CompactTreeNode>& outNodes, glm::vec3& outOffset, unsigned int threadCount = 0) const;
+
+	// 30 bits morton code of a position normalized to [0, 1], as generated by PPB_PT.comp
+	static uint32_t GetMortonCode(const glm::vec3& normalizedPosition);
+
+	// Bounds of the cylinder around a beam
+	static void CalculateBeamBounds(const PhotonBeam& beam, float radius, glm::vec4 outBounds[2]);
+
+	// Largest half not above the value and smallest half not below it, clamped to the half range
+	static uint16_t PackHalfBelow(float value);
+	static uint16_t PackHalfAbove(float value);
+
+	// Bounds of the first (0) or second (1) child of a packed node, relative to the tree offset
+	static void UnpackChildBounds(const CompactTreeNode& node, unsigned int child, glm::vec3 outBounds[2]);
+
+private:
+	int GetCommonPrefix(int first, int second) const;
+	void GenerateNode(int idx);
+
+private:
+	std::vector<TreeNode> m_nodes;
+	std::vector<uint32_t> m_mortonCodes;
+	uint32_t m_innerCount = 0;
+};
@@ -0,0 +1,104 @@
+#include "stdafx.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	m_file = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		return;
+	}
+
+	m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_mapping)
+	{
+		return;
+	}
+
+	m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	m_size = m_data ? static_cast<size_t>(fileSize.QuadPart) : 0;
+#else
+	m_file = open(filename.c_str(), O_RDONLY);
+	if (m_file < 0)
+	{
+		return;
+	}
+
+	struct stat fileStat;
+	if (fstat(m_file, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		return;
+	}
+
+	void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+	if (data == MAP_FAILED)
+	{
+		return;
+	}
+
+	// The whole payload is read front to back exactly once
+	madvise(data, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+
+	m_data = static_cast<const char*>(data);
+	m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (m_data)
+	{
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+	}
+	if (m_file)
+	{
+		CloseHandle(m_file);
+	}
+#else
+	if (m_data)
+	{
+		munmap(const_cast<char*>(m_data), m_size);
+	}
+	if (m_file >= 0)
+	{
+		close(m_file);
+	}
+#endif
+}
+
+bool MappedFile::IsOpen() const
+{
+	return m_data != nullptr;
+}
+
+const char* MappedFile::GetData() const
+{
+	return m_data;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return m_size;
+}
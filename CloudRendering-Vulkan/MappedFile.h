@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+ * Read-only memory mapping of a whole file
+ */
+class MappedFile
+{
+public:
+	MappedFile(const std::string& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool IsOpen() const;
+	const char* GetData() const;
+	size_t GetSize() const;
+
+private:
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_file = -1;
+#endif
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+};
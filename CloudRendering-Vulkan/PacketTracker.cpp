@@ -0,0 +1,433 @@
+#include "stdafx.h"
+#include "PacketTracker.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE4
+#define TARGET_AVX2
+#else
+// MSVC emits any intrinsic regardless of /arch, GCC and Clang need the target per function
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+	constexpr float UNIFORM_SCALE = 1.0f / 16777216.0f; // 2^-24
+
+	// Cephes logf coefficients, also used for the vector paths
+	constexpr float LOG_SQRTHF = 0.707106781186547524f;
+	constexpr float LOG_P[9] =
+	{
+		7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f,
+		-1.2420140846e-1f, 1.4249322787e-1f, -1.6668057665e-1f,
+		2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f
+	};
+	constexpr float LOG_Q1 = -2.12194440e-4f;
+	constexpr float LOG_Q2 = 0.693359375f;
+
+	uint32_t XorShift(uint32_t state)
+	{
+		state ^= (state << 13);
+		state ^= (state >> 17);
+		state ^= (state << 5);
+		return state;
+	}
+
+	float SampleTexel(const float* data, const glm::ivec3& count, const glm::vec3& texel)
+	{
+		const glm::vec3 base = glm::floor(texel);
+		const glm::vec3 weight = texel - base;
+		const glm::ivec3 index0 = glm::clamp(glm::ivec3(base), glm::ivec3(0), count - 1);
+		const glm::ivec3 index1 = glm::clamp(glm::ivec3(base) + 1, glm::ivec3(0), count - 1);
+
+		auto at = [data, &count](int x, int y, int z)
+		{
+			return data[x + y * static_cast<size_t>(count.x) + z * static_cast<size_t>(count.x) * count.y];
+		};
+
+		float c00 = glm::mix(at(index0.x, index0.y, index0.z), at(index1.x, index0.y, index0.z), weight.x);
+		float c10 = glm::mix(at(index0.x, index1.y, index0.z), at(index1.x, index1.y, index0.z), weight.x);
+		float c01 = glm::mix(at(index0.x, index0.y, index1.z), at(index1.x, index0.y, index1.z), weight.x);
+		float c11 = glm::mix(at(index0.x, index1.y, index1.z), at(index1.x, index1.y, index1.z), weight.x);
+		return glm::mix(glm::mix(c00, c10, weight.y), glm::mix(c01, c11, weight.y), weight.z);
+	}
+
+	//---------------------------------------------------------
+	// SSE4
+	//---------------------------------------------------------
+	TARGET_SSE4 __m128i XorShift128(__m128i state)
+	{
+		state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+		state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+		return _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+	}
+
+	TARGET_SSE4 __m128 ToUniform128(__m128i state)
+	{
+		__m128i bits = _mm_add_epi32(_mm_srli_epi32(state, 8), _mm_set1_epi32(1));
+		return _mm_mul_ps(_mm_cvtepi32_ps(bits), _mm_set1_ps(UNIFORM_SCALE));
+	}
+
+	// Natural logarithm for positive normalized inputs
+	TARGET_SSE4 __m128 Log128(__m128 x)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		__m128i exponent = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(x), 23), _mm_set1_epi32(0x7f));
+		__m128 e = _mm_add_ps(_mm_cvtepi32_ps(exponent), one);
+
+		// Mantissa in [0.5, 1)
+		x = _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff)));
+		x = _mm_or_ps(x, _mm_set1_ps(0.5f));
+
+		__m128 mask = _mm_cmplt_ps(x, _mm_set1_ps(LOG_SQRTHF));
+		__m128 tmp = _mm_and_ps(x, mask);
+		x = _mm_sub_ps(x, one);
+		e = _mm_sub_ps(e, _mm_and_ps(one, mask));
+		x = _mm_add_ps(x, tmp);
+
+		__m128 z = _mm_mul_ps(x, x);
+		__m128 y = _mm_set1_ps(LOG_P[0]);
+		for (int i = 1; i < 9; i++)
+		{
+			y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(LOG_P[i]));
+		}
+		y = _mm_mul_ps(_mm_mul_ps(y, x), z);
+		y = _mm_add_ps(y, _mm_mul_ps(e, _mm_set1_ps(LOG_Q1)));
+		y = _mm_sub_ps(y, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+		x = _mm_add_ps(x, y);
+		return _mm_add_ps(x, _mm_mul_ps(e, _mm_set1_ps(LOG_Q2)));
+	}
+
+	TARGET_SSE4 __m128 Lerp128(__m128 a, __m128 b, __m128 weight)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), weight));
+	}
+
+	// SSE has no gather, the lanes are loaded one by one
+	TARGET_SSE4 __m128 Gather128(const float* data, __m128i x, __m128i row, __m128i slice)
+	{
+		alignas(16) int32_t index[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_add_epi32(x, _mm_add_epi32(row, slice)));
+		return _mm_setr_ps(data[index[0]], data[index[1]], data[index[2]], data[index[3]]);
+	}
+
+	TARGET_SSE4 __m128 SampleTexel128(const float* data, const glm::ivec3& count, __m128 x, __m128 y, __m128 z)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i one = _mm_set1_epi32(1);
+		__m128 baseX = _mm_floor_ps(x), baseY = _mm_floor_ps(y), baseZ = _mm_floor_ps(z);
+		__m128 weightX = _mm_sub_ps(x, baseX), weightY = _mm_sub_ps(y, baseY), weightZ = _mm_sub_ps(z, baseZ);
+
+		__m128i maxX = _mm_set1_epi32(count.x - 1), maxY = _mm_set1_epi32(count.y - 1), maxZ = _mm_set1_epi32(count.z - 1);
+		__m128i x0 = _mm_cvttps_epi32(baseX), y0 = _mm_cvttps_epi32(baseY), z0 = _mm_cvttps_epi32(baseZ);
+		__m128i x1 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(x0, one), zero), maxX);
+		__m128i y1 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(y0, one), zero), maxY);
+		__m128i z1 = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(z0, one), zero), maxZ);
+		x0 = _mm_min_epi32(_mm_max_epi32(x0, zero), maxX);
+		y0 = _mm_min_epi32(_mm_max_epi32(y0, zero), maxY);
+		z0 = _mm_min_epi32(_mm_max_epi32(z0, zero), maxZ);
+
+		__m128i strideY = _mm_set1_epi32(count.x), strideZ = _mm_set1_epi32(count.x * count.y);
+		__m128i rowY0 = _mm_mullo_epi32(y0, strideY), rowY1 = _mm_mullo_epi32(y1, strideY);
+		__m128i sliceZ0 = _mm_mullo_epi32(z0, strideZ), sliceZ1 = _mm_mullo_epi32(z1, strideZ);
+
+		__m128 c00 = Lerp128(Gather128(data, x0, rowY0, sliceZ0), Gather128(data, x1, rowY0, sliceZ0), weightX);
+		__m128 c10 = Lerp128(Gather128(data, x0, rowY1, sliceZ0), Gather128(data, x1, rowY1, sliceZ0), weightX);
+		__m128 c01 = Lerp128(Gather128(data, x0, rowY0, sliceZ1), Gather128(data, x1, rowY0, sliceZ1), weightX);
+		__m128 c11 = Lerp128(Gather128(data, x0, rowY1, sliceZ1), Gather128(data, x1, rowY1, sliceZ1), weightX);
+		return Lerp128(Lerp128(c00, c10, weightY), Lerp128(c01, c11, weightY), weightZ);
+	}
+
+	//---------------------------------------------------------
+	// AVX2
+	//---------------------------------------------------------
+	TARGET_AVX2 __m256i XorShift256(__m256i state)
+	{
+		state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+		state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+		return _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+	}
+
+	TARGET_AVX2 __m256 ToUniform256(__m256i state)
+	{
+		__m256i bits = _mm256_add_epi32(_mm256_srli_epi32(state, 8), _mm256_set1_epi32(1));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(UNIFORM_SCALE));
+	}
+
+	// Natural logarithm for positive normalized inputs
+	TARGET_AVX2 __m256 Log256(__m256 x)
+	{
+		const __m256 one = _mm256_set1_ps(1.0f);
+		__m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(_mm256_castps_si256(x), 23), _mm256_set1_epi32(0x7f));
+		__m256 e = _mm256_add_ps(_mm256_cvtepi32_ps(exponent), one);
+
+		// Mantissa in [0.5, 1)
+		x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff)));
+		x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+
+		__m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(LOG_SQRTHF), _CMP_LT_OQ);
+		__m256 tmp = _mm256_and_ps(x, mask);
+		x = _mm256_sub_ps(x, one);
+		e = _mm256_sub_ps(e, _mm256_and_ps(one, mask));
+		x = _mm256_add_ps(x, tmp);
+
+		__m256 z = _mm256_mul_ps(x, x);
+		__m256 y = _mm256_set1_ps(LOG_P[0]);
+		for (int i = 1; i < 9; i++)
+		{
+			y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(LOG_P[i]));
+		}
+		y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+		y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q1)));
+		y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+		x = _mm256_add_ps(x, y);
+		return _mm256_add_ps(x, _mm256_mul_ps(e, _mm256_set1_ps(LOG_Q2)));
+	}
+
+	TARGET_AVX2 __m256 Lerp256(__m256 a, __m256 b, __m256 weight)
+	{
+		return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), weight));
+	}
+
+	TARGET_AVX2 __m256 Gather256(const float* data, __m256i x, __m256i row, __m256i slice)
+	{
+		return _mm256_i32gather_ps(data, _mm256_add_epi32(x, _mm256_add_epi32(row, slice)), 4);
+	}
+
+	TARGET_AVX2 __m256 SampleTexel256(const float* data, const glm::ivec3& count, __m256 x, __m256 y, __m256 z)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i one = _mm256_set1_epi32(1);
+		__m256 baseX = _mm256_floor_ps(x), baseY = _mm256_floor_ps(y), baseZ = _mm256_floor_ps(z);
+		__m256 weightX = _mm256_sub_ps(x, baseX), weightY = _mm256_sub_ps(y, baseY), weightZ = _mm256_sub_ps(z, baseZ);
+
+		__m256i maxX = _mm256_set1_epi32(count.x - 1), maxY = _mm256_set1_epi32(count.y - 1), maxZ = _mm256_set1_epi32(count.z - 1);
+		__m256i x0 = _mm256_cvttps_epi32(baseX), y0 = _mm256_cvttps_epi32(baseY), z0 = _mm256_cvttps_epi32(baseZ);
+		__m256i x1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(x0, one), zero), maxX);
+		__m256i y1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(y0, one), zero), maxY);
+		__m256i z1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(z0, one), zero), maxZ);
+		x0 = _mm256_min_epi32(_mm256_max_epi32(x0, zero), maxX);
+		y0 = _mm256_min_epi32(_mm256_max_epi32(y0, zero), maxY);
+		z0 = _mm256_min_epi32(_mm256_max_epi32(z0, zero), maxZ);
+
+		__m256i strideY = _mm256_set1_epi32(count.x), strideZ = _mm256_set1_epi32(count.x * count.y);
+		__m256i rowY0 = _mm256_mullo_epi32(y0, strideY), rowY1 = _mm256_mullo_epi32(y1, strideY);
+		__m256i sliceZ0 = _mm256_mullo_epi32(z0, strideZ), sliceZ1 = _mm256_mullo_epi32(z1, strideZ);
+
+		__m256 c00 = Lerp256(Gather256(data, x0, rowY0, sliceZ0), Gather256(data, x1, rowY0, sliceZ0), weightX);
+		__m256 c10 = Lerp256(Gather256(data, x0, rowY1, sliceZ0), Gather256(data, x1, rowY1, sliceZ0), weightX);
+		__m256 c01 = Lerp256(Gather256(data, x0, rowY0, sliceZ1), Gather256(data, x1, rowY0, sliceZ1), weightX);
+		__m256 c11 = Lerp256(Gather256(data, x0, rowY1, sliceZ1), Gather256(data, x1, rowY1, sliceZ1), weightX);
+		return Lerp256(Lerp256(c00, c10, weightY), Lerp256(c01, c11, weightY), weightZ);
+	}
+}
+
+PacketTracker::PacketTracker(Grid3D<float>* grid, const CloudProperties& cloudProperties, ESimdLevel simdLevel /*= GetSupportedSimdLevel()*/)
+{
+	m_data = static_cast<const float*>(grid->GetData());
+	m_voxelCount = glm::ivec3(grid->GetVoxelCount());
+
+	// Vector indices are 32 bit
+	m_simdLevel = std::min(simdLevel, GetSupportedSimdLevel());
+	if (grid->GetSize() > static_cast<size_t>(INT32_MAX))
+	{
+		m_simdLevel = ESimdLevel::Scalar;
+	}
+
+	glm::vec3 boundsMin = glm::vec3(cloudProperties.bounds[0]);
+	glm::vec3 boundsMax = glm::vec3(cloudProperties.bounds[1]);
+	m_texelScale = glm::vec3(m_voxelCount) / (boundsMax - boundsMin);
+	m_texelOffset = -boundsMin * m_texelScale - 0.5f;
+
+	m_invMajorant = cloudProperties.baseScaling / (cloudProperties.maxExtinction * cloudProperties.densityScaling);
+	m_invMaxExtinction = 1.0f / cloudProperties.maxExtinction;
+}
+
+ESimdLevel PacketTracker::GetSupportedSimdLevel()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+
+	// The OS must save the YMM registers as well
+	bool avx2 = false;
+	if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	const bool sse41 = __builtin_cpu_supports("sse4.1");
+	const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+	if (avx2) return ESimdLevel::AVX2;
+	if (sse41) return ESimdLevel::SSE4;
+	return ESimdLevel::Scalar;
+}
+
+const char* PacketTracker::GetSimdLevelName(ESimdLevel simdLevel)
+{
+	switch (simdLevel)
+	{
+	case ESimdLevel::AVX2: return "AVX2";
+	case ESimdLevel::SSE4: return "SSE4";
+	default: return "Scalar";
+	}
+}
+
+float PacketTracker::NextRandom(uint32_t& state)
+{
+	state = XorShift(state);
+	return float((state >> 8) + 1) * UNIFORM_SCALE;
+}
+
+void PacketTracker::Track(RayPacket& packet) const
+{
+	switch (m_simdLevel)
+	{
+	case ESimdLevel::AVX2: TrackAVX2(packet); break;
+	case ESimdLevel::SSE4: TrackSSE4(packet); break;
+	default: TrackScalar(packet); break;
+	}
+}
+
+ESimdLevel PacketTracker::GetSimdLevel() const
+{
+	return m_simdLevel;
+}
+
+void PacketTracker::TrackScalar(RayPacket& packet) const
+{
+	for (int lane = 0; lane < RayPacket::SIZE; lane++)
+	{
+		const glm::vec3 origin = glm::vec3(packet.posX[lane], packet.posY[lane], packet.posZ[lane]) * m_texelScale + m_texelOffset;
+		const glm::vec3 direction = glm::vec3(packet.dirX[lane], packet.dirY[lane], packet.dirZ[lane]) * m_texelScale;
+		const float maxT = packet.maxT[lane];
+		uint32_t& state = packet.rngState[lane];
+
+		float t = 0;
+		bool hit = false;
+		while (maxT > 0)
+		{
+			t += -std::log(NextRandom(state)) * m_invMajorant;
+			if (t >= maxT)
+			{
+				break;
+			}
+
+			float density = SampleTexel(m_data, m_voxelCount, origin + t * direction);
+			if (NextRandom(state) < density * m_invMaxExtinction)
+			{
+				hit = true;
+				break;
+			}
+		}
+
+		packet.t[lane] = hit ? t : maxT;
+		packet.hit[lane] = hit ? 1 : 0;
+	}
+}
+
+TARGET_SSE4 void PacketTracker::TrackSSE4(RayPacket& packet) const
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 negInvMajorant = _mm_set1_ps(-m_invMajorant);
+	const __m128 invMaxExtinction = _mm_set1_ps(m_invMaxExtinction);
+
+	// Two half packets
+	for (int lane = 0; lane < RayPacket::SIZE; lane += 4)
+	{
+		const __m128 originX = _mm_add_ps(_mm_mul_ps(_mm_load_ps(packet.posX + lane), _mm_set1_ps(m_texelScale.x)), _mm_set1_ps(m_texelOffset.x));
+		const __m128 originY = _mm_add_ps(_mm_mul_ps(_mm_load_ps(packet.posY + lane), _mm_set1_ps(m_texelScale.y)), _mm_set1_ps(m_texelOffset.y));
+		const __m128 originZ = _mm_add_ps(_mm_mul_ps(_mm_load_ps(packet.posZ + lane), _mm_set1_ps(m_texelScale.z)), _mm_set1_ps(m_texelOffset.z));
+		const __m128 directionX = _mm_mul_ps(_mm_load_ps(packet.dirX + lane), _mm_set1_ps(m_texelScale.x));
+		const __m128 directionY = _mm_mul_ps(_mm_load_ps(packet.dirY + lane), _mm_set1_ps(m_texelScale.y));
+		const __m128 directionZ = _mm_mul_ps(_mm_load_ps(packet.dirZ + lane), _mm_set1_ps(m_texelScale.z));
+		const __m128 maxT = _mm_load_ps(packet.maxT + lane);
+
+		__m128i state = _mm_load_si128(reinterpret_cast<const __m128i*>(packet.rngState + lane));
+		__m128 t = zero;
+		__m128 hit = zero;
+		__m128 active = _mm_cmpgt_ps(maxT, zero);
+		while (_mm_movemask_ps(active))
+		{
+			// Free flight, finished lanes keep their state
+			state = _mm_blendv_epi8(state, XorShift128(state), _mm_castps_si128(active));
+			__m128 step = _mm_mul_ps(Log128(ToUniform128(state)), negInvMajorant);
+			t = _mm_blendv_ps(t, _mm_add_ps(t, step), active);
+			active = _mm_andnot_ps(_mm_cmpge_ps(t, maxT), active);
+			if (!_mm_movemask_ps(active))
+			{
+				break;
+			}
+
+			// Real or null collision
+			__m128 density = SampleTexel128(m_data, m_voxelCount,
+				_mm_add_ps(originX, _mm_mul_ps(t, directionX)),
+				_mm_add_ps(originY, _mm_mul_ps(t, directionY)),
+				_mm_add_ps(originZ, _mm_mul_ps(t, directionZ)));
+			state = _mm_blendv_epi8(state, XorShift128(state), _mm_castps_si128(active));
+			__m128 accept = _mm_and_ps(_mm_cmplt_ps(ToUniform128(state), _mm_mul_ps(density, invMaxExtinction)), active);
+			hit = _mm_or_ps(hit, accept);
+			active = _mm_andnot_ps(accept, active);
+		}
+
+		_mm_store_ps(packet.t + lane, _mm_blendv_ps(maxT, t, hit));
+		_mm_store_si128(reinterpret_cast<__m128i*>(packet.hit + lane), _mm_and_si128(_mm_castps_si128(hit), _mm_set1_epi32(1)));
+		_mm_store_si128(reinterpret_cast<__m128i*>(packet.rngState + lane), state);
+	}
+}
+
+TARGET_AVX2 void PacketTracker::TrackAVX2(RayPacket& packet) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 negInvMajorant = _mm256_set1_ps(-m_invMajorant);
+	const __m256 invMaxExtinction = _mm256_set1_ps(m_invMaxExtinction);
+
+	const __m256 originX = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(packet.posX), _mm256_set1_ps(m_texelScale.x)), _mm256_set1_ps(m_texelOffset.x));
+	const __m256 originY = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(packet.posY), _mm256_set1_ps(m_texelScale.y)), _mm256_set1_ps(m_texelOffset.y));
+	const __m256 originZ = _mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(packet.posZ), _mm256_set1_ps(m_texelScale.z)), _mm256_set1_ps(m_texelOffset.z));
+	const __m256 directionX = _mm256_mul_ps(_mm256_load_ps(packet.dirX), _mm256_set1_ps(m_texelScale.x));
+	const __m256 directionY = _mm256_mul_ps(_mm256_load_ps(packet.dirY), _mm256_set1_ps(m_texelScale.y));
+	const __m256 directionZ = _mm256_mul_ps(_mm256_load_ps(packet.dirZ), _mm256_set1_ps(m_texelScale.z));
+	const __m256 maxT = _mm256_load_ps(packet.maxT);
+
+	__m256i state = _mm256_load_si256(reinterpret_cast<const __m256i*>(packet.rngState));
+	__m256 t = zero;
+	__m256 hit = zero;
+	__m256 active = _mm256_cmp_ps(maxT, zero, _CMP_GT_OQ);
+	while (_mm256_movemask_ps(active))
+	{
+		// Free flight, finished lanes keep their state
+		state = _mm256_blendv_epi8(state, XorShift256(state), _mm256_castps_si256(active));
+		__m256 step = _mm256_mul_ps(Log256(ToUniform256(state)), negInvMajorant);
+		t = _mm256_blendv_ps(t, _mm256_add_ps(t, step), active);
+		active = _mm256_andnot_ps(_mm256_cmp_ps(t, maxT, _CMP_GE_OQ), active);
+		if (!_mm256_movemask_ps(active))
+		{
+			break;
+		}
+
+		// Real or null collision
+		__m256 density = SampleTexel256(m_data, m_voxelCount,
+			_mm256_add_ps(originX, _mm256_mul_ps(t, directionX)),
+			_mm256_add_ps(originY, _mm256_mul_ps(t, directionY)),
+			_mm256_add_ps(originZ, _mm256_mul_ps(t, directionZ)));
+		state = _mm256_blendv_epi8(state, XorShift256(state), _mm256_castps_si256(active));
+		__m256 accept = _mm256_and_ps(_mm256_cmp_ps(ToUniform256(state), _mm256_mul_ps(density, invMaxExtinction), _CMP_LT_OQ), active);
+		hit = _mm256_or_ps(hit, accept);
+		active = _mm256_andnot_ps(accept, active);
+	}
+
+	_mm256_store_ps(packet.t, _mm256_blendv_ps(maxT, t, hit));
+	_mm256_store_si256(reinterpret_cast<__m256i*>(packet.hit), _mm256_and_si256(_mm256_castps_si256(hit), _mm256_set1_epi32(1)));
+	_mm256_store_si256(reinterpret_cast<__m256i*>(packet.rngState), state);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Grid3D.h"
+
+enum class ESimdLevel
+{
+	Scalar = 0,
+	SSE4,
+	AVX2
+};
+
+/*
+ * Eight rays for packet delta tracking. Positions and directions are in world space,
+ * lanes with maxT <= 0 are inactive. rngState carries each lane's xorshift state in and out.
+ */
+struct RayPacket
+{
+	static constexpr int SIZE = 8;
+
+	alignas(32) float posX[SIZE];
+	alignas(32) float posY[SIZE];
+	alignas(32) float posZ[SIZE];
+	alignas(32) float dirX[SIZE];
+	alignas(32) float dirY[SIZE];
+	alignas(32) float dirZ[SIZE];
+	alignas(32) float maxT[SIZE];
+	alignas(32) uint32_t rngState[SIZE];
+
+	// Results: distance to the real collision, or maxT for lanes that left the volume
+	alignas(32) float t[SIZE];
+	alignas(32) int32_t hit[SIZE];
+};
+
+/*
+ * Delta tracking of 8 rays at once against a global majorant, with trilinear density lookups
+ * like a linear clamp to edge sampler. AVX2 and SSE4 paths, scalar fallback.
+ */
+class PacketTracker
+{
+public:
+	PacketTracker(Grid3D<float>* grid, const CloudProperties& cloudProperties, ESimdLevel simdLevel = GetSupportedSimdLevel());
+
+	static ESimdLevel GetSupportedSimdLevel();
+	static const char* GetSimdLevelName(ESimdLevel simdLevel);
+
+	// Uniform number in (0, 1] from the top 24 bits of a xorshift step, never 0 so -log stays finite
+	static float NextRandom(uint32_t& state);
+
+	// Tracks all active lanes to their first real collision
+	void Track(RayPacket& packet) const;
+
+	ESimdLevel GetSimdLevel() const;
+
+private:
+	void TrackScalar(RayPacket& packet) const;
+	void TrackSSE4(RayPacket& packet) const;
+	void TrackAVX2(RayPacket& packet) const;
+
+private:
+	const float* m_data = nullptr;
+	glm::ivec3 m_voxelCount{ 0 };
+	ESimdLevel m_simdLevel = ESimdLevel::Scalar;
+
+	// World position to texel coordinates: texel = position * scale + offset
+	glm::vec3 m_texelScale{ 0 };
+	glm::vec3 m_texelOffset{ 0 };
+
+	float m_invMajorant = 0;	// World distance per unit of sampled optical depth
+	float m_invMaxExtinction = 0;
+};
@@ -8,8 +8,8 @@ struct QueueFamilyIndices
 	uint32_t computeFamily = UINT32_MAX;
 	uint32_t presentFamily = UINT32_MAX;
 
-	bool IsComplete()
+	bool IsComplete(bool requirePresent = true)
 	{
-		return graphicsFamily != UINT32_MAX && computeFamily != UINT32_MAX && presentFamily != UINT32_MAX;
+		return graphicsFamily != UINT32_MAX && computeFamily != UINT32_MAX && (presentFamily != UINT32_MAX || !requirePresent);
 	}
 };
@@ -11,6 +11,11 @@ RenderTechnique::~RenderTechnique()
 {
 }
 
+void RenderTechnique::PrepareFrame(uint32_t frameIndex)
+{
+	m_frameIndex = frameIndex;
+}
+
 void RenderTechnique::UpdateDescriptorSets()
 {
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(m_writeQueue.size()), m_writeQueue.data(), 0, nullptr);
@@ -11,6 +11,10 @@ class VulkanDescriptorPool;
 #include "VulkanImage.h"
 #include "VulkanImageView.h"
 #include "VulkanDescriptorSetLayout.h"
+#include "VulkanTimestampProfiler.h"
+
+// Presents recorded ahead of the GPU, readbacks are kept once per frame in flight
+constexpr int MAX_FRAMES_IN_FLIGHT = 3;
 
 class RenderTechnique
 {
@@ -23,7 +27,8 @@ public:
 	void UpdateDescriptorSets();
 	
 	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const = 0;
-	virtual void SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain) = 0;
+	// Every frame in flight accumulates into the same frame image, the swapchain is only presented to
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) = 0;
 	virtual void ClearFrameReferences() = 0;
 
 	virtual uint32_t GetRequiredSetCount() const = 0;
@@ -38,15 +43,32 @@ public:
 		}
 	}
 
-	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx) = 0;
-	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx) = 0;
-	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx) = 0;
-	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx) = 0;
-	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx) = 0;
-	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx) = 0;
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) = 0;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) = 0;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) = 0;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) = 0;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) = 0;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) = 0;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) = 0;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) = 0;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) = 0;
+
+	// Called once before the command buffer of a frame is begun, once the previous frame of its slot among the frames in flight is done.
+	// The readbacks of that slot are read and resources are reallocated here
+	virtual void PrepareFrame(uint32_t frameIndex);
 
+	// Selects the pipeline permutations matching the parameters, needs no descriptor update
+	virtual void UpdatePermutations(const Parameters& parameters) = 0;
+
+	// imageIndex is the swapchain image the frame is presented to, can be recorded several times per frame and must not allocate
 	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex) = 0;
 
+	// Passes are only timed with a profiler set
+	inline void SetProfiler(VulkanTimestampProfiler* profiler)
+	{
+		m_profiler = profiler;
+	}
+
 protected:
 	inline void AddDescriptorTypesCount(std::vector<VkDescriptorSetLayoutBinding>& bindings)
 	{
@@ -56,12 +78,49 @@ protected:
         }
 	}
 
+	// The estimates run one workgroup per unconverged tile, listed by RenderTechniqueAS
+	inline void SetTileList(VkBuffer tileList)
+	{
+		m_tileList = tileList;
+	}
+
+	inline void CmdDispatchTiles(VkCommandBuffer commandBuffer)
+	{
+		vkCmdDispatchIndirect(commandBuffer, m_tileList, 0);
+	}
+
+	// Specialization of the shaders, constant_id 0 is ISOTROPIC_PHASE, 1 and 2 are local_size_x_id and local_size_y_id.
+	// Pass the workgroup size the dispatch math uses, a shader ignores the constants it does not declare
+	static inline std::vector<uint32_t> GetPermutation(uint32_t workgroupSizeX, uint32_t workgroupSizeY = 1, bool isotropic = false)
+	{
+		return { isotropic ? VK_TRUE : VK_FALSE, workgroupSizeX, workgroupSizeY };
+	}
+
+	inline void CmdBeginPass(VkCommandBuffer commandBuffer, const std::string& name)
+	{
+		if (m_profiler)
+		{
+			m_profiler->CmdBeginPass(commandBuffer, name);
+		}
+	}
+
+	inline void CmdEndPass(VkCommandBuffer commandBuffer)
+	{
+		if (m_profiler)
+		{
+			m_profiler->CmdEndPass(commandBuffer);
+		}
+	}
+
 protected:
 	VulkanDevice* m_device = nullptr;
 	PushConstants* m_pushConstants = nullptr;
 	std::vector<VkWriteDescriptorSet> m_writeQueue;
 	std::vector<VkDescriptorSet> m_descriptorSets;
 	unsigned int m_descriptorSetCount = 0;
+	VkBuffer m_tileList = VK_NULL_HANDLE;
+	VulkanTimestampProfiler* m_profiler = nullptr;
+	uint32_t m_frameIndex = 0; // Slot of the frame being recorded among the frames in flight
 
 	std::unordered_map<VkDescriptorType, unsigned int> m_descriptorTypeCountMap;
 };
\ No newline at end of file
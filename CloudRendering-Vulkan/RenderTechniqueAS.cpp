@@ -0,0 +1,217 @@
+#include "stdafx.h"
+#include "RenderTechniqueAS.h"
+
+#include "VulkanBuffer.h"
+
+RenderTechniqueAS::RenderTechniqueAS(VulkanDevice* device, PushConstants* pushConstants) : RenderTechnique(device, pushConstants)
+{
+	// Shader Modules
+	static const uint32_t adaptiveTilesSPV[] =
+	{
+#include "AdaptiveTiles.comp.h"
+	};
+	m_shader = new VulkanShaderModule(m_device, adaptiveTilesSPV, sizeof(adaptiveTilesSPV));
+
+	// Adaptive Tiles Descriptor Set Layout
+	std::vector<VkDescriptorSetLayoutBinding> adaptiveTilesLayoutBindings = {
+		// Binding 0: Moment image (read)
+		initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+		// Binding 1: Tile list (write)
+		initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+	};
+	AddDescriptorTypesCount(adaptiveTilesLayoutBindings);
+	m_descriptorSetLayout = new VulkanDescriptorSetLayout(m_device, adaptiveTilesLayoutBindings);
+
+	// Adaptive tiles pipeline
+	std::vector<VkPushConstantRange> asPushConstantRanges
+	{
+		initializers::PushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TilePushConstants))
+	};
+	std::vector<VkDescriptorSetLayout> asSetLayouts{ m_descriptorSetLayout->GetLayout() };
+	m_pipelineLayout = new VulkanPipelineLayout(m_device, asSetLayouts, asPushConstantRanges);
+	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader, GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE));
+}
+
+RenderTechniqueAS::~RenderTechniqueAS()
+{
+	delete m_pipeline;
+	delete m_shader;
+	delete m_descriptorSetLayout;
+	delete m_pipelineLayout;
+
+	FreeTileLists();
+}
+
+void RenderTechniqueAS::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const
+{
+	outSetLayouts.push_back(m_descriptorSetLayout->GetLayout());
+}
+
+void RenderTechniqueAS::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
+{
+	m_image = frameImage;
+	m_imageView = frameImageView;
+
+	// The tile list follows the moment image resolution
+	VkExtent3D extent = m_image->GetExtent();
+	m_tileGrid = glm::uvec2(
+		(extent.width + TileListHeader::TILE_SIZE - 1) / TileListHeader::TILE_SIZE,
+		(extent.height + TileListHeader::TILE_SIZE - 1) / TileListHeader::TILE_SIZE);
+	size_t headerWords = sizeof(TileListHeader) / sizeof(uint32_t);
+
+	FreeTileLists();
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	m_tileListBuffer = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), usage, headerWords + GetTileCount());
+	m_headers.assign(MAX_FRAMES_IN_FLIGHT, TileListHeader());
+	for (TileListHeader& header : m_headers)
+	{
+		m_headerReadbacks.push_back(new VulkanBuffer(m_device, &header, sizeof(TileListHeader), VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+		m_headerReadbacks.back()->SetData();
+	}
+
+	// Update compute bindings for the moment image and tile list
+	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto bufferInfo = GetTileListInfo();
+	std::vector<VkWriteDescriptorSet> writes
+	{
+		initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &bufferInfo)
+	};
+	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void RenderTechniqueAS::ClearFrameReferences()
+{
+	m_imageView = nullptr;
+	m_image = nullptr;
+}
+
+void RenderTechniqueAS::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	// The classification only reads the accumulated moments
+}
+
+void RenderTechniqueAS::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
+{
+}
+
+void RenderTechniqueAS::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
+{
+	// Bound in SetFrameReferences with the tile lists they are created with
+}
+
+void RenderTechniqueAS::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
+{
+}
+
+void RenderTechniqueAS::UpdatePermutations(const Parameters& parameters)
+{
+}
+
+uint32_t RenderTechniqueAS::GetRequiredSetCount() const
+{
+	return 1;
+}
+
+void RenderTechniqueAS::PrepareFrame(uint32_t frameIndex)
+{
+	RenderTechnique::PrepareFrame(frameIndex);
+	m_unconvergedTileCount = ReadUnconvergedTileCount();
+}
+
+void RenderTechniqueAS::RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex)
+{
+	m_tilePushConstants.frameCount = m_pushConstants->frameCount;
+
+	// Wait for the previous estimate, also of an earlier frame in flight, before the moments are read and the list is overwritten
+	VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	// Empty list, the tiles are appended by the classification
+	TileListHeader header{};
+	header.tileCount = GetTileCount();
+	vkCmdUpdateBuffer(commandBuffer, m_tileListBuffer->GetBuffer(), 0, sizeof(TileListHeader), &header);
+
+	memoryBarrier = initializers::MemBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	// One workgroup per tile
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TilePushConstants), &m_tilePushConstants);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetPipeline());
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, 1, &m_descriptorSets[0], 0, nullptr);
+	CmdBeginPass(commandBuffer, "Adaptive sampling");
+	vkCmdDispatch(commandBuffer, m_tileGrid.x, m_tileGrid.y, 1);
+	CmdEndPass(commandBuffer);
+
+	// The estimate reads the list as its dispatch size and tiles, the host reads the header copy
+	memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	VkBufferCopy headerRegion{ 0, 0, sizeof(TileListHeader) };
+	vkCmdCopyBuffer(commandBuffer, m_tileListBuffer->GetBuffer(), m_headerReadbacks[m_frameIndex]->GetBuffer(), 1, &headerRegion);
+
+	VkMemoryBarrier hostBarrier = initializers::MemBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+}
+
+void RenderTechniqueAS::SetTargetError(float targetError)
+{
+	m_tilePushConstants.targetError = std::max(targetError, 0.f);
+}
+
+float RenderTechniqueAS::GetTargetError() const
+{
+	return m_tilePushConstants.targetError;
+}
+
+VkDescriptorBufferInfo RenderTechniqueAS::GetTileListInfo()
+{
+	return initializers::DescriptorBufferInfo(m_tileListBuffer->GetBuffer(), 0, VK_WHOLE_SIZE);
+}
+
+uint32_t RenderTechniqueAS::ReadUnconvergedTileCount()
+{
+	m_headerReadbacks[m_frameIndex]->GetData();
+	return m_headers[m_frameIndex].groupCountX;
+}
+
+uint32_t RenderTechniqueAS::GetUnconvergedTileCount() const
+{
+	return m_unconvergedTileCount;
+}
+
+uint32_t RenderTechniqueAS::GetTileCount() const
+{
+	return m_tileGrid.x * m_tileGrid.y;
+}
+
+void RenderTechniqueAS::FreeTileLists()
+{
+	delete m_tileListBuffer;
+	m_tileListBuffer = nullptr;
+	for (VulkanBuffer* headerReadback : m_headerReadbacks)
+	{
+		delete headerReadback;
+	}
+	m_headerReadbacks.clear();
+}
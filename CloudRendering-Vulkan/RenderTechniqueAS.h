@@ -0,0 +1,78 @@
+#pragma once
+
+#include "RenderTechnique.h"
+
+class VulkanBuffer;
+
+/*
+ * Adaptive sampling - compacts the tiles of the result image whose pixels have not reached the target relative error.
+ * Runs before the estimate, which dispatches one workgroup per listed tile with vkCmdDispatchIndirect.
+ * The frame reference is the moment image of the result image.
+ */
+class RenderTechniqueAS : public RenderTechnique
+{
+public:
+	RenderTechniqueAS(VulkanDevice* device, PushConstants* pushConstants);
+	~RenderTechniqueAS();
+
+	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) override;
+	virtual void ClearFrameReferences() override;
+
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) override;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) override;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) override;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) override;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
+
+	virtual uint32_t GetRequiredSetCount() const override;
+
+	virtual void PrepareFrame(uint32_t frameIndex) override;
+	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex) override;
+
+	// Relative standard error of the pixel mean a pixel converges at, 0 disables adaptive sampling
+	void SetTargetError(float targetError);
+	float GetTargetError() const;
+
+	// Header and tiles of the unconverged tiles, also the indirect dispatch of the estimates
+	VkDescriptorBufferInfo GetTileListInfo();
+
+	// Unconverged tiles of the last frame recorded into the current slot, which has to be done
+	uint32_t ReadUnconvergedTileCount();
+
+	// Unconverged tiles read when the last frame was prepared
+	uint32_t GetUnconvergedTileCount() const;
+	uint32_t GetTileCount() const;
+
+private:
+	void FreeTileLists();
+
+private:
+	VulkanShaderModule* m_shader = nullptr;
+	VulkanDescriptorSetLayout* m_descriptorSetLayout = nullptr;
+	VulkanPipelineLayout* m_pipelineLayout = nullptr;
+	VulkanComputePipeline* m_pipeline = nullptr;
+
+	struct TilePushConstants
+	{
+		float targetError = 0;
+		uint32_t minSamples = 16; // Below that the variance estimate is unreliable
+		uint32_t frameCount = 0;
+
+	} m_tilePushConstants;
+
+	// Tile list shared by the frames in flight and a host visible header copy per frame in flight
+	VulkanBuffer* m_tileListBuffer = nullptr;
+	std::vector<VulkanBuffer*> m_headerReadbacks;
+	std::vector<TileListHeader> m_headers;
+	glm::uvec2 m_tileGrid{ 0, 0 };
+	uint32_t m_unconvergedTileCount = 0;
+
+	VulkanImage* m_image = nullptr;
+	VulkanImageView* m_imageView = nullptr;
+};
@@ -4,15 +4,32 @@
 #include "RenderTechniquePPB.h"
 
 #include "VulkanBuffer.h"
+#include "VulkanPhysicalDevice.h"
 #include "VulkanSwapchain.h"
+#include "WideBVH.h"
 
-RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* pushConstants, CameraProperties* cameraProperties, float initialRadius) : RenderTechnique(device, pushConstants), m_initialRadius(initialRadius), m_cameraProperties(cameraProperties)
+RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* pushConstants, CameraProperties* cameraProperties, float initialRadius, size_t beamCapacity /*= 1 << 16*/, unsigned int bvhWidth /*= 2*/) : RenderTechnique(device, pushConstants), m_initialRadius(initialRadius), m_cameraProperties(cameraProperties)
 {
+	assert(bvhWidth == 2 || bvhWidth == 4 || bvhWidth == WideBVHNode::WIDTH);
+	m_bvhWidth = bvhWidth;
+	m_lbvhPushConstants.bvhWidth = bvhWidth;
+
+	// The tree is the largest buffer with two nodes per beam, or the wide tree with up to one node per beam
+	uint32_t maxStorageBufferRange = m_device->GetPhysicalDevice()->GetPhysicalDeviceProperties().limits.maxStorageBufferRange;
+	m_maxBeamCapacity = maxStorageBufferRange / (2 * sizeof(TreeNode));
+	if (m_bvhWidth > 2)
+	{
+		m_maxBeamCapacity = std::min(m_maxBeamCapacity, size_t(maxStorageBufferRange / sizeof(WideBVHNode)));
+	}
+	m_beamCapacity = std::min(std::max(beamCapacity, size_t(m_sortElementsPerWorkgroup)), m_maxBeamCapacity);
+
 	// Photon Tracer
 	{
-		std::vector<char> photonTracerSPV;
-		utilities::ReadFile("../shaders/PPB_PT.comp.spv", photonTracerSPV);
-		m_tracingShader = new VulkanShaderModule(m_device, photonTracerSPV);
+		static const uint32_t photonTracerSPV[] =
+		{
+#include "PPB_PT.comp.h"
+		};
+		m_tracingShader = new VulkanShaderModule(m_device, photonTracerSPV, sizeof(photonTracerSPV));
 
 		// Photon Tracer Tracer Descriptor Set Layout
 		std::vector<VkDescriptorSetLayoutBinding> tracingSetLayoutBindings = {
@@ -27,7 +44,9 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 			// Binding 4: Cloud Properties
 			initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
 			// Binding 5: Parameters (read)
-			initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
+			// Binding 6: Brick Majorant Sampler
+			initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER)
 		};
         AddDescriptorTypesCount(tracingSetLayoutBindings);
 		m_tracingDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, tracingSetLayoutBindings);
@@ -42,14 +61,17 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_tracingPipelineLayout = new VulkanPipelineLayout(m_device, tracingSetLayouts, tracingPushConstantRanges);
-		m_tracingPipeline = new VulkanComputePipeline(m_device, m_tracingPipelineLayout, m_tracingShader);
+		m_tracingPipeline = new VulkanComputePipeline(m_device, m_tracingPipelineLayout, m_tracingShader, GetPermutation(m_beamsPerWorkgroup, 1, false));
+		m_tracingPipeline->AddPermutation(GetPermutation(m_beamsPerWorkgroup, 1, true));
 	}
 
 	// Photon Estimate
 	{
-		std::vector<char> photonEstimatorSPV;
-		utilities::ReadFile("../shaders/PPB_PE.comp.spv", photonEstimatorSPV);
-		m_estimateShader = new VulkanShaderModule(m_device, photonEstimatorSPV);
+		static const uint32_t photonEstimatorSPV[] =
+		{
+#include "PPB_PE.comp.h"
+		};
+		m_estimateShader = new VulkanShaderModule(m_device, photonEstimatorSPV, sizeof(photonEstimatorSPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> estimateSetLayoutBindings = {
 			// Binding 0: Result Image
@@ -60,7 +82,7 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 			initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 			// Binding 3: Photon Beams Data
 			initializers::DescriptorSetLayoutBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
-			// Binding 4: Tree
+			// Binding 4: Compact Tree
 			initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 			// Binding 5: Cloud Sampler
 			initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
@@ -68,10 +90,20 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 			initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
 			// Binding 7: Parameters
 			initializers::DescriptorSetLayoutBinding(7, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
-			// Binding 8: Shadow Volume Sampler
-			initializers::DescriptorSetLayoutBinding(8, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
-			// Binding 9: Shadow Volume Properties
-			initializers::DescriptorSetLayoutBinding(9, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+			// Binding 8: Front and Back Shadow Volume Sampler
+			initializers::DescriptorSetLayoutBinding(8, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
+			// Binding 9: Front and Back Shadow Volume Properties
+			initializers::DescriptorSetLayoutBinding(9, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+			// Binding 10: Wide Tree
+			initializers::DescriptorSetLayoutBinding(10, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 11: Per pixel radius and beam count (read and write)
+			initializers::DescriptorSetLayoutBinding(11, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 12: Moment image (read and write)
+			initializers::DescriptorSetLayoutBinding(12, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+			// Binding 13: Unconverged tile list (read)
+			initializers::DescriptorSetLayoutBinding(13, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 14: Accumulation buffer (read and write)
+			initializers::DescriptorSetLayoutBinding(14, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 		};
 		AddDescriptorTypesCount(estimateSetLayoutBindings);
 		m_estimateDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, estimateSetLayoutBindings);
@@ -86,14 +118,17 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_estimatePipelineLayout = new VulkanPipelineLayout(m_device, estimateSetLayouts, estimatePushConstantRanges);
-		m_estimatePipeline = new VulkanComputePipeline(m_device, m_estimatePipelineLayout, m_estimateShader);
+		m_estimatePipeline = new VulkanComputePipeline(m_device, m_estimatePipelineLayout, m_estimateShader, GetEstimatePermutation(false));
+		m_estimatePipeline->AddPermutation(GetEstimatePermutation(true));
 	}
 
 	// AABB Fitting
 	{
-		std::vector<char> fittingSPV;
-		utilities::ReadFile("../shaders/PPB_CalculateAABB.comp.spv", fittingSPV);
-		m_fittingShader = new VulkanShaderModule(m_device, fittingSPV);
+		static const uint32_t fittingSPV[] =
+		{
+#include "PPB_CalculateAABB.comp.h"
+		};
+		m_fittingShader = new VulkanShaderModule(m_device, fittingSPV, sizeof(fittingSPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> fittingSetLayoutBindings = {
 			// Binding 0: Sorted Photon Beams
@@ -114,14 +149,16 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_fittingPipelineLayout = new VulkanPipelineLayout(m_device, fittingSetLayouts, fittingPushConstantRanges);
-		m_fittingPipeline = new VulkanComputePipeline(m_device, m_fittingPipelineLayout, m_fittingShader);
+		m_fittingPipeline = new VulkanComputePipeline(m_device, m_fittingPipelineLayout, m_fittingShader, GetPermutation(m_lbvhWorkgroupSize));
 	}
 
 	// Hierarchy Generation
 	{
-		std::vector<char> hierarchySPV;
-		utilities::ReadFile("../shaders/PPB_GenerateHierarchy.comp.spv", hierarchySPV);
-		m_hierarchyShader = new VulkanShaderModule(m_device, hierarchySPV);
+		static const uint32_t hierarchySPV[] =
+		{
+#include "PPB_GenerateHierarchy.comp.h"
+		};
+		m_hierarchyShader = new VulkanShaderModule(m_device, hierarchySPV, sizeof(hierarchySPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> hierarchySetLayoutBindings = {
 			// Binding 0: Sorted Photon Beams
@@ -142,22 +179,82 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_hierarchyPipelineLayout = new VulkanPipelineLayout(m_device, hierarchySetLayouts, hierarchyPushConstantRanges);
-		m_hierarchyPipeline = new VulkanComputePipeline(m_device, m_hierarchyPipelineLayout, m_hierarchyShader);
+		m_hierarchyPipeline = new VulkanComputePipeline(m_device, m_hierarchyPipelineLayout, m_hierarchyShader, GetPermutation(m_lbvhWorkgroupSize));
+	}
+
+	// Tree Packing
+	{
+		static const uint32_t packTreeSPV[] =
+		{
+#include "PPB_PackTree.comp.h"
+		};
+		m_packTreeShader = new VulkanShaderModule(m_device, packTreeSPV, sizeof(packTreeSPV));
+
+		std::vector<VkDescriptorSetLayoutBinding> packTreeSetLayoutBindings = {
+			// Binding 0: Tree
+			initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 1: Compact Tree
+			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		};
+		AddDescriptorTypesCount(packTreeSetLayoutBindings);
+		m_packTreeDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, packTreeSetLayoutBindings);
+
+		std::vector<VkPushConstantRange> packTreePushConstantRanges
+		{
+			initializers::PushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants))
+		};
+		std::vector<VkDescriptorSetLayout> packTreeSetLayouts
+		{
+			m_packTreeDescriptorSetLayout->GetLayout()
+		};
+
+		m_packTreePipelineLayout = new VulkanPipelineLayout(m_device, packTreeSetLayouts, packTreePushConstantRanges);
+		m_packTreePipeline = new VulkanComputePipeline(m_device, m_packTreePipelineLayout, m_packTreeShader, GetPermutation(m_lbvhWorkgroupSize));
+	}
+
+	// Tree Collapsing
+	{
+		static const uint32_t collapseTreeSPV[] =
+		{
+#include "PPB_CollapseTree.comp.h"
+		};
+		m_collapseTreeShader = new VulkanShaderModule(m_device, collapseTreeSPV, sizeof(collapseTreeSPV));
+
+		std::vector<VkDescriptorSetLayoutBinding> collapseTreeSetLayoutBindings = {
+			// Binding 0: Tree
+			initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 1: Wide Tree
+			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		};
+		AddDescriptorTypesCount(collapseTreeSetLayoutBindings);
+		m_collapseTreeDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, collapseTreeSetLayoutBindings);
+
+		std::vector<VkPushConstantRange> collapseTreePushConstantRanges
+		{
+			initializers::PushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants))
+		};
+		std::vector<VkDescriptorSetLayout> collapseTreeSetLayouts
+		{
+			m_collapseTreeDescriptorSetLayout->GetLayout()
+		};
+
+		m_collapseTreePipelineLayout = new VulkanPipelineLayout(m_device, collapseTreeSetLayouts, collapseTreePushConstantRanges);
+		m_collapseTreePipeline = new VulkanComputePipeline(m_device, m_collapseTreePipelineLayout, m_collapseTreeShader, GetPermutation(m_lbvhWorkgroupSize));
 	}
 
 	// Radix Local Sort
 	{
-		std::vector<char> localSortSPV;
-		utilities::ReadFile("../shaders/PPB_RadixSort_LocalSort.comp.spv", localSortSPV);
-		m_localSortShader = new VulkanShaderModule(m_device, localSortSPV);
+		static const uint32_t localSortSPV[] =
+		{
+#include "PPB_RadixSort_LocalSort.comp.h"
+		};
+		m_localSortShader = new VulkanShaderModule(m_device, localSortSPV, sizeof(localSortSPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> localSortSetLayoutBindings = {
-			// Binding 0: Photon Beams
+			// Binding 0: Photon Beams - both ping-pong halves
 			initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
-			// Binding 1: Sorted Photon Beams
-			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 			// Binding 1: Histogram 4b
-			initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 		};
         AddDescriptorTypesCount(localSortSetLayoutBindings);
 		m_localSortDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, localSortSetLayoutBindings);
@@ -172,24 +269,24 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_localSortPipelineLayout = new VulkanPipelineLayout(m_device, localSortSetLayouts, localSortPushConstantRanges);
-		m_localSortPipeline = new VulkanComputePipeline(m_device, m_localSortPipelineLayout, m_localSortShader);
+		m_localSortPipeline = new VulkanComputePipeline(m_device, m_localSortPipelineLayout, m_localSortShader, GetPermutation(m_sortWorkgroupSize));
 	}
 
 	// Radix Global Sort
 	{
-		std::vector<char> globalSortSPV;
-		utilities::ReadFile("../shaders/PPB_RadixSort_GlobalSort.comp.spv", globalSortSPV);
-		m_globalSortShader = new VulkanShaderModule(m_device, globalSortSPV);
+		static const uint32_t globalSortSPV[] =
+		{
+#include "PPB_RadixSort_GlobalSort.comp.h"
+		};
+		m_globalSortShader = new VulkanShaderModule(m_device, globalSortSPV, sizeof(globalSortSPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> globalSortSetLayoutBindings = {
-			// Binding 0: Sorted Photon Beams
+			// Binding 0: Photon Beams - both ping-pong halves
 			initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
-			// Binding 1: Global Sorted Photon Beams
-			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 			// Binding 1: Histogram 4b
-			initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
-			// Binding 1: Scanned Histogram 4b
-			initializers::DescriptorSetLayoutBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+			initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+			// Binding 2: Scanned Histogram 4b
+			initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 		};
         AddDescriptorTypesCount(globalSortSetLayoutBindings);
 		m_globalSortDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, globalSortSetLayoutBindings);
@@ -204,14 +301,16 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_globalSortPipelineLayout = new VulkanPipelineLayout(m_device, globalSortSetLayouts, globalSortPushConstantRanges);
-		m_globalSortPipeline = new VulkanComputePipeline(m_device, m_globalSortPipelineLayout, m_globalSortShader);
+		m_globalSortPipeline = new VulkanComputePipeline(m_device, m_globalSortPipelineLayout, m_globalSortShader, GetPermutation(m_sortWorkgroupSize));
 	}
 
 	// Radix Prefix Sum
 	{
-		std::vector<char> prefixSumSPV;
-		utilities::ReadFile("../shaders/PPB_RadixSort_PrefixSum.comp.spv", prefixSumSPV);
-		m_prefixSumShader = new VulkanShaderModule(m_device, prefixSumSPV);
+		static const uint32_t prefixSumSPV[] =
+		{
+#include "PPB_RadixSort_PrefixSum.comp.h"
+		};
+		m_prefixSumShader = new VulkanShaderModule(m_device, prefixSumSPV, sizeof(prefixSumSPV));
 
 		std::vector<VkDescriptorSetLayoutBinding> prefixSumSetLayoutBindings = {
 			// Binding 0: Histogram 4b
@@ -232,51 +331,62 @@ RenderTechniquePPB::RenderTechniquePPB(VulkanDevice* device, PushConstants* push
 		};
 
 		m_prefixSumPipelineLayout = new VulkanPipelineLayout(m_device, prefixSumSetLayouts, prefixSumPushConstantRanges);
-		m_prefixSumPipeline = new VulkanComputePipeline(m_device, m_prefixSumPipelineLayout, m_prefixSumShader);
+		m_prefixSumPipeline = new VulkanComputePipeline(m_device, m_prefixSumPipelineLayout, m_prefixSumShader, GetPermutation(m_sortWorkgroupSize));
 	}
 }
 
 RenderTechniquePPB::~RenderTechniquePPB()
 {
 	// Photon Beams
+	delete m_estimatePipeline;
 	delete m_estimateShader;
 	delete m_estimateDescriptorSetLayout;
 	delete m_estimatePipelineLayout;
-	delete m_estimatePipeline;
 
+	delete m_tracingPipeline;
 	delete m_tracingShader;
 	delete m_tracingDescriptorSetLayout;
 	delete m_tracingPipelineLayout;
-	delete m_tracingPipeline;
 
 	// LBVH
+	delete m_fittingPipeline;
 	delete m_fittingShader;
 	delete m_fittingDescriptorSetLayout;
 	delete m_fittingPipelineLayout;
-	delete m_fittingPipeline;
 
+	delete m_hierarchyPipeline;
 	delete m_hierarchyShader;
 	delete m_hierarchyDescriptorSetLayout;
 	delete m_hierarchyPipelineLayout;
-	delete m_hierarchyPipeline;
+
+	delete m_packTreePipeline;
+	delete m_packTreeShader;
+	delete m_packTreeDescriptorSetLayout;
+	delete m_packTreePipelineLayout;
+
+	delete m_collapseTreePipeline;
+	delete m_collapseTreeShader;
+	delete m_collapseTreeDescriptorSetLayout;
+	delete m_collapseTreePipelineLayout;
 
 	// Radix Sort
+	delete m_globalSortPipeline;
 	delete m_globalSortShader;
 	delete m_globalSortDescriptorSetLayout;
 	delete m_globalSortPipelineLayout;
-	delete m_globalSortPipeline;
 
+	delete m_localSortPipeline;
 	delete m_localSortShader;
 	delete m_localSortDescriptorSetLayout;
 	delete m_localSortPipelineLayout;
-	delete m_localSortPipeline;
 
+	delete m_prefixSumPipeline;
 	delete m_prefixSumShader;
 	delete m_prefixSumDescriptorSetLayout;
 	delete m_prefixSumPipelineLayout;
-	delete m_prefixSumPipeline;
 
 	FreeResources();
+	delete m_pixelStatistics;
 }
 
 void RenderTechniquePPB::AllocateResources()
@@ -287,20 +397,32 @@ void RenderTechniquePPB::AllocateResources()
 	}
 
 	VkBufferUsageFlags flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-	m_photonBeams = new VulkanBuffer(m_device, &m_debugBeams, sizeof(uint32_t), flags, (sizeof(PhotonBeam) / 4) * m_maxBeamCount * 2 + 4);		// + 4 to account for the count variable
-	m_photonBeamsData = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, (sizeof(PhotonBeamData) / 4) * m_maxBeamCount + 4);	// + 4 to account for the count variable
-	m_localHistogram = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, 16);						// 4 bits at a time, 16 buckets
-	m_scannedHistogram = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, 16);						// 4 bits at a time, 16 buckets
-	m_lbvh = new VulkanBuffer(m_device, nullptr, sizeof(TreeNode), flags, 2 * m_maxBeamCount);					// Inner nodes + Leaf nodes - Binary Tree + 1 for the count variable
+	m_photonBeams = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, (sizeof(PhotonBeam) / 4) * m_beamCapacity * 2 + 4);	// + 4 to account for the count variable
+	m_photonBeamsData = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, (sizeof(PhotonBeamData) / 4) * m_beamCapacity + 4);	// + 4 to account for the count variable
+	m_localHistogram = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, 16 * GetSortWorkgroupCount());		// 4 bits at a time, 16 buckets per work group
+	m_scannedHistogram = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, 16 * GetSortWorkgroupCount());	// 4 bits at a time, 16 buckets per work group
+	m_lbvh = new VulkanBuffer(m_device, nullptr, sizeof(TreeNode), flags, 2 * m_beamCapacity);					// Inner nodes + Leaf nodes - Binary Tree + 1 for the count variable
+	m_compactTree = new VulkanBuffer(m_device, nullptr, sizeof(CompactTreeNode), flags, m_beamCapacity);		// Inner nodes + 1 for the offset and count variables
+	m_wideTree = new VulkanBuffer(m_device, nullptr, sizeof(WideBVHNode), flags, m_bvhWidth > 2 ? m_beamCapacity : 1);	// At most one wide node per inner node + 1 for the width and count variables
 
 	auto photonBeamsInfo = initializers::DescriptorBufferInfo(m_photonBeams->GetBuffer(), 0, VK_WHOLE_SIZE);
 	auto photonBeamsDataInfo = initializers::DescriptorBufferInfo(m_photonBeamsData->GetBuffer(), 0, VK_WHOLE_SIZE);
 	auto localHistogramInfo = initializers::DescriptorBufferInfo(m_localHistogram->GetBuffer(), 0, VK_WHOLE_SIZE);
 	auto scannedHistogramInfo = initializers::DescriptorBufferInfo(m_scannedHistogram->GetBuffer(), 0, VK_WHOLE_SIZE);
 	auto lbvhInfo = initializers::DescriptorBufferInfo(m_lbvh->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto compactTreeInfo = initializers::DescriptorBufferInfo(m_compactTree->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto wideTreeInfo = initializers::DescriptorBufferInfo(m_wideTree->GetBuffer(), 0, VK_WHOLE_SIZE);
 
-	std::vector<VkWriteDescriptorSet> writes;
+	// Host visible beam counters, cleared so the first frames do not trigger a resize
+	m_beamCount = 0;
+	m_beamCounts.assign(MAX_FRAMES_IN_FLIGHT, 0);
+	for (uint32_t& beamCount : m_beamCounts)
+	{
+		m_beamCountReadbacks.push_back(new VulkanBuffer(m_device, &beamCount, sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+		m_beamCountReadbacks.back()->SetData();
+	}
 
+	std::vector<VkWriteDescriptorSet> writes;
 	// Tracing
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &photonBeamsInfo));
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &photonBeamsDataInfo));
@@ -326,9 +448,19 @@ void RenderTechniquePPB::AllocateResources()
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Fitting], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &photonBeamsInfo));
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Fitting], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &lbvhInfo));
 
-	// Tracing
+	// Tree Packing
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_PackTree], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &lbvhInfo));
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_PackTree], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compactTreeInfo));
+
+	// Tree Collapsing
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_CollapseTree], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &lbvhInfo));
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_CollapseTree], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &wideTreeInfo));
+
+	// Estimate
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &photonBeamsInfo));
 	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &photonBeamsDataInfo));
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &compactTreeInfo));
+	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10, &wideTreeInfo));
 
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
@@ -351,10 +483,22 @@ void RenderTechniquePPB::FreeResources()
 
 		delete m_lbvh;
 		m_lbvh = nullptr;
+
+		delete m_compactTree;
+		m_compactTree = nullptr;
+
+		delete m_wideTree;
+		m_wideTree = nullptr;
+
+		for (VulkanBuffer* beamCountReadback : m_beamCountReadbacks)
+		{
+			delete beamCountReadback;
+		}
+		m_beamCountReadbacks.clear();
 	}
 }
 
-void RenderTechniquePPB::UpdatePhotonMapProperties(VulkanBuffer* photonMapPropertiesBuffer, unsigned int imageIdx)
+void RenderTechniquePPB::UpdatePhotonMapProperties(VulkanBuffer* photonMapPropertiesBuffer)
 {
 	auto photonMapPropertiesInfo = initializers::DescriptorBufferInfo(photonMapPropertiesBuffer->GetBuffer(), 0, photonMapPropertiesBuffer->GetSize());
 	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2, &photonMapPropertiesInfo));
@@ -370,28 +514,38 @@ void RenderTechniquePPB::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayou
 	outSetLayouts.push_back(m_globalSortDescriptorSetLayout->GetLayout());
 	outSetLayouts.push_back(m_hierarchyDescriptorSetLayout->GetLayout());
 	outSetLayouts.push_back(m_fittingDescriptorSetLayout->GetLayout());
+	outSetLayouts.push_back(m_packTreeDescriptorSetLayout->GetLayout());
+	outSetLayouts.push_back(m_collapseTreeDescriptorSetLayout->GetLayout());
 	outSetLayouts.push_back(m_estimateDescriptorSetLayout->GetLayout());
 }
 
-void RenderTechniquePPB::SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain)
+void RenderTechniquePPB::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
 {
-	m_images = frameImages;
-	m_imageViews = frameImageViews;
+	m_image = frameImage;
+	m_imageView = frameImageView;
 	m_swapchain = swapchain;
 
-	// Update compute bindings for output image
-	std::vector<VkWriteDescriptorSet> writes;
-	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageViews[0]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
-
-	writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo));
+	// Pixel statistics follow the result image resolution, cleared before their first use
+	VkExtent3D extent = m_image->GetExtent();
+	delete m_pixelStatistics;
+	m_pixelStatistics = new VulkanBuffer(m_device, nullptr, sizeof(PixelStatistics), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, static_cast<size_t>(extent.width) * extent.height);
+	m_clearPixelStatistics = true;
 
+	// Update compute bindings for output image and pixel statistics
+	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto pixelStatisticsInfo = initializers::DescriptorBufferInfo(m_pixelStatistics->GetBuffer(), 0, VK_WHOLE_SIZE);
+	std::vector<VkWriteDescriptorSet> writes
+	{
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 11, &pixelStatisticsInfo)
+	};
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 void RenderTechniquePPB::ClearFrameReferences()
 {
-	m_imageViews.clear();
-	m_images.clear();
+	m_imageView = nullptr;
+	m_image = nullptr;
 	m_swapchain = nullptr;
 }
 
@@ -400,49 +554,99 @@ uint32_t RenderTechniquePPB::GetRequiredSetCount() const
 	return ESetIndex_SetCount;
 }
 
-void RenderTechniquePPB::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPB::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &cloudBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 6, &cloudBufferInfo));
+}
+
+void RenderTechniquePPB::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &cloudImageInfo));
+}
+
+void RenderTechniquePPB::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &majorantImageInfo));
+}
+
+void RenderTechniquePPB::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
+}
+
+void RenderTechniquePPB::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &cloudBufferInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 6, &cloudBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &parametersBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 7, &parametersBufferInfo));
 }
 
-void RenderTechniquePPB::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx)
+void RenderTechniquePPB::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &cloudImageInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9, &shadowVolumeBufferInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePPB::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPB::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &shadowVolumeImageInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePPB::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPB::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &parametersBufferInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 7, &parametersBufferInfo));
+	SetTileList(tileListInfo.buffer);
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 12, &momentImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 13, &tileListInfo));
 }
 
-void RenderTechniquePPB::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPB::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9, &shadowVolumeBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 14, &accumulationBufferInfo));
 }
 
-void RenderTechniquePPB::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx)
+void RenderTechniquePPB::UpdatePermutations(const Parameters& parameters)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &shadowVolumeImageInfo));
+	m_tracingPipeline->SetPermutation(GetPermutation(m_beamsPerWorkgroup, 1, parameters.IsIsotropic()));
+	m_estimatePipeline->SetPermutation(GetEstimatePermutation(parameters.IsIsotropic()));
+}
+
+void RenderTechniquePPB::PrepareFrame(uint32_t frameIndex)
+{
+	RenderTechnique::PrepareFrame(frameIndex);
+
+	// Count of the last frame recorded into this slot, it lags behind the other frames in flight
+	m_beamCountReadbacks[m_frameIndex]->GetData();
+	m_beamCount = m_beamCounts[m_frameIndex];
+
+	// Grow the buffers if the beams of an earlier frame did not fit, never while a command buffer bound to them is recorded
+	if (m_beamCount >= m_beamCapacity && m_beamCapacity < m_maxBeamCapacity)
+	{
+		GrowBeamCapacity(m_beamCount);
+	}
 }
 
 void RenderTechniquePPB::RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex)
 {
 	m_lbvhPushConstants.currentBuffer = 0;
 	UpdateRadius(m_pushConstants->frameCount);
+	m_lbvhPushConstants.beamRadius = m_pushConstants->pmRadius;
+
+	// Zeroed statistics restart at the global radius in PPB_PE.comp
+	if (m_clearPixelStatistics)
+	{
+		vkCmdFillBuffer(commandBuffer, m_pixelStatistics->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
+		m_clearPixelStatistics = false;
+	}
 
 	// Photon Tracing
 	{
-		// Clear previous data
-		vkCmdFillBuffer(commandBuffer, m_photonBeams->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
-		vkCmdFillBuffer(commandBuffer, m_photonBeamsData->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
+		// Clear previous counters, the beam buffers are overwritten up to the new count
+		// The wide tree width stays 0 unless the tree is collapsed, which selects the binary traversal
+		vkCmdFillBuffer(commandBuffer, m_photonBeams->GetBuffer(), 0, sizeof(uint32_t), 0);
+		vkCmdFillBuffer(commandBuffer, m_photonBeamsData->GetBuffer(), 0, sizeof(uint32_t), 0);
+		vkCmdFillBuffer(commandBuffer, m_wideTree->GetBuffer(), 0, sizeof(uint32_t), 0);
 
 		// Wait until buffers are cleared
 		VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT);
@@ -458,89 +662,170 @@ void RenderTechniquePPB::RecordDrawCommands(VkCommandBuffer commandBuffer, unsig
 		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_tracingPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Tracing, 0, nullptr);
 
 		// Start compute shader
+		CmdBeginPass(commandBuffer, "PPB tracing");
 		vkCmdDispatch(commandBuffer, m_workgroupsPerPass, 1, 1);
+		CmdEndPass(commandBuffer);
 	}
 
-	// Sorting - n passes
-	unsigned int passes = 1; // should be size of morton code divided by 4 (e.g. 24 / 4)
-	for(unsigned int i = 0; i < passes; i++)
+	// Read back the beam count, including the beams that did not fit
 	{
-		// Clear previous data
-		vkCmdFillBuffer(commandBuffer, m_localHistogram->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
-		vkCmdFillBuffer(commandBuffer, m_scannedHistogram->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
+		VkMemoryBarrier countBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &countBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
-		// Wait until tracing is complete to start the estimate
-		VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
-		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+		VkBufferCopy countRegion{ 0, 0, sizeof(uint32_t) };
+		vkCmdCopyBuffer(commandBuffer, m_photonBeams->GetBuffer(), m_beamCountReadbacks[m_frameIndex]->GetBuffer(), 1, &countRegion);
 
-		// Push constants
-		m_lbvhPushConstants.baseShift = i * 4;
-		vkCmdPushConstants(commandBuffer, m_localSortPipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+		VkMemoryBarrier hostBarrier = initializers::MemBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+	}
 
-		// Bind compute pipeline
-		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_localSortPipeline->GetPipeline());
+	// Wait until tracing is complete to start sorting
+	VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
-		// Bind descriptor set (resources)
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_localSortPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_LocalSort, 0, nullptr);
+	// Sorting - 4 bits per pass over the whole morton code
+	// Each pass sorts blocks locally into the second half of the beam buffer and scatters them back into the first one
+	{
+		const uint32_t sortWorkgroupCount = GetSortWorkgroupCount();
+		const uint32_t passes = (m_mortonCodeBits + m_radixBitsPerPass - 1) / m_radixBitsPerPass;
+		m_lbvhPushConstants.workGroupCount = sortWorkgroupCount;
 
-		// Start compute shader
-		vkCmdDispatch(commandBuffer, static_cast<uint32_t>(m_maxBeamCount) / (256 * 4) + 1, 1, 1);
+		const VulkanPipelineLayout* passLayouts[] = { m_localSortPipelineLayout, m_prefixSumPipelineLayout, m_globalSortPipelineLayout };
+		const VulkanComputePipeline* passPipelines[] = { m_localSortPipeline, m_prefixSumPipeline, m_globalSortPipeline };
+		const ESetIndex passSets[] = { ESetIndex_LocalSort, ESetIndex_PrefixSum, ESetIndex_GlobalSort };
+		const uint32_t passWorkGroups[] = { sortWorkgroupCount, 1, sortWorkgroupCount };
 
-		// Flip buffers
-		m_lbvhPushConstants.currentBuffer = (m_lbvhPushConstants.currentBuffer + 1) % 2;
+		for (uint32_t i = 0; i < passes; i++)
+		{
+			m_lbvhPushConstants.baseShift = i * m_radixBitsPerPass;
+			CmdBeginPass(commandBuffer, "PPB radix pass " + std::to_string(i));
+			for (uint32_t step = 0; step < 3; step++)
+			{
+				vkCmdPushConstants(commandBuffer, passLayouts[step]->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passPipelines[step]->GetPipeline());
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, passLayouts[step]->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + passSets[step], 0, nullptr);
+				vkCmdDispatch(commandBuffer, passWorkGroups[step], 1, 1);
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+			}
+			CmdEndPass(commandBuffer);
+		}
 	}
 
-	// Change swapchain image layout to dst blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	// LBVH - Karras hierarchy over the sorted beams, bottom-up bounds fitting, then packing into the traversal layout
+	// or collapsing into the wide tree
+	{
+		const uint32_t lbvhWorkgroupCount = static_cast<uint32_t>((m_beamCapacity + m_lbvhWorkgroupSize - 1) / m_lbvhWorkgroupSize);
+
+		vkCmdPushConstants(commandBuffer, m_hierarchyPipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hierarchyPipeline->GetPipeline());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_hierarchyPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Hierarchy, 0, nullptr);
+		CmdBeginPass(commandBuffer, "PPB hierarchy");
+		vkCmdDispatch(commandBuffer, lbvhWorkgroupCount, 1, 1);
+		CmdEndPass(commandBuffer);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
-	// Change result image layout to scr blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		vkCmdPushConstants(commandBuffer, m_fittingPipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_fittingPipeline->GetPipeline());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_fittingPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Fitting, 0, nullptr);
+		CmdBeginPass(commandBuffer, "PPB fitting");
+		vkCmdDispatch(commandBuffer, lbvhWorkgroupCount, 1, 1);
+		CmdEndPass(commandBuffer);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
-	// Copy result to swapchain image
-	VkImageSubresourceLayers layers{};
-	layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	layers.layerCount = 1;
-	layers.mipLevel = 0;
+		if (m_bvhWidth > 2)
+		{
+			// A single workgroup, the collapse synchronizes the levels of the wide tree with barriers
+			vkCmdPushConstants(commandBuffer, m_collapseTreePipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_collapseTreePipeline->GetPipeline());
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_collapseTreePipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_CollapseTree, 0, nullptr);
+			CmdBeginPass(commandBuffer, "PPB collapse");
+			vkCmdDispatch(commandBuffer, 1, 1, 1);
+			CmdEndPass(commandBuffer);
+		}
+		else
+		{
+			vkCmdPushConstants(commandBuffer, m_packTreePipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(LBVHPushConstants), &m_lbvhPushConstants);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_packTreePipeline->GetPipeline());
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_packTreePipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_PackTree, 0, nullptr);
+			CmdBeginPass(commandBuffer, "PPB packing");
+			vkCmdDispatch(commandBuffer, lbvhWorkgroupCount, 1, 1);
+			CmdEndPass(commandBuffer);
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+	}
 
-	VkExtent3D extents = m_images[imageIndex]->GetExtent();
-	VkImageBlit blit{};
-	blit.srcOffsets[0] = { 0,0,0 };
-	blit.srcOffsets[1] = { static_cast<int32_t>(extents.width), static_cast<int32_t>(extents.height), static_cast<int32_t>(extents.depth) };
-	blit.srcSubresource = layers;
-	blit.dstOffsets[0] = { 0,0,0 };
-	blit.dstOffsets[1] = { m_cameraProperties->GetWidth(), m_cameraProperties->GetHeight(), 1 };
-	blit.dstSubresource = layers;
+	// Photon Beam Estimate - traverses the LBVH per camera ray
+	{
+		// Push constants
+		vkCmdPushConstants(commandBuffer, m_estimatePipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), m_pushConstants);
 
-	vkCmdBlitImage(commandBuffer, m_images[imageIndex]->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_swapchain->GetSwapchainImages()[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+		// Bind compute pipeline
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_estimatePipeline->GetPipeline());
 
+		// Bind descriptor set (resources)
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_estimatePipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Estimate, 0, nullptr);
+
+		// Start compute shader on the unconverged tiles
+		CmdBeginPass(commandBuffer, "PPB estimate");
+		CmdDispatchTiles(commandBuffer);
+		CmdEndPass(commandBuffer);
+	}
+}
+
+size_t RenderTechniquePPB::GetBeamCapacity() const
+{
+	return m_beamCapacity;
+}
+
+uint32_t RenderTechniquePPB::GetSortWorkgroupCount() const
+{
+	return static_cast<uint32_t>((m_beamCapacity + m_sortElementsPerWorkgroup - 1) / m_sortElementsPerWorkgroup);
+}
+
+std::vector<uint32_t> RenderTechniquePPB::GetEstimatePermutation(bool isotropic) const
+{
+	// Each level of the binary tree splits on one more key bit, the morton code then the beam index of duplicate codes
+	uint32_t indexBits = 0;
+	while ((size_t(1) << indexBits) < m_maxBeamCapacity)
+	{
+		indexBits++;
+	}
+	const uint32_t treeDepth = m_mortonCodeBits + indexBits;
 
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+	// STACK_SIZE and WIDE_STACK_SIZE follow, the wide tree is at most as deep as the binary one
+	std::vector<uint32_t> permutation = GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, isotropic);
+	permutation.push_back(treeDepth + 1);
+	permutation.push_back(m_bvhWidth > 2 ? (m_bvhWidth - 1) * treeDepth + 1 : 1);
+	return permutation;
 }
 
-void RenderTechniquePPB::GetDebug()
+void RenderTechniquePPB::GrowBeamCapacity(size_t requiredCapacity)
 {
-	if (m_pushConstants->frameCount > 1)
+	size_t capacity = m_beamCapacity;
+	while (capacity <= requiredCapacity && capacity < m_maxBeamCapacity)
 	{
-		vkDeviceWaitIdle(m_device->GetDevice());
-		m_photonBeams->GetData();
+		capacity *= 2;
 	}
+	m_beamCapacity = std::min(capacity, m_maxBeamCapacity);
+
+	// Other frames in flight may still use the old buffers
+	vkDeviceWaitIdle(m_device->GetDevice());
+	AllocateResources();
+
+	std::cout << "Photon beam capacity grown to " << m_beamCapacity << " beams" << std::endl;
 }
 
 void RenderTechniquePPB::UpdateRadius(unsigned int frameNumber)
 {
+	m_pushConstants->pmAlpha = m_alpha;
 	if (frameNumber <= 1)
 	{
 		m_pushConstants->pmRadius = m_initialRadius;
 	}
 	else
 	{
-		float sum = 0;
-		int constant = (frameNumber - 2) * m_beamsPerPass;
-		for (unsigned int j = 1; j <= m_beamsPerPass; j++)
-		{
-			sum += (constant + j + m_alpha) / (constant + j + 1.0f);
-		}
-		m_pushConstants->pmRadius = m_pushConstants->pmRadius * sum;
+		// Upper bound of the pixel radii, the tree bounds are fitted with it
+		uint64_t previousBeams = static_cast<uint64_t>(frameNumber - 2) * m_beamsPerPass;
+		m_pushConstants->pmRadius *= utilities::ProgressiveRadiusScale(previousBeams, m_beamsPerPass, m_alpha);
 	}
 }
@@ -7,33 +7,41 @@ class VulkanBuffer;
 class RenderTechniquePPB : public RenderTechnique
 {
 public:
-	RenderTechniquePPB(VulkanDevice* device, PushConstants* pushConstants, CameraProperties* cameraProperties, float initialRadius);
+	RenderTechniquePPB(VulkanDevice* device, PushConstants* pushConstants, CameraProperties* cameraProperties, float initialRadius, size_t beamCapacity = 1 << 16, unsigned int bvhWidth = 2);
 	~RenderTechniquePPB();
 
 	void AllocateResources();
 	void FreeResources();
 
-	void UpdatePhotonMapProperties(VulkanBuffer* photonMapPropertiesBuffer, unsigned int imageIdx);
+	void UpdatePhotonMapProperties(VulkanBuffer* photonMapPropertiesBuffer);
 
 	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
-	virtual void SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain) override;
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) override;
 	virtual void ClearFrameReferences() override;
 
 	virtual uint32_t GetRequiredSetCount() const override;
 
-	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx) override;
-
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) override;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) override;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) override;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) override;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
+
+	virtual void PrepareFrame(uint32_t frameIndex) override;
 	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex) override;
 
-	void GetDebug();
+	size_t GetBeamCapacity() const;
 
 private:
 	void UpdateRadius(unsigned int frameNumber);
+	uint32_t GetSortWorkgroupCount() const;
+	std::vector<uint32_t> GetEstimatePermutation(bool isotropic) const;
+	void GrowBeamCapacity(size_t requiredCapacity);
 
 private:
 
@@ -43,6 +51,8 @@ private:
 		uint32_t baseShift = 0;
 		uint32_t currentBuffer = 0;
 		uint32_t workGroupCount = 0;
+		float beamRadius = 0;	// Shared by all beams of the frame
+		uint32_t bvhWidth = 0;	// Children per node of the collapsed tree
 
 	} m_lbvhPushConstants;
 
@@ -54,6 +64,8 @@ private:
 		ESetIndex_GlobalSort,
 		ESetIndex_Hierarchy,
 		ESetIndex_Fitting,
+		ESetIndex_PackTree,
+		ESetIndex_CollapseTree,
 		ESetIndex_Estimate,
 		ESetIndex_SetCount
 	};
@@ -80,6 +92,16 @@ private:
 	VulkanPipelineLayout* m_hierarchyPipelineLayout = nullptr;
 	VulkanComputePipeline* m_hierarchyPipeline = nullptr;
 
+	VulkanShaderModule* m_packTreeShader = nullptr;
+	VulkanDescriptorSetLayout* m_packTreeDescriptorSetLayout = nullptr;
+	VulkanPipelineLayout* m_packTreePipelineLayout = nullptr;
+	VulkanComputePipeline* m_packTreePipeline = nullptr;
+
+	VulkanShaderModule* m_collapseTreeShader = nullptr;
+	VulkanDescriptorSetLayout* m_collapseTreeDescriptorSetLayout = nullptr;
+	VulkanPipelineLayout* m_collapseTreePipelineLayout = nullptr;
+	VulkanComputePipeline* m_collapseTreePipeline = nullptr;
+
 	// Radix Sort
 	VulkanShaderModule* m_localSortShader = nullptr;
 	VulkanDescriptorSetLayout* m_localSortDescriptorSetLayout = nullptr;
@@ -99,31 +121,42 @@ private:
 	// GPU Data
 	VulkanBuffer* m_photonBeams = nullptr;
 	VulkanBuffer* m_photonBeamsData = nullptr;
-	VulkanBuffer* m_lbvh = nullptr;
+	VulkanBuffer* m_lbvh = nullptr;			// Build-time nodes
+	VulkanBuffer* m_compactTree = nullptr;	// Traversal-time nodes, read by the estimate
+	VulkanBuffer* m_wideTree = nullptr;		// Collapsed nodes, read by the estimate instead when the width is above 2
 	VulkanBuffer* m_localHistogram = nullptr;
 	VulkanBuffer* m_scannedHistogram = nullptr;
 
+	// SPPM radius and beam count per result image pixel, shared by all frames
+	VulkanBuffer* m_pixelStatistics = nullptr;
+	bool m_clearPixelStatistics = false;
+
+	// Deposited beam count per frame in flight, and the one of the last frame prepared
+	std::vector<VulkanBuffer*> m_beamCountReadbacks;
+	std::vector<uint32_t> m_beamCounts;
+	uint32_t m_beamCount = 0;
+
 	// References and Parameters
 	const CameraProperties* m_cameraProperties = nullptr;
 	const PhotonMapProperties* m_photonMapProperties = nullptr;
 	VulkanSwapchain* m_swapchain = nullptr;
 
-	std::vector<VulkanImage*> m_images;
-	std::vector<VulkanImageView*> m_imageViews;
+	VulkanImage* m_image = nullptr;
+	VulkanImageView* m_imageView = nullptr;
 
 	const float m_initialRadius = 0;
 	const float m_alpha = .8f;
 
-	const size_t m_maxBeamCount = 4096;
-	const unsigned int m_workgroupsPerPass = 28;
-	const unsigned int m_beamsPerWorkgroup = 2;
+	size_t m_beamCapacity = 0;		// Grows geometrically when a frame deposits more beams
+	size_t m_maxBeamCapacity = 0;	// Limited by the storage buffer range of the tree
+	unsigned int m_bvhWidth = 2;	// 2 traverses the compact binary tree, 4 or 8 the collapsed one
+	const unsigned int m_workgroupsPerPass = 64;
+	const unsigned int m_beamsPerWorkgroup = 64;
 	const unsigned int m_beamsPerPass = m_workgroupsPerPass * m_beamsPerWorkgroup;
 
-
-	//TEMP DEBUG
-	struct PhotonBeams
-	{
-		glm::uvec4 stuff;
-		PhotonBeam beams[4096];
-	} m_debugBeams;
+	const unsigned int m_mortonCodeBits = 30;
+	const unsigned int m_radixBitsPerPass = 4;
+	const unsigned int m_sortWorkgroupSize = 256;
+	const unsigned int m_sortElementsPerWorkgroup = 4 * m_sortWorkgroupSize;	// 4 elements per thread
+	const unsigned int m_lbvhWorkgroupSize = 256;
 };
\ No newline at end of file
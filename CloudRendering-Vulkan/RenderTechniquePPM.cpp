@@ -15,13 +15,15 @@ RenderTechniquePPM::RenderTechniquePPM(VulkanDevice* device, VulkanSwapchain* sw
 	m_pushConstants->pmRadius = m_initialRadius;
 
 	// Photon Tracer
-	std::vector<char> photonTracerSPV;
-	utilities::ReadFile("../shaders/PPM_PT.comp.spv", photonTracerSPV);
-	m_ptShader = new VulkanShaderModule(m_device, photonTracerSPV);
+	static const uint32_t photonTracerSPV[] =
+	{
+#include "PPM_PT.comp.h"
+	};
+	m_ptShader = new VulkanShaderModule(m_device, photonTracerSPV, sizeof(photonTracerSPV));
 
 	// Photon Tracer Tracer Descriptor Set Layout
 	std::vector<VkDescriptorSetLayoutBinding> ptSetLayoutBindings = {
-		// Binding 0: Output 3D photon map buffer (read and write)
+		// Binding 0: Deposited photons (write)
 		initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 		// Binding 1: Photon Map Properties (read)
 		initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
@@ -31,8 +33,12 @@ RenderTechniquePPM::RenderTechniquePPM(VulkanDevice* device, VulkanSwapchain* sw
 		initializers::DescriptorSetLayoutBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
 		// Binding 4: Parameters (read)
 		initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
-		// Binding 5: Photon collision map (read and write)
-		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+		// Binding 5: Photon count per grid cell (read and write)
+		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 6: Brick majorant 3D sampler (read)
+		initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+		// Binding 7: Deposited photon count (read and write)
+		initializers::DescriptorSetLayoutBinding(7, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 	};
     AddDescriptorTypesCount(ptSetLayoutBindings);
 	m_ptDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, ptSetLayoutBindings);
@@ -48,12 +54,53 @@ RenderTechniquePPM::RenderTechniquePPM(VulkanDevice* device, VulkanSwapchain* sw
 	};
 
 	m_ptPipelineLayout = new VulkanPipelineLayout(m_device, ptSetLayouts, ptPushConstantRanges);
-	m_ptPipeline = new VulkanComputePipeline(m_device, m_ptPipelineLayout, m_ptShader);
+	m_ptPipeline = new VulkanComputePipeline(m_device, m_ptPipelineLayout, m_ptShader, GetPermutation(m_photonsPerWorkgroup, 1, false));
+	m_ptPipeline->AddPermutation(GetPermutation(m_photonsPerWorkgroup, 1, true));
+
+	// Photon Grid
+	static const uint32_t photonGridSPV[] =
+	{
+#include "PPM_Grid.comp.h"
+	};
+	m_gridShader = new VulkanShaderModule(m_device, photonGridSPV, sizeof(photonGridSPV));
+
+	// Photon Grid Descriptor Set Layout
+	std::vector<VkDescriptorSetLayoutBinding> gridSetLayoutBindings = {
+		// Binding 0: Photon count per grid cell (read)
+		initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 1: First photon per grid cell (read and write)
+		initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 2: Scan block sums (read and write)
+		initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 3: Deposited photons (read)
+		initializers::DescriptorSetLayoutBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 4: Photon map sorted by cell (write)
+		initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 5: Deposited photon count (read)
+		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+	};
+	AddDescriptorTypesCount(gridSetLayoutBindings);
+	m_gridDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, gridSetLayoutBindings);
+
+	// Photon grid pipeline
+	std::vector<VkPushConstantRange> gridPushConstantRanges
+	{
+		initializers::PushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GridPushConstants))
+	};
+	std::vector<VkDescriptorSetLayout> gridSetLayouts
+	{
+		m_gridDescriptorSetLayout->GetLayout()
+	};
+
+	m_gridPipelineLayout = new VulkanPipelineLayout(m_device, gridSetLayouts, gridPushConstantRanges);
+	m_gridPipeline = new VulkanComputePipeline(m_device, m_gridPipelineLayout, m_gridShader, GetPermutation(m_gridWorkgroupSize));
 
 	// Photon Estimate
-	std::vector<char> photonEstimateSPV;
-	utilities::ReadFile("../shaders/PPM_PE.comp.spv", photonEstimateSPV);
-	m_peShader = new VulkanShaderModule(m_device, photonEstimateSPV);
+	static const uint32_t photonEstimateSPV[] =
+	{
+#include "PPM_PE.comp.h"
+	};
+	m_peShader = new VulkanShaderModule(m_device, photonEstimateSPV, sizeof(photonEstimateSPV));
 
 
 	// Photon Estimate Descriptor Set Layout
@@ -70,14 +117,22 @@ RenderTechniquePPM::RenderTechniquePPM(VulkanDevice* device, VulkanSwapchain* sw
 		initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
 		// Binding 5: Photon Map Properties
 		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
-		// Binding 6: Collision Map
+		// Binding 6: First photon per grid cell
 		initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
 		// Binding 7: Cloud Sampler
 		initializers::DescriptorSetLayoutBinding(7, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
-		// Binding 8: Shadow Volume Sampler
-		initializers::DescriptorSetLayoutBinding(8, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
-		// Binding 9: Shadow Volume Properties
-		initializers::DescriptorSetLayoutBinding(9, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+		// Binding 8: Front and Back Shadow Volume Sampler
+		initializers::DescriptorSetLayoutBinding(8, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
+		// Binding 9: Front and Back Shadow Volume Properties
+		initializers::DescriptorSetLayoutBinding(9, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+		// Binding 10: Per pixel radius and photon count (read and write)
+		initializers::DescriptorSetLayoutBinding(10, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 11: Moment image (read and write)
+		initializers::DescriptorSetLayoutBinding(11, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+		// Binding 12: Unconverged tile list (read)
+		initializers::DescriptorSetLayoutBinding(12, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 13: Accumulation buffer (read and write)
+		initializers::DescriptorSetLayoutBinding(13, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 	};
     AddDescriptorTypesCount(peSetLayoutBindings);
 	m_peDescriptorSetLayout = new VulkanDescriptorSetLayout(m_device, peSetLayoutBindings);
@@ -93,23 +148,30 @@ RenderTechniquePPM::RenderTechniquePPM(VulkanDevice* device, VulkanSwapchain* sw
 	};
 
 	m_pePipelineLayout = new VulkanPipelineLayout(m_device, peSetLayouts, pePushConstantRanges);
-	m_pePipeline = new VulkanComputePipeline(m_device, m_pePipelineLayout, m_peShader);
+	m_pePipeline = new VulkanComputePipeline(m_device, m_pePipelineLayout, m_peShader, GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, false));
+	m_pePipeline->AddPermutation(GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, true));
 }
 
 RenderTechniquePPM::~RenderTechniquePPM()
 {
+	delete m_ptPipeline;
 	delete m_ptShader;
 	delete m_ptDescriptorSetLayout;
-	delete m_ptPipeline;
 	delete m_ptPipelineLayout;
 
+	delete m_gridPipeline;
+	delete m_gridShader;
+	delete m_gridDescriptorSetLayout;
+	delete m_gridPipelineLayout;
+
+	delete m_pePipeline;
 	delete m_peShader;
 	delete m_peDescriptorSetLayout;
-	delete m_pePipeline;
 	delete m_pePipelineLayout;
 
 	FreeResources();
 	ClearFrameReferences();
+	delete m_pixelStatistics;
 }
 
 void RenderTechniquePPM::FreeResources()
@@ -119,8 +181,20 @@ void RenderTechniquePPM::FreeResources()
 		delete m_photonMap;
 		m_photonMap = nullptr;
 
-		delete m_collisionMap;
-		m_collisionMap = nullptr;
+		delete m_depositedPhotons;
+		m_depositedPhotons = nullptr;
+
+		delete m_photonCount;
+		m_photonCount = nullptr;
+
+		delete m_cellCounts;
+		m_cellCounts = nullptr;
+
+		delete m_cellStarts;
+		m_cellStarts = nullptr;
+
+		delete m_blockSums;
+		m_blockSums = nullptr;
 	}
 }
 
@@ -131,26 +205,42 @@ void RenderTechniquePPM::AllocateResources(VulkanBuffer* photonMapPropertiesBuff
 		FreeResources();
 	}
 
-	uint32_t bufferSize = m_photonMapProperties->GetTotalSize();
+	// Photon storage scales with the photon capacity, the grid only keeps two counters per cell
+	uint32_t cellCount = m_photonMapProperties->GetTotalSize();
+	uint32_t blockCount = (cellCount + m_scanBlockSize - 1) / m_scanBlockSize;
+	m_gridPushConstants.cellCount = cellCount;
 
 	VkBufferUsageFlags flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-	m_photonMap = new VulkanBuffer(m_device, nullptr, sizeof(Photon) * elementsPerCell, flags, bufferSize);
-	m_collisionMap = new VulkanBuffer(m_device, nullptr, sizeof(glm::uvec4), flags, bufferSize);
+	m_photonMap = new VulkanBuffer(m_device, nullptr, sizeof(Photon), flags, m_photonCapacity);
+	m_depositedPhotons = new VulkanBuffer(m_device, nullptr, sizeof(Photon), flags, m_photonCapacity);
+	m_photonCount = new VulkanBuffer(m_device, nullptr, sizeof(glm::uvec4), flags, 1);
+	m_cellCounts = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, cellCount);
+	m_cellStarts = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, cellCount + 1);
+	m_blockSums = new VulkanBuffer(m_device, nullptr, sizeof(uint32_t), flags, blockCount);
 
 	auto photonMapInfo = initializers::DescriptorBufferInfo(m_photonMap->GetBuffer(), 0, VK_WHOLE_SIZE);
-	auto collisionMapInfo = initializers::DescriptorBufferInfo(m_collisionMap->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto depositedPhotonsInfo = initializers::DescriptorBufferInfo(m_depositedPhotons->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto photonCountInfo = initializers::DescriptorBufferInfo(m_photonCount->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto cellCountsInfo = initializers::DescriptorBufferInfo(m_cellCounts->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto cellStartsInfo = initializers::DescriptorBufferInfo(m_cellStarts->GetBuffer(), 0, VK_WHOLE_SIZE);
+	auto blockSumsInfo = initializers::DescriptorBufferInfo(m_blockSums->GetBuffer(), 0, VK_WHOLE_SIZE);
 	auto photonMapPropertiesInfo = initializers::DescriptorBufferInfo(photonMapPropertiesBuffer->GetBuffer(), 0, photonMapPropertiesBuffer->GetSize());
 
-	std::vector<VkWriteDescriptorSet> writes;
-	uint32_t frameCount = static_cast<uint32_t>(m_descriptorSets.size() / ESetIndex_SetCount);
-	for (size_t i = 0; i < frameCount; i++)
+	std::vector<VkWriteDescriptorSet> writes
 	{
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &photonMapInfo));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &collisionMapInfo));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &photonMapPropertiesInfo));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &photonMapInfo));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &photonMapPropertiesInfo));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &collisionMapInfo));
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &depositedPhotonsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &cellCountsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &photonCountInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &photonMapPropertiesInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &cellCountsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &cellStartsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &blockSumsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &depositedPhotonsInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4, &photonMapInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Grid], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5, &photonCountInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &photonMapInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &photonMapPropertiesInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &cellStartsInfo)
 	};
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
@@ -158,83 +248,119 @@ void RenderTechniquePPM::AllocateResources(VulkanBuffer* photonMapPropertiesBuff
 void RenderTechniquePPM::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const
 {
 	outSetLayouts.push_back(m_ptDescriptorSetLayout->GetLayout());
+	outSetLayouts.push_back(m_gridDescriptorSetLayout->GetLayout());
 	outSetLayouts.push_back(m_peDescriptorSetLayout->GetLayout());
 }
 
-void RenderTechniquePPM::SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain)
+void RenderTechniquePPM::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
 {
-	m_images = frameImages;
-	m_imageViews = frameImageViews;
+	m_image = frameImage;
+	m_imageView = frameImageView;
 	m_swapchain = swapchain;
 
-	// Update compute bindings for output image
-	std::vector<VkDescriptorImageInfo> imageInfos;
-	std::vector<VkWriteDescriptorSet> writes;
-	imageInfos.reserve(m_descriptorSets.size());
-	writes.reserve(m_descriptorSets.size());
-	uint32_t frameCount = static_cast<uint32_t>(m_descriptorSets.size() / ESetIndex_SetCount);
-	for (size_t i = 0; i < frameCount; i++)
+	// Pixel statistics follow the result image resolution, cleared before their first use
+	VkExtent3D extent = m_image->GetExtent();
+	delete m_pixelStatistics;
+	m_pixelStatistics = new VulkanBuffer(m_device, nullptr, sizeof(PixelStatistics), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, static_cast<size_t>(extent.width) * extent.height);
+	m_clearPixelStatistics = true;
+
+	// Update compute bindings for output image and pixel statistics
+	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto pixelStatisticsInfo = initializers::DescriptorBufferInfo(m_pixelStatistics->GetBuffer(), 0, VK_WHOLE_SIZE);
+	std::vector<VkWriteDescriptorSet> writes
 	{
-		imageInfos.push_back(initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageViews[i]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + i * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfos.back()));
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10, &pixelStatisticsInfo)
 	};
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 void RenderTechniquePPM::ClearFrameReferences()
 {
-	m_imageViews.clear();
-	m_images.clear();
+	m_imageView = nullptr;
+	m_image = nullptr;
 	m_swapchain = nullptr;
 }
 
 uint32_t RenderTechniquePPM::GetRequiredSetCount() const
 {
-	return 2; // Photon Tracing and Estimate sets
+	return ESetIndex_SetCount; // Photon Tracing, Grid and Estimate sets
+}
+
+void RenderTechniquePPM::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+}
+
+void RenderTechniquePPM::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7, &cloudImageInfo));
+}
+
+void RenderTechniquePPM::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &majorantImageInfo));
+}
+
+void RenderTechniquePPM::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
 }
 
-void RenderTechniquePPM::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPM::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate  + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
 }
 
-void RenderTechniquePPM::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx)
+void RenderTechniquePPM::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate  + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9, &shadowVolumeBufferInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePPM::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPM::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &shadowVolumeImageInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePPM::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPM::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Tracing + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
+	SetTileList(tileListInfo.buffer);
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 11, &momentImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 12, &tileListInfo));
 }
 
-void RenderTechniquePPM::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx)
+void RenderTechniquePPM::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 9, &shadowVolumeBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 13, &accumulationBufferInfo));
 }
 
-void RenderTechniquePPM::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx)
+void RenderTechniquePPM::UpdatePermutations(const Parameters& parameters)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[ESetIndex_Estimate + imageIdx * ESetIndex_SetCount], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8, &shadowVolumeImageInfo));
+	m_ptPipeline->SetPermutation(GetPermutation(m_photonsPerWorkgroup, 1, parameters.IsIsotropic()));
+	m_pePipeline->SetPermutation(GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, parameters.IsIsotropic()));
 }
 
 void RenderTechniquePPM::RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex)
 {
 	UpdateRadius(m_pushConstants->frameCount);
 
+	// Zeroed statistics restart at the global radius in PPM_PE.comp
+	if (m_clearPixelStatistics)
+	{
+		vkCmdFillBuffer(commandBuffer, m_pixelStatistics->GetBuffer(), 0, VK_WHOLE_SIZE, 0);
+		m_clearPixelStatistics = false;
+	}
+
 	// Photon Tracing
 	{
-		// Clear previous data
-		vkCmdFillBuffer(commandBuffer, m_photonMap->GetBuffer(), 0, m_photonMap->GetSize(), 0);
-		vkCmdFillBuffer(commandBuffer, m_collisionMap->GetBuffer(), 0, m_collisionMap->GetSize(), 0);
+		// Clear previous counters, the photon buffers are overwritten up to the new count
+		vkCmdFillBuffer(commandBuffer, m_photonCount->GetBuffer(), 0, m_photonCount->GetSize(), 0);
+		vkCmdFillBuffer(commandBuffer, m_cellCounts->GetBuffer(), 0, m_cellCounts->GetSize(), 0);
 
 		// Wait until tracing is complete to start the estimate
 		VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_WRITE_BIT);
@@ -247,16 +373,43 @@ void RenderTechniquePPM::RecordDrawCommands(VkCommandBuffer commandBuffer, unsig
 		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_ptPipeline->GetPipeline());
 
 		// Bind descriptor set (resources)
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_ptPipelineLayout->GetPipelineLayout(), ESetIndex_Tracing, 1, m_descriptorSets.data() + imageIndex * ESetIndex_SetCount, 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_ptPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Tracing, 0, nullptr);
 
 		// Start compute shader
+		CmdBeginPass(commandBuffer, "PPM tracing");
 		vkCmdDispatch(commandBuffer, 200, 1, 1);
+		CmdEndPass(commandBuffer);
 	}
 
-	// Wait until tracing is complete to start the estimate
-	VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+	// Wait until tracing is complete to build the grid
+	VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
 
+	// Photon Grid - scan the cell counts into cell starts and sort the photons by cell
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_gridPipeline->GetPipeline());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_gridPipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Grid, 0, nullptr);
+
+		const uint32_t blockCount = (m_gridPushConstants.cellCount + m_scanBlockSize - 1) / m_scanBlockSize;
+		const uint32_t passWorkGroups[] =
+		{
+			blockCount, // EGridPass_ScanBlocks
+			1, // EGridPass_ScanBlockSums
+			blockCount, // EGridPass_AddBlockOffsets
+			(m_photonCapacity + m_gridWorkgroupSize - 1) / m_gridWorkgroupSize // EGridPass_Scatter
+		};
+
+		CmdBeginPass(commandBuffer, "PPM grid");
+		for (uint32_t pass = EGridPass_ScanBlocks; pass <= EGridPass_Scatter; pass++)
+		{
+			m_gridPushConstants.pass = pass;
+			vkCmdPushConstants(commandBuffer, m_gridPipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GridPushConstants), &m_gridPushConstants);
+			vkCmdDispatch(commandBuffer, passWorkGroups[pass], 1, 1);
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+		}
+		CmdEndPass(commandBuffer);
+	}
+
 	// Photon Estimate
 	{
 		// Push constants
@@ -266,41 +419,18 @@ void RenderTechniquePPM::RecordDrawCommands(VkCommandBuffer commandBuffer, unsig
 		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pePipeline->GetPipeline());
 
 		// Bind descriptor set (resources)
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pePipelineLayout->GetPipelineLayout(), ESetIndex_Estimate, 1, m_descriptorSets.data() + imageIndex * ESetIndex_SetCount, 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pePipelineLayout->GetPipelineLayout(), 0, 1, m_descriptorSets.data() + ESetIndex_Estimate, 0, nullptr);
 
-		// Start compute shader
-		vkCmdDispatch(commandBuffer, (m_cameraProperties->GetWidth() / 32) + 1, (m_cameraProperties->GetHeight() / 32) + 1, 1);
+		// Start compute shader on the unconverged tiles
+		CmdBeginPass(commandBuffer, "PPM estimate");
+		CmdDispatchTiles(commandBuffer);
+		CmdEndPass(commandBuffer);
 	}
-
-	// Change swapchain image layout to dst blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-	// Change result image layout to scr blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-	// Copy result to swapchain image
-	VkImageSubresourceLayers layers{};
-	layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	layers.layerCount = 1;
-	layers.mipLevel = 0;
-
-	VkExtent3D extents = m_images[imageIndex]->GetExtent();
-	VkImageBlit blit{};
-	blit.srcOffsets[0] = { 0,0,0 };
-	blit.srcOffsets[1] = { static_cast<int32_t>(extents.width), static_cast<int32_t>(extents.height), static_cast<int32_t>(extents.depth) };
-	blit.srcSubresource = layers;
-	blit.dstOffsets[0] = { 0,0,0 };
-	blit.dstOffsets[1] = { m_cameraProperties->GetWidth(), m_cameraProperties->GetHeight(), 1 };
-	blit.dstSubresource = layers;
-
-	vkCmdBlitImage(commandBuffer, m_images[imageIndex]->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_swapchain->GetSwapchainImages()[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
 }
 
 void RenderTechniquePPM::UpdateRadius(unsigned int frameNumber)
 {
+	m_pushConstants->pmAlpha = m_alpha;
 	if (frameNumber <= 1)
 	{
 		m_pushConstants->pmRadius = m_initialRadius;
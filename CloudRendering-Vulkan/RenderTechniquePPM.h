@@ -11,6 +11,7 @@ private:
 	const enum ESetIndex
 	{
 		ESetIndex_Tracing = 0,
+		ESetIndex_Grid,
 		ESetIndex_Estimate,
 		ESetIndex_SetCount
 	};
@@ -24,17 +25,21 @@ public:
 
 	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
 
-	virtual void SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain);
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain);
 	virtual void ClearFrameReferences();
 
 	virtual uint32_t GetRequiredSetCount() const;
 
-	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx);
-	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx);
-	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx);
-	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx);
-	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx);
-	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx);
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo);
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo);
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo);
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo);
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx);
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx);
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
 
 	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex);
 
@@ -42,6 +47,21 @@ private:
 	void UpdateRadius(unsigned int frameNumber);
 
 private:
+	// Passes of PPM_Grid.comp
+	enum EGridPass
+	{
+		EGridPass_ScanBlocks = 0,
+		EGridPass_ScanBlockSums,
+		EGridPass_AddBlockOffsets,
+		EGridPass_Scatter
+	};
+
+	struct GridPushConstants
+	{
+		uint32_t pass = 0;
+		uint32_t cellCount = 0;
+	} m_gridPushConstants;
+
 	VulkanShaderModule* m_peShader = nullptr;
 	VulkanDescriptorSetLayout* m_peDescriptorSetLayout = nullptr;
 	VulkanPipelineLayout* m_pePipelineLayout = nullptr;
@@ -52,17 +72,34 @@ private:
 	VulkanPipelineLayout* m_ptPipelineLayout = nullptr;
 	VulkanComputePipeline* m_ptPipeline = nullptr;
 
+	VulkanShaderModule* m_gridShader = nullptr;
+	VulkanDescriptorSetLayout* m_gridDescriptorSetLayout = nullptr;
+	VulkanPipelineLayout* m_gridPipelineLayout = nullptr;
+	VulkanComputePipeline* m_gridPipeline = nullptr;
+
+	// Photons are appended unordered, counted per cell and then sorted by cell into the photon map
+	VulkanBuffer* m_depositedPhotons = nullptr;
+	VulkanBuffer* m_photonCount = nullptr;
+	VulkanBuffer* m_cellCounts = nullptr;
+	VulkanBuffer* m_cellStarts = nullptr;
+	VulkanBuffer* m_blockSums = nullptr;
 	VulkanBuffer* m_photonMap = nullptr;
-	VulkanBuffer* m_collisionMap = nullptr;
+
+	// SPPM radius and photon count per result image pixel, shared by all frames
+	VulkanBuffer* m_pixelStatistics = nullptr;
+	bool m_clearPixelStatistics = false;
 
 	const CameraProperties* m_cameraProperties = nullptr;
 	const PhotonMapProperties* m_photonMapProperties = nullptr;
 	VulkanSwapchain* m_swapchain = nullptr;
 
-	std::vector<VulkanImage*> m_images;
-	std::vector<VulkanImageView*> m_imageViews;
+	VulkanImage* m_image = nullptr;
+	VulkanImageView* m_imageView = nullptr;
 
 	const float m_initialRadius = 0;
 	const float m_alpha = .8f;
-	const uint32_t elementsPerCell = 32;
+	const uint32_t m_photonCapacity = 1 << 20;
+	const uint32_t m_photonsPerWorkgroup = 64;
+	const uint32_t m_gridWorkgroupSize = 512;
+	const uint32_t m_scanBlockSize = 2 * m_gridWorkgroupSize; // Cells per work group of the scan passes
 };
\ No newline at end of file
@@ -12,9 +12,11 @@
 RenderTechniquePT::RenderTechniquePT(VulkanDevice* device, VulkanSwapchain* swapchain, const CameraProperties* cameraProperties, PushConstants* pushConstants) : RenderTechnique(device, pushConstants), m_cameraProperties(cameraProperties), m_swapchain(swapchain)
 {
 	// Create Shader
-	std::vector<char> pathTracerSPV;
-	utilities::ReadFile("../shaders/PathTracer.comp.spv", pathTracerSPV);
-	m_shader = new VulkanShaderModule(m_device, pathTracerSPV);
+	static const uint32_t pathTracerSPV[] =
+	{
+#include "PathTracer.comp.h"
+	};
+	m_shader = new VulkanShaderModule(m_device, pathTracerSPV, sizeof(pathTracerSPV));
 
 	// Path Tracer Descriptor Set Layout
 	std::vector<VkDescriptorSetLayoutBinding> pathTracerSetLayoutBindings = {
@@ -28,10 +30,18 @@ RenderTechniquePT::RenderTechniquePT(VulkanDevice* device, VulkanSwapchain* swap
 		initializers::DescriptorSetLayoutBinding(3, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
 		// Binding 4: Parameters (read)
 		initializers::DescriptorSetLayoutBinding(4, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER),
-		// Binding 5: Shadow volume 3D sampler (read)
-		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
-		// Binding 6: Shadow volume properties (read)
-		initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER)
+		// Binding 5: Front and back shadow volume 3D sampler (read)
+		initializers::DescriptorSetLayoutBinding(5, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2),
+		// Binding 6: Front and back shadow volume properties (read)
+		initializers::DescriptorSetLayoutBinding(6, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),
+		// Binding 7: Brick majorant 3D sampler (read)
+		initializers::DescriptorSetLayoutBinding(7, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER),
+		// Binding 8: Moment image (read and write)
+		initializers::DescriptorSetLayoutBinding(8, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+		// Binding 9: Unconverged tile list (read)
+		initializers::DescriptorSetLayoutBinding(9, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER),
+		// Binding 10: Accumulation buffer (read and write)
+		initializers::DescriptorSetLayoutBinding(10, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
 	};
     AddDescriptorTypesCount(pathTracerSetLayoutBindings);
 	m_descriptorSetLayout = new VulkanDescriptorSetLayout(m_device, pathTracerSetLayoutBindings);
@@ -47,14 +57,15 @@ RenderTechniquePT::RenderTechniquePT(VulkanDevice* device, VulkanSwapchain* swap
 	};
 
 	m_pipelineLayout = new VulkanPipelineLayout(m_device, ptSetLayouts, ptPushConstantRanges);
-	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader);
+	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader, GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, false));
+	m_pipeline->AddPermutation(GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, true));
 }
 
 RenderTechniquePT::~RenderTechniquePT()
 {
+	delete m_pipeline;
 	delete m_shader;
 	delete m_descriptorSetLayout;
-	delete m_pipeline;
 	delete m_pipelineLayout;
 
 	ClearFrameReferences();
@@ -65,60 +76,77 @@ void RenderTechniquePT::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout
 	outSetLayouts.push_back(m_descriptorSetLayout->GetLayout());
 }
 
-void RenderTechniquePT::SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain)
+void RenderTechniquePT::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
 {
-	m_images = frameImages;
-	m_imageViews = frameImageViews;
+	m_image = frameImage;
+	m_imageView = frameImageView;
 	m_swapchain = swapchain;
 
-	// Update compute bindings for output image
-	std::vector<VkDescriptorImageInfo> imageInfos;
-	std::vector<VkWriteDescriptorSet> writes;
-	imageInfos.reserve(m_descriptorSets.size());
-	writes.reserve(m_descriptorSets.size());
-	for (size_t i = 0; i < m_descriptorSets.size(); i++)
-	{
-		imageInfos.push_back(initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageViews[i]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL));
-		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfos.back()));
-	};
-	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+	// Update compute binding for output image
+	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto write = initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo);
+	vkUpdateDescriptorSets(m_device->GetDevice(), 1, &write, 0, nullptr);
 }
 
 void RenderTechniquePT::ClearFrameReferences()
 {
-	m_imageViews.clear();
-	m_images.clear();
+	m_imageView = nullptr;
+	m_image = nullptr;
 	m_swapchain = nullptr;
 }
 
-void RenderTechniquePT::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+}
+
+void RenderTechniquePT::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
+}
+
+void RenderTechniquePT::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 7, &majorantImageInfo));
 }
 
-void RenderTechniquePT::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
 }
 
-void RenderTechniquePT::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &cameraBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
 }
 
-void RenderTechniquePT::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &parametersBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 6, &shadowVolumeBufferInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePT::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 6, &shadowVolumeBufferInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &shadowVolumeImageInfo));
+	m_writeQueue.back().dstArrayElement = volumeIdx;
 }
 
-void RenderTechniquePT::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx)
+void RenderTechniquePT::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &shadowVolumeImageInfo));
+	SetTileList(tileListInfo.buffer);
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 8, &momentImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &tileListInfo));
+}
+
+void RenderTechniquePT::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
+{
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 10, &accumulationBufferInfo));
+}
+
+void RenderTechniquePT::UpdatePermutations(const Parameters& parameters)
+{
+	m_pipeline->SetPermutation(GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE, parameters.IsIsotropic()));
 }
 
 uint32_t RenderTechniquePT::GetRequiredSetCount() const
@@ -135,34 +163,10 @@ void RenderTechniquePT::RecordDrawCommands(VkCommandBuffer commandBuffer, unsign
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetPipeline());
 
 	// Bind descriptor set (resources)
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, 1, &m_descriptorSets[imageIndex], 0, nullptr);
-
-	// Start compute shader
-	vkCmdDispatch(commandBuffer, (m_cameraProperties->GetWidth() / 32) + 1, (m_cameraProperties->GetHeight() / 32) + 1, 1);
-
-	// Change swapchain image layout to dst blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-	// Change result image layout to scr blit
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-
-	// Copy result to swapchain image
-	VkImageSubresourceLayers layers{};
-	layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	layers.layerCount = 1;
-	layers.mipLevel = 0;
-
-	VkExtent3D extents = m_images[imageIndex]->GetExtent();
-	VkImageBlit blit{};
-	blit.srcOffsets[0] = { 0,0,0 };
-	blit.srcOffsets[1] = { static_cast<int32_t>(extents.width), static_cast<int32_t>(extents.height), static_cast<int32_t>(extents.depth) };
-	blit.srcSubresource = layers;
-	blit.dstOffsets[0] = { 0,0,0 };
-	blit.dstOffsets[1] = { m_cameraProperties->GetWidth(), m_cameraProperties->GetHeight(), 1 };
-	blit.dstSubresource = layers;
-
-	vkCmdBlitImage(commandBuffer, m_images[imageIndex]->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_swapchain->GetSwapchainImages()[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, 1, &m_descriptorSets[0], 0, nullptr);
 
-	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	utilities::CmdTransitionImageLayout(commandBuffer, m_images[imageIndex]->GetImage(), m_images[imageIndex]->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+	// Start compute shader on the unconverged tiles
+	CmdBeginPass(commandBuffer, "PT estimate");
+	CmdDispatchTiles(commandBuffer);
+	CmdEndPass(commandBuffer);
 }
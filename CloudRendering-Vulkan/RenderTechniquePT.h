@@ -13,15 +13,19 @@ public:
 
 
 	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
-	virtual void SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain) override;
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) override;
 	virtual void ClearFrameReferences() override;
 
-	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx) override;
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) override;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) override;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) override;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) override;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
 
 	virtual uint32_t GetRequiredSetCount() const override;
 
@@ -35,6 +39,6 @@ private:
 
 	const CameraProperties* m_cameraProperties = nullptr;
 	VulkanSwapchain* m_swapchain = nullptr;
-	std::vector<VulkanImage*> m_images;
-	std::vector<VulkanImageView*> m_imageViews;
+	VulkanImage* m_image = nullptr;
+	VulkanImageView* m_imageView = nullptr;
 };
\ No newline at end of file
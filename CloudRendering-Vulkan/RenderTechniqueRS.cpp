@@ -0,0 +1,195 @@
+#include "stdafx.h"
+#include "RenderTechniqueRS.h"
+
+#include "VulkanBuffer.h"
+#include "VulkanSwapchain.h"
+
+RenderTechniqueRS::RenderTechniqueRS(VulkanDevice* device, const CameraProperties* cameraProperties, PushConstants* pushConstants) : RenderTechnique(device, pushConstants), m_cameraProperties(cameraProperties)
+{
+	// Shader Modules
+	static const uint32_t resolveSPV[] =
+	{
+#include "Resolve.comp.h"
+	};
+	m_shader = new VulkanShaderModule(m_device, resolveSPV, sizeof(resolveSPV));
+
+	// Resolve Descriptor Set Layout
+	std::vector<VkDescriptorSetLayoutBinding> resolveLayoutBindings = {
+		// Binding 0: Result image (write)
+		initializers::DescriptorSetLayoutBinding(0, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+		// Binding 1: Moment image with the sample count (read)
+		initializers::DescriptorSetLayoutBinding(1, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE),
+		// Binding 2: Accumulation buffer (read)
+		initializers::DescriptorSetLayoutBinding(2, VK_SHADER_STAGE_COMPUTE_BIT, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER)
+	};
+	AddDescriptorTypesCount(resolveLayoutBindings);
+	m_descriptorSetLayout = new VulkanDescriptorSetLayout(m_device, resolveLayoutBindings);
+
+	// Resolve pipeline
+	std::vector<VkPushConstantRange> rsPushConstantRanges;
+	std::vector<VkDescriptorSetLayout> rsSetLayouts{ m_descriptorSetLayout->GetLayout() };
+	m_pipelineLayout = new VulkanPipelineLayout(m_device, rsSetLayouts, rsPushConstantRanges);
+	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader, GetPermutation(TileListHeader::TILE_SIZE, TileListHeader::TILE_SIZE));
+}
+
+RenderTechniqueRS::~RenderTechniqueRS()
+{
+	delete m_pipeline;
+	delete m_shader;
+	delete m_descriptorSetLayout;
+	delete m_pipelineLayout;
+
+	FreeAccumulationBuffer();
+	ClearFrameReferences();
+}
+
+void RenderTechniqueRS::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const
+{
+	outSetLayouts.push_back(m_descriptorSetLayout->GetLayout());
+}
+
+void RenderTechniqueRS::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
+{
+	m_image = frameImage;
+	m_imageView = frameImageView;
+	m_swapchain = swapchain;
+
+	// The accumulation buffer follows the result image resolution
+	VkExtent3D extent = m_image->GetExtent();
+	FreeAccumulationBuffer();
+	m_accumulationBuffer = new VulkanBuffer(m_device, nullptr, sizeof(AccumulationTexel), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, static_cast<size_t>(extent.width) * extent.height);
+
+	// Update compute bindings for the result image and accumulation buffer
+	auto imageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto bufferInfo = GetAccumulationInfo();
+	std::vector<VkWriteDescriptorSet> writes
+	{
+		initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfo),
+		initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &bufferInfo)
+	};
+	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void RenderTechniqueRS::ClearFrameReferences()
+{
+	m_imageView = nullptr;
+	m_image = nullptr;
+	m_swapchain = nullptr;
+}
+
+void RenderTechniqueRS::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	// The resolve only reads the accumulated samples
+}
+
+void RenderTechniqueRS::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
+{
+}
+
+void RenderTechniqueRS::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
+{
+	// Every pixel is resolved, the sample count is all it needs
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[0], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &momentImageInfo));
+}
+
+void RenderTechniqueRS::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
+{
+	// Bound in SetFrameReferences with the buffer it is created with
+}
+
+void RenderTechniqueRS::UpdatePermutations(const Parameters& parameters)
+{
+}
+
+uint32_t RenderTechniqueRS::GetRequiredSetCount() const
+{
+	return 1;
+}
+
+void RenderTechniqueRS::RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex)
+{
+	if (m_pushConstants->accumulationMode == EAccumulationMode::CompensatedSum)
+	{
+		// Wait for the estimate to finish its sums
+		VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+		VkExtent3D extent = m_image->GetExtent();
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetPipeline());
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, 1, &m_descriptorSets[0], 0, nullptr);
+		CmdBeginPass(commandBuffer, "Resolve");
+		vkCmdDispatch(commandBuffer, (extent.width + TileListHeader::TILE_SIZE - 1) / TileListHeader::TILE_SIZE, (extent.height + TileListHeader::TILE_SIZE - 1) / TileListHeader::TILE_SIZE, 1);
+		CmdEndPass(commandBuffer);
+	}
+
+	// The result image is copied to the swapchain or read back next
+	VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+	// Headless rendering keeps the result in the result image, presenting copies it to the swapchain image of this frame
+	if (!m_swapchain)
+	{
+		return;
+	}
+
+	CmdBeginPass(commandBuffer, "Blit");
+
+	// Change swapchain image layout to dst blit
+	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	// Change result image layout to scr blit
+	utilities::CmdTransitionImageLayout(commandBuffer, m_image->GetImage(), m_image->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	// Copy result to swapchain image
+	VkImageSubresourceLayers layers{};
+	layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	layers.layerCount = 1;
+	layers.mipLevel = 0;
+
+	VkExtent3D extents = m_image->GetExtent();
+	VkImageBlit blit{};
+	blit.srcOffsets[0] = { 0,0,0 };
+	blit.srcOffsets[1] = { static_cast<int32_t>(extents.width), static_cast<int32_t>(extents.height), static_cast<int32_t>(extents.depth) };
+	blit.srcSubresource = layers;
+	blit.dstOffsets[0] = { 0,0,0 };
+	blit.dstOffsets[1] = { m_cameraProperties->GetWidth(), m_cameraProperties->GetHeight(), 1 };
+	blit.dstSubresource = layers;
+
+	vkCmdBlitImage(commandBuffer, m_image->GetImage(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_swapchain->GetSwapchainImages()[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+	utilities::CmdTransitionImageLayout(commandBuffer, m_swapchain->GetSwapchainImages()[imageIndex], m_swapchain->GetImageFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	utilities::CmdTransitionImageLayout(commandBuffer, m_image->GetImage(), m_image->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+
+	CmdEndPass(commandBuffer);
+}
+
+VkDescriptorBufferInfo RenderTechniqueRS::GetAccumulationInfo()
+{
+	return initializers::DescriptorBufferInfo(m_accumulationBuffer->GetBuffer(), 0, VK_WHOLE_SIZE);
+}
+
+void RenderTechniqueRS::FreeAccumulationBuffer()
+{
+	delete m_accumulationBuffer;
+	m_accumulationBuffer = nullptr;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "RenderTechnique.h"
+
+class VulkanBuffer;
+
+/*
+ * Resolve - divides the compensated sums of the estimates by the per-pixel sample count and presents the result image.
+ * Runs after the estimate, the running mean mode only presents. Headless rendering resolves once before the readback.
+ * Owns the accumulation buffer, shared by all frames in flight like the result image.
+ */
+class RenderTechniqueRS : public RenderTechnique
+{
+public:
+	RenderTechniqueRS(VulkanDevice* device, const CameraProperties* cameraProperties, PushConstants* pushConstants);
+	~RenderTechniqueRS();
+
+	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) override;
+	virtual void ClearFrameReferences() override;
+
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) override;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) override;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) override;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) override;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
+
+	virtual uint32_t GetRequiredSetCount() const override;
+
+	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex) override;
+
+	// Compensated sums of the estimates, pixels in row order
+	VkDescriptorBufferInfo GetAccumulationInfo();
+
+private:
+	void FreeAccumulationBuffer();
+
+private:
+	VulkanShaderModule* m_shader = nullptr;
+	VulkanDescriptorSetLayout* m_descriptorSetLayout = nullptr;
+	VulkanPipelineLayout* m_pipelineLayout = nullptr;
+	VulkanComputePipeline* m_pipeline = nullptr;
+
+	VulkanBuffer* m_accumulationBuffer = nullptr;
+
+	const CameraProperties* m_cameraProperties = nullptr;
+	VulkanSwapchain* m_swapchain = nullptr;
+	VulkanImage* m_image = nullptr;
+	VulkanImageView* m_imageView = nullptr;
+};
@@ -4,9 +4,11 @@
 RenderTechniqueSV::RenderTechniqueSV(VulkanDevice* device, const ShadowVolumeProperties* shadowVolumeProperties, PushConstants* pushConstants) : RenderTechnique(device, pushConstants), m_shadowVolumeProperties(shadowVolumeProperties)
 {
 	// Shader Modules
-	std::vector<char> shadowVolumeSPV;
-	utilities::ReadFile("../shaders/ShadowVolume.comp.spv", shadowVolumeSPV);
-	m_shader = new VulkanShaderModule(m_device, shadowVolumeSPV);
+	static const uint32_t shadowVolumeSPV[] =
+	{
+#include "ShadowVolume.comp.h"
+	};
+	m_shader = new VulkanShaderModule(m_device, shadowVolumeSPV, sizeof(shadowVolumeSPV));
 
 
 	// Shadow Volume Descriptor Set Layout
@@ -25,18 +27,21 @@ RenderTechniqueSV::RenderTechniqueSV(VulkanDevice* device, const ShadowVolumePro
 
 
 	// Shadow volume pipeline;
-	std::vector<VkPushConstantRange> svPushConstantRanges;
+	std::vector<VkPushConstantRange> svPushConstantRanges
+	{
+		initializers::PushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SlicePushConstants))
+	};
 	std::vector<VkDescriptorSetLayout> svSetLayouts{ m_descriptorSetLayout->GetLayout() };
 	m_pipelineLayout = new VulkanPipelineLayout(m_device, svSetLayouts, svPushConstantRanges);
-	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader);
+	m_pipeline = new VulkanComputePipeline(m_device, m_pipelineLayout, m_shader, GetPermutation(m_columnGroupSize, m_columnGroupSize));
 }
 
 RenderTechniqueSV::~RenderTechniqueSV()
 {
+	delete m_pipeline;
 	delete m_shader;
 	delete m_descriptorSetLayout;
 	delete m_pipelineLayout;
-	delete m_pipeline;
 }
 
 void RenderTechniqueSV::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const
@@ -44,54 +49,87 @@ void RenderTechniqueSV::GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout
 	outSetLayouts.push_back(m_descriptorSetLayout->GetLayout());
 }
 
-void RenderTechniqueSV::SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain)
+void RenderTechniqueSV::SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain)
 {
-	m_image = frameImages[0];
-	m_imageView = frameImageViews[0];
+	// The shadow volume does not depend on the frame, its images are set with SetVolumes
+}
 
-	// Update compute bindings for output image
+void RenderTechniqueSV::SetVolumes(std::vector<VulkanImage*>& volumeImages, std::vector<VulkanImageView*>& volumeImageViews)
+{
+	assert(volumeImages.size() == 2 && m_descriptorSets.size() == 2);
+	m_images = volumeImages;
+	m_imageViews = volumeImageViews;
+
+	// Update compute bindings for output image, one set per volume
     std::vector<VkDescriptorImageInfo> imageInfos;
 	std::vector<VkWriteDescriptorSet> writes;
     imageInfos.reserve(m_descriptorSets.size());
 	writes.reserve(m_descriptorSets.size());
 	for (size_t i = 0; i < m_descriptorSets.size(); i++)
 	{
-		imageInfos.push_back(initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL));
+		imageInfos.push_back(initializers::DescriptorImageInfo(VK_NULL_HANDLE, m_imageViews[i]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL));
 		writes.push_back(initializers::WriteDescriptorSet(m_descriptorSets[i], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfos.back()));
 	};
 	vkUpdateDescriptorSets(m_device->GetDevice(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
 }
 
 void RenderTechniqueSV::ClearFrameReferences()
+{
+	// The volumes outlive the swapchain
+}
+
+void RenderTechniqueSV::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo)
+{
+	// Both volumes integrate the same cloud
+	for (VkDescriptorSet descriptorSet : m_descriptorSets)
+	{
+		m_writeQueue.push_back(initializers::WriteDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
+	}
+}
+
+void RenderTechniqueSV::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo)
+{
+	for (VkDescriptorSet descriptorSet : m_descriptorSets)
+	{
+		m_writeQueue.push_back(initializers::WriteDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
+	}
+}
+
+void RenderTechniqueSV::QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo)
+{
+	// Shadow volume integrates the density along whole columns, no free flights to sample
+}
+
+void RenderTechniqueSV::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo)
 {
 }
 
-void RenderTechniqueSV::QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx)
+void RenderTechniqueSV::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3, &cloudBufferInfo));
 }
 
-void RenderTechniqueSV::QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx)
+void RenderTechniqueSV::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &cloudImageInfo));
+	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[volumeIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &shadowVolumeBufferInfo));
 }
 
-void RenderTechniqueSV::QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx)
+void RenderTechniqueSV::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx)
 {
+	// Bound as storage images in SetVolumes
 }
 
-void RenderTechniqueSV::QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx)
+void RenderTechniqueSV::QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo)
 {
+	// The shadow volume is rebuilt as a whole
 }
 
-void RenderTechniqueSV::QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx)
+void RenderTechniqueSV::QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, &shadowVolumeBufferInfo));
 }
 
-void RenderTechniqueSV::QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int imageIdx)
+void RenderTechniqueSV::UpdatePermutations(const Parameters& parameters)
 {
-	m_writeQueue.push_back(initializers::WriteDescriptorSet(m_descriptorSets[imageIdx], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &shadowVolumeImageInfo));
+	// The shadow volume does not scatter
 }
 
 uint32_t RenderTechniqueSV::GetRequiredSetCount() const
@@ -101,13 +139,94 @@ uint32_t RenderTechniqueSV::GetRequiredSetCount() const
 
 void RenderTechniqueSV::RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex)
 {
-	utilities::CmdTransitionImageLayout(commandBuffer, m_image->GetImage(), m_image->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	if (!m_rebuilding || IsRebuildRecorded())
+	{
+		return;
+	}
+
+	// Columns are independent, each slice integrates a band of whole columns
+	uint32_t groupRows = std::min(m_groupRowsPerSlice, m_columnGroupCount - m_nextGroupRow);
+	m_slicePushConstants.columnRowOffset = m_nextGroupRow * m_columnGroupSize;
+	vkCmdPushConstants(commandBuffer, m_pipelineLayout->GetPipelineLayout(), VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SlicePushConstants), &m_slicePushConstants);
 
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline->GetPipeline());
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, static_cast<uint32_t>(m_descriptorSets.size()), m_descriptorSets.data(), 0, nullptr);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout->GetPipelineLayout(), 0, 1, &m_descriptorSets[GetBackIndex()], 0, nullptr);
+
+	CmdBeginPass(commandBuffer, "Shadow volume");
+	vkCmdDispatch(commandBuffer, m_columnGroupCount, groupRows, 1);
+	CmdEndPass(commandBuffer);
+	m_nextGroupRow += groupRows;
+	m_lastSliceFrame = m_frameIndex;
+	m_backReleaseFrame = m_frameIndex;
+
+	if (IsRebuildRecorded())
+	{
+		VkMemoryBarrier memoryBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+	}
+}
+
+void RenderTechniqueSV::BeginRebuild(unsigned int sliceCount)
+{
+	m_columnGroupCount = (m_shadowVolumeProperties->voxelAxisCount + m_columnGroupSize - 1) / m_columnGroupSize;
+	m_groupRowsPerSlice = (m_columnGroupCount + std::max(sliceCount, 1u) - 1) / std::max(sliceCount, 1u);
+	m_nextGroupRow = 0;
+	m_rebuilding = true;
+}
+
+void RenderTechniqueSV::CancelRebuild()
+{
+	m_rebuilding = false;
+}
+
+bool RenderTechniqueSV::IsRebuilding() const
+{
+	return m_rebuilding;
+}
+
+bool RenderTechniqueSV::IsRebuildRecorded() const
+{
+	return m_rebuilding && m_nextGroupRow >= m_columnGroupCount;
+}
+
+float RenderTechniqueSV::GetRebuildProgress() const
+{
+	return m_rebuilding ? static_cast<float>(m_nextGroupRow) / m_columnGroupCount : 1.f;
+}
+
+unsigned int RenderTechniqueSV::GetLastSliceFrame() const
+{
+	return m_lastSliceFrame;
+}
+
+unsigned int RenderTechniqueSV::GetBackReleaseFrame() const
+{
+	return m_backReleaseFrame;
+}
+
+void RenderTechniqueSV::SwapVolumes()
+{
+	assert(IsRebuildRecorded());
+	m_frontIndex = GetBackIndex();
 
-	vkCmdDispatch(commandBuffer, m_shadowVolumeProperties->voxelAxisCount / 32 + 1, m_shadowVolumeProperties->voxelAxisCount / 32 + 1, 1);
+	// The frames recorded until now sample the old front volume
+	m_backReleaseFrame = m_frameIndex;
+	m_rebuilding = false;
+	m_hasVolume = true;
+}
 
-	utilities::CmdTransitionImageLayout(commandBuffer, m_image->GetImage(), m_image->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+bool RenderTechniqueSV::HasVolume() const
+{
+	return m_hasVolume;
+}
+
+unsigned int RenderTechniqueSV::GetFrontIndex() const
+{
+	return m_frontIndex;
+}
+
+unsigned int RenderTechniqueSV::GetBackIndex() const
+{
+	return 1 - m_frontIndex;
 }
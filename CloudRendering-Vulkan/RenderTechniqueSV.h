@@ -2,8 +2,11 @@
 
 #include "RenderTechnique.h"
 
-class VulkanSampler;
-
+/*
+ * Shadow volume - transmittance towards the light, double buffered.
+ * A rebuild writes the back volume over several frames in slices of columns while the estimates keep sampling the front volume.
+ * Has no frame references, the two volumes are set with SetVolumes. Both stay in the general layout since the estimates bind both.
+ */
 class RenderTechniqueSV : public RenderTechnique
 {
 public:
@@ -11,20 +14,49 @@ public:
 	~RenderTechniqueSV();
 
 	virtual void GetDescriptorSetLayout(std::vector<VkDescriptorSetLayout>& outSetLayouts) const override;
-	virtual void SetFrameReferences(std::vector<VulkanImage*>& frameImages, std::vector<VulkanImageView*>& frameImageViews, VulkanSwapchain* swapchain) override;
+	virtual void SetFrameReferences(VulkanImage* frameImage, VulkanImageView* frameImageView, VulkanSwapchain* swapchain) override;
 	virtual void ClearFrameReferences() override;
 
-	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int imageIdx) override;
-	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeBufferInfo, unsigned int imageIdx) override;
+	// Front and back volume, one set each
+	void SetVolumes(std::vector<VulkanImage*>& volumeImages, std::vector<VulkanImageView*>& volumeImageViews);
+
+	virtual void QueueUpdateCloudData(VkDescriptorBufferInfo& cloudBufferInfo) override;
+	virtual void QueueUpdateCloudDataSampler(VkDescriptorImageInfo& cloudImageInfo) override;
+	virtual void QueueUpdateMajorantSampler(VkDescriptorImageInfo& majorantImageInfo) override;
+	virtual void QueueUpdateCameraProperties(VkDescriptorBufferInfo& cameraBufferInfo) override;
+	virtual void QueueUpdateParameters(VkDescriptorBufferInfo& parametersBufferInfo) override;
+	virtual void QueueUpdateShadowVolume(VkDescriptorBufferInfo& shadowVolumeBufferInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateShadowVolumeSampler(VkDescriptorImageInfo& shadowVolumeImageInfo, unsigned int volumeIdx) override;
+	virtual void QueueUpdateAdaptiveSampling(VkDescriptorImageInfo& momentImageInfo, VkDescriptorBufferInfo& tileListInfo) override;
+	virtual void QueueUpdateAccumulation(VkDescriptorBufferInfo& accumulationBufferInfo) override;
+	virtual void UpdatePermutations(const Parameters& parameters) override;
 
 	virtual uint32_t GetRequiredSetCount() const override;
 
+	// Records the next slice of a rebuild in progress
 	virtual void RecordDrawCommands(VkCommandBuffer commandBuffer, unsigned int imageIndex) override;
 
+	// Starts rebuilding the back volume over sliceCount frames, the frames still using it have to be finished
+	void BeginRebuild(unsigned int sliceCount);
+	// Stops recording slices, the back volume is in use until the frame of GetBackReleaseFrame finished
+	void CancelRebuild();
+	bool IsRebuilding() const;
+
+	// The last slice is recorded, the back volume is complete once the frame of GetLastSliceFrame finished
+	bool IsRebuildRecorded() const;
+	float GetRebuildProgress() const;
+	unsigned int GetLastSliceFrame() const;
+
+	// Frame slot of the last frame writing or sampling the back volume
+	unsigned int GetBackReleaseFrame() const;
+
+	// Makes the rebuilt back volume the front volume, the frame with the last slice has to be finished
+	void SwapVolumes();
+	bool HasVolume() const;
+
+	unsigned int GetFrontIndex() const;
+	unsigned int GetBackIndex() const;
+
 private:
 	VulkanShaderModule* m_shader = nullptr;
 	VulkanDescriptorSetLayout* m_descriptorSetLayout = nullptr;
@@ -33,7 +65,23 @@ private:
 
 	const ShadowVolumeProperties* m_shadowVolumeProperties = nullptr;
 
-	VulkanSampler* m_cloudSampler = nullptr;
-	VulkanImage* m_image = nullptr;
-	VulkanImageView* m_imageView = nullptr;
+	struct SlicePushConstants
+	{
+		uint32_t columnRowOffset = 0;
+
+	} m_slicePushConstants;
+
+	const uint32_t m_columnGroupSize = 32; // Columns along each axis of a workgroup
+	uint32_t m_columnGroupCount = 0; // Workgroups along each axis
+	uint32_t m_groupRowsPerSlice = 0;
+	uint32_t m_nextGroupRow = 0;
+	bool m_rebuilding = false;
+	bool m_hasVolume = false;
+	unsigned int m_frontIndex = 1; // The first rebuild writes volume 0
+
+	unsigned int m_lastSliceFrame = 0;
+	unsigned int m_backReleaseFrame = 0;
+
+	std::vector<VulkanImage*> m_images;
+	std::vector<VulkanImageView*> m_imageViews;
 };
\ No newline at end of file
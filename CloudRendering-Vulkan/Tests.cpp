@@ -3,14 +3,63 @@
 
 #include "UniformBuffers.h"
 #include "Grid3D.h"
+#include "GridData.h"
+#include "CPUPathTracer.h"
+#include "PacketTracker.h"
+#include "KDTree.h"
+#include "LBVH.h"
+#include "WideBVH.h"
 
 #include<random>
+#include<cstring>
+#include<numeric>
+#include<glm/gtc/packing.hpp>
 
 void tests::RunTests()
 {
-	localSort();
-
 	bool test = true;
+	test &= radixSortTest();
+	test &= gridLoadTest();
+	test &= brickMajorantTest();
+	test &= mipMajorantTest();
+	test &= cpuPathTracerTest();
+	test &= packetTrackerTest();
+	test &= kdTreeTest();
+	test &= photonGridTest();
+	test &= lbvhTest();
+	test &= lbvhPackTest();
+	test &= wideBVHTest();
+	test &= progressiveRadiusTest();
+	test &= adaptiveSamplingTest();
+	test &= accumulationTest();
+	test &= shadowVolumeTest();
+
+	std::cout << "Tests " << (test ? "passed" : "FAILED") << std::endl;
+}
+
+void tests::RunBenchmarks()
+{
+	gridLoadBenchmark(256);
+	packetTrackingBenchmark(128);
+	for (size_t photonCount : { 1000000, 10000000, 50000000 })
+	{
+		kdTreeBuildBenchmark(photonCount);
+	}
+	for (size_t beamCount : { 1 << 12, 1 << 16, 1 << 20 })
+	{
+		lbvhBuildBenchmark(beamCount);
+	}
+	for (size_t beamCount : { 1 << 16, 1 << 20 })
+	{
+		lbvhLayoutBenchmark(beamCount);
+	}
+	for (size_t beamCount : { 1 << 16, 1 << 20 })
+	{
+		wideBVHBenchmark(beamCount);
+	}
+	accumulationErrorBenchmark(1 << 24);
+	shadowVolumeBenchmark(256);
+	mipMajorantBenchmark(256);
 }
 
 void tests::createOrthonormalBasis(const glm::vec3& dir, glm::vec3& t0, glm::vec3& t1)
@@ -75,21 +124,182 @@ bool tests::intersectCloud(CloudProperties& cloudProperties, glm::vec3& rayDir,
 	return true;
 }
 
-bool tests::shadowVolumeTest(glm::uvec2 columnCoord, ShadowVolumeProperties& shadowVolumeProperties, const CloudProperties& cloudProperties)
+bool tests::shadowVolumeTest()
 {
-	glm::vec4 accumulatedValue = glm::vec4(0.0f);
-	glm::vec3 position = glm::vec3(0.0f);
+	bool test = true;
+	ShadowVolumeProperties shadowVolumeProperties;
+	shadowVolumeProperties.voxelAxisCount = 48;
+	shadowVolumeProperties.SetLightDirection(glm::vec3(1, -2, 0.5f));
 
-	for (unsigned int z = 0; z < shadowVolumeProperties.voxelAxisCount; z++)
+	// Homogeneous cube, every voxel has the closed form transmittance of its distance to the lit faces
 	{
-		position = tests::calculateVoxelPosition(glm::uvec3(columnCoord, z), shadowVolumeProperties);
-		if (tests::isInCloud(position, cloudProperties))
+		Grid3D<float> grid(8, 8, 8);
+		std::fill_n(static_cast<float*>(grid.GetData()), grid.GetSize(), 1.f);
+
+		CloudProperties cloudProperties;
+		cloudProperties.bounds[0] = glm::vec4(0, 0, 0, 0);
+		cloudProperties.bounds[1] = glm::vec4(1, 1, 1, 0);
+		cloudProperties.voxelCount = glm::uvec4(8);
+		cloudProperties.maxExtinction = 1.f;
+		cloudProperties.baseScaling = 1.f;
+		cloudProperties.densityScaling = 3.f;
+		shadowVolumeProperties.SetOrigin(cloudProperties.bounds[0], cloudProperties.bounds[1]);
+
+		CPUPathTracer pathTracer(&grid);
+		pathTracer.UpdateShadowVolume(cloudProperties, shadowVolumeProperties);
+
+		float maxError = 0.f;
+		glm::vec3 lightDirection = glm::vec3(shadowVolumeProperties.GetLightDirection());
+		for (unsigned int z = 0; z < shadowVolumeProperties.voxelAxisCount; z++)
 		{
-			//accumulatedValue += sampleExtinction(position);
+			for (unsigned int y = 0; y < shadowVolumeProperties.voxelAxisCount; y++)
+			{
+				for (unsigned int x = 0; x < shadowVolumeProperties.voxelAxisCount; x++)
+				{
+					glm::vec3 position = tests::calculateVoxelPosition(glm::uvec3(x, y, z), shadowVolumeProperties);
+					CPUPathTracer::Ray toLight{ position, -lightDirection };
+					float tmax = 0, tmin = 0, distance = 0;
+					if (pathTracer.IntersectCloud(toLight, tmax, tmin) && tmax > 0)
+					{
+						distance = tmax - std::max(tmin, 0.f);
+					}
+					maxError = std::max(maxError, std::abs(pathTracer.GetShadowVolumeVoxel(x, y, z) - std::exp(-3.f * distance)));
+				}
+			}
 		}
+		test &= maxError < 1e-4f;
+		std::cout << "shadowVolumeTest: Homogeneous max error " << maxError;
 	}
 
-	return true;
+	// Gaussian puff against ratio tracking, and the former average density approximation for comparison
+	{
+		const unsigned int axisCount = 32;
+		Grid3D<float> grid(axisCount, axisCount, axisCount);
+		for (unsigned int z = 0; z < axisCount; z++)
+		{
+			for (unsigned int y = 0; y < axisCount; y++)
+			{
+				for (unsigned int x = 0; x < axisCount; x++)
+				{
+					glm::vec3 offset = (glm::vec3(x, y, z) + 0.5f) / float(axisCount) - 0.5f;
+					grid(x, y, z) = std::exp(-glm::dot(offset, offset) / (2 * 0.15f * 0.15f));
+				}
+			}
+		}
+
+		CloudProperties cloudProperties;
+		cloudProperties.bounds[0] = glm::vec4(0, 0, 0, 0);
+		cloudProperties.bounds[1] = glm::vec4(1, 1, 1, 0);
+		cloudProperties.voxelCount = glm::uvec4(axisCount);
+		cloudProperties.maxExtinction = grid.GetMajorant();
+		cloudProperties.baseScaling = 1.f;
+		cloudProperties.densityScaling = 8.f;
+		shadowVolumeProperties.SetOrigin(cloudProperties.bounds[0], cloudProperties.bounds[1]);
+
+		CPUPathTracer pathTracer(&grid);
+		pathTracer.UpdateShadowVolume(cloudProperties, shadowVolumeProperties);
+
+		std::mt19937 gen(5);
+		std::uniform_int_distribution<unsigned int> voxel(0, shadowVolumeProperties.voxelAxisCount - 1);
+		float maxError = 0.f, meanError = 0.f, maxOldError = 0.f;
+		const int voxelCount = 128;
+		for (int i = 0; i < voxelCount; i++)
+		{
+			glm::uvec3 voxelIdx(voxel(gen), voxel(gen), voxel(gen));
+			float reference = estimateVoxelTransmittance(pathTracer, voxelIdx, shadowVolumeProperties, 1 << 14);
+			float error = std::abs(pathTracer.GetShadowVolumeVoxel(voxelIdx.x, voxelIdx.y, voxelIdx.z) - reference);
+			maxError = std::max(maxError, error);
+			meanError += error / voxelCount;
+
+			float accumulatedValue = 0.f;
+			for (unsigned int z = 0; z <= voxelIdx.z; z++)
+			{
+				glm::vec3 position = tests::calculateVoxelPosition(glm::uvec3(voxelIdx.x, voxelIdx.y, z), shadowVolumeProperties);
+				if (tests::isInCloud(position, cloudProperties))
+				{
+					accumulatedValue += pathTracer.SampleCloud(position) * cloudProperties.densityScaling / cloudProperties.baseScaling;
+				}
+			}
+			float accumulatedDistance = (voxelIdx.z + 1) * shadowVolumeProperties.voxelSize;
+			maxOldError = std::max(maxOldError, std::abs(std::exp(-accumulatedDistance * accumulatedValue / (voxelIdx.z + 1)) - reference));
+		}
+
+		// Reference noise is about 0.005 at 2^14 samples
+		test &= maxError < 0.03f && meanError < 0.01f;
+		std::cout << ", heterogeneous mean error " << meanError << ", max error " << maxError << " (average density approximation " << maxOldError << ")";
+	}
+
+	std::cout << " " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::shadowVolumeBenchmark(unsigned int axisCount)
+{
+	// Smooth noise cloud with empty margins, so clipping the columns to the cloud matters like for real clouds
+	const unsigned int cloudAxisCount = 64;
+	Grid3D<float> grid(cloudAxisCount, cloudAxisCount, cloudAxisCount);
+	for (unsigned int z = 0; z < cloudAxisCount; z++)
+	{
+		for (unsigned int y = 0; y < cloudAxisCount; y++)
+		{
+			for (unsigned int x = 0; x < cloudAxisCount; x++)
+			{
+				glm::vec3 p = glm::vec3(x, y, z) / float(cloudAxisCount);
+				float noise = 0.5f + 0.25f * std::sin(17.f * p.x) * std::sin(11.f * p.y + 3.f * p.z) + 0.25f * std::sin(23.f * p.z + 5.f * p.x);
+				float radius = glm::length(p - 0.5f);
+				grid(x, y, z) = radius < 0.45f ? noise : 0.f;
+			}
+		}
+	}
+
+	CloudProperties cloudProperties;
+	cloudProperties.bounds[0] = glm::vec4(0, 0, 0, 0);
+	cloudProperties.bounds[1] = glm::vec4(1, 2, 1, 0);
+	cloudProperties.voxelCount = glm::uvec4(cloudAxisCount);
+	cloudProperties.maxExtinction = grid.GetMajorant();
+	cloudProperties.baseScaling = 1.f;
+	cloudProperties.densityScaling = 4.f;
+
+	ShadowVolumeProperties shadowVolumeProperties;
+	shadowVolumeProperties.SetLightDirection(glm::vec3(1, -2, 0.5f));
+
+	std::cout << "shadowVolumeBenchmark:";
+	for (unsigned int resolution = 32; resolution <= axisCount; resolution *= 2)
+	{
+		shadowVolumeProperties.voxelAxisCount = resolution;
+		shadowVolumeProperties.SetOrigin(cloudProperties.bounds[0], cloudProperties.bounds[1]);
+		CPUPathTracer pathTracer(&grid);
+
+		auto start = std::chrono::steady_clock::now();
+		pathTracer.UpdateShadowVolume(cloudProperties, shadowVolumeProperties);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::mt19937 gen(resolution);
+		std::uniform_int_distribution<unsigned int> voxel(0, resolution - 1);
+		float meanError = 0.f;
+		const int voxelCount = 64;
+		for (int i = 0; i < voxelCount; i++)
+		{
+			glm::uvec3 voxelIdx(voxel(gen), voxel(gen), voxel(gen));
+			float reference = estimateVoxelTransmittance(pathTracer, voxelIdx, shadowVolumeProperties, 1 << 12);
+			meanError += std::abs(pathTracer.GetShadowVolumeVoxel(voxelIdx.x, voxelIdx.y, voxelIdx.z) - reference) / voxelCount;
+		}
+
+		std::cout << (resolution > 32 ? "," : "") << " " << resolution << "^3 " << seconds * 1000.0 << " ms (" << double(resolution) * resolution * resolution / seconds / 1e6 << " Mvoxels/s, mean error " << meanError << ")";
+	}
+	std::cout << std::endl;
+}
+
+float tests::estimateVoxelTransmittance(const CPUPathTracer& pathTracer, glm::uvec3 voxelIdx, ShadowVolumeProperties& shadowVolumeProperties, unsigned int sampleCount)
+{
+	CPUPathTracer::Ray toLight{ tests::calculateVoxelPosition(voxelIdx, shadowVolumeProperties), -glm::vec3(shadowVolumeProperties.GetLightDirection()) };
+	double transmittance = 0.0;
+	for (unsigned int i = 0; i < sampleCount; i++)
+	{
+		CPUPathTracer::Random random((i + 1) * 2654435761u);
+		transmittance += pathTracer.EstimateTransmittance(toLight, random);
+	}
+	return static_cast<float>(transmittance / sampleCount);
 }
 
 bool tests::isInCloud(glm::vec3 point, const CloudProperties& cloudProperties)
@@ -110,114 +320,1700 @@ glm::vec3 tests::calculateVoxelPosition(glm::uvec3 voxelIdx, ShadowVolumePropert
 		voxelIdx.z * shadowVolumeProperties.voxelSize * shadowVolumeProperties.lightDirection);
 }
 
-void tests::localSort()
+bool tests::radixSortTest()
 {
-	std::mt19937 gen(1); //Standard mersenne_twister_engine seeded with rd()
-	std::uniform_int_distribution dist(0, 255);
-	std::vector<unsigned int> codes;
-	for (unsigned int i = 0; i < 176; i++)
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<uint32_t> fullKeys(0, (1u << 30) - 1);
+	std::uniform_int_distribution<uint32_t> fewKeys(0, 63);
+
+	// Single beam, a partial work group, several work groups and many equal keys for stability
+	struct Case { size_t beamCount; std::uniform_int_distribution<uint32_t>* keys; };
+	bool test = true;
+	for (const Case& sortCase : { Case{ 1, &fullKeys }, Case{ 176, &fullKeys }, Case{ 10000, &fullKeys }, Case{ 5000, &fewKeys } })
 	{
-		codes.push_back(dist(gen));
+		std::vector<PhotonBeam> beams(sortCase.beamCount);
+		for (size_t i = 0; i < beams.size(); i++)
+		{
+			beams[i] = PhotonBeam();
+			beams[i].startPos = glm::vec3(static_cast<float>(i));
+			beams[i].mortonCode = (*sortCase.keys)(gen);
+			beams[i].dataIdx = static_cast<uint32_t>(i);
+		}
+
+		std::vector<PhotonBeam> expected(beams);
+		std::stable_sort(expected.begin(), expected.end(), [](const PhotonBeam& a, const PhotonBeam& b) { return a.mortonCode < b.mortonCode; });
+
+		radixSort(beams, 30);
+		test &= std::memcmp(beams.data(), expected.data(), beams.size() * sizeof(PhotonBeam)) == 0;
 	}
 
-	std::vector<unsigned int> temp(codes);
-	std::vector<unsigned int> scatterOffsets(codes.size());	
-	for (unsigned int i = 0; i < 8; i++)
+	std::cout << "radixSortTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::radixSort(std::vector<PhotonBeam>& beams, unsigned int keyBits)
+{
+	// Mirrors PPB_RadixSort_LocalSort, _PrefixSum and _GlobalSort - 4 bits per pass, 1024 beams per work group
+	const unsigned int bitsPerPass = 4;
+	const unsigned int bucketCount = 1 << bitsPerPass;
+	const size_t elementsPerWorkGroup = 1024;
+	const size_t beamCount = beams.size();
+	const size_t workGroupCount = (beamCount + elementsPerWorkGroup - 1) / elementsPerWorkGroup;
+
+	// Both ping-pong halves of the beam buffer
+	std::vector<PhotonBeam> buffer(2 * beamCount);
+	std::copy(beams.begin(), beams.end(), buffer.begin());
+	std::vector<unsigned int> histogram(bucketCount * workGroupCount);
+	std::vector<unsigned int> scannedHistogram(bucketCount * workGroupCount);
+
+	for (unsigned int baseShift = 0; baseShift < keyBits; baseShift += bitsPerPass)
 	{
-		radixSort(codes, scatterOffsets, i);
+		// Local sort - each work group sorts its block into the second half and counts its buckets
+		for (size_t group = 0; group < workGroupCount; group++)
+		{
+			const size_t groupOffset = group * elementsPerWorkGroup;
+			const size_t itemCount = std::min(elementsPerWorkGroup, beamCount - groupOffset);
+
+			std::vector<SortElement> items(itemCount);
+			for (size_t i = 0; i < itemCount; i++)
+			{
+				items[i].idx = static_cast<uint32_t>(groupOffset + i);
+				items[i].mortonCode = buffer[groupOffset + i].mortonCode;
+			}
+			for (unsigned int bit = 0; bit < bitsPerPass; bit++)
+			{
+				splitByBit(items, baseShift + bit);
+			}
+
+			std::vector<unsigned int> localHistogram(bucketCount, 0);
+			for (size_t i = 0; i < itemCount; i++)
+			{
+				buffer[beamCount + groupOffset + i] = buffer[items[i].idx];
+				localHistogram[(items[i].mortonCode >> baseShift) & (bucketCount - 1)]++;
+			}
+
+			// Column major, all work groups of a bucket are contiguous
+			for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+			{
+				histogram[bucket * workGroupCount + group] = localHistogram[bucket];
+			}
+		}
+
+		// Prefix sum
+		unsigned int sum = 0;
+		for (size_t i = 0; i < histogram.size(); i++)
+		{
+			scannedHistogram[i] = sum;
+			sum += histogram[i];
+		}
+
+		// Global sort - scatter the locally sorted blocks back into the first half
+		for (size_t group = 0; group < workGroupCount; group++)
+		{
+			const size_t groupOffset = group * elementsPerWorkGroup;
+			const size_t itemCount = std::min(elementsPerWorkGroup, beamCount - groupOffset);
+
+			std::vector<unsigned int> localBucketStarts(bucketCount);
+			unsigned int localSum = 0;
+			for (unsigned int bucket = 0; bucket < bucketCount; bucket++)
+			{
+				localBucketStarts[bucket] = localSum;
+				localSum += histogram[bucket * workGroupCount + group];
+			}
+
+			for (size_t i = 0; i < itemCount; i++)
+			{
+				const PhotonBeam& beam = buffer[beamCount + groupOffset + i];
+				unsigned int bucket = (beam.mortonCode >> baseShift) & (bucketCount - 1);
+				buffer[scannedHistogram[bucket * workGroupCount + group] + i - localBucketStarts[bucket]] = beam;
+			}
+		}
 	}
 
-	bool test = true;
+	buffer.resize(beamCount);
+	beams.swap(buffer);
 }
 
-void tests::radixSort(std::vector<unsigned int>& keys, std::vector<unsigned int>& scatterOffsets, unsigned int nthShift)
+void tests::splitByBit(std::vector<SortElement>& items, unsigned int nthShift)
 {
-	const size_t elementCount = unsigned int(std::pow(2.0, std::ceil(std::log2(keys.size()))));
-	std::vector<unsigned int> temp(keys);
-	std::vector<unsigned int> falses(elementCount);
+	// Blelloch scan over the 0s of a whole work group, padding counts as 1s
+	const size_t elementCount = 1024;
+	assert(items.size() <= elementCount);
+
+	std::vector<unsigned int> falses(elementCount, 0);
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		falses[i] = ((items[i].mortonCode >> nthShift) & 1) ^ 1;
+	}
+	std::vector<unsigned int> isFalse(falses.begin(), falses.begin() + items.size());
+
+	// Build sum in place up the tree
+	size_t offset = 1;
+	for (size_t d = elementCount >> 1; d > 0; d >>= 1)
+	{
+		for (size_t i = 0; i < d; i++)
+		{
+			size_t ai = offset * (2 * i + 1) - 1;
+			size_t bi = offset * (2 * i + 2) - 1;
+			falses[bi] += falses[ai];
+		}
+		offset *= 2;
+	}
+
+	// Clear the last element
+	unsigned int totalFalses = falses[elementCount - 1];
+	falses[elementCount - 1] = 0;
 
-	unsigned int startIdx, endIdx;
-	std::vector<unsigned int> offset;
-	offset.resize(1024, 1);
+	// Traverse down tree & build scan
+	for (size_t d = 1; d < elementCount; d *= 2)
+	{
+		offset >>= 1;
+		for (size_t i = 0; i < d; i++)
+		{
+			size_t ai = offset * (2 * i + 1) - 1;
+			size_t bi = offset * (2 * i + 2) - 1;
+			unsigned int t = falses[ai];
+			falses[ai] = falses[bi];
+			falses[bi] += t;
+		}
+	}
 
-	for (unsigned int thread = 0; thread < 256; thread++)
+	// Calculate scatter indexes
+	std::vector<SortElement> sorted(items.size());
+	for (size_t i = 0; i < items.size(); i++)
 	{
-		startIdx = thread * 4;
-		endIdx = std::min(startIdx + 4, static_cast<unsigned int>(keys.size()));
+		size_t scatterIdx = isFalse[i] ? falses[i] : (i - falses[i] + totalFalses);
+		sorted[scatterIdx] = items[i];
+	}
+	items.swap(sorted);
+}
+
+bool tests::gridLoadTest()
+{
+	// Same random grid saved in both orderings must load into identical grids
+	const glm::uvec3 size(37, 19, 53);
+	std::mt19937 gen(2);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
 
-		// Mark 1 and 0
-		for (unsigned int i = startIdx; i < endIdx; i++)
+	GridData gridData{ size.x, size.y, size.z, .01, .02, .03 };
+	gridData.data.resize(static_cast<size_t>(size.x) * size.y * size.z);
+	Grid3D<float> expected(size.x, size.y, size.z, .01, .02, .03);
+	for (unsigned int x = 0; x < size.x; x++)
+	{
+		for (unsigned int y = 0; y < size.y; y++)
 		{
-			falses[i] = ((temp[i] >> nthShift) & 1) ^ 1;
-			scatterOffsets[i] = falses[i]; // reusing final buffer to save memory
+			for (unsigned int z = 0; z < size.z; z++)
+			{
+				float value = dist(gen);
+				gridData.data[gridData.coordToOffset(x, y, z)] = value;
+				expected(x, y, z) = value;
+			}
 		}
 	}
 
-	// Scan the 1s - Build sum in place up the tree
-	unsigned int currentIdx;
-	for (unsigned int d = static_cast<unsigned int>(elementCount) >> 1; d > 0; d >>= 1)
+	gridData.save("gridLoadTest_zyx.xyz");
+	expected.Save("gridLoadTest_xyz.xyz");
+	Grid3D<float>* zFastest = Grid3D<float>::Load("gridLoadTest_zyx.xyz");
+	Grid3D<float>* xFastest = Grid3D<float>::Load("gridLoadTest_xyz.xyz");
+
+	bool test = zFastest && xFastest &&
+		zFastest->GetVoxelCount() == size && xFastest->GetVoxelCount() == size &&
+		zFastest->GetVoxelSize() == expected.GetVoxelSize() &&
+		memcmp(zFastest->GetData(), expected.GetData(), expected.GetByteSize()) == 0 &&
+		memcmp(xFastest->GetData(), expected.GetData(), expected.GetByteSize()) == 0;
+
+	// Streaming uploads decode the file slab by slab, uneven slab depth covers the partial last slab
+	for (const char* filename : { "gridLoadTest_zyx.xyz", "gridLoadTest_xyz.xyz" })
 	{
-		for (unsigned int thread = 0; thread < 256; thread++)
+		MappedFile file(filename);
+		GridFileHeader header;
+		test &= file.IsOpen() && ReadGridFileHeader(file.GetData(), file.GetSize(), header);
+		if (!test)
+		{
+			break;
+		}
+
+		const uint32_t slabDepth = 10;
+		const size_t sliceVoxelCount = static_cast<size_t>(size.x) * size.y;
+		std::vector<float> slab(sliceVoxelCount * slabDepth);
+		float majorant = 0.f;
+		for (uint32_t z = 0; z < size.z; z += slabDepth)
 		{
-			startIdx = thread * 4;
-			endIdx = std::min(startIdx + 4, static_cast<unsigned int>(keys.size()));
+			uint32_t zEnd = std::min(z + slabDepth, size.z);
+			majorant = std::max(majorant, Grid3D<float>::ReadSlab(file, header, z, zEnd, slab.data()));
+			test &= memcmp(slab.data(), static_cast<float*>(expected.GetData()) + z * sliceVoxelCount, (zEnd - z) * sliceVoxelCount * sizeof(float)) == 0;
+		}
+		test &= majorant == expected.GetMajorant();
+	}
+
+	delete zFastest;
+	delete xFastest;
+	std::remove("gridLoadTest_zyx.xyz");
+	std::remove("gridLoadTest_xyz.xyz");
+
+	std::cout << "gridLoadTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::gridLoadBenchmark(unsigned int axisCount)
+{
+	GridData gridData{ axisCount, axisCount, axisCount, .01, .01, .01 };
+	gridData.data.resize(static_cast<size_t>(axisCount) * axisCount * axisCount);
+	std::mt19937 gen(3);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	for (float& value : gridData.data)
+	{
+		value = dist(gen);
+	}
+	gridData.save("gridLoadBenchmark_zyx.xyz");
+	double gigabytes = gridData.data.size() * sizeof(float) / 1e9;
+
+	auto measure = [gigabytes](const char* name, const std::function<void()>& function)
+	{
+		auto start = std::chrono::steady_clock::now();
+		function();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "  " << name << ": " << seconds * 1000.0 << " ms (" << gigabytes / seconds << " GB/s)" << std::endl;
+	};
+
+	std::cout << "gridLoadBenchmark " << axisCount << "^3 (" << gigabytes * 1000.0 << " MB)" << std::endl;
 
-			currentIdx = thread * 4;
-			for (unsigned int i = startIdx; i < endIdx; i++)
+	// Previous loader: one stream read per voxel
+	measure("ifstream per voxel", []()
+		{
+			std::ifstream in("gridLoadBenchmark_zyx.xyz", std::ifstream::in | std::ifstream::binary);
+			unsigned int header[2], size[3];
+			double voxelSize[3];
+			in.read(reinterpret_cast<char*>(header), sizeof(header));
+			in.read(reinterpret_cast<char*>(size), sizeof(size));
+			in.read(reinterpret_cast<char*>(voxelSize), sizeof(voxelSize));
+			Grid3D<float> grid(size[0], size[1], size[2]);
+			for (unsigned int x = 0; x < size[0]; x++)
 			{
-				if (i < d)
+				for (unsigned int y = 0; y < size[1]; y++)
 				{
-					unsigned int ai = offset[currentIdx] * (2 * i + 1) - 1;
-					unsigned int bi = offset[currentIdx] * (2 * i + 2) - 1;
-
-					falses[bi] += falses[ai];
+					for (unsigned int z = 0; z < size[2]; z++)
+					{
+						float value;
+						in.read(reinterpret_cast<char*>(&value), sizeof(float));
+						grid(x, y, z) = value;
+					}
 				}
-				offset[currentIdx] *= 2;
-				currentIdx++;
+			}
+		});
+
+	Grid3D<float>* grid = nullptr;
+	measure("mmap + blocked transpose (z fastest)", [&grid]()
+		{
+			grid = Grid3D<float>::Load("gridLoadBenchmark_zyx.xyz");
+		});
+
+	grid->Save("gridLoadBenchmark_xyz.xyz");
+	delete grid;
+	measure("mmap + copy (x fastest)", [&grid]()
+		{
+			grid = Grid3D<float>::Load("gridLoadBenchmark_xyz.xyz");
+		});
+	delete grid;
+
+	std::remove("gridLoadBenchmark_zyx.xyz");
+	std::remove("gridLoadBenchmark_xyz.xyz");
+}
+
+bool tests::brickMajorantTest()
+{
+	// Sparse grid: a dense blob in an otherwise empty volume
+	const glm::uvec3 size(45, 23, 61);
+	const unsigned int brickSize = 8;
+	std::mt19937 gen(4);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+	Grid3D<float> grid(size.x, size.y, size.z);
+	for (unsigned int z = 0; z < size.z; z++)
+	{
+		for (unsigned int y = 0; y < size.y; y++)
+		{
+			for (unsigned int x = 0; x < size.x; x++)
+			{
+				float radius = glm::length(glm::vec3(x, y, z) - glm::vec3(size) * 0.4f);
+				grid(x, y, z) = radius < 10.f ? dist(gen) : 0.f;
 			}
 		}
 	}
 
-	// Clear the last element 
-	unsigned int totalFalses = falses[elementCount - 1];
-	falses[elementCount - 1] = 0;
+	// Whole grid and streamed slabs must agree
+	Grid3D<float>* bricks = grid.CreateBrickMajorants(brickSize);
+	Grid3D<float>* streamedBricks = Grid3D<float>::CreateBrickGrid(size, grid.GetVoxelSize(), brickSize);
+	const uint32_t slabDepth = 5;
+	for (uint32_t z = 0; z < size.z; z += slabDepth)
+	{
+		const float* slab = static_cast<float*>(grid.GetData()) + static_cast<size_t>(size.x) * size.y * z;
+		Grid3D<float>::AccumulateBrickMajorants(slab, size, z, std::min(z + slabDepth, size.z), brickSize, *streamedBricks);
+	}
+	bool test = bricks->GetVoxelCount() == (size + brickSize - 1u) / brickSize &&
+		memcmp(bricks->GetData(), streamedBricks->GetData(), bricks->GetByteSize()) == 0;
 
-	// Traverse down tree & build scan
-	for (unsigned int d = 1; d < elementCount; d *= 2)
+	// Trilinear lookups, as done by the sampler, must never exceed the majorant of their brick
+	std::uniform_real_distribution<float> position(0.f, 1.f);
+	for (int i = 0; i < 100000 && test; i++)
+	{
+		glm::vec3 voxelPos = glm::vec3(position(gen), position(gen), position(gen)) * glm::vec3(size);
+		glm::vec3 texel = voxelPos - 0.5f;
+		glm::ivec3 base = glm::ivec3(glm::floor(texel));
+		glm::vec3 weight = texel - glm::vec3(base);
+
+		float value = 0.f;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::ivec3 offset(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+			glm::ivec3 voxel = glm::clamp(base + offset, glm::ivec3(0), glm::ivec3(size) - 1);
+			glm::vec3 w = glm::mix(1.f - weight, weight, glm::vec3(offset));
+			value += w.x * w.y * w.z * grid(voxel.x, voxel.y, voxel.z);
+		}
+
+		glm::uvec3 brick = glm::min(glm::uvec3(voxelPos) / brickSize, bricks->GetVoxelCount() - 1u);
+		test &= value <= (*bricks)(brick.x, brick.y, brick.z) + 1e-5f;
+	}
+
+	delete bricks;
+	delete streamedBricks;
+
+	std::cout << "brickMajorantTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+bool tests::mipMajorantTest()
+{
+	// Isolated voxels spread the furthest through the mips, odd extents make the blits uneven
+	const glm::uvec3 size(45, 23, 61);
+	const unsigned int brickSize = 8;
+	std::mt19937 gen(5);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+	Grid3D<float> grid(size.x, size.y, size.z);
+	for (size_t i = 0; i < grid.GetSize(); i++)
 	{
+		static_cast<float*>(grid.GetData())[i] = dist(gen) < 0.002f ? dist(gen) : 0.f;
+	}
 
-		for (unsigned int thread = 0; thread < 256; thread++)
+	// Mip chain as built by utilities::CmdGenerateMipmaps, every texel is a linear lookup at its center in the previous level
+	const uint32_t levelCount = utilities::GetMipLevelCount({ size.x, size.y, size.z });
+	std::vector<Grid3D<float>*> mips = { &grid };
+	for (uint32_t level = 1; level < levelCount; level++)
+	{
+		Grid3D<float>& source = *mips.back();
+		glm::uvec3 extent = glm::max(source.GetVoxelCount() / 2u, glm::uvec3(1));
+		Grid3D<float>* mip = new Grid3D<float>(extent.x, extent.y, extent.z);
+		for (unsigned int z = 0; z < extent.z; z++)
 		{
-			startIdx = thread * 4;
-			endIdx = std::min(startIdx + 4, static_cast<unsigned int>(keys.size()));
+			for (unsigned int y = 0; y < extent.y; y++)
+			{
+				for (unsigned int x = 0; x < extent.x; x++)
+				{
+					(*mip)(x, y, z) = source.SampleLinear((glm::vec3(x, y, z) + 0.5f) / glm::vec3(extent));
+				}
+			}
+		}
+		mips.push_back(mip);
+	}
 
-			currentIdx = thread * 4;
-			for (unsigned int i = startIdx; i < endIdx; i++)
+	Grid3D<float>* bricks = grid.CreateBrickMajorants(brickSize);
+	Grid3D<float>* levels = Grid3D<float>::CreateLevelMajorants(*bricks, size, brickSize, levelCount);
+	const glm::uvec3 brickCount = bricks->GetVoxelCount();
+	bool test = levels->GetVoxelCount() == glm::uvec3(brickCount.x, brickCount.y, brickCount.z * levelCount) &&
+		memcmp(levels->GetData(), bricks->GetData(), bricks->GetByteSize()) == 0;
+
+	// A lookup blends every texel whose center is less than a texel away, each of them has to be bounded by the bricks it can be read from
+	for (uint32_t level = 0; level < levelCount && test; level++)
+	{
+		Grid3D<float>& mip = *mips[level];
+		const glm::uvec3 extent = mip.GetVoxelCount();
+		const glm::vec3 span = glm::vec3(size) / glm::vec3(extent);
+		for (unsigned int z = 0; z < extent.z; z++)
+		{
+			for (unsigned int y = 0; y < extent.y; y++)
 			{
-				offset[currentIdx] >>= 1;
-				if (i < d)
+				for (unsigned int x = 0; x < extent.x; x++)
 				{
-					unsigned int ai = offset[currentIdx] * (2 * i + 1) - 1;
-					unsigned int bi = offset[currentIdx] * (2 * i + 2) - 1;
-					unsigned int t = falses[ai];
-					falses[ai] = falses[bi];
-					falses[bi] += t;
+					float value = mip(x, y, z);
+					glm::vec3 center = (glm::vec3(x, y, z) + 0.5f) * span;
+					glm::uvec3 brickBegin = glm::uvec3(glm::max(center - span, glm::vec3(0))) / brickSize;
+					glm::uvec3 brickEnd = glm::min(glm::uvec3(center + span) / brickSize, brickCount - 1u);
+					for (unsigned int bz = brickBegin.z; bz <= brickEnd.z; bz++)
+					{
+						for (unsigned int by = brickBegin.y; by <= brickEnd.y; by++)
+						{
+							for (unsigned int bx = brickBegin.x; bx <= brickEnd.x; bx++)
+							{
+								test &= value <= (*levels)(bx, by, bz + level * brickCount.z) + 1e-5f;
+							}
+						}
+					}
 				}
-				currentIdx++;
 			}
 		}
 	}
 
-	// Calculate scatter indexes
-	for (unsigned int thread = 0; thread < 256; thread++)
+	// Lookups between two levels are bounded by the coarser one
+	for (size_t i = bricks->GetSize(); i < levels->GetSize(); i++)
+	{
+		test &= static_cast<float*>(levels->GetData())[i] >= static_cast<float*>(levels->GetData())[i - bricks->GetSize()];
+	}
+
+	for (size_t level = 1; level < mips.size(); level++)
+	{
+		delete mips[level];
+	}
+	delete bricks;
+	delete levels;
+
+	std::cout << "mipMajorantTest: " << (test ? "OK" : "FAILED") << " (" << levelCount << " levels)" << std::endl;
+	return test;
+}
+
+void tests::mipMajorantBenchmark(unsigned int axisCount)
+{
+	// Smooth noise cloud with empty margins, the dilation of the coarse levels spreads the majorants into them
+	Grid3D<float> grid(axisCount, axisCount, axisCount);
+	for (unsigned int z = 0; z < axisCount; z++)
+	{
+		for (unsigned int y = 0; y < axisCount; y++)
+		{
+			for (unsigned int x = 0; x < axisCount; x++)
+			{
+				glm::vec3 p = glm::vec3(x, y, z) / float(axisCount);
+				float noise = 0.5f + 0.25f * std::sin(17.f * p.x) * std::sin(11.f * p.y + 3.f * p.z) + 0.25f * std::sin(23.f * p.z + 5.f * p.x);
+				float radius = glm::length(p - 0.5f);
+				grid(x, y, z) = radius < 0.45f ? noise : 0.f;
+			}
+		}
+	}
+
+	const unsigned int brickSize = 8;
+	const uint32_t levelCount = utilities::GetMipLevelCount({ axisCount, axisCount, axisCount });
+
+	auto start = std::chrono::steady_clock::now();
+	Grid3D<float>* bricks = grid.CreateBrickMajorants(brickSize);
+	double brickSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	Grid3D<float>* levels = Grid3D<float>::CreateLevelMajorants(*bricks, grid.GetVoxelCount(), brickSize, levelCount);
+	double levelSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "mipMajorantBenchmark " << axisCount << "^3: bricks " << brickSeconds * 1000.0 << " ms, " << levelCount << " levels " << levelSeconds * 1000.0 << " ms ("
+		<< levels->GetByteSize() / 1024 << " KB)" << std::endl;
+
+	// Delta tracking takes steps proportional to the majorant, so its mean tells how much a coarse lookup costs over level 0
+	const size_t levelSize = bricks->GetSize();
+	const float* data = static_cast<const float*>(levels->GetData());
+	double baseMean = 0.0;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		double mean = std::accumulate(data + level * levelSize, data + (level + 1) * levelSize, 0.0) / levelSize;
+		baseMean = level == 0 ? mean : baseMean;
+		std::cout << "  level " << level << ": mean majorant x" << mean / baseMean << std::endl;
+	}
+
+	delete bricks;
+	delete levels;
+}
+
+bool tests::cpuPathTracerTest()
+{
+	// Small spherical cloud in front of the default camera
+	const unsigned int axisCount = 32;
+	Grid3D<float> grid(axisCount, axisCount, axisCount);
+	for (unsigned int z = 0; z < axisCount; z++)
+	{
+		for (unsigned int y = 0; y < axisCount; y++)
+		{
+			for (unsigned int x = 0; x < axisCount; x++)
+			{
+				float radius = glm::length(glm::vec3(x, y, z) - glm::vec3(axisCount / 2.f));
+				grid(x, y, z) = radius < axisCount / 2.f ? 1.f : 0.f;
+			}
+		}
+	}
+
+	CloudProperties cloudProperties;
+	cloudProperties.bounds[0] = glm::vec4(-200, -200, 0, 0);
+	cloudProperties.bounds[1] = glm::vec4(200, 200, 400, 0);
+	cloudProperties.voxelCount = glm::uvec4(axisCount);
+	cloudProperties.maxExtinction = grid.GetMajorant();
+	cloudProperties.densityScaling = 5.f;
+
+	CameraProperties cameraProperties;
+	cameraProperties.SetResolution(96, 64);
+	float fov = 90.f;
+	cameraProperties.SetFOV(fov);
+
+	ShadowVolumeProperties shadowVolumeProperties;
+	shadowVolumeProperties.voxelAxisCount = 32;
+	shadowVolumeProperties.SetLightDirection(glm::vec3(1, -1, 0));
+	shadowVolumeProperties.SetOrigin(cloudProperties.bounds[0], cloudProperties.bounds[1]);
+
+	Parameters parameters;
+	parameters.SetPhaseG(0.5f);
+	PushConstants pushConstants;
+
+	// Per pixel seeding makes the image independent of the thread count
+	auto render = [&](unsigned int threadCount, const CloudProperties& properties, bool packetTracking = false)
+	{
+		CPUPathTracer pathTracer(&grid, threadCount, packetTracking);
+		pathTracer.UpdateShadowVolume(properties, shadowVolumeProperties);
+		pushConstants.frameCount = 1;
+		for (int frame = 0; frame < 4; frame++)
+		{
+			pushConstants.seed = 100 + frame;
+			pathTracer.Render(cameraProperties, properties, parameters, pushConstants);
+			pushConstants.frameCount++;
+		}
+		return pathTracer.GetResult();
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<glm::vec4> singleThreaded = render(1, cloudProperties);
+	double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	start = std::chrono::steady_clock::now();
+	std::vector<glm::vec4> multiThreaded = render(0, cloudProperties);
+	double multiSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	bool test = singleThreaded.size() == 96 * 64 && singleThreaded == multiThreaded;
+
+	// Center pixel looks through the cloud and has to differ from the sky behind it
+	glm::vec4 center = singleThreaded[48 + 32 * 96];
+	glm::vec4 sky = CPUPathTracer::SampleBackground(glm::vec3(0, 0, 1));
+	test &= std::isfinite(center.x) && glm::length(center - sky) > 1e-3f;
+
+	// Without density every pixel is the background, the running mean restarts at the first frame instead of blending in the empty start image
+	CloudProperties emptyCloudProperties = cloudProperties;
+	emptyCloudProperties.densityScaling = 0.f;
+	std::vector<glm::vec4> empty = render(0, emptyCloudProperties);
+	test &= glm::length(empty[48 + 32 * 96] - sky) < 1e-5f;
+
+	// Packets keep the per pixel streams, their image is deterministic and close to the scalar one on average
+	std::vector<glm::vec4> packets = render(1, cloudProperties, true);
+	test &= packets == render(0, cloudProperties, true);
+	glm::vec4 scalarSum(0.0f), packetSum(0.0f);
+	for (size_t i = 0; i < packets.size(); i++)
+	{
+		scalarSum += singleThreaded[i];
+		packetSum += packets[i];
+	}
+	test &= glm::length(packetSum - scalarSum) < 0.02f * glm::length(scalarSum);
+
+	std::cout << "cpuPathTracerTest: " << (test ? "OK" : "FAILED") << " (1 thread " << singleSeconds * 1000.0 << " ms, all threads " << multiSeconds * 1000.0 << " ms)" << std::endl;
+	return test;
+}
+
+bool tests::packetTrackerTest()
+{
+	// Homogeneous medium at half the majorant, so every level has to handle null collisions
+	const unsigned int axisCount = 16;
+	Grid3D<float> grid(axisCount, axisCount, axisCount);
+	std::fill_n(static_cast<float*>(grid.GetData()), grid.GetSize(), 0.5f);
+
+	CloudProperties cloudProperties;
+	cloudProperties.bounds[0] = glm::vec4(0, 0, 0, 0);
+	cloudProperties.bounds[1] = glm::vec4(1, 1, 1, 0);
+	cloudProperties.voxelCount = glm::uvec4(axisCount);
+	cloudProperties.maxExtinction = 1.f;
+	cloudProperties.baseScaling = 1.f;
+	cloudProperties.densityScaling = 2.f; // Extinction of 1 per unit
+
+	bool test = true;
+	std::string levels;
+	const ESimdLevel supportedLevel = PacketTracker::GetSupportedSimdLevel();
+	for (int level = 0; level <= static_cast<int>(supportedLevel); level++)
+	{
+		PacketTracker tracker(&grid, cloudProperties, static_cast<ESimdLevel>(level));
+		test &= tracker.GetSimdLevel() == static_cast<ESimdLevel>(level);
+
+		// Rays cross the unit cube along x, the escaping share is the transmittance exp(-1)
+		const int packetCount = 8192;
+		int escaped = 0, hits = 0;
+		double hitDistance = 0;
+		std::mt19937 gen(5);
+		std::uniform_real_distribution<float> dist(0.f, 1.f);
+		RayPacket packet;
+		for (int i = 0; i < packetCount; i++)
+		{
+			for (int lane = 0; lane < RayPacket::SIZE; lane++)
+			{
+				packet.posX[lane] = 0.f;
+				packet.posY[lane] = dist(gen);
+				packet.posZ[lane] = dist(gen);
+				packet.dirX[lane] = 1.f;
+				packet.dirY[lane] = 0.f;
+				packet.dirZ[lane] = 0.f;
+				packet.maxT[lane] = lane == 7 ? 0.f : 1.f; // Last lane is inactive
+				packet.rngState[lane] = i * RayPacket::SIZE + lane + 1;
+			}
+
+			tracker.Track(packet);
+			test &= packet.hit[7] == 0 && packet.rngState[7] == static_cast<uint32_t>(i * RayPacket::SIZE + 8);
+			for (int lane = 0; lane < 7; lane++)
+			{
+				test &= packet.t[lane] >= 0.f && packet.t[lane] <= 1.f;
+				escaped += packet.hit[lane] == 0;
+				hits += packet.hit[lane];
+				hitDistance += packet.hit[lane] ? packet.t[lane] : 0.f;
+			}
+		}
+
+		// Mean collision distance of an exponential truncated at 1 is (1 - 2/e) / (1 - 1/e)
+		float transmittance = float(escaped) / float(packetCount * 7);
+		float meanHitDistance = float(hitDistance / hits);
+		test &= std::abs(transmittance - std::exp(-1.f)) < 0.01f;
+		test &= std::abs(meanHitDistance - (1.f - 2.f / std::exp(1.f)) / (1.f - 1.f / std::exp(1.f))) < 0.01f;
+		levels += std::string(" ") + PacketTracker::GetSimdLevelName(static_cast<ESimdLevel>(level));
+	}
+
+	std::cout << "packetTrackerTest: " << (test ? "OK" : "FAILED") << " (" << levels.substr(1) << ")" << std::endl;
+	return test;
+}
+
+void tests::packetTrackingBenchmark(unsigned int axisCount)
+{
+	Grid3D<float> grid(axisCount, axisCount, axisCount);
+	std::mt19937 gen(7);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	float* data = static_cast<float*>(grid.GetData());
+	for (size_t i = 0; i < grid.GetSize(); i++)
+	{
+		data[i] = dist(gen);
+	}
+
+	CloudProperties cloudProperties;
+	cloudProperties.bounds[0] = glm::vec4(0, 0, 0, 0);
+	cloudProperties.bounds[1] = glm::vec4(1, 1, 1, 0);
+	cloudProperties.voxelCount = glm::uvec4(axisCount);
+	cloudProperties.maxExtinction = grid.GetMajorant();
+	cloudProperties.baseScaling = 1.f;
+	cloudProperties.densityScaling = 8.f;
+
+	// Random rays from inside the volume, single threaded so the rates are per core
+	const int rayCount = 1 << 20;
+	std::vector<CPUPathTracer::Ray> rays(rayCount);
+	for (CPUPathTracer::Ray& ray : rays)
+	{
+		ray.pos = glm::vec3(dist(gen), dist(gen), dist(gen));
+		ray.dir = glm::normalize(glm::vec3(dist(gen), dist(gen), dist(gen)) - 0.5f);
+	}
+
+	ShadowVolumeProperties shadowVolumeProperties;
+	shadowVolumeProperties.voxelAxisCount = 8;
+	shadowVolumeProperties.SetOrigin(cloudProperties.bounds[0], cloudProperties.bounds[1]);
+	CPUPathTracer pathTracer(&grid, 1);
+	pathTracer.UpdateShadowVolume(cloudProperties, shadowVolumeProperties);
+
+	auto start = std::chrono::steady_clock::now();
+	int scalarHits = 0;
+	for (int i = 0; i < rayCount; i++)
+	{
+		CPUPathTracer::Ray ray = rays[i];
+		CPUPathTracer::Random random(i + 1);
+		scalarHits += pathTracer.FindScatterPoint(ray, random);
+	}
+	double scalarRate = rayCount / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "packetTrackingBenchmark: Scalar reference " << scalarRate / 1e6 << " Mrays/s per core";
+
+	const ESimdLevel supportedLevel = PacketTracker::GetSupportedSimdLevel();
+	for (int level = 0; level <= static_cast<int>(supportedLevel); level++)
+	{
+		PacketTracker tracker(&grid, cloudProperties, static_cast<ESimdLevel>(level));
+		RayPacket packet;
+		int hits = 0;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < rayCount; i += RayPacket::SIZE)
+		{
+			for (int lane = 0; lane < RayPacket::SIZE; lane++)
+			{
+				const CPUPathTracer::Ray& ray = rays[i + lane];
+				float tmax = 0, tmin = 0;
+				pathTracer.IntersectCloud(ray, tmax, tmin);
+				packet.posX[lane] = ray.pos.x;
+				packet.posY[lane] = ray.pos.y;
+				packet.posZ[lane] = ray.pos.z;
+				packet.dirX[lane] = ray.dir.x;
+				packet.dirY[lane] = ray.dir.y;
+				packet.dirZ[lane] = ray.dir.z;
+				packet.maxT[lane] = tmax;
+				packet.rngState[lane] = i + lane + 1;
+			}
+			tracker.Track(packet);
+			for (int lane = 0; lane < RayPacket::SIZE; lane++)
+			{
+				hits += packet.hit[lane];
+			}
+		}
+		double rate = rayCount / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << ", " << PacketTracker::GetSimdLevelName(static_cast<ESimdLevel>(level)) << " packets " << rate / 1e6 << " Mrays/s (x" << rate / scalarRate << ", "
+			<< 100.f * hits / rayCount << "% vs " << 100.f * scalarHits / rayCount << "% scattered)";
+	}
+	std::cout << std::endl;
+}
+
+bool tests::kdTreeTest()
+{
+	// Clustered photons, so the tree has to split unevenly sized cells
+	std::mt19937 gen(11);
+	std::normal_distribution<float> cluster(0.f, 5.f);
+	std::uniform_real_distribution<float> dist(0.f, 100.f);
+	std::vector<Photon> photons(200000);
+	for (size_t i = 0; i < photons.size(); i++)
+	{
+		glm::vec3 center = i % 2 ? glm::vec3(30, 50, 70) : glm::vec3(dist(gen), dist(gen), dist(gen));
+		photons[i].position = glm::vec4(center + glm::vec3(cluster(gen), cluster(gen), cluster(gen)), 1);
+		photons[i].power = glm::vec4(float(i));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	KDTree tree(photons.data(), photons.size(), 4); // Enough threads for the parallel top levels on any machine
+	double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	bool test = tree.GetSize() == photons.size();
+
+	// Every photon must be in the heap exactly once
+	std::vector<bool> seen(photons.size(), false);
+	for (const Photon& photon : tree.GetPhotons())
+	{
+		size_t idx = static_cast<size_t>(photon.power.x);
+		test &= !seen[idx];
+		seen[idx] = true;
+	}
+
+	const unsigned int k = 16;
+	const float radius = 4.f;
+	std::vector<KDTree::Neighbor> neighbors;
+	std::vector<float> distances;
+	for (int query = 0; query < 200 && test; query++)
+	{
+		glm::vec3 point(dist(gen), dist(gen), dist(gen));
+		if (query % 4 == 0)
+		{
+			point = glm::vec3(30, 50, 70) + glm::vec3(cluster(gen), cluster(gen), cluster(gen));
+		}
+
+		distances.clear();
+		size_t inRadius = 0;
+		for (const Photon& photon : photons)
+		{
+			float distanceSquared = glm::distance2(glm::vec3(photon.position), point);
+			distances.push_back(distanceSquared);
+			inRadius += distanceSquared <= radius * radius;
+		}
+		std::sort(distances.begin(), distances.end());
+
+		// k closest distances match the brute force ones in order
+		tree.NearestNeighbors(point, k, neighbors);
+		test &= neighbors.size() == k;
+		for (unsigned int i = 0; i < neighbors.size() && i < k; i++)
+		{
+			test &= neighbors[i].distanceSquared == distances[i];
+		}
+
+		tree.RadiusSearch(point, radius, neighbors);
+		test &= neighbors.size() == inRadius;
+		for (const KDTree::Neighbor& neighbor : neighbors)
+		{
+			test &= neighbor.distanceSquared <= radius * radius;
+		}
+
+		// A bounded k-NN query returns only what the radius search finds
+		tree.NearestNeighbors(point, k, neighbors, radius);
+		test &= neighbors.size() == std::min<size_t>(k, inRadius);
+	}
+
+	// Corner cases
+	KDTree single(photons.data(), 1);
+	single.NearestNeighbors(glm::vec3(0), k, neighbors);
+	test &= neighbors.size() == 1 && neighbors[0].photon == &single.GetPhotons()[0];
+	KDTree empty(photons.data(), 0);
+	empty.RadiusSearch(glm::vec3(0), radius, neighbors);
+	test &= neighbors.empty();
+
+	std::cout << "kdTreeTest: " << (test ? "OK" : "FAILED") << " (build " << buildSeconds * 1000.0 << " ms for " << photons.size() << " photons)" << std::endl;
+	return test;
+}
+
+void tests::kdTreeBuildBenchmark(size_t photonCount)
+{
+	std::vector<Photon> photons(photonCount);
+	utilities::ParallelFor(photonCount, [&photons](size_t begin, size_t end)
+		{
+			std::mt19937 gen(static_cast<unsigned int>(begin));
+			std::uniform_real_distribution<float> dist(0.f, 100.f);
+			for (size_t i = begin; i < end; i++)
+			{
+				photons[i].position = glm::vec4(dist(gen), dist(gen), dist(gen), 1);
+			}
+		});
+
+	unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	std::cout << "kdTreeBuildBenchmark " << photonCount << " photons:";
+	for (unsigned int threads : { 1u, threadCount })
+	{
+		auto start = std::chrono::steady_clock::now();
+		KDTree tree(photons.data(), photons.size(), threads);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << " " << threads << " thread(s) " << seconds * 1000.0 << " ms (" << photonCount / seconds / 1e6 << " Mphotons/s)";
+		if (threadCount == 1)
+		{
+			break;
+		}
+	}
+	std::cout << std::endl;
+}
+
+// CPU mirror of depositPhoton in PPM_PT.comp and the passes of PPM_Grid.comp
+void tests::buildPhotonGrid(const std::vector<Photon>& photons, const glm::vec3& boundsMin, float voxelSize, const glm::ivec3& voxelCount, unsigned int photonCapacity,
+	std::vector<unsigned int>& outCellStarts, std::vector<Photon>& outPhotonMap)
+{
+	const unsigned int scanBlockSize = 1024;
+	const unsigned int cellCount = voxelCount.x * voxelCount.y * voxelCount.z;
+	const unsigned int blockCount = (cellCount + scanBlockSize - 1) / scanBlockSize;
+
+	// Deposit: append and count per cell, the slot is the cell count before the increment
+	std::vector<unsigned int> cellCounts(cellCount, 0);
+	std::vector<Photon> depositedPhotons;
+	unsigned int photonCount = 0;
+	for (Photon photon : photons)
+	{
+		unsigned int photonIdx = photonCount++;
+		if (photonIdx >= photonCapacity)
+		{
+			continue;
+		}
+
+		glm::vec3 normPos = (glm::vec3(photon.position) - boundsMin) / voxelSize;
+		glm::ivec3 idx3D = glm::clamp(glm::ivec3(normPos), glm::ivec3(0), voxelCount - 1);
+		int idx = idx3D.x + (idx3D.y + idx3D.z * voxelCount.y) * voxelCount.x;
+		photon.cellIdx = idx;
+		photon.cellSlot = cellCounts[idx]++;
+		depositedPhotons.push_back(photon);
+	}
+
+	// Pass 0: local scan per block
+	outCellStarts.assign(static_cast<size_t>(cellCount) + 1, 0);
+	std::vector<unsigned int> blockSums(blockCount);
+	std::vector<unsigned int> blockData(scanBlockSize);
+	for (unsigned int block = 0; block < blockCount; block++)
+	{
+		unsigned int base = block * scanBlockSize;
+		for (unsigned int i = 0; i < scanBlockSize; i++)
+		{
+			blockData[i] = base + i < cellCount ? cellCounts[base + i] : 0;
+		}
+		blockSums[block] = scanBlock(blockData);
+		for (unsigned int i = 0; i < scanBlockSize && base + i < cellCount; i++)
+		{
+			outCellStarts[base + i] = blockData[i];
+		}
+	}
+
+	// Pass 1: scan of the block sums in chunks with a carry
+	unsigned int carry = 0;
+	for (unsigned int chunk = 0; chunk < blockCount; chunk += scanBlockSize)
+	{
+		for (unsigned int i = 0; i < scanBlockSize; i++)
+		{
+			blockData[i] = chunk + i < blockCount ? blockSums[chunk + i] : 0;
+		}
+		unsigned int total = scanBlock(blockData);
+		for (unsigned int i = 0; i < scanBlockSize && chunk + i < blockCount; i++)
+		{
+			blockSums[chunk + i] = blockData[i] + carry;
+		}
+		carry += total;
+	}
+	outCellStarts[cellCount] = carry;
+
+	// Pass 2: add block offsets
+	for (unsigned int cell = 0; cell < cellCount; cell++)
+	{
+		outCellStarts[cell] += blockSums[cell / scanBlockSize];
+	}
+
+	// Pass 3: scatter
+	outPhotonMap.assign(depositedPhotons.size(), Photon{});
+	for (const Photon& photon : depositedPhotons)
+	{
+		outPhotonMap[outCellStarts[photon.cellIdx] + photon.cellSlot] = photon;
+	}
+}
+
+// Exclusive Blelloch scan like scanBlock in PPM_Grid.comp, one loop iteration per invocation
+unsigned int tests::scanBlock(std::vector<unsigned int>& blockData)
+{
+	const unsigned int blockSize = static_cast<unsigned int>(blockData.size());
+	unsigned int offset = 1;
+	for (unsigned int d = blockSize >> 1; d > 0; d >>= 1)
+	{
+		for (unsigned int tid = 0; tid < d; tid++)
+		{
+			blockData[offset * (2 * tid + 2) - 1] += blockData[offset * (2 * tid + 1) - 1];
+		}
+		offset *= 2;
+	}
+
+	unsigned int total = blockData[blockSize - 1];
+	blockData[blockSize - 1] = 0;
+	for (unsigned int d = 1; d < blockSize; d *= 2)
+	{
+		offset >>= 1;
+		for (unsigned int tid = 0; tid < d; tid++)
+		{
+			unsigned int ai = offset * (2 * tid + 1) - 1;
+			unsigned int bi = offset * (2 * tid + 2) - 1;
+			unsigned int t = blockData[ai];
+			blockData[ai] = blockData[bi];
+			blockData[bi] += t;
+		}
+	}
+
+	return total;
+}
+
+bool tests::photonGridTest()
+{
+	// Default photon map grid, half of the photons in a dense cluster that overflowed the old 32 slots per cell
+	const glm::vec3 boundsMin(0);
+	const float voxelSize = 1.f;
+	const glm::ivec3 voxelCount(100);
+	const unsigned int cellCount = voxelCount.x * voxelCount.y * voxelCount.z;
+
+	std::mt19937 gen(13);
+	std::uniform_real_distribution<float> dist(0.f, 100.f);
+	std::normal_distribution<float> cluster(0.f, 1.5f);
+	std::vector<Photon> photons(100000);
+	for (size_t i = 0; i < photons.size(); i++)
+	{
+		glm::vec3 position = i % 2 ? glm::vec3(50) + glm::vec3(cluster(gen), cluster(gen), cluster(gen)) : glm::vec3(dist(gen), dist(gen), dist(gen));
+		photons[i].position = glm::vec4(position, 0);
+		photons[i].power = glm::vec4(float(i));
+	}
+
+	std::vector<unsigned int> cellStarts;
+	std::vector<Photon> photonMap;
+	buildPhotonGrid(photons, boundsMin, voxelSize, voxelCount, 1 << 20, cellStarts, photonMap);
+
+	// Every photon is kept and every cell range holds exactly the photons of that cell
+	bool test = cellStarts.size() == cellCount + 1 && cellStarts.back() == photons.size() && photonMap.size() == photons.size();
+	std::vector<unsigned int> expectedCounts(cellCount, 0);
+	for (const Photon& photon : photons)
+	{
+		glm::ivec3 idx3D = glm::clamp(glm::ivec3((glm::vec3(photon.position) - boundsMin) / voxelSize), glm::ivec3(0), voxelCount - 1);
+		expectedCounts[idx3D.x + (idx3D.y + idx3D.z * voxelCount.y) * voxelCount.x]++;
+	}
+	size_t droppedWithFixedSlots = 0;
+	for (unsigned int cell = 0; cell < cellCount && test; cell++)
+	{
+		test &= cellStarts[cell + 1] - cellStarts[cell] == expectedCounts[cell];
+		for (unsigned int i = cellStarts[cell]; i < cellStarts[cell + 1]; i++)
+		{
+			test &= photonMap[i].cellIdx == cell;
+		}
+		droppedWithFixedSlots += expectedCounts[cell] > 32 ? expectedCounts[cell] - 32 : 0;
+	}
+
+	// Radius gather over the cells like samplePhotonMap in PPM_PE.comp matches the kd-tree
+	KDTree tree(photons.data(), photons.size());
+	std::vector<KDTree::Neighbor> neighbors;
+	const float radius = 2.5f;
+	for (int query = 0; query < 50 && test; query++)
+	{
+		glm::vec3 pos = query % 2 ? glm::vec3(50) + glm::vec3(cluster(gen), cluster(gen), cluster(gen)) : glm::vec3(dist(gen), dist(gen), dist(gen));
+		glm::ivec3 minIdx = glm::max(glm::ivec3((pos - boundsMin - radius) / voxelSize), glm::ivec3(0));
+		glm::ivec3 maxIdx = glm::min(glm::ivec3((pos - boundsMin + radius) / voxelSize), voxelCount - 1);
+		size_t gathered = 0;
+		for (int z = minIdx.z; z <= maxIdx.z; z++)
+		{
+			for (int y = minIdx.y; y <= maxIdx.y; y++)
+			{
+				for (int x = minIdx.x; x <= maxIdx.x; x++)
+				{
+					int cell = x + (y + z * voxelCount.y) * voxelCount.x;
+					for (unsigned int i = cellStarts[cell]; i < cellStarts[cell + 1]; i++)
+					{
+						gathered += glm::distance2(glm::vec3(photonMap[i].position), pos) <= radius * radius;
+					}
+				}
+			}
+		}
+
+		tree.RadiusSearch(pos, radius, neighbors);
+		test &= gathered == neighbors.size();
+	}
+
+	// A full photon buffer drops the photons past the capacity and keeps the counts consistent
+	buildPhotonGrid(photons, boundsMin, voxelSize, voxelCount, 1000, cellStarts, photonMap);
+	test &= cellStarts.back() == 1000 && photonMap.size() == 1000;
+
+	double fixedSlotsMB = sizeof(Photon) * 32.0 * cellCount / 1e6;
+	double compactMB = (2.0 * sizeof(Photon) * (1 << 20) + sizeof(unsigned int) * (2.0 * cellCount + 1)) / 1e6;
+	std::cout << "photonGridTest: " << (test ? "OK" : "FAILED") << " (" << droppedWithFixedSlots << " of " << photons.size() << " photons dropped by 32 slots per cell, "
+		<< fixedSlotsMB << " MB fixed slots vs " << compactMB << " MB compact for 2^20 photons)" << std::endl;
+	return test;
+}
+
+namespace
+{
+	const float g_testBeamRadius = 0.5f;
+}
+
+void tests::generateBeams(size_t beamCount, float cellSize, unsigned int seed, std::vector<PhotonBeam>& outBeams)
+{
+	// Beams inside a 100^3 box, start positions snapped to cellSize to force equal morton codes
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> position(0.f, 100.f);
+	std::uniform_real_distribution<float> offset(-2.f, 2.f);
+
+	outBeams.resize(beamCount);
+	for (size_t i = 0; i < beamCount; i++)
+	{
+		PhotonBeam& beam = outBeams[i];
+		beam = PhotonBeam();
+		beam.startPos = glm::vec3(position(gen), position(gen), position(gen));
+		if (cellSize > 0)
+		{
+			beam.startPos = glm::floor(beam.startPos / cellSize) * cellSize;
+		}
+		beam.endPos = beam.startPos + glm::vec3(offset(gen), offset(gen), offset(gen));
+		beam.mortonCode = LBVH::GetMortonCode(beam.startPos / 100.f);
+		beam.dataIdx = static_cast<uint32_t>(i);
+	}
+}
+
+bool tests::lbvhTest()
+{
+	bool test = true;
+
+	// Single leaf, single inner node, random beams and heavily duplicated morton codes
+	struct Case { size_t beamCount; float cellSize; };
+	for (const Case& lbvhCase : { Case{ 1, 0 }, Case{ 2, 0 }, Case{ 5000, 0 }, Case{ 3000, 50.f } })
+	{
+		std::vector<PhotonBeam> beams;
+		generateBeams(lbvhCase.beamCount, lbvhCase.cellSize, static_cast<unsigned int>(lbvhCase.beamCount), beams);
+		radixSort(beams, 30);
+
+		LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius, 4);
+		const std::vector<TreeNode>& nodes = lbvh.GetNodes();
+		const uint32_t innerCount = lbvh.GetInnerCount();
+		test &= nodes.size() == 2 * beams.size() - 1 && innerCount == beams.size() - 1 && nodes[0].parent == UINT32_MAX;
+
+		// Every leaf is reached once, each inner node covers a contiguous range of leaves and tightly bounds its children
+		std::vector<unsigned int> leafVisits(beams.size(), 0);
+		std::function<glm::uvec2(uint32_t)> visit = [&](uint32_t nodeIdx) -> glm::uvec2
+		{
+			const TreeNode& node = nodes[nodeIdx];
+			if (node.isLeaf)
+			{
+				glm::vec4 bounds[2];
+				LBVH::CalculateBeamBounds(beams[node.left], g_testBeamRadius, bounds);
+				test &= nodeIdx == innerCount + node.left && bounds[0] == node.bounds[0] && bounds[1] == node.bounds[1];
+				leafVisits[node.left]++;
+				return glm::uvec2(node.left);
+			}
+
+			const TreeNode& left = nodes[node.left];
+			const TreeNode& right = nodes[node.right];
+			test &= left.parent == nodeIdx && right.parent == nodeIdx && node.processed == 2;
+			test &= node.bounds[0] == glm::min(left.bounds[0], right.bounds[0]) && node.bounds[1] == glm::max(left.bounds[1], right.bounds[1]);
+
+			glm::uvec2 leftRange = visit(node.left);
+			glm::uvec2 rightRange = visit(node.right);
+			test &= leftRange.y + 1 == rightRange.x;
+			return glm::uvec2(leftRange.x, rightRange.y);
+		};
+		glm::uvec2 range = visit(0);
+		test &= range == glm::uvec2(0, beams.size() - 1) && std::all_of(leafVisits.begin(), leafVisits.end(), [](unsigned int visits) { return visits == 1; });
+
+		// Point queries against brute force over the leaf bounds
+		auto contains = [](const TreeNode& node, const glm::vec3& point)
+		{
+			return glm::all(glm::greaterThanEqual(point, glm::vec3(node.bounds[0]))) && glm::all(glm::lessThanEqual(point, glm::vec3(node.bounds[1])));
+		};
+		std::mt19937 gen(7);
+		std::uniform_real_distribution<float> position(0.f, 100.f);
+		for (unsigned int query = 0; query < 200; query++)
+		{
+			glm::vec3 point(position(gen), position(gen), position(gen));
+			size_t expected = 0;
+			for (size_t i = 0; i < beams.size(); i++)
+			{
+				expected += contains(nodes[innerCount + i], point) ? 1 : 0;
+			}
+
+			size_t found = 0;
+			std::vector<uint32_t> stack = { 0 };
+			while (!stack.empty())
+			{
+				const TreeNode& node = nodes[stack.back()];
+				stack.pop_back();
+				if (!contains(node, point))
+				{
+					continue;
+				}
+				if (node.isLeaf)
+				{
+					found++;
+				}
+				else
+				{
+					stack.push_back(node.left);
+					stack.push_back(node.right);
+				}
+			}
+			test &= found == expected;
+		}
+	}
+
+	std::cout << "lbvhTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::lbvhBuildBenchmark(size_t beamCount)
+{
+	std::vector<PhotonBeam> beams;
+	generateBeams(beamCount, 0, 1, beams);
+	std::stable_sort(beams.begin(), beams.end(), [](const PhotonBeam& a, const PhotonBeam& b) { return a.mortonCode < b.mortonCode; });
+
+	unsigned int threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	std::cout << "lbvhBuildBenchmark " << beamCount << " beams:";
+	for (unsigned int threads : { 1u, threadCount })
+	{
+		auto start = std::chrono::steady_clock::now();
+		LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius, threads);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << " " << threads << " thread(s) " << seconds * 1000.0 << " ms (" << beamCount / seconds / 1e6 << " Mbeams/s)";
+		if (threadCount == 1)
+		{
+			break;
+		}
+	}
+	std::cout << std::endl;
+}
+
+bool tests::intersectBounds(const Ray& ray, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 invDir = 1.f / ray.dir;
+	glm::vec3 t0 = (boundsMin - ray.pos) * invDir;
+	glm::vec3 t1 = (boundsMax - ray.pos) * invDir;
+	glm::vec3 tMin = glm::min(t0, t1);
+	glm::vec3 tMax = glm::max(t0, t1);
+
+	float tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+	float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+	return tNear <= tFar && tFar >= 0;
+}
+
+size_t tests::traverseBuildNodes(const std::vector<TreeNode>& nodes, uint32_t innerCount, const Ray& ray, std::vector<uint32_t>& outBeams)
+{
+	// Reads the current node and both children per step, as PPB_PE.comp did on the build-time layout
+	size_t bytesRead = 0;
+	if (innerCount == 0)
+	{
+		outBeams.push_back(0);
+		return bytesRead;
+	}
+
+	std::vector<uint32_t> stack = { 0 };
+	while (!stack.empty())
+	{
+		const TreeNode& node = nodes[stack.back()];
+		stack.pop_back();
+		bytesRead += 3 * sizeof(TreeNode);
+		for (uint32_t childIdx : { node.left, node.right })
+		{
+			const TreeNode& child = nodes[childIdx];
+			if (!intersectBounds(ray, glm::vec3(child.bounds[0]), glm::vec3(child.bounds[1])))
+			{
+				continue;
+			}
+			if (child.isLeaf)
+			{
+				outBeams.push_back(child.left);
+			}
+			else
+			{
+				stack.push_back(childIdx);
+			}
+		}
+	}
+	return bytesRead;
+}
+
+size_t tests::traverseCompactNodes(const std::vector<CompactTreeNode>& nodes, const glm::vec3& offset, const Ray& ray, std::vector<uint32_t>& outBeams)
+{
+	// One node read per step, bounds relative to the tree offset
+	size_t bytesRead = 0;
+	if (nodes.empty())
+	{
+		outBeams.push_back(0);
+		return bytesRead;
+	}
+
+	Ray relativeRay{ ray.pos - offset, ray.dir };
+	std::vector<uint32_t> stack = { 0 };
+	while (!stack.empty())
+	{
+		const CompactTreeNode& node = nodes[stack.back()];
+		stack.pop_back();
+		bytesRead += sizeof(CompactTreeNode);
+		for (unsigned int child = 0; child < 2; child++)
+		{
+			glm::vec3 bounds[2];
+			LBVH::UnpackChildBounds(node, child, bounds);
+			if (!intersectBounds(relativeRay, bounds[0], bounds[1]))
+			{
+				continue;
+			}
+			if (node.children[child] & CompactTreeNode::LEAF_FLAG)
+			{
+				outBeams.push_back(node.children[child] & ~CompactTreeNode::LEAF_FLAG);
+			}
+			else
+			{
+				stack.push_back(node.children[child]);
+			}
+		}
+	}
+	return bytesRead;
+}
+
+void tests::generateBeamRays(size_t rayCount, unsigned int seed, std::vector<Ray>& outRays)
+{
+	// Rays from a sphere around the 100^3 beam box towards a point inside of it
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> position(0.f, 100.f);
+	std::normal_distribution<float> direction;
+
+	outRays.resize(rayCount);
+	for (Ray& ray : outRays)
+	{
+		glm::vec3 target(position(gen), position(gen), position(gen));
+		ray.pos = glm::vec3(50.f) + 150.f * glm::normalize(glm::vec3(direction(gen), direction(gen), direction(gen)));
+		ray.dir = glm::normalize(target - ray.pos);
+	}
+}
+
+bool tests::lbvhPackTest()
+{
+	bool test = true;
+
+	// Conservative half conversion, including values past the half range and around zero
+	std::mt19937 gen(3);
+	std::uniform_real_distribution<float> exponent(-20.f, 17.f);
+	std::vector<float> values = { 0.f, -0.f, 1e-9f, -1e-9f, 65504.f, -65504.f, 1e6f, -1e6f };
+	for (unsigned int i = 0; i < 10000; i++)
+	{
+		values.push_back((i % 2 ? -1.f : 1.f) * std::exp2(exponent(gen)));
+	}
+	for (float value : values)
+	{
+		float clamped = glm::clamp(value, -65504.f, 65504.f);
+		float below = glm::unpackHalf1x16(LBVH::PackHalfBelow(value));
+		float above = glm::unpackHalf1x16(LBVH::PackHalfAbove(value));
+		test &= below <= clamped && above >= clamped && above - below <= std::abs(clamped) / 512.f + 1e-7f;
+	}
+
+	struct Case { size_t beamCount; float cellSize; };
+	for (const Case& packCase : { Case{ 1, 0 }, Case{ 2, 0 }, Case{ 5000, 0 }, Case{ 3000, 50.f } })
+	{
+		std::vector<PhotonBeam> beams;
+		generateBeams(packCase.beamCount, packCase.cellSize, static_cast<unsigned int>(packCase.beamCount), beams);
+		radixSort(beams, 30);
+
+		LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius, 4);
+		const std::vector<TreeNode>& nodes = lbvh.GetNodes();
+		std::vector<CompactTreeNode> compactNodes;
+		glm::vec3 offset;
+		lbvh.Pack(compactNodes, offset, 4);
+		test &= compactNodes.size() == lbvh.GetInnerCount();
+
+		// Same children with packed leaf flags, packed bounds contain the exact ones
+		for (uint32_t i = 0; i < compactNodes.size(); i++)
+		{
+			for (unsigned int child = 0; child < 2; child++)
+			{
+				uint32_t childIdx = child == 0 ? nodes[i].left : nodes[i].right;
+				const TreeNode& childNode = nodes[childIdx];
+				test &= compactNodes[i].children[child] == (childNode.isLeaf ? (childNode.left | CompactTreeNode::LEAF_FLAG) : childIdx);
+
+				glm::vec3 bounds[2];
+				LBVH::UnpackChildBounds(compactNodes[i], child, bounds);
+				test &= glm::all(glm::lessThanEqual(bounds[0] + offset, glm::vec3(childNode.bounds[0])));
+				test &= glm::all(glm::greaterThanEqual(bounds[1] + offset, glm::vec3(childNode.bounds[1])));
+			}
+		}
+
+		// The compact traversal finds every beam of the exact one, and only few more from the looser bounds
+		std::vector<Ray> rays;
+		generateBeamRays(200, 11, rays);
+		size_t exactCount = 0;
+		size_t compactCount = 0;
+		for (const Ray& ray : rays)
+		{
+			std::vector<uint32_t> exactBeams;
+			std::vector<uint32_t> compactBeams;
+			traverseBuildNodes(nodes, lbvh.GetInnerCount(), ray, exactBeams);
+			traverseCompactNodes(compactNodes, offset, ray, compactBeams);
+			std::sort(exactBeams.begin(), exactBeams.end());
+			std::sort(compactBeams.begin(), compactBeams.end());
+			test &= std::includes(compactBeams.begin(), compactBeams.end(), exactBeams.begin(), exactBeams.end());
+			exactCount += exactBeams.size();
+			compactCount += compactBeams.size();
+		}
+		test &= compactCount <= exactCount + exactCount / 10 + 1;
+	}
+
+	std::cout << "lbvhPackTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::lbvhLayoutBenchmark(size_t beamCount)
+{
+	std::vector<PhotonBeam> beams;
+	generateBeams(beamCount, 0, 1, beams);
+	std::stable_sort(beams.begin(), beams.end(), [](const PhotonBeam& a, const PhotonBeam& b) { return a.mortonCode < b.mortonCode; });
+
+	LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius);
+	std::vector<CompactTreeNode> compactNodes;
+	glm::vec3 offset;
+	lbvh.Pack(compactNodes, offset);
+
+	std::vector<Ray> rays;
+	generateBeamRays(5000, 5, rays);
+
+	// Bytes read per ray by the tree traversal, beams are read once per candidate in both layouts
+	size_t candidates[2] = { 0, 0 };
+	size_t bytesRead[2] = { 0, 0 };
+	double seconds[2] = { 0, 0 };
+	std::vector<uint32_t> foundBeams;
+	for (unsigned int layout = 0; layout < 2; layout++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (const Ray& ray : rays)
+		{
+			foundBeams.clear();
+			bytesRead[layout] += layout == 0 ? traverseBuildNodes(lbvh.GetNodes(), lbvh.GetInnerCount(), ray, foundBeams) : traverseCompactNodes(compactNodes, offset, ray, foundBeams);
+			candidates[layout] += foundBeams.size();
+		}
+		seconds[layout] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	double buildMB = sizeof(TreeNode) * lbvh.GetNodes().size() / 1e6;
+	double compactMB = sizeof(CompactTreeNode) * compactNodes.size() / 1e6;
+	std::cout << "lbvhLayoutBenchmark " << beamCount << " beams, " << rays.size() << " rays (" << sizeof(PhotonBeam) << " bytes per beam, " << sizeof(PhotonBeamData) << " bytes per beam data):"
+		<< " build layout " << buildMB << " MB, " << bytesRead[0] / rays.size() << " bytes/ray, " << double(candidates[0]) / rays.size() << " beams/ray, " << seconds[0] * 1000.0 << " ms;"
+		<< " compact layout " << compactMB << " MB, " << bytesRead[1] / rays.size() << " bytes/ray, " << double(candidates[1]) / rays.size() << " beams/ray, " << seconds[1] * 1000.0 << " ms" << std::endl;
+}
+
+bool tests::wideBVHTest()
+{
+	bool test = true;
+
+	struct Case { size_t beamCount; float cellSize; };
+	for (const Case& wideCase : { Case{ 1, 0 }, Case{ 2, 0 }, Case{ 5000, 0 }, Case{ 3000, 50.f } })
+	{
+		std::vector<PhotonBeam> beams;
+		generateBeams(wideCase.beamCount, wideCase.cellSize, static_cast<unsigned int>(wideCase.beamCount), beams);
+		radixSort(beams, 30);
+		LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius, 4);
+		const std::vector<TreeNode>& nodes = lbvh.GetNodes();
+
+		std::vector<Ray> rays;
+		generateBeamRays(200, 13, rays);
+
+		// Beams hit by each ray, brute force over the leaf bounds
+		std::vector<std::vector<uint32_t>> expectedBeams(rays.size());
+		for (size_t r = 0; r < rays.size(); r++)
+		{
+			for (uint32_t i = 0; i < beams.size(); i++)
+			{
+				const TreeNode& leaf = nodes[lbvh.GetInnerCount() + i];
+				if (intersectBounds(rays[r], glm::vec3(leaf.bounds[0]), glm::vec3(leaf.bounds[1])))
+				{
+					expectedBeams[r].push_back(i);
+				}
+			}
+		}
+
+		for (unsigned int width : { 4u, 8u })
+		{
+			for (ESimdLevel simdLevel : { ESimdLevel::Scalar, ESimdLevel::SSE4, ESimdLevel::AVX2 })
+			{
+				WideBVH wideBVH(lbvh, width, simdLevel);
+				const std::vector<WideBVHNode>& wideNodes = wideBVH.GetNodes();
+
+				// Every beam is a leaf of exactly one node, only a single beam tree has a node with one child
+				std::vector<unsigned int> leafVisits(beams.size(), 0);
+				for (const WideBVHNode& node : wideNodes)
+				{
+					test &= node.childCount <= width && (node.childCount >= 2 || beams.size() == 1);
+					for (uint32_t i = 0; i < node.childCount; i++)
+					{
+						if (node.children[i] & WideBVHNode::LEAF_FLAG)
+						{
+							leafVisits[node.children[i] & ~WideBVHNode::LEAF_FLAG]++;
+						}
+						else
+						{
+							test &= node.children[i] < wideNodes.size();
+						}
+					}
+				}
+				test &= std::all_of(leafVisits.begin(), leafVisits.end(), [](unsigned int visits) { return visits == 1; });
+
+				// Same beams as the brute force
+				std::vector<uint32_t> foundBeams;
+				for (size_t r = 0; r < rays.size(); r++)
+				{
+					foundBeams.clear();
+					wideBVH.Traverse(rays[r].pos, rays[r].dir, foundBeams);
+					std::sort(foundBeams.begin(), foundBeams.end());
+					test &= foundBeams == expectedBeams[r];
+				}
+			}
+		}
+	}
+
+	std::cout << "wideBVHTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::wideBVHBenchmark(size_t beamCount)
+{
+	std::vector<PhotonBeam> beams;
+	generateBeams(beamCount, 0, 1, beams);
+	std::stable_sort(beams.begin(), beams.end(), [](const PhotonBeam& a, const PhotonBeam& b) { return a.mortonCode < b.mortonCode; });
+	LBVH lbvh(beams.data(), beams.size(), g_testBeamRadius);
+
+	std::vector<Ray> rays;
+	generateBeamRays(5000, 5, rays);
+	std::vector<uint32_t> foundBeams;
+
+	// Binary tree on the build-time nodes as the reference
+	auto start = std::chrono::steady_clock::now();
+	size_t binaryBytes = 0;
+	for (const Ray& ray : rays)
+	{
+		foundBeams.clear();
+		binaryBytes += traverseBuildNodes(lbvh.GetNodes(), lbvh.GetInnerCount(), ray, foundBeams);
+	}
+	double binarySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "wideBVHBenchmark " << beamCount << " beams, " << rays.size() << " rays: binary " << rays.size() / binarySeconds / 1e6 << " Mrays/s ("
+		<< binaryBytes / (3 * sizeof(TreeNode)) / rays.size() << " nodes/ray)";
+
+	struct Config { unsigned int width; ESimdLevel simdLevel; };
+	for (const Config& config : { Config{ 4, ESimdLevel::Scalar }, Config{ 4, ESimdLevel::SSE4 }, Config{ 8, ESimdLevel::Scalar }, Config{ 8, ESimdLevel::SSE4 }, Config{ 8, ESimdLevel::AVX2 } })
+	{
+		WideBVH wideBVH(lbvh, config.width, config.simdLevel);
+		if (wideBVH.GetSimdLevel() != config.simdLevel)
+		{
+			continue;
+		}
+
+		start = std::chrono::steady_clock::now();
+		size_t wideBytes = 0;
+		for (const Ray& ray : rays)
+		{
+			foundBeams.clear();
+			wideBytes += wideBVH.Traverse(ray.pos, ray.dir, foundBeams);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << ", " << config.width << "-wide " << PacketTracker::GetSimdLevelName(config.simdLevel) << " " << rays.size() / seconds / 1e6 << " Mrays/s (x" << binarySeconds / seconds << ", "
+			<< wideBytes / sizeof(WideBVHNode) / rays.size() << " nodes/ray)";
+	}
+	std::cout << std::endl;
+}
+
+bool tests::progressiveRadiusTest()
+{
+	bool test = true;
+	const float alpha = .8f;
+
+	// Closed form against the explicit product, on the first frame and late in the accumulation
+	for (uint64_t previousCount : { uint64_t(0), uint64_t(1000), uint64_t(1) << 20, uint64_t(1) << 30 })
+	{
+		for (uint64_t count : { uint64_t(1), uint64_t(1000), uint64_t(1) << 16 })
+		{
+			double logProduct = 0;
+			for (uint64_t j = 1; j <= count; j++)
+			{
+				logProduct += std::log1p((static_cast<double>(alpha) - 1) / (previousCount + j + 1.0));
+			}
+			double product = std::exp(logProduct);
+			float scale = utilities::ProgressiveRadiusScale(previousCount, count, alpha);
+			test &= std::abs(scale - product) <= std::max(1e-4 * (1 - product), 1e-7);
+			test &= scale > 0 && scale <= 1;
+		}
+	}
+
+	// SPPM rule - no photons keep the radius, more photons shrink it faster, the count grows by alpha M
+	for (float dimensions : { 1.f, 3.f })
+	{
+		PixelStatistics initial = { 1.f, 10.f };
+		PixelStatistics empty = initial;
+		utilities::UpdatePixelStatistics(empty, 0, alpha, dimensions);
+		test &= empty.radius == initial.radius && empty.photonCount == initial.photonCount;
+
+		PixelStatistics sparse = initial;
+		PixelStatistics dense = initial;
+		utilities::UpdatePixelStatistics(sparse, 1, alpha, dimensions);
+		utilities::UpdatePixelStatistics(dense, 100, alpha, dimensions);
+		test &= sparse.radius < initial.radius && dense.radius < sparse.radius;
+		test &= std::abs(dense.photonCount - (initial.photonCount + alpha * 100)) < 1e-4f;
+
+		// The radius decreases monotonically without reaching zero
+		PixelStatistics statistics = { 1.f, 0.f };
+		float previousRadius = statistics.radius;
+		for (int i = 0; i < 1000; i++)
+		{
+			utilities::UpdatePixelStatistics(statistics, 5, alpha, dimensions);
+			test &= statistics.radius <= previousRadius && statistics.radius > 0;
+			previousRadius = statistics.radius;
+		}
+	}
+
+	std::cout << "progressiveRadiusTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+bool tests::adaptiveSamplingTest()
+{
+	bool test = true;
+	std::mt19937 generator(7);
+	std::uniform_real_distribution<float> distribution(0.f, 1.f);
+
+	// Running moments against the direct mean and variance
+	glm::vec4 moments(0);
+	std::vector<float> luminances;
+	for (int i = 0; i < 1000; i++)
+	{
+		float value = distribution(generator);
+		utilities::AccumulateMoments(moments, glm::vec4(value));
+		luminances.push_back(value);
+	}
+	double mean = 0, squaredMean = 0;
+	for (float luminance : luminances)
+	{
+		mean += luminance / luminances.size();
+		squaredMean += luminance * luminance / luminances.size();
+	}
+	double relativeError = std::sqrt((squaredMean - mean * mean) / luminances.size()) / mean;
+	test &= moments.z == luminances.size();
+	test &= std::abs(moments.x - mean) < 1e-4 && std::abs(moments.y - squaredMean) < 1e-4;
+	test &= std::abs(utilities::RelativeError(moments) - relativeError) < 1e-3 * relativeError;
+
+	// Flat pixels everywhere but in one noisy pixel of the second tile, the image ends in partial tiles
+	const uint32_t tileSize = TileListHeader::TILE_SIZE;
+	const uint32_t width = 2 * tileSize + 5;
+	const uint32_t height = tileSize + 3;
+	const uint32_t tileCount = 3 * 2;
+	std::vector<glm::vec4> image(width * height, glm::vec4(0));
+	const size_t noisyPixel = tileSize + 1;
+	for (int i = 0; i < 64; i++)
+	{
+		for (size_t pixel = 0; pixel < image.size(); pixel++)
+		{
+			utilities::AccumulateMoments(image[pixel], glm::vec4(pixel != noisyPixel ? .5f : i % 2 ? 0.f : 10.f));
+		}
+	}
+
+	std::vector<uint32_t> tiles;
+	test &= utilities::ClassifyTiles(image, width, height, .01f, 16, tiles) == 1;
+	test &= tiles.size() == 1 && tiles[0] == (1u | (0u << 16));
+
+	// Too few samples keep every tile, and so does a target error of 0
+	test &= utilities::ClassifyTiles(image, width, height, .01f, 1000, tiles) == tileCount;
+	test &= utilities::ClassifyTiles(image, width, height, 0.f, 16, tiles) == tileCount;
+
+	// A lenient target converges the noisy tile too
+	test &= utilities::ClassifyTiles(image, width, height, 1e3f, 16, tiles) == 0;
+
+	// A single noisy pixel in the partial corner tile
+	utilities::AccumulateMoments(image.back(), glm::vec4(100.f));
+	test &= utilities::ClassifyTiles(image, width, height, .01f, 16, tiles) == 2;
+	test &= tiles.back() == (2u | (1u << 16));
+
+	std::cout << "adaptiveSamplingTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::generateRadianceSamples(size_t sampleCount, unsigned int seed, std::vector<float>& outSamples)
+{
+	// Mostly dim with rare bright paths, like the estimates of a cloud pixel
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> distribution(0.f, 1.f);
+	std::exponential_distribution<float> brightDistribution(.2f);
+
+	outSamples.resize(sampleCount);
+	for (float& sample : outSamples)
+	{
+		sample = distribution(generator) < .1f ? brightDistribution(generator) : .02f * distribution(generator);
+	}
+}
+
+bool tests::accumulationTest()
+{
+	bool test = true;
+	std::vector<float> samples;
+	generateRadianceSamples(1 << 20, 3, samples);
+
+	glm::vec4 mean(0);
+	AccumulationTexel texel{ glm::vec4(0), glm::vec4(0) };
+	double sum = 0;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		utilities::AccumulateMean(mean, glm::vec4(samples[i]), static_cast<float>(i + 1));
+		utilities::AccumulateCompensated(texel, glm::vec4(samples[i]));
+		sum += samples[i];
+	}
+
+	// The compensated sum stays within a few roundings of the exact mean, the running mean drifts
+	double reference = sum / samples.size();
+	double meanError = std::abs(mean.x - reference) / reference;
+	double compensatedError = std::abs(utilities::ResolveAccumulation(texel, static_cast<float>(samples.size())).x - reference) / reference;
+	test &= compensatedError < 1e-6;
+	test &= compensatedError < meanError;
+
+	// Nothing accumulated yet resolves to black
+	AccumulationTexel empty{ glm::vec4(0), glm::vec4(0) };
+	test &= utilities::ResolveAccumulation(empty, 0) == glm::vec4(0);
+
+	std::cout << "accumulationTest: " << (test ? "OK" : "FAILED") << std::endl;
+	return test;
+}
+
+void tests::accumulationErrorBenchmark(size_t frameCount)
+{
+	std::vector<float> samples;
+	generateRadianceSamples(frameCount, 4, samples);
+
+	// Relative error of one pixel against its exact mean, for the frame blend the shaders used before, the per-pixel running mean and the compensated sum
+	std::cout << "accumulationErrorBenchmark: frames, frame blend, running mean, compensated sum" << std::endl;
+	glm::vec4 blend(0);
+	glm::vec4 mean(0);
+	AccumulationTexel texel{ glm::vec4(0), glm::vec4(0) };
+	double sum = 0;
+	size_t nextReport = 16;
+	for (size_t i = 0; i < samples.size(); i++)
 	{
-		startIdx = thread * 4;
-		endIdx = std::min(startIdx + 4, static_cast<unsigned int>(keys.size()));
+		float frame = static_cast<float>(i);
+		blend = (glm::vec4(samples[i]) + blend * frame) / (frame + 1);
+		utilities::AccumulateMean(mean, glm::vec4(samples[i]), frame + 1);
+		utilities::AccumulateCompensated(texel, glm::vec4(samples[i]));
+		sum += samples[i];
 
-		for (unsigned int i = startIdx; i < endIdx; i++)
+		if (i + 1 == nextReport || i + 1 == samples.size())
 		{
-			scatterOffsets[i] = (scatterOffsets[i] == 0) ? (i - falses[i] + totalFalses) : falses[i];
-			keys[scatterOffsets[i]] = temp[i];
+			double reference = sum / (i + 1);
+			float compensated = utilities::ResolveAccumulation(texel, frame + 1).x;
+			std::cout << "  " << i + 1 << ", " << std::abs(blend.x - reference) / reference << ", " << std::abs(mean.x - reference) / reference << ", "
+				<< std::abs(compensated - reference) / reference << std::endl;
+			nextReport *= 4;
 		}
 	}
 }
@@ -2,9 +2,17 @@
 
 struct CloudProperties;
 struct ShadowVolumeProperties;
+class CPUPathTracer;
+struct Photon;
+struct PhotonBeam;
+struct SortElement;
+struct TreeNode;
+struct CompactTreeNode;
 namespace tests
 {
 	void RunTests();
+	// Timings only, too slow for every test run
+	void RunBenchmarks();
 
 	void createOrthonormalBasis(const glm::vec3& dir, glm::vec3& t0, glm::vec3& t1);
 
@@ -18,13 +26,78 @@ namespace tests
 
 	bool intersectCloud(CloudProperties& cloudProperties, glm::vec3& rayDir, glm::vec3& rayPos, glm::vec3& intersectionPoint);
 
-	bool shadowVolumeTest(glm::uvec2 columnCoord, ShadowVolumeProperties& shadowVolumeProperties, const CloudProperties& cloudProperties);
+	bool shadowVolumeTest();
+
+	void shadowVolumeBenchmark(unsigned int axisCount);
+
+	float estimateVoxelTransmittance(const CPUPathTracer& pathTracer, glm::uvec3 voxelIdx, ShadowVolumeProperties& shadowVolumeProperties, unsigned int sampleCount);
 
 	bool isInCloud(glm::vec3 point, const CloudProperties& cloudProperties);
 
 	glm::vec3 calculateVoxelPosition(glm::uvec3 voxelIdx, ShadowVolumeProperties& shadowVolumeProperties);
 
-	void localSort();
+	bool radixSortTest();
+
+	void radixSort(std::vector<PhotonBeam>& beams, unsigned int keyBits);
+
+	void splitByBit(std::vector<SortElement>& items, unsigned int nthShift);
+
+	bool gridLoadTest();
+
+	void gridLoadBenchmark(unsigned int axisCount);
+
+	bool brickMajorantTest();
+
+	bool mipMajorantTest();
+
+	void mipMajorantBenchmark(unsigned int axisCount);
+
+	bool cpuPathTracerTest();
+
+	bool packetTrackerTest();
+
+	bool kdTreeTest();
+
+	void kdTreeBuildBenchmark(size_t photonCount);
+
+	void buildPhotonGrid(const std::vector<Photon>& photons, const glm::vec3& boundsMin, float voxelSize, const glm::ivec3& voxelCount, unsigned int photonCapacity,
+		std::vector<unsigned int>& outCellStarts, std::vector<Photon>& outPhotonMap);
+
+	unsigned int scanBlock(std::vector<unsigned int>& blockData);
+
+	bool photonGridTest();
+
+	void packetTrackingBenchmark(unsigned int axisCount);
+
+	void generateBeams(size_t beamCount, float cellSize, unsigned int seed, std::vector<PhotonBeam>& outBeams);
+
+	bool lbvhTest();
+
+	void lbvhBuildBenchmark(size_t beamCount);
+
+	bool intersectBounds(const Ray& ray, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	size_t traverseBuildNodes(const std::vector<TreeNode>& nodes, uint32_t innerCount, const Ray& ray, std::vector<uint32_t>& outBeams);
+
+	size_t traverseCompactNodes(const std::vector<CompactTreeNode>& nodes, const glm::vec3& offset, const Ray& ray, std::vector<uint32_t>& outBeams);
+
+	void generateBeamRays(size_t rayCount, unsigned int seed, std::vector<Ray>& outRays);
+
+	bool lbvhPackTest();
+
+	void lbvhLayoutBenchmark(size_t beamCount);
+
+	bool wideBVHTest();
+
+	void wideBVHBenchmark(size_t beamCount);
+
+	bool progressiveRadiusTest();
+
+	bool adaptiveSamplingTest();
+
+	void generateRadianceSamples(size_t sampleCount, unsigned int seed, std::vector<float>& outSamples);
+
+	bool accumulationTest();
 
-	void radixSort(std::vector<unsigned int>& keys, std::vector<unsigned int>& scatterOffsets, unsigned int nthShift);
+	void accumulationErrorBenchmark(size_t frameCount);
 }
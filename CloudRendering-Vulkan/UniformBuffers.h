@@ -3,6 +3,13 @@
 #include <glm/glm.hpp>
 #include "Tests.h"
 
+// How the estimates accumulate their samples, matches the ACCUMULATION_ constants of the shaders
+enum class EAccumulationMode : uint32_t
+{
+	RunningMean = 0, // Mean in the result image, rounded again every frame
+	CompensatedSum = 1 // Kahan-compensated sum in an accumulation buffer, divided by the sample count on resolve
+};
+
 struct PushConstants
 {
 	double time = 0;
@@ -10,10 +17,16 @@ struct PushConstants
 	uint32_t frameCount = 1;
 	float pmRadius = 0;
 	uint32_t currentBuffer = 0;
+	EAccumulationMode accumulationMode = EAccumulationMode::RunningMean;
+	float pmAlpha = 0;	// m_alpha of the progressive technique, for the per-pixel statistics
+	glm::vec4 lightDirection = glm::normalize(glm::vec4(1, -1, 0, 0)); // Photon light direction, the one of the front shadow volume
+	uint32_t shadowVolume = 0; // Front shadow volume, both are bound to the estimates
 };
 
 struct CameraProperties
 {
+	friend class CPUPathTracer;
+
 	glm::vec3 position = glm::vec3(0, 0, -800);
 private:
 	int halfWidth = 800 / 2;
@@ -75,10 +88,13 @@ struct CloudProperties
 	float maxExtinction = 0.2f;
 	float baseScaling = 1000.f;
 	float densityScaling = 200.f;
+	unsigned int majorantBrickSize = 8; // Voxels per brick side of the majorant grid
 };
 
 struct Parameters
 {
+	friend class CPUPathTracer;
+
 public:
 	unsigned int maxRayBounces = 5;
 	float lightIntensity = 5;
@@ -109,11 +125,17 @@ public:
 	{
 		return phaseG;
 	}
+
+	bool IsIsotropic() const
+	{
+		return isotropic;
+	}
 };
 
 struct ShadowVolumeProperties
 {
 	friend glm::vec3 tests::calculateVoxelPosition(glm::uvec3 voxelIdx, ShadowVolumeProperties& shadowVolumeProperties);
+	friend class CPUPathTracer;
 
 private:
 	glm::vec4 bounds[2]{ glm::vec4(0), glm::vec4(0) };
@@ -166,31 +188,67 @@ private:
 	}
 };
 
-struct PhotonBeam
+// The radius is shared by all beams of a frame and is passed as a push constant
+struct PhotonBeam // 32 Bytes
 {
 	glm::vec3 startPos;
 	uint32_t mortonCode;
 	glm::vec3 endPos;
-	float radius;
 	uint32_t dataIdx;
-	uint32_t _padding_beam[3];
 };
 
-struct TreeNode
+// Build-time node, written by PPB_GenerateHierarchy.comp and PPB_CalculateAABB.comp
+struct TreeNode // 64 Bytes
 {
 	uint32_t parent;
 	uint32_t left;
 	uint32_t right;
-	bool isLeaf;
+	uint32_t isLeaf; // GLSL bool, if leaf, left indicates the beam idx in the sorted beams
 	glm::vec4 bounds[2];
 	uint32_t processed;
 	uint32_t _padding_node[3];
 };
 
-struct PhotonBeamData
+// Traversal-time node, packed from the build-time inner nodes by PPB_PackTree.comp or LBVH::Pack
+// Both child bounds are stored in the parent, so one node read tests both children
+struct CompactTreeNode // 32 Bytes
+{
+	static constexpr uint32_t LEAF_FLAG = 0x80000000u; // Set on a leaf child, the lower bits hold the beam idx
+
+	uint32_t children[2];
+	uint32_t bounds[6]; // Half precision per child, relative to the tree offset: (min.x, min.y), (min.z, max.x), (max.y, max.z)
+};
+
+struct PhotonBeamData // 48 Bytes
 {
 	glm::vec4 power;
-	float trDistances[16];
+	uint32_t trDistances[8]; // 16 half precision distances, two per element
+};
+
+// Stochastic progressive photon mapping statistics of a pixel, reset with the accumulation
+struct PixelStatistics
+{
+	float radius;
+	float photonCount; // Accumulated N, fractional because of the alpha factor
+};
+
+// Head of an adaptive sampling tile list, doubles as the indirect dispatch of the estimates
+struct TileListHeader
+{
+	static constexpr uint32_t TILE_SIZE = 32; // Workgroup size of the estimates, adaptive sampling and resolve
+	static constexpr float MIN_LUMINANCE = 1e-3f; // Keeps the relative error of dark pixels finite
+
+	uint32_t groupCountX = 0; // Unconverged tiles, one workgroup each
+	uint32_t groupCountY = 1;
+	uint32_t groupCountZ = 1;
+	uint32_t tileCount = 0; // All tiles of the image
+};
+
+// Per pixel of the accumulation buffer in compensated sum mode
+struct AccumulationTexel
+{
+	glm::vec4 sum;
+	glm::vec4 compensation; // Low-order bits lost by the last addition to the sum
 };
 
 struct SortElement
@@ -200,19 +258,18 @@ struct SortElement
 };
 
 // Jarosz et al. - 2008 - Advanced Global Illumination using Photon Maps
-struct Photon // 36 Bytes
+struct Photon // 48 Bytes
 {
 	glm::vec4 position;
 	glm::vec4 power;
 	float phi;
 	float theta;
-	float __padding[2];
+	uint32_t cellIdx; // Photon grid cell and the photon's slot in it, written by the photon tracer
+	uint32_t cellSlot;
 };
 
 struct PhotonMapProperties
 {
-	glm::vec4 lightDirection = glm::normalize(glm::vec4( 1,-1, 0,0));
-
 private:
 	glm::vec4 bounds[2]{ {0,0,0,0}, {100,100,100,100} };
 	glm::ivec3 voxelCount{ 100, 100, 100 };
@@ -35,6 +35,194 @@ void utilities::ReadFile(const std::string& filename, std::vector<char>& outData
 	file.close();
 }
 
+void utilities::SaveImage(const std::string& filename, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels)
+{
+	assert(pixels.size() >= size_t(width) * height);
+
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("Failed to open file");
+	}
+
+	bool isPFM = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0;
+	if (isPFM)
+	{
+		// Portable float map, little endian (negative scale), rows stored bottom to top
+		file << "PF\n" << width << " " << height << "\n-1.0\n";
+		std::vector<float> row(size_t(width) * 3);
+		for (uint32_t y = height; y-- > 0;)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				const glm::vec4& pixel = pixels[x + size_t(y) * width];
+				row[x * 3 + 0] = pixel.r;
+				row[x * 3 + 1] = pixel.g;
+				row[x * 3 + 2] = pixel.b;
+			}
+			file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+		}
+	}
+	else
+	{
+		// Binary portable pixmap, clamped and gamma corrected
+		file << "P6\n" << width << " " << height << "\n255\n";
+		std::vector<uint8_t> row(size_t(width) * 3);
+		for (uint32_t y = 0; y < height; y++)
+		{
+			for (uint32_t x = 0; x < width; x++)
+			{
+				glm::vec3 color = glm::pow(glm::clamp(glm::vec3(pixels[x + size_t(y) * width]), 0.f, 1.f), glm::vec3(1.f / 2.2f));
+				row[x * 3 + 0] = static_cast<uint8_t>(color.r * 255.f + .5f);
+				row[x * 3 + 1] = static_cast<uint8_t>(color.g * 255.f + .5f);
+				row[x * 3 + 2] = static_cast<uint8_t>(color.b * 255.f + .5f);
+			}
+			file.write(reinterpret_cast<const char*>(row.data()), row.size());
+		}
+	}
+
+	file.close();
+}
+
+void utilities::ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& function, unsigned int threadCount /*= 0*/)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, count));
+	if (threadCount <= 1)
+	{
+		if (count > 0)
+		{
+			function(0, count);
+		}
+		return;
+	}
+
+	size_t rangeSize = (count + threadCount - 1) / threadCount;
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount);
+	for (size_t begin = 0; begin < count; begin += rangeSize)
+	{
+		threads.emplace_back(function, begin, std::min(begin + rangeSize, count));
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+float utilities::ProgressiveRadiusScale(uint64_t previousCount, uint64_t count, float alpha)
+{
+	// Closed form of the product over j in [1, count] of (k + j + alpha) / (k + j + 1), with k = previousCount:
+	// G(k + n + 1 + alpha) G(k + 2) / (G(k + 1 + alpha) G(k + n + 2)), with G the gamma function
+	double k = static_cast<double>(previousCount);
+	double n = static_cast<double>(count);
+	double a = static_cast<double>(alpha);
+	if (previousCount < 1024)
+	{
+		return static_cast<float>(std::exp(std::lgamma(k + n + 1 + a) - std::lgamma(k + 1 + a) - std::lgamma(k + n + 2) + std::lgamma(k + 2)));
+	}
+
+	// The log gamma differences cancel out for large k, use the expansion of ln(G(x + alpha) / G(x + 1)) in 1 / x instead
+	double c1 = (a - 1) * a / 2;
+	double c2 = (a - 1) * (a - 2) * (3 * a * a - a) / 24;
+	double x1 = k + 1;
+	double x2 = k + n + 1;
+	double logScale = (a - 1) * std::log1p(n / x1) + std::log1p(c1 / x2 + c2 / (x2 * x2)) - std::log1p(c1 / x1 + c2 / (x1 * x1));
+	return static_cast<float>(std::exp(logScale));
+}
+
+void utilities::UpdatePixelStatistics(PixelStatistics& statistics, float newCount, float alpha, float dimensions)
+{
+	// Hachisuka and Jensen - 2009 - Stochastic Progressive Photon Mapping
+	// N' = N + alpha M, R' = R ((N + alpha M) / (N + M))^(1 / dimensions), as in PPM_PE.comp and PPB_PE.comp
+	if (newCount <= 0)
+	{
+		return;
+	}
+
+	float accumulatedCount = statistics.photonCount + alpha * newCount;
+	statistics.radius *= std::pow(accumulatedCount / (statistics.photonCount + newCount), 1.f / dimensions);
+	statistics.photonCount = accumulatedCount;
+}
+
+void utilities::AccumulateMoments(glm::vec4& moments, const glm::vec4& sample)
+{
+	float luminance = glm::dot(glm::vec3(sample), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	moments.z += 1;
+	moments.x += (luminance - moments.x) / moments.z;
+	moments.y += (luminance * luminance - moments.y) / moments.z;
+}
+
+float utilities::RelativeError(const glm::vec4& moments)
+{
+	float variance = std::max(moments.y - moments.x * moments.x, 0.f);
+	return std::sqrt(variance / std::max(moments.z, 1.f)) / std::max(moments.x, TileListHeader::MIN_LUMINANCE);
+}
+
+uint32_t utilities::ClassifyTiles(const std::vector<glm::vec4>& moments, uint32_t width, uint32_t height, float targetError, uint32_t minSamples, std::vector<uint32_t>& outTiles)
+{
+	assert(moments.size() >= static_cast<size_t>(width) * height);
+	const uint32_t tileSize = TileListHeader::TILE_SIZE;
+
+	outTiles.clear();
+	for (uint32_t tileY = 0; tileY * tileSize < height; tileY++)
+	{
+		for (uint32_t tileX = 0; tileX * tileSize < width; tileX++)
+		{
+			// A tile is sampled again as long as one of its pixels is not converged
+			bool converged = targetError > 0;
+			for (uint32_t y = tileY * tileSize; converged && y < std::min((tileY + 1) * tileSize, height); y++)
+			{
+				for (uint32_t x = tileX * tileSize; converged && x < std::min((tileX + 1) * tileSize, width); x++)
+				{
+					const glm::vec4& pixel = moments[x + static_cast<size_t>(y) * width];
+					converged = pixel.z >= minSamples && RelativeError(pixel) <= targetError;
+				}
+			}
+
+			if (!converged)
+			{
+				outTiles.push_back(tileX | (tileY << 16));
+			}
+		}
+	}
+	return static_cast<uint32_t>(outTiles.size());
+}
+
+void utilities::AccumulateMean(glm::vec4& mean, const glm::vec4& sample, float sampleCount)
+{
+	mean += (sample - mean) / sampleCount;
+}
+
+void utilities::AccumulateCompensated(AccumulationTexel& texel, const glm::vec4& sample)
+{
+	glm::vec4 y = sample - texel.compensation;
+	glm::vec4 t = texel.sum + y;
+	texel.compensation = (t - texel.sum) - y;
+	texel.sum = t;
+}
+
+glm::vec4 utilities::ResolveAccumulation(const AccumulationTexel& texel, float sampleCount)
+{
+	return (texel.sum - texel.compensation) / std::max(sampleCount, 1.f);
+}
+
+uint32_t utilities::GetMipLevelCount(VkExtent3D extent)
+{
+	uint32_t maxExtent = std::max(std::max(extent.width, extent.height), extent.depth);
+	uint32_t levels = 1;
+	while (maxExtent > 1)
+	{
+		maxExtent >>= 1;
+		levels++;
+	}
+	return levels;
+}
+
 VkCommandBuffer utilities::BeginSingleTimeCommands(VulkanDevice* device, VulkanCommandPool* g_computeCommandPool)
 {
 	VkCommandBufferAllocateInfo allocInfo = {};
@@ -70,7 +258,7 @@ void utilities::EndSingleTimeCommands(VulkanDevice* device, VulkanCommandPool* c
 	vkFreeCommandBuffers(device->GetDevice(), commandPool->GetCommandPool(), 1, &commandBuffer);
 }
 
-void utilities::CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout)
+void utilities::CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t levelCount /*= 1*/)
 
 {
 	VkImageMemoryBarrier imgBarrier = {};
@@ -82,7 +270,7 @@ void utilities::CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage
 	imgBarrier.image = image;
 	imgBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	imgBarrier.subresourceRange.baseMipLevel = 0;
-	imgBarrier.subresourceRange.levelCount = 1;
+	imgBarrier.subresourceRange.levelCount = levelCount;
 	imgBarrier.subresourceRange.baseArrayLayer = 0;
 	imgBarrier.subresourceRange.layerCount = 1;
 	imgBarrier.srcAccessMask = 0;
@@ -91,7 +279,62 @@ void utilities::CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage
 	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
 }
 
-void utilities::CmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, VkExtent3D imageExtent)
+void utilities::CmdGenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkExtent3D extent, uint32_t mipLevels)
+{
+	VkImageMemoryBarrier imgBarrier = {};
+	imgBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imgBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imgBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imgBarrier.image = image;
+	imgBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imgBarrier.subresourceRange.levelCount = 1;
+	imgBarrier.subresourceRange.baseArrayLayer = 0;
+	imgBarrier.subresourceRange.layerCount = 1;
+
+	VkImageSubresourceLayers layers{};
+	layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	layers.layerCount = 1;
+
+	VkOffset3D srcExtent = { static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), static_cast<int32_t>(extent.depth) };
+	for (uint32_t level = 1; level < mipLevels; level++)
+	{
+		// Previous level becomes the blit source once its writes are done
+		imgBarrier.subresourceRange.baseMipLevel = level - 1;
+		imgBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		imgBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imgBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		imgBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+
+		// A linear blit of half the extent averages 2x2x2 voxels
+		VkOffset3D dstExtent = { std::max(srcExtent.x / 2, 1), std::max(srcExtent.y / 2, 1), std::max(srcExtent.z / 2, 1) };
+		VkImageBlit blit{};
+		blit.srcOffsets[1] = srcExtent;
+		blit.srcSubresource = layers;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.dstOffsets[1] = dstExtent;
+		blit.dstSubresource = layers;
+		blit.dstSubresource.mipLevel = level;
+		vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+
+		imgBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		imgBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imgBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		imgBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+
+		srcExtent = dstExtent;
+	}
+
+	imgBarrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	imgBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imgBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imgBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imgBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imgBarrier);
+}
+
+void utilities::CmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, VkExtent3D imageExtent, VkOffset3D imageOffset /*= { 0, 0, 0 }*/)
 
 {
 	VkBufferImageCopy region = {};
@@ -104,9 +347,26 @@ void utilities::CmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buf
 	region.imageSubresource.baseArrayLayer = 0;
 	region.imageSubresource.layerCount = 1;
 
-	region.imageOffset = { 0, 0, 0 };
+	region.imageOffset = imageOffset;
 	region.imageExtent = imageExtent;
 
 	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 }
 
+void utilities::CmdCopyImageToBuffer(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer, VkExtent3D imageExtent)
+{
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = imageExtent;
+
+	vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+}
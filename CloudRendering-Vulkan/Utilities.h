@@ -2,15 +2,51 @@
 
 class VulkanCommandPool;
 class VulkanDevice;
+struct PixelStatistics;
+struct AccumulationTexel;
 
 namespace utilities
 {
 	void GetOrthonormalBasis(const glm::vec3& fwd, glm::vec3& outRight, glm::vec3& outUp);
 	void ReadFile(const std::string& filename, std::vector<char>& outData);
+	void SaveImage(const std::string& filename, uint32_t width, uint32_t height, const std::vector<glm::vec4>& pixels);
+
+	// Splits [0, count) into contiguous ranges, one per hardware thread (threadCount = 0)
+	void ParallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& function, unsigned int threadCount = 0);
+
+	// Radius scale after count more photons, following r_{i+1} = r_i (i + alpha) / (i + 1) from the (previousCount + 1)-th photon
+	float ProgressiveRadiusScale(uint64_t previousCount, uint64_t count, float alpha);
+
+	// SPPM update with newCount photons found inside the radius, dimensions of the kernel (3 for photons, 1 for beams)
+	void UpdatePixelStatistics(PixelStatistics& statistics, float newCount, float alpha, float dimensions);
+
+	// Running mean of the sample luminance (x) and its square (y), sample count in z, as written by the estimates
+	void AccumulateMoments(glm::vec4& moments, const glm::vec4& sample);
+
+	// Standard error of the pixel mean relative to the mean luminance
+	float RelativeError(const glm::vec4& moments);
+
+	// CPU version of AdaptiveTiles.comp, returns the unconverged tile count, tiles packed as x | y << 16
+	uint32_t ClassifyTiles(const std::vector<glm::vec4>& moments, uint32_t width, uint32_t height, float targetError, uint32_t minSamples, std::vector<uint32_t>& outTiles);
+
+	// Running mean of the samples, the sample count includes the new sample
+	void AccumulateMean(glm::vec4& mean, const glm::vec4& sample, float sampleCount);
+
+	// Kahan-compensated sum as in the compensated sum mode of the estimates, needs strict floating point (no /fp:fast)
+	void AccumulateCompensated(AccumulationTexel& texel, const glm::vec4& sample);
+
+	// Mean of a compensated sum, as Resolve.comp
+	glm::vec4 ResolveAccumulation(const AccumulationTexel& texel, float sampleCount);
+
+	// Levels of a full mip chain down to a single voxel
+	uint32_t GetMipLevelCount(VkExtent3D extent);
 
 	VkCommandBuffer BeginSingleTimeCommands(VulkanDevice* device, VulkanCommandPool* commandPool);
 	void EndSingleTimeCommands(VulkanDevice* device, VulkanCommandPool* commandPool, VkCommandBuffer commandBuffer);
 
-	void CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
-	void CmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, VkExtent3D imageExtent);
+	void CmdTransitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t levelCount = 1);
+	// Box filters every level from the previous one, level 0 in transfer dst layout. All levels end up shader read only
+	void CmdGenerateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkExtent3D extent, uint32_t mipLevels);
+	void CmdCopyBufferToImage(VkCommandBuffer commandBuffer, VkBuffer buffer, VkImage image, VkExtent3D imageExtent, VkOffset3D imageOffset = { 0, 0, 0 });
+	void CmdCopyImageToBuffer(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer, VkExtent3D imageExtent);
 }
\ No newline at end of file
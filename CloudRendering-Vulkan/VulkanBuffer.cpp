@@ -11,14 +11,24 @@ VulkanBuffer::VulkanBuffer(VulkanDevice* device, void* data, size_t elementSize,
 	m_elementSize = elementSize;
 	m_count = count;
 	m_totalSize = (VkDeviceSize)m_elementSize * m_count;
-	AllocateBuffer(usageFlags);
+	AllocateBuffer(usageFlags, m_ptr ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+}
+
+VulkanBuffer::VulkanBuffer(VulkanDevice* device, size_t elementSize, VkBufferUsageFlags usageFlags, size_t count, VkMemoryPropertyFlags memoryFlags)
+{
+	m_device = device;
+	m_ptr = nullptr;
+	m_elementSize = elementSize;
+	m_count = count;
+	m_totalSize = (VkDeviceSize)m_elementSize * m_count;
+	AllocateBuffer(usageFlags, memoryFlags);
 }
 
 VulkanBuffer::~VulkanBuffer()
 {
 	if (m_deviceMemory != VK_NULL_HANDLE)
 	{
-		if (m_ptr)
+		if (m_mappedMemory)
 		{
 			vkUnmapMemory(m_device->GetDevice(), m_deviceMemory);
 		}
@@ -75,7 +85,12 @@ VkDeviceSize VulkanBuffer::GetSize()
 	return m_totalSize;
 }
 
-void VulkanBuffer::AllocateBuffer(VkBufferUsageFlags usageFlags)
+void* VulkanBuffer::GetMappedMemory()
+{
+	return m_mappedMemory;
+}
+
+void VulkanBuffer::AllocateBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags)
 {
 	VkBufferCreateInfo bufferInfo = initializers::BufferCreateInfo(m_totalSize, usageFlags);
 
@@ -85,15 +100,14 @@ void VulkanBuffer::AllocateBuffer(VkBufferUsageFlags usageFlags)
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(m_device->GetDevice(), m_buffer, &memRequirements);
 
-	VkMemoryPropertyFlags flags = m_ptr ? VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-	VkMemoryAllocateInfo allocInfo = initializers::MemoryAllocateInfo(memRequirements.size, m_device->FindMemoryType(flags, memRequirements.memoryTypeBits));
+	VkMemoryAllocateInfo allocInfo = initializers::MemoryAllocateInfo(memRequirements.size, m_device->FindMemoryType(memoryFlags, memRequirements.memoryTypeBits));
 
 	// Allocate memory for the buffer and bind it
 	ValidCheck(vkAllocateMemory(m_device->GetDevice(), &allocInfo, nullptr, &m_deviceMemory));
 	ValidCheck(vkBindBufferMemory(m_device->GetDevice(), m_buffer, m_deviceMemory, 0));
 
-	// Only map memory if there is a pointer to a host memory block
-	if (m_ptr)
+	// Only map memory that the host can see
+	if (memoryFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
 	{
 		ValidCheck(vkMapMemory(m_device->GetDevice(), m_deviceMemory, 0, memRequirements.size, 0, &m_mappedMemory));
 	}
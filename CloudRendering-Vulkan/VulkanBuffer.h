@@ -6,6 +6,8 @@ class VulkanBuffer
 {
 public:
 	VulkanBuffer(VulkanDevice* device, void* data, size_t elementSize, VkBufferUsageFlags usageFlags, size_t count = 1);
+	// Buffer without a host copy, host visible memory stays mapped for direct writes
+	VulkanBuffer(VulkanDevice* device, size_t elementSize, VkBufferUsageFlags usageFlags, size_t count, VkMemoryPropertyFlags memoryFlags);
 	~VulkanBuffer();
 
 	virtual void SetData();
@@ -14,19 +16,20 @@ public:
 	void GetData();
 	VkBuffer GetBuffer();
 	VkDeviceSize GetSize();
+	void* GetMappedMemory();
 
 private:
-	void AllocateBuffer(VkBufferUsageFlags usageFlags);
+	void AllocateBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryFlags);
 
 private:
 	VulkanDevice* m_device;
-	VkBuffer m_buffer;
+	VkBuffer m_buffer = VK_NULL_HANDLE;
 	
 	void* m_ptr;
 	size_t m_elementSize;
 	size_t m_count;
-	void* m_mappedMemory;
+	void* m_mappedMemory = nullptr;
 
 	VkDeviceSize m_totalSize;
-	VkDeviceMemory m_deviceMemory;
+	VkDeviceMemory m_deviceMemory = VK_NULL_HANDLE;
 };
\ No newline at end of file
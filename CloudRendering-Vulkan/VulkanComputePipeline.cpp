@@ -5,27 +5,80 @@
 #include "VulkanPipelineLayout.h"
 #include "VulkanShaderModule.h"
 
-VulkanComputePipeline::VulkanComputePipeline(VulkanDevice* device, VulkanPipelineLayout* layout, VulkanShaderModule* shaderModule)
+VulkanComputePipeline::VulkanComputePipeline(VulkanDevice* device, VulkanPipelineLayout* layout, VulkanShaderModule* shaderModule, const std::vector<uint32_t>& specialization /*= {}*/)
 {
 	m_device = device;
+	m_layout = layout->GetPipelineLayout();
+	m_shaderModule = shaderModule->GetShaderModule();
 
-	VkComputePipelineCreateInfo computeInfo{};
-	computeInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-	computeInfo.layout = layout->GetPipelineLayout();
-	computeInfo.stage = initializers::PipelineShaderStageCreateInfo(shaderModule->GetShaderModule(), VK_SHADER_STAGE_COMPUTE_BIT);
-
-	ValidCheck(vkCreateComputePipelines(m_device->GetDevice(), VK_NULL_HANDLE, 1, &computeInfo, nullptr, &m_computePipeline));
+	SetPermutation(specialization);
 }
 
 VulkanComputePipeline::~VulkanComputePipeline()
 {
-	if (m_computePipeline != VK_NULL_HANDLE)
+	for (auto& permutation : m_permutations)
+	{
+		VkPipeline pipeline = permutation.second.get();
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(m_device->GetDevice(), pipeline, nullptr);
+		}
+	}
+}
+
+void VulkanComputePipeline::AddPermutation(const std::vector<uint32_t>& specialization)
+{
+	if (m_permutations.count(specialization))
+	{
+		return;
+	}
+
+	// Pipeline caches are synchronized internally, the workers can share the device's one
+	VkDevice vkDevice = m_device->GetDevice();
+	VkPipelineCache pipelineCache = m_device->GetPipelineCache();
+	VkPipelineLayout layout = m_layout;
+	VkShaderModule shaderModule = m_shaderModule;
+	m_permutations[specialization] = std::async(std::launch::async, [vkDevice, pipelineCache, layout, shaderModule, specialization]()
+	{
+		std::vector<VkSpecializationMapEntry> mapEntries(specialization.size());
+		for (uint32_t i = 0; i < mapEntries.size(); i++)
+		{
+			mapEntries[i] = { i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t) };
+		}
+
+		VkSpecializationInfo specializationInfo{};
+		specializationInfo.mapEntryCount = static_cast<uint32_t>(mapEntries.size());
+		specializationInfo.pMapEntries = mapEntries.data();
+		specializationInfo.dataSize = specialization.size() * sizeof(uint32_t);
+		specializationInfo.pData = specialization.data();
+
+		VkComputePipelineCreateInfo computeInfo{};
+		computeInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		computeInfo.layout = layout;
+		computeInfo.stage = initializers::PipelineShaderStageCreateInfo(shaderModule, VK_SHADER_STAGE_COMPUTE_BIT);
+		computeInfo.stage.pSpecializationInfo = specialization.empty() ? nullptr : &specializationInfo;
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		ValidCheck(vkCreateComputePipelines(vkDevice, pipelineCache, 1, &computeInfo, nullptr, &pipeline));
+		return pipeline;
+	}).share();
+}
+
+void VulkanComputePipeline::SetPermutation(const std::vector<uint32_t>& specialization)
+{
+	AddPermutation(specialization);
+	if (specialization != m_specialization)
 	{
-		vkDestroyPipeline(m_device->GetDevice(), m_computePipeline, nullptr);
+		m_specialization = specialization;
+		m_computePipeline = VK_NULL_HANDLE;
 	}
 }
 
 VkPipeline VulkanComputePipeline::GetPipeline()
 {
+	if (m_computePipeline == VK_NULL_HANDLE)
+	{
+		m_computePipeline = m_permutations.at(m_specialization).get();
+	}
 	return m_computePipeline;
 }
@@ -4,15 +4,28 @@ class VulkanDevice;
 class VulkanPipelineLayout;
 class VulkanShaderModule;
 
+// Created on a worker thread so the pipelines of all techniques compile concurrently, GetPipeline waits for it.
+// Specialization constant i is constant_id i of the shader, each permutation is compiled once and kept.
+// The layout and shader module have to outlive the pipeline object.
 class VulkanComputePipeline
 {
 public:
-	VulkanComputePipeline(VulkanDevice* device, VulkanPipelineLayout* layout, VulkanShaderModule* shaderModule);
+	VulkanComputePipeline(VulkanDevice* device, VulkanPipelineLayout* layout, VulkanShaderModule* shaderModule, const std::vector<uint32_t>& specialization = {});
 	~VulkanComputePipeline();
 
+	// Starts compiling a permutation without selecting it
+	void AddPermutation(const std::vector<uint32_t>& specialization);
+	// Selects the permutation GetPipeline returns, compiling it first if it was never added
+	void SetPermutation(const std::vector<uint32_t>& specialization);
+
 	VkPipeline GetPipeline();
 
 private:
 	VulkanDevice* m_device = nullptr;
-	VkPipeline m_computePipeline = VK_NULL_HANDLE;
+	VkPipelineLayout m_layout = VK_NULL_HANDLE;
+	VkShaderModule m_shaderModule = VK_NULL_HANDLE;
+
+	std::map<std::vector<uint32_t>, std::shared_future<VkPipeline>> m_permutations;
+	std::vector<uint32_t> m_specialization;
+	VkPipeline m_computePipeline = VK_NULL_HANDLE; // Of the selected permutation, once it is compiled
 };
@@ -9,4 +9,7 @@ struct VulkanConfiguration
 	const uint32_t engineVersion = VK_MAKE_VERSION(0, 0, 0);
 
 	const uint32_t apiVersion = VK_MAKE_VERSION(1, 2, 131);
+
+	// No window, surface or swapchain (offscreen rendering)
+	bool headless = false;
 };
\ No newline at end of file
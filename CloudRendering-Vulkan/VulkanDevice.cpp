@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "VulkanDevice.h"
 
+#include "VulkanPipelineCache.h"
+
 VulkanDevice::VulkanDevice(VulkanInstance* instance, VulkanSurface* surface, VulkanPhysicalDevice* physicalDevice)
 {
 	m_instance = instance;
@@ -8,7 +10,11 @@ VulkanDevice::VulkanDevice(VulkanInstance* instance, VulkanSurface* surface, Vul
 	m_surface = surface;
 
 	QueueFamilyIndices& indices = m_physicalDevice->GetQueueFamilyIndices();
-	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily};
+	std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily, indices.computeFamily };
+	if (indices.presentFamily != UINT32_MAX)
+	{
+		uniqueQueueFamilies.insert(indices.presentFamily);
+	}
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	float priority = 1.0f;
@@ -22,7 +28,10 @@ VulkanDevice::VulkanDevice(VulkanInstance* instance, VulkanSurface* surface, Vul
 
 	vkGetDeviceQueue(m_device, indices.computeFamily, 0, &m_computeQueue);
 	vkGetDeviceQueue(m_device, indices.graphicsFamily, 0, &m_graphicsQueue);
-	vkGetDeviceQueue(m_device, indices.presentFamily, 0, &m_presentQueue);
+	if (indices.presentFamily != UINT32_MAX)
+	{
+		vkGetDeviceQueue(m_device, indices.presentFamily, 0, &m_presentQueue);
+	}
 }
 
 VulkanDevice::~VulkanDevice()
@@ -81,3 +90,13 @@ uint32_t VulkanDevice::FindMemoryType(VkMemoryPropertyFlags props, uint32_t type
 	assert(0 && "No available memory properties");
 	return UINT32_MAX;
 }
+
+void VulkanDevice::SetPipelineCache(VulkanPipelineCache* pipelineCache)
+{
+	m_pipelineCache = pipelineCache;
+}
+
+VkPipelineCache VulkanDevice::GetPipelineCache()
+{
+	return m_pipelineCache ? m_pipelineCache->GetPipelineCache() : VK_NULL_HANDLE;
+}
@@ -5,6 +5,7 @@
 
 // Fwd. decl.
 class VulkanInstance;
+class VulkanPipelineCache;
 
 class VulkanDevice
 {
@@ -23,6 +24,10 @@ public:
 
 	uint32_t FindMemoryType(VkMemoryPropertyFlags props, uint32_t typeFilter);
 
+	// Used by every pipeline created afterwards, owned by the caller
+	void SetPipelineCache(VulkanPipelineCache* pipelineCache);
+	VkPipelineCache GetPipelineCache();
+
 private:
 	VulkanInstance* m_instance = nullptr;
 	VulkanPhysicalDevice* m_physicalDevice = nullptr;
@@ -32,4 +37,5 @@ private:
 	VkQueue m_computeQueue = VK_NULL_HANDLE;
 	VkQueue m_graphicsQueue = VK_NULL_HANDLE;
 	VkQueue m_presentQueue = VK_NULL_HANDLE;
+	VulkanPipelineCache* m_pipelineCache = nullptr;
 };
\ No newline at end of file
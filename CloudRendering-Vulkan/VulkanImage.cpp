@@ -3,11 +3,12 @@
 
 #include "VulkanDevice.h"
 
-VulkanImage::VulkanImage(VulkanDevice* device, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height /*= 1*/, uint32_t depth /*= 1*/)
+VulkanImage::VulkanImage(VulkanDevice* device, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height /*= 1*/, uint32_t depth /*= 1*/, uint32_t mipLevels /*= 1*/)
 {
 	m_device = device;
 	m_format = format;
 	m_extents = { width, height, depth };
+	m_mipLevels = mipLevels;
 
 	VkImageType type = VK_IMAGE_TYPE_1D;
 	if (depth > 1)
@@ -19,7 +20,7 @@ VulkanImage::VulkanImage(VulkanDevice* device, VkFormat format, VkImageUsageFlag
 		type = VK_IMAGE_TYPE_2D;
 	}
 
-	VkImageCreateInfo imageInfo = initializers::ImageCreateInfo(type, m_format, m_extents, 1, 1, VK_SAMPLE_COUNT_1_BIT, usage);
+	VkImageCreateInfo imageInfo = initializers::ImageCreateInfo(type, m_format, m_extents, m_mipLevels, 1, VK_SAMPLE_COUNT_1_BIT, usage);
 
 	ValidCheck(vkCreateImage(m_device->GetDevice(), &imageInfo, nullptr, &m_image));
 
@@ -47,6 +48,7 @@ VulkanImage::VulkanImage(VulkanImage&& other) noexcept
 	m_image = std::move(other.m_image);
 	m_format = std::move(other.m_format);
 	m_extents = std::move(other.m_extents);
+	m_mipLevels = other.m_mipLevels;
 
 	other.m_device = nullptr;
     other.m_deviceMemory = VK_NULL_HANDLE;
@@ -60,6 +62,7 @@ VulkanImage::VulkanImage(const VulkanImage&& other)
 	m_image = other.m_image;
 	m_format = other.m_format;
 	m_extents = other.m_extents;
+	m_mipLevels = other.m_mipLevels;
 }
 
 VulkanImage::~VulkanImage()
@@ -85,3 +88,8 @@ VkExtent3D VulkanImage::GetExtent()
 {
 	return m_extents;
 }
+
+uint32_t VulkanImage::GetMipLevels()
+{
+	return m_mipLevels;
+}
@@ -5,7 +5,7 @@ class VulkanDevice;
 class VulkanImage
 {
 public:
-	VulkanImage(VulkanDevice* device, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height = 1, uint32_t depth = 1);
+	VulkanImage(VulkanDevice* device, VkFormat format, VkImageUsageFlags usage, uint32_t width, uint32_t height = 1, uint32_t depth = 1, uint32_t mipLevels = 1);
 	VulkanImage(VulkanImage&& other) noexcept;
 	VulkanImage(const VulkanImage&& other);
 	~VulkanImage();
@@ -13,6 +13,7 @@ public:
 	VkImage GetImage();
 	VkFormat GetFormat();
 	VkExtent3D GetExtent();
+	uint32_t GetMipLevels();
 
 private:
 	VulkanDevice* m_device = nullptr;
@@ -21,4 +22,5 @@ private:
 	VkDeviceMemory m_deviceMemory;
 
 	VkExtent3D m_extents;
+	uint32_t m_mipLevels = 1;
 };
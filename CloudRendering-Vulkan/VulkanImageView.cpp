@@ -19,7 +19,7 @@ VulkanImageView::VulkanImageView(VulkanDevice* device, VulkanImage* image)
 		viewType = VK_IMAGE_VIEW_TYPE_2D;
 	}
 
-	VkImageViewCreateInfo viewInfo = initializers::ImageViewCreateInfo(image->GetImage(), viewType, image->GetFormat());
+	VkImageViewCreateInfo viewInfo = initializers::ImageViewCreateInfo(image->GetImage(), viewType, image->GetFormat(), image->GetMipLevels());
 	ValidCheck(vkCreateImageView(m_device->GetDevice(), &viewInfo, nullptr, &m_imageView));
 }
 
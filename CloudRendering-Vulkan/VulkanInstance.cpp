@@ -3,18 +3,25 @@
 
 VulkanInstance::VulkanInstance(const VulkanConfiguration& config)
 {
-	// Initialize GLFW required extensions
-	uint32_t count;
-	const char** extensions = glfwGetRequiredInstanceExtensions(&count);;
-	m_extensions.resize(count);
-	for (uint32_t i = 0; i < count; i++)
+	// Initialize GLFW required extensions, a headless instance does not need any surface extension
+	if (!config.headless)
 	{
-		m_extensions[i] = extensions[i];
+		uint32_t count;
+		const char** extensions = glfwGetRequiredInstanceExtensions(&count);;
+		m_extensions.resize(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			m_extensions[i] = extensions[i];
+		}
 	}
 
-	//m_layers.push_back("VK_LAYER_LUNARG_api_dump");
-	m_layers.push_back("VK_LAYER_KHRONOS_validation");
-	m_extensions.push_back("VK_EXT_debug_report");
+	// Only enable validation if the layer is installed (e.g. not present on CI machines)
+	if (IsLayerAvailable("VK_LAYER_KHRONOS_validation"))
+	{
+		//m_layers.push_back("VK_LAYER_LUNARG_api_dump");
+		m_layers.push_back("VK_LAYER_KHRONOS_validation");
+		m_extensions.push_back("VK_EXT_debug_report");
+	}
 	
 	VkApplicationInfo appInfo = initializers::ApplicationInfo(config);
 	VkInstanceCreateInfo instanceInfo = initializers::InstanceCreateInfo(appInfo, m_layers, m_extensions);
@@ -34,3 +41,21 @@ VkInstance& VulkanInstance::GetInstance()
 {
 	return m_instance;
 }
+
+bool VulkanInstance::IsLayerAvailable(const char* layerName)
+{
+	uint32_t layerCount;
+	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+	std::vector<VkLayerProperties> availableLayers(layerCount);
+	vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+	for (const auto& layer : availableLayers)
+	{
+		if (strcmp(layer.layerName, layerName) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
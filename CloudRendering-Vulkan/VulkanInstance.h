@@ -10,6 +10,9 @@ public:
 
 	VkInstance& GetInstance();
 
+private:
+	static bool IsLayerAvailable(const char* layerName);
+
 private:
 	VkInstance m_instance;
 	std::vector<const char*> m_layers;
@@ -12,7 +12,7 @@ VulkanPhysicalDevice* VulkanPhysicalDevice::CreatePhysicalDevice(VulkanInstance*
 	VkPhysicalDevice secondaryDevice = VK_NULL_HANDLE;
 	QueueFamilyIndices secondaryQueue;
 
-	// Try to find a discrete GPU with present capabilities
+	// Try to find a discrete GPU with present capabilities (surface is null when rendering headless)
 	for (auto& device : devices)
 	{
 		QueueFamilyIndices queueFamily;
@@ -25,10 +25,11 @@ VulkanPhysicalDevice* VulkanPhysicalDevice::CreatePhysicalDevice(VulkanInstance*
 			{
 				return new VulkanPhysicalDevice(instance, device, queueFamily, deviceExtensions);
 			}
-			else
+			else if (secondaryDevice == VK_NULL_HANDLE)
 			{
-				VkPhysicalDevice secondaryDevice = device;
-				QueueFamilyIndices secondaryQueue = queueFamily;
+				// Integrated or software (e.g. lavapipe) device as fallback
+				secondaryDevice = device;
+				secondaryQueue = queueFamily;
 			}
 		}
 	}
@@ -64,8 +65,8 @@ bool VulkanPhysicalDevice::CheckPhysicalDeviceSupported(VkPhysicalDevice& device
 	bool extensionsSupported = CheckDeviceExtensionsSupported(device, extensions);
 
 	// SwapChain support
-	bool swapchainAdequate = false;
-	if (extensionsSupported)
+	bool swapchainAdequate = surface == nullptr;
+	if (extensionsSupported && surface)
 	{
 		SwapchainSupportDetails swapchainSupport = QuerySwapchainSupport(device, surface);
 		swapchainAdequate = !swapchainSupport.formats.empty() && !swapchainSupport.presentModes.empty();
@@ -90,7 +91,10 @@ bool VulkanPhysicalDevice::CheckQueueFamilySupported(VkPhysicalDevice& device, Q
 		if (queueFamily.queueCount > 0)
 		{
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface->GetSurface(), &presentSupport);
+			if (surface)
+			{
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface->GetSurface(), &presentSupport);
+			}
 			if (presentSupport)
 			{
 				familyIndices.presentFamily = i;
@@ -105,7 +109,7 @@ bool VulkanPhysicalDevice::CheckQueueFamilySupported(VkPhysicalDevice& device, Q
 			}
 		}
 
-		if (familyIndices.IsComplete())
+		if (familyIndices.IsComplete(surface != nullptr))
 		{
 			return true;
 		}
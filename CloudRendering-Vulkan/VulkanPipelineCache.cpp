@@ -0,0 +1,80 @@
+#include "stdafx.h"
+#include "VulkanPipelineCache.h"
+
+#include "VulkanDevice.h"
+
+VulkanPipelineCache::VulkanPipelineCache(VulkanDevice* device, const std::string& filename)
+{
+	m_device = device;
+	m_filename = filename;
+
+	// A missing file starts an empty cache
+	std::vector<char> data;
+	std::ifstream file(m_filename, std::ios::ate | std::ios::binary);
+	if (file.is_open())
+	{
+		data.resize(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(data.data(), data.size());
+	}
+
+	if (!data.empty() && !IsCompatible(data))
+	{
+		std::cout << "Pipeline cache \"" << m_filename << "\" was written by another device or driver, it is rebuilt" << std::endl;
+		data.clear();
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+	ValidCheck(vkCreatePipelineCache(m_device->GetDevice(), &cacheInfo, nullptr, &m_pipelineCache));
+}
+
+VulkanPipelineCache::~VulkanPipelineCache()
+{
+	if (m_pipelineCache != VK_NULL_HANDLE)
+	{
+		vkDestroyPipelineCache(m_device->GetDevice(), m_pipelineCache, nullptr);
+	}
+}
+
+void VulkanPipelineCache::Save()
+{
+	size_t size = 0;
+	ValidCheck(vkGetPipelineCacheData(m_device->GetDevice(), m_pipelineCache, &size, nullptr));
+	std::vector<char> data(size);
+	ValidCheck(vkGetPipelineCacheData(m_device->GetDevice(), m_pipelineCache, &size, data.data()));
+
+	// Not being able to write the cache only costs the next start its pipelines
+	std::ofstream file(m_filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "Failed to write pipeline cache \"" << m_filename << "\"" << std::endl;
+		return;
+	}
+	file.write(data.data(), size);
+}
+
+VkPipelineCache VulkanPipelineCache::GetPipelineCache()
+{
+	return m_pipelineCache;
+}
+
+bool VulkanPipelineCache::IsCompatible(const std::vector<char>& data)
+{
+	// Drivers reject foreign caches themselves, but not all of them do it gracefully
+	VkPipelineCacheHeaderVersionOne header{};
+	if (data.size() < sizeof(header))
+	{
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+
+	const VkPhysicalDeviceProperties& properties = m_device->GetPhysicalDevice()->GetPhysicalDeviceProperties();
+	return header.headerSize >= sizeof(header)
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == properties.vendorID
+		&& header.deviceID == properties.deviceID
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
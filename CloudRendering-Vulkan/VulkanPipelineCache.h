@@ -0,0 +1,24 @@
+#pragma once
+
+class VulkanDevice;
+
+// Pipeline cache persisted to a file, discarded when it was written by another device or driver
+class VulkanPipelineCache
+{
+public:
+	VulkanPipelineCache(VulkanDevice* device, const std::string& filename);
+	~VulkanPipelineCache();
+
+	// Writes the cache back to its file, pipelines created since loading included
+	void Save();
+
+	VkPipelineCache GetPipelineCache();
+
+private:
+	bool IsCompatible(const std::vector<char>& data);
+
+private:
+	VulkanDevice* m_device = nullptr;
+	VkPipelineCache m_pipelineCache = VK_NULL_HANDLE;
+	std::string m_filename;
+};
@@ -3,11 +3,11 @@
 
 #include "VulkanDevice.h"
 
-VulkanSampler::VulkanSampler(VulkanDevice* device)
+VulkanSampler::VulkanSampler(VulkanDevice* device, float maxLod /*= 0.0f*/)
 {
 	m_device = device;
 
-    VkSamplerCreateInfo samplerInfo = initializers::SamplerCreateInfo();
+    VkSamplerCreateInfo samplerInfo = initializers::SamplerCreateInfo(maxLod);
 	vkCreateSampler(m_device->GetDevice(), &samplerInfo, nullptr, &m_sampler);
 }
 
@@ -5,7 +5,7 @@ class VulkanDevice;
 class VulkanSampler
 {
 public:
-	VulkanSampler(VulkanDevice* device);
+	VulkanSampler(VulkanDevice* device, float maxLod = 0.0f); // Mip levels above maxLod are never sampled
 	~VulkanSampler();
 
 	VkSampler GetSampler();
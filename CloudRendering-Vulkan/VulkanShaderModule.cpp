@@ -3,11 +3,11 @@
 
 #include "VulkanDevice.h"
 
-VulkanShaderModule::VulkanShaderModule(VulkanDevice* device, std::vector<char>& code)
+VulkanShaderModule::VulkanShaderModule(VulkanDevice* device, const uint32_t* code, size_t codeSize)
 {
 	m_device = device;
 
-	VkShaderModuleCreateInfo createInfo = initializers::ShaderModuleCreateInfo(code);
+	VkShaderModuleCreateInfo createInfo = initializers::ShaderModuleCreateInfo(code, codeSize);
 	ValidCheck(vkCreateShaderModule(m_device->GetDevice(), &createInfo, nullptr, &m_shaderModule));
 }
 
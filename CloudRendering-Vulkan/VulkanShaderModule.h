@@ -5,7 +5,8 @@ class VulkanDevice;
 class VulkanShaderModule
 {
 public:
-	VulkanShaderModule(VulkanDevice* device, std::vector<char>& code);
+	// SPIR-V words embedded from the headers shaders/Compile.bat emits before the build, codeSize in bytes
+	VulkanShaderModule(VulkanDevice* device, const uint32_t* code, size_t codeSize);
 	~VulkanShaderModule();
 
 	VkShaderModule GetShaderModule();
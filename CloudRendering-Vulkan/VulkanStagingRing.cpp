@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "VulkanStagingRing.h"
+
+#include "VulkanDevice.h"
+#include "VulkanCommandPool.h"
+#include "VulkanBuffer.h"
+#include "VulkanImage.h"
+
+VulkanStagingRing::VulkanStagingRing(VulkanDevice* device, VulkanCommandPool* commandPool, VkDeviceSize slotSize, uint32_t slotCount /*= 3*/)
+{
+	m_device = device;
+	m_commandPool = commandPool;
+	m_slotSize = slotSize;
+
+	for (uint32_t i = 0; i < slotCount; i++)
+	{
+		m_buffers.push_back(new VulkanBuffer(m_device, static_cast<size_t>(m_slotSize), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 1, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT));
+		m_fences.emplace_back(m_device);
+	}
+
+	// Allocated directly from the pool so the pool's own command buffer list is left untouched
+	m_commandBuffers.resize(slotCount);
+	VkCommandBufferAllocateInfo allocInfo = initializers::CommandBufferAllocateInfo(m_commandPool->GetCommandPool(), slotCount);
+	ValidCheck(vkAllocateCommandBuffers(m_device->GetDevice(), &allocInfo, m_commandBuffers.data()));
+}
+
+VulkanStagingRing::~VulkanStagingRing()
+{
+	Flush();
+
+	vkFreeCommandBuffers(m_device->GetDevice(), m_commandPool->GetCommandPool(), static_cast<uint32_t>(m_commandBuffers.size()), m_commandBuffers.data());
+	for (VulkanBuffer* buffer : m_buffers)
+	{
+		delete buffer;
+	}
+}
+
+void* VulkanStagingRing::Acquire()
+{
+	ValidCheck(vkWaitForFences(m_device->GetDevice(), 1, &m_fences[m_currentSlot].GetFence(), VK_TRUE, UINT64_MAX));
+	return m_buffers[m_currentSlot]->GetMappedMemory();
+}
+
+void VulkanStagingRing::SubmitCopyToImage(VulkanImage* image, uint32_t zOffset, uint32_t depth, bool firstCopy, bool lastCopy)
+{
+	VkCommandBuffer commandBuffer = m_commandBuffers[m_currentSlot];
+	VkCommandBufferBeginInfo beginInfo = initializers::CommandBufferBeginInfo();
+	ValidCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+	// Copies on the same queue execute in submission order, so the layout only changes around the first and last copy
+	if (firstCopy)
+	{
+		utilities::CmdTransitionImageLayout(commandBuffer, image->GetImage(), image->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, image->GetMipLevels());
+	}
+
+	VkExtent3D extent = image->GetExtent();
+	extent.depth = depth;
+	utilities::CmdCopyBufferToImage(commandBuffer, m_buffers[m_currentSlot]->GetBuffer(), image->GetImage(), extent, { 0, 0, static_cast<int32_t>(zOffset) });
+
+	// The mip chain is filtered from the complete level 0
+	if (lastCopy)
+	{
+		utilities::CmdGenerateMipmaps(commandBuffer, image->GetImage(), image->GetExtent(), image->GetMipLevels());
+	}
+
+	ValidCheck(vkEndCommandBuffer(commandBuffer));
+
+	VkSubmitInfo submitInfo = initializers::SubmitInfo();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	ValidCheck(vkResetFences(m_device->GetDevice(), 1, &m_fences[m_currentSlot].GetFence()));
+	ValidCheck(vkQueueSubmit(m_device->GetComputeQueue(), 1, &submitInfo, m_fences[m_currentSlot].GetFence()));
+
+	m_currentSlot = (m_currentSlot + 1) % static_cast<uint32_t>(m_buffers.size());
+}
+
+void VulkanStagingRing::Flush()
+{
+	for (VulkanFence& fence : m_fences)
+	{
+		ValidCheck(vkWaitForFences(m_device->GetDevice(), 1, &fence.GetFence(), VK_TRUE, UINT64_MAX));
+	}
+}
+
+VkDeviceSize VulkanStagingRing::GetSlotSize()
+{
+	return m_slotSize;
+}
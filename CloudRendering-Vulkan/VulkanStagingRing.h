@@ -0,0 +1,35 @@
+#pragma once
+
+#include "VulkanFence.h"
+
+class VulkanDevice;
+class VulkanCommandPool;
+class VulkanBuffer;
+class VulkanImage;
+
+// Fixed number of host visible staging slots, a slot is reused once the GPU finished copying from it
+class VulkanStagingRing
+{
+public:
+	VulkanStagingRing(VulkanDevice* device, VulkanCommandPool* commandPool, VkDeviceSize slotSize, uint32_t slotCount = 3);
+	~VulkanStagingRing();
+
+	// Waits until the next slot is free and returns its mapped memory
+	void* Acquire();
+	// Copies the acquired slot into the z slices [zOffset, zOffset + depth) of the image, the last copy generates its mip levels
+	void SubmitCopyToImage(VulkanImage* image, uint32_t zOffset, uint32_t depth, bool firstCopy, bool lastCopy);
+	// Waits for all submitted copies
+	void Flush();
+
+	VkDeviceSize GetSlotSize();
+
+private:
+	VulkanDevice* m_device = nullptr;
+	VulkanCommandPool* m_commandPool = nullptr;
+	VkDeviceSize m_slotSize = 0;
+
+	std::vector<VulkanBuffer*> m_buffers;
+	std::vector<VulkanFence> m_fences;
+	std::vector<VkCommandBuffer> m_commandBuffers;
+	uint32_t m_currentSlot = 0;
+};
@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "VulkanTimestampProfiler.h"
+
+#include "VulkanDevice.h"
+
+VulkanTimestampProfiler::VulkanTimestampProfiler(VulkanDevice* device, uint32_t frameCount /*= 4*/, uint32_t maxPassesPerFrame /*= 1024*/)
+{
+	m_device = device;
+	m_maxPassesPerFrame = maxPassesPerFrame;
+	m_slots.resize(frameCount);
+	m_timestamps.resize(2 * static_cast<size_t>(maxPassesPerFrame));
+
+	// Without timestamps on the compute and graphics queues the passes are only named, never timed
+	const VkPhysicalDeviceLimits& limits = m_device->GetPhysicalDevice()->GetPhysicalDeviceProperties().limits;
+	m_supported = limits.timestampComputeAndGraphics == VK_TRUE;
+	m_timestampPeriod = limits.timestampPeriod;
+	if (!m_supported)
+	{
+		std::cout << "Timestamp queries are not supported, the profiler is disabled" << std::endl;
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo{};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2 * maxPassesPerFrame * frameCount;
+	ValidCheck(vkCreateQueryPool(m_device->GetDevice(), &queryPoolInfo, nullptr, &m_queryPool));
+}
+
+VulkanTimestampProfiler::~VulkanTimestampProfiler()
+{
+	if (m_queryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(m_device->GetDevice(), m_queryPool, nullptr);
+	}
+}
+
+void VulkanTimestampProfiler::CmdBeginFrame(VkCommandBuffer commandBuffer)
+{
+	assert(!m_passOpen);
+	if (!m_supported)
+	{
+		return;
+	}
+
+	m_currentSlot = (m_currentSlot + 1) % static_cast<uint32_t>(m_slots.size());
+	FrameSlot& slot = m_slots[m_currentSlot];
+
+	// The frame that used the slot is a ring behind, it is done unless the GPU fell behind by more than the ring
+	if (slot.pending)
+	{
+		ReadFrame(m_currentSlot, false);
+	}
+
+	slot.passNames.clear();
+	slot.frameNumber = m_frameNumber++;
+	slot.pending = true;
+	vkCmdResetQueryPool(commandBuffer, m_queryPool, 2 * m_maxPassesPerFrame * m_currentSlot, 2 * m_maxPassesPerFrame);
+}
+
+void VulkanTimestampProfiler::CmdBeginPass(VkCommandBuffer commandBuffer, const std::string& name)
+{
+	assert(!m_passOpen);
+	FrameSlot& slot = m_slots[m_currentSlot];
+	if (!m_supported || !slot.pending)
+	{
+		return;
+	}
+
+	if (slot.passNames.size() >= m_maxPassesPerFrame)
+	{
+		if (!m_reportedOverflow)
+		{
+			std::cout << "More than " << m_maxPassesPerFrame << " passes in a frame, \"" << name << "\" and the passes after it are not timed" << std::endl;
+			m_reportedOverflow = true;
+		}
+		return;
+	}
+
+	// Written once every earlier command finished, so the pass does not include the work before it
+	uint32_t query = 2 * (m_maxPassesPerFrame * m_currentSlot + static_cast<uint32_t>(slot.passNames.size()));
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, query);
+	slot.passNames.push_back(name);
+	m_passOpen = true;
+}
+
+void VulkanTimestampProfiler::CmdEndPass(VkCommandBuffer commandBuffer)
+{
+	if (!m_passOpen)
+	{
+		return;
+	}
+
+	FrameSlot& slot = m_slots[m_currentSlot];
+	uint32_t query = 2 * (m_maxPassesPerFrame * m_currentSlot + static_cast<uint32_t>(slot.passNames.size()) - 1) + 1;
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_queryPool, query);
+	m_passOpen = false;
+}
+
+void VulkanTimestampProfiler::Flush()
+{
+	if (!m_supported)
+	{
+		return;
+	}
+
+	// Oldest frame first, so the CSV stays in frame order
+	for (size_t i = 1; i <= m_slots.size(); i++)
+	{
+		uint32_t slot = (m_currentSlot + static_cast<uint32_t>(i)) % static_cast<uint32_t>(m_slots.size());
+		if (m_slots[slot].pending)
+		{
+			ReadFrame(slot, true);
+		}
+	}
+}
+
+const std::vector<VulkanTimestampProfiler::PassTime>& VulkanTimestampProfiler::GetPassTimes() const
+{
+	return m_passTimes;
+}
+
+void VulkanTimestampProfiler::SetCSVOutput(std::ostream* stream)
+{
+	m_csvOutput = stream;
+	if (m_csvOutput)
+	{
+		*m_csvOutput << "frame,pass,ms" << std::endl;
+	}
+}
+
+bool VulkanTimestampProfiler::ReadFrame(uint32_t slotIndex, bool wait)
+{
+	FrameSlot& slot = m_slots[slotIndex];
+	slot.pending = false;
+
+	uint32_t queryCount = 2 * static_cast<uint32_t>(slot.passNames.size());
+	if (queryCount == 0)
+	{
+		return false;
+	}
+
+	VkQueryResultFlags flags = VK_QUERY_RESULT_64_BIT | (wait ? VK_QUERY_RESULT_WAIT_BIT : 0);
+	VkResult result = vkGetQueryPoolResults(m_device->GetDevice(), m_queryPool, 2 * m_maxPassesPerFrame * slotIndex, queryCount, queryCount * sizeof(uint64_t), m_timestamps.data(), sizeof(uint64_t), flags);
+	if (result != VK_SUCCESS)
+	{
+		// Dropped rather than stalling the frame
+		return false;
+	}
+
+	m_passTimes.clear();
+	for (size_t i = 0; i < slot.passNames.size(); i++)
+	{
+		float milliseconds = static_cast<float>(double(m_timestamps[2 * i + 1] - m_timestamps[2 * i]) * m_timestampPeriod * 1e-6);
+		auto passTime = std::find_if(m_passTimes.begin(), m_passTimes.end(), [&](const PassTime& time) { return time.name == slot.passNames[i]; });
+		if (passTime == m_passTimes.end())
+		{
+			m_passTimes.push_back({ slot.passNames[i], milliseconds });
+		}
+		else
+		{
+			passTime->milliseconds += milliseconds;
+		}
+	}
+
+	if (m_csvOutput)
+	{
+		for (const PassTime& passTime : m_passTimes)
+		{
+			*m_csvOutput << slot.frameNumber << "," << passTime.name << "," << passTime.milliseconds << "\n";
+		}
+	}
+	return true;
+}
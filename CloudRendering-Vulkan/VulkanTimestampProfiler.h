@@ -0,0 +1,57 @@
+#pragma once
+
+class VulkanDevice;
+
+// Timestamps around the passes of a frame, read back a ring of frames later so the host never waits for them
+class VulkanTimestampProfiler
+{
+public:
+	struct PassTime
+	{
+		std::string name;
+		float milliseconds = 0;
+	};
+
+public:
+	VulkanTimestampProfiler(VulkanDevice* device, uint32_t frameCount = 4, uint32_t maxPassesPerFrame = 1024);
+	~VulkanTimestampProfiler();
+
+	// Reads back the oldest frame of the ring and resets its queries, recorded before any pass of the frame
+	void CmdBeginFrame(VkCommandBuffer commandBuffer);
+	// Passes of the same name in one frame are summed, they can not be nested
+	void CmdBeginPass(VkCommandBuffer commandBuffer, const std::string& name);
+	void CmdEndPass(VkCommandBuffer commandBuffer);
+	// Reads back every frame still in the ring, the device has to be idle
+	void Flush();
+
+	// Passes of the last frame read back, in recording order
+	const std::vector<PassTime>& GetPassTimes() const;
+	// Appends a frame,pass,ms row per pass of every frame read back from now on
+	void SetCSVOutput(std::ostream* stream);
+
+private:
+	bool ReadFrame(uint32_t slot, bool wait);
+
+private:
+	VulkanDevice* m_device = nullptr;
+	VkQueryPool m_queryPool = VK_NULL_HANDLE;
+	bool m_supported = false;
+	float m_timestampPeriod = 1; // Nanoseconds per tick
+
+	struct FrameSlot
+	{
+		std::vector<std::string> passNames;
+		uint32_t frameNumber = 0;
+		bool pending = false;
+	};
+	std::vector<FrameSlot> m_slots;
+	uint32_t m_maxPassesPerFrame = 0;
+	uint32_t m_currentSlot = 0;
+	uint32_t m_frameNumber = 0;
+	bool m_passOpen = false;
+	bool m_reportedOverflow = false;
+
+	std::vector<uint64_t> m_timestamps;
+	std::vector<PassTime> m_passTimes;
+	std::ostream* m_csvOutput = nullptr;
+};
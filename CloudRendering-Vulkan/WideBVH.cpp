@@ -0,0 +1,241 @@
+#include "stdafx.h"
+#include "WideBVH.h"
+
+#include "LBVH.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE4
+#define TARGET_AVX2
+#else
+// MSVC emits any intrinsic regardless of /arch, GCC and Clang need the target per function
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+	// Collapsing never deepens the binary tree, whose depth is bounded by 30 morton bits and 32 index bits
+	constexpr int MAX_STACK_SIZE = 64 * (WideBVHNode::WIDTH - 1) + 1;
+
+	int CountTrailingZeroes(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long lsb;
+		return _BitScanForward(&lsb, value) ? static_cast<int>(lsb) : 32;
+#else
+		return value ? __builtin_ctz(value) : 32;
+#endif
+	}
+
+	float SurfaceArea(const TreeNode& node)
+	{
+		glm::vec3 size = glm::vec3(node.bounds[1] - node.bounds[0]);
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	TARGET_SSE4 __m128 Slab128(const float* boundsMin, const float* boundsMax, __m128 position, __m128 invDir, __m128& outFar)
+	{
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boundsMin), position), invDir);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(boundsMax), position), invDir);
+		outFar = _mm_max_ps(t0, t1);
+		return _mm_min_ps(t0, t1);
+	}
+
+	TARGET_AVX2 __m256 Slab256(const float* boundsMin, const float* boundsMax, __m256 position, __m256 invDir, __m256& outFar)
+	{
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(boundsMin), position), invDir);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(boundsMax), position), invDir);
+		outFar = _mm256_max_ps(t0, t1);
+		return _mm256_min_ps(t0, t1);
+	}
+}
+
+WideBVH::WideBVH(const LBVH& lbvh, unsigned int width /*= WideBVHNode::WIDTH*/, ESimdLevel simdLevel /*= PacketTracker::GetSupportedSimdLevel()*/)
+{
+	assert(width == 4 || width == WideBVHNode::WIDTH);
+	m_width = width;
+	m_simdLevel = std::min(simdLevel, PacketTracker::GetSupportedSimdLevel());
+
+	const std::vector<TreeNode>& nodes = lbvh.GetNodes();
+	if (nodes.empty())
+	{
+		return;
+	}
+
+	// Binary nodes that become wide nodes, in breadth-first order
+	std::vector<uint32_t> wideRoots = { 0 };
+	std::vector<uint32_t> children;
+	m_nodes.reserve(lbvh.GetInnerCount() / (width - 1) + 1);
+	for (size_t wideIdx = 0; wideIdx < wideRoots.size(); wideIdx++)
+	{
+		// Open the inner child with the largest surface area until the node is full
+		children.assign(1, wideRoots[wideIdx]);
+		while (children.size() < width)
+		{
+			int openIdx = -1;
+			float maxArea = -1.f;
+			for (size_t i = 0; i < children.size(); i++)
+			{
+				if (!nodes[children[i]].isLeaf && SurfaceArea(nodes[children[i]]) > maxArea)
+				{
+					openIdx = static_cast<int>(i);
+					maxArea = SurfaceArea(nodes[children[i]]);
+				}
+			}
+			if (openIdx < 0)
+			{
+				break;
+			}
+
+			const TreeNode& opened = nodes[children[openIdx]];
+			children[openIdx] = opened.left;
+			children.push_back(opened.right);
+		}
+
+		WideBVHNode wideNode{};
+		wideNode.childCount = static_cast<uint32_t>(children.size());
+		for (int i = 0; i < WideBVHNode::WIDTH; i++)
+		{
+			if (i >= static_cast<int>(children.size()))
+			{
+				wideNode.children[i] = WideBVHNode::EMPTY_SLOT;
+				continue;
+			}
+
+			const TreeNode& child = nodes[children[i]];
+			wideNode.minX[i] = child.bounds[0].x;
+			wideNode.minY[i] = child.bounds[0].y;
+			wideNode.minZ[i] = child.bounds[0].z;
+			wideNode.maxX[i] = child.bounds[1].x;
+			wideNode.maxY[i] = child.bounds[1].y;
+			wideNode.maxZ[i] = child.bounds[1].z;
+			if (child.isLeaf)
+			{
+				wideNode.children[i] = child.left | WideBVHNode::LEAF_FLAG;
+			}
+			else
+			{
+				wideNode.children[i] = static_cast<uint32_t>(wideRoots.size());
+				wideRoots.push_back(children[i]);
+			}
+		}
+		m_nodes.push_back(wideNode);
+	}
+}
+
+size_t WideBVH::Traverse(const glm::vec3& rayPos, const glm::vec3& rayDir, std::vector<uint32_t>& outBeams) const
+{
+	size_t bytesRead = 0;
+	if (m_nodes.empty())
+	{
+		return bytesRead;
+	}
+
+	const glm::vec3 invDir = 1.f / rayDir;
+	uint32_t stack[MAX_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		const WideBVHNode& node = m_nodes[stack[--stackSize]];
+		bytesRead += sizeof(WideBVHNode);
+
+		uint32_t mask;
+		switch (m_simdLevel)
+		{
+		case ESimdLevel::AVX2: mask = IntersectAVX2(node, rayPos, invDir); break;
+		case ESimdLevel::SSE4: mask = IntersectSSE4(node, rayPos, invDir); break;
+		default: mask = IntersectScalar(node, rayPos, invDir); break;
+		}
+		mask &= (1u << node.childCount) - 1;
+
+		while (mask)
+		{
+			uint32_t child = node.children[CountTrailingZeroes(mask)];
+			mask &= mask - 1;
+			if (child & WideBVHNode::LEAF_FLAG)
+			{
+				outBeams.push_back(child & ~WideBVHNode::LEAF_FLAG);
+			}
+			else
+			{
+				assert(stackSize < MAX_STACK_SIZE);
+				stack[stackSize++] = child;
+			}
+		}
+	}
+	return bytesRead;
+}
+
+const std::vector<WideBVHNode>& WideBVH::GetNodes() const
+{
+	return m_nodes;
+}
+
+unsigned int WideBVH::GetWidth() const
+{
+	return m_width;
+}
+
+ESimdLevel WideBVH::GetSimdLevel() const
+{
+	return m_simdLevel;
+}
+
+uint32_t WideBVH::IntersectScalar(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const
+{
+	uint32_t mask = 0;
+	for (uint32_t i = 0; i < node.childCount; i++)
+	{
+		glm::vec3 t0 = (glm::vec3(node.minX[i], node.minY[i], node.minZ[i]) - rayPos) * invDir;
+		glm::vec3 t1 = (glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]) - rayPos) * invDir;
+		glm::vec3 tMin = glm::min(t0, t1);
+		glm::vec3 tMax = glm::max(t0, t1);
+
+		float tNear = std::max(std::max(tMin.x, tMin.y), tMin.z);
+		float tFar = std::min(std::min(tMax.x, tMax.y), tMax.z);
+		mask |= (tNear <= tFar && tFar >= 0) ? 1u << i : 0;
+	}
+	return mask;
+}
+
+TARGET_SSE4 uint32_t WideBVH::IntersectSSE4(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 positionX = _mm_set1_ps(rayPos.x), positionY = _mm_set1_ps(rayPos.y), positionZ = _mm_set1_ps(rayPos.z);
+	const __m128 invDirX = _mm_set1_ps(invDir.x), invDirY = _mm_set1_ps(invDir.y), invDirZ = _mm_set1_ps(invDir.z);
+
+	// Two halves for the 8-wide nodes
+	uint32_t mask = 0;
+	for (uint32_t lane = 0; lane < node.childCount; lane += 4)
+	{
+		__m128 farX, farY, farZ;
+		__m128 nearX = Slab128(node.minX + lane, node.maxX + lane, positionX, invDirX, farX);
+		__m128 nearY = Slab128(node.minY + lane, node.maxY + lane, positionY, invDirY, farY);
+		__m128 nearZ = Slab128(node.minZ + lane, node.maxZ + lane, positionZ, invDirZ, farZ);
+
+		__m128 tNear = _mm_max_ps(_mm_max_ps(nearX, nearY), nearZ);
+		__m128 tFar = _mm_min_ps(_mm_min_ps(farX, farY), farZ);
+		__m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmpge_ps(tFar, zero));
+		mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << lane;
+	}
+	return mask;
+}
+
+TARGET_AVX2 uint32_t WideBVH::IntersectAVX2(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 positionX = _mm256_set1_ps(rayPos.x), positionY = _mm256_set1_ps(rayPos.y), positionZ = _mm256_set1_ps(rayPos.z);
+	const __m256 invDirX = _mm256_set1_ps(invDir.x), invDirY = _mm256_set1_ps(invDir.y), invDirZ = _mm256_set1_ps(invDir.z);
+
+	__m256 farX, farY, farZ;
+	__m256 nearX = Slab256(node.minX, node.maxX, positionX, invDirX, farX);
+	__m256 nearY = Slab256(node.minY, node.maxY, positionY, invDirY, farY);
+	__m256 nearZ = Slab256(node.minZ, node.maxZ, positionZ, invDirZ, farZ);
+
+	__m256 tNear = _mm256_max_ps(_mm256_max_ps(nearX, nearY), nearZ);
+	__m256 tFar = _mm256_min_ps(_mm256_min_ps(farX, farY), farZ);
+	__m256 hit = _mm256_and_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ), _mm256_cmp_ps(tFar, zero, _CMP_GE_OQ));
+	return static_cast<uint32_t>(_mm256_movemask_ps(hit));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "PacketTracker.h"
+
+class LBVH;
+
+/*
+ * Up to eight children per node with their bounds stored SoA, so one vector box test covers all of them.
+ * The children are packed at the front, slots past childCount are empty.
+ */
+struct WideBVHNode
+{
+	static constexpr int WIDTH = 8;
+	static constexpr uint32_t LEAF_FLAG = 0x80000000u; // Set on a leaf child, the lower bits hold the beam idx
+	static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+	alignas(32) float minX[WIDTH];
+	alignas(32) float minY[WIDTH];
+	alignas(32) float minZ[WIDTH];
+	alignas(32) float maxX[WIDTH];
+	alignas(32) float maxY[WIDTH];
+	alignas(32) float maxZ[WIDTH];
+	alignas(32) uint32_t children[WIDTH];
+	uint32_t childCount;
+};
+static_assert(sizeof(WideBVHNode) == 256, "WideBVHNode must match WideTreeNode in the shaders");
+
+/*
+ * 4- or 8-wide BVH collapsed from the binary LBVH as a post-pass.
+ * Each wide node greedily opens its largest inner child until the width is reached (Wald et al. - 2008).
+ * Traversal tests all children of a node at once with AVX2 or SSE4, with a scalar fallback.
+ * PPB_CollapseTree.comp builds the same nodes in the same breadth-first order for the GPU estimate.
+ */
+class WideBVH
+{
+public:
+	WideBVH(const WideBVH&) = delete;
+	WideBVH& operator=(const WideBVH&) = delete;
+
+	// Width is 4 or 8
+	WideBVH(const LBVH& lbvh, unsigned int width = WideBVHNode::WIDTH, ESimdLevel simdLevel = PacketTracker::GetSupportedSimdLevel());
+
+	// Appends the beams whose bounds the ray intersects, returns the bytes of nodes read
+	size_t Traverse(const glm::vec3& rayPos, const glm::vec3& rayDir, std::vector<uint32_t>& outBeams) const;
+
+	const std::vector<WideBVHNode>& GetNodes() const;
+	unsigned int GetWidth() const;
+	ESimdLevel GetSimdLevel() const;
+
+private:
+	uint32_t IntersectScalar(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const;
+	uint32_t IntersectSSE4(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const;
+	uint32_t IntersectAVX2(const WideBVHNode& node, const glm::vec3& rayPos, const glm::vec3& invDir) const;
+
+private:
+	std::vector<WideBVHNode> m_nodes;
+	unsigned int m_width = WideBVHNode::WIDTH;
+	ESimdLevel m_simdLevel = ESimdLevel::Scalar;
+};
@@ -15,21 +15,28 @@
 #include "VulkanSemaphore.h"
 #include "VulkanFence.h"
 #include "VulkanDescriptorPool.h"
+#include "VulkanStagingRing.h"
 
 #include "RenderTechniquePT.h"
 #include "RenderTechniqueSV.h"
 #include "RenderTechniquePPM.h"
 #include "RenderTechniquePPB.h"
+#include "RenderTechniqueAS.h"
+#include "RenderTechniqueRS.h"
 
+#include "CPUPathTracer.h"
 #include "Grid3D.h"
+#include "MappedFile.h"
 #include "Tests.h"
 #include "ImGUILayer.h"
+#include "VulkanTimestampProfiler.h"
+#include "VulkanPipelineCache.h"
 
 //--------------------------------------------------------------
 // Shader Resources
 //--------------------------------------------------------------
-ShadowVolumeProperties g_shadowVolumeProperties;
-VulkanBuffer* g_shadowVolumePropertiesBuffer;
+ShadowVolumeProperties g_shadowVolumeProperties; // Of the volume being rebuilt
+std::vector<VulkanBuffer*> g_shadowVolumePropertiesBuffers; // Front and back volume
 
 CameraProperties g_cameraProperties;
 VulkanBuffer* g_cameraPropertiesBuffer;
@@ -42,6 +49,7 @@ VulkanBuffer* g_parametersBuffer;
 
 PhotonMapProperties g_photonMapProperties;
 VulkanBuffer* g_photonMapPropertiesBuffer;
+glm::vec4 g_rebuildLightDirection; // Photon light direction of the volume being rebuilt, applied with it
 
 PushConstants g_pushConstants;
 
@@ -52,6 +60,8 @@ RenderTechniquePT* g_pathTracingTechnique;
 RenderTechniquePPM* g_photonMappingTechnique;
 RenderTechniqueSV* g_shadowVolumeTechnique;
 RenderTechniquePPB* g_photonBeamsTechnique;
+RenderTechniqueAS* g_adaptiveSamplingTechnique;
+RenderTechniqueRS* g_resolveTechnique;
 
 VulkanInstance* g_instance;
 VulkanPhysicalDevice* g_physicalDevice;
@@ -65,20 +75,29 @@ std::vector<VulkanFramebuffer*> g_framebuffers;
 
 VulkanCommandPool* g_computeCommandPool;
 VulkanDescriptorPool* g_computeDescriptorPool;
+VulkanPipelineCache* g_pipelineCache;
 
 Grid3D<float>* g_cloudData;
+std::string g_cloudFilePath;
+bool g_keepCloudData = false; // Host copy of the cloud is only kept for CPU side code, otherwise it is streamed from the file
 VulkanImage* g_cloudImage;
 VulkanImageView* g_cloudImageView;
 VulkanSampler* g_cloudSampler;
 
-VulkanImage* g_shadowVolumeImage;
-VulkanImageView* g_shadowVolumeImageView;
+VulkanImage* g_majorantImage;
+VulkanImageView* g_majorantImageView;
+
+std::vector<VulkanImage*> g_shadowVolumeImages;
+std::vector<VulkanImageView*> g_shadowVolumeImageViews;
 VulkanSampler* g_shadowVolumeSampler;
 
-std::vector<VulkanImage*> g_resultImages;
-std::vector<VulkanImageView*> g_resultImageViews;
+VulkanImage* g_resultImage; // Shared by all frames in flight, resolved to the swapchain image of each present
+VulkanImageView* g_resultImageView;
+VulkanImage* g_momentImage; // Luminance moments and sample count of each result image pixel
+VulkanImageView* g_momentImageView;
 
 ImGUILayer* g_imguiLayer = nullptr;
+VulkanTimestampProfiler* g_profiler = nullptr;
 
 std::vector<VulkanSemaphore> g_imageAvailableSemaphores;
 std::vector<VulkanSemaphore> g_computeFinishedSemaphores;
@@ -95,9 +114,81 @@ GLFWwindow* g_window;
 double g_renderStartTime = 0;
 double g_previousTime = 0;
 unsigned int g_framesInSecond = 0;
+unsigned int g_samplesInSecond = 0;
+double g_previousPresentTime = 0;
 
-constexpr int MAX_FRAMES_IN_FLIGHT = 3;
+constexpr VkDeviceSize CLOUD_STAGING_SLOT_SIZE = 16 * 1024 * 1024;
+constexpr uint32_t CLOUD_STAGING_SLOT_COUNT = 4;
 const char* CLOUD_FILE_PATH = "../models/mycloud.xyz";
+const char* PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+//----------------------------------------------------------------------
+// Headless
+//----------------------------------------------------------------------
+
+constexpr uint32_t HEADLESS_IMAGE_COUNT = 1;
+bool g_headless = false;
+unsigned int g_headlessFrameCount = 100;
+std::string g_headlessOutputFile = "render.pfm";
+bool g_runTests = false;
+bool g_runBenchmarks = false;
+
+//----------------------------------------------------------------------
+// CPU Rendering
+//----------------------------------------------------------------------
+
+constexpr uint32_t CPU_SHADOW_VOLUME_AXIS_COUNT = 128;
+bool g_cpuRender = false;
+bool g_cpuPacketTracking = false; // SIMD delta tracking, statistically equal to the scalar reference
+
+//----------------------------------------------------------------------
+// Photon Beams
+//----------------------------------------------------------------------
+
+size_t g_beamCapacity = 1 << 16; // Initial capacity, grows when a frame deposits more beams
+unsigned int g_beamBVHWidth = 2; // 4 or 8 collapses the LBVH into a wide BVH for the estimate
+
+//----------------------------------------------------------------------
+// Adaptive Sampling
+//----------------------------------------------------------------------
+
+float g_adaptiveTargetError = 0; // Relative standard error of the pixel mean, 0 samples every pixel every frame
+
+//----------------------------------------------------------------------
+// Shadow Volume
+//----------------------------------------------------------------------
+
+VkFormat g_shadowVolumeFormat = VK_FORMAT_R16_SFLOAT; // Two fp16 volumes take the memory of a single fp32 one
+unsigned int g_shadowVolumeSliceCount = 8; // Frames a rebuild is spread over
+bool g_shadowVolumeRebuildPending = false; // The light changed, the rebuild waits for the frames using the back volume
+
+//----------------------------------------------------------------------
+// Cloud
+//----------------------------------------------------------------------
+
+bool g_cloudMipmaps = true; // Without mips every density sample reads the full resolution volume
+
+//----------------------------------------------------------------------
+// Accumulation
+//----------------------------------------------------------------------
+
+const char* ACCUMULATION_MODE_NAMES[] = { "Running mean", "Compensated sum" };
+
+//----------------------------------------------------------------------
+// Presentation
+//----------------------------------------------------------------------
+
+constexpr int MAX_SAMPLES_PER_PRESENT = 256;
+constexpr uint32_t MAX_PROFILED_PASSES_PER_SAMPLE = 32; // Adaptive sampling and an estimate, the radix sort passes of PPB are most of them
+int g_samplesPerPresent = 1; // Estimates recorded into the compute submission of each present
+float g_presentBudget = 0; // ms a present may take, adapts the samples per present, 0 keeps them fixed
+float g_adaptiveSamplesPerPresent = 1; // Unrounded, so small budget changes still move the sample count
+
+//----------------------------------------------------------------------
+// Profiling
+//----------------------------------------------------------------------
+
+std::string g_profileOutputFile; // CSV of the pass times of every headless frame, empty writes none
 
 //----------------------------------------------------------------------
 // UI
@@ -107,10 +198,12 @@ char g_UICloudFile[1024];
 std::string g_UICurrentCloudFile = " ";
 float g_UIPhaseG = g_parameters.GetPhaseG();
 float g_UISecondsPerFrame = 0;
+float g_UISamplesPerSecond = 0;
 glm::vec2 g_UICameraRotate{ 0, 0 };
 glm::vec3 g_UILightDirection = g_shadowVolumeProperties.GetLightDirection();
 int g_UICurrentResolution = 0;
 int g_UIPreviousResolution = g_UICurrentResolution;
+int g_UIAccumulationMode = static_cast<int>(g_pushConstants.accumulationMode);
 const char* RESOLUTIONS_NAMES[] = { "800x600", "1920x1080" };
 const glm::ivec2 RESOLUTIONS[] = { {800, 600}, {1920, 1080} };
 float g_UIFov = 90.f;
@@ -130,27 +223,45 @@ enum class ERenderTechnique
 //----------------------------------------------------------------------
 // Functions
 //----------------------------------------------------------------------
+double GetTime()
+{
+	// GLFW is not initialized when rendering headless or on the CPU
+	if (g_headless || g_cpuRender)
+	{
+		static const auto startTime = std::chrono::steady_clock::now();
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	}
+	return glfwGetTime();
+}
+
+// Command buffers and fences are per swapchain image, the result image is not
+uint32_t GetPresentImageCount()
+{
+	return g_swapchain ? g_swapchain->GetImageCount() : HEADLESS_IMAGE_COUNT;
+}
+
 void UpdateTime()
 {
-	g_pushConstants.time = glfwGetTime();
+	g_pushConstants.time = GetTime();
 	if (g_pushConstants.time - g_previousTime >= 1.0)
 	{
 		g_UISecondsPerFrame = static_cast<float>(1000.0 / double(g_framesInSecond));
+		g_UISamplesPerSecond = static_cast<float>(g_samplesInSecond);
 		g_framesInSecond = 0;
+		g_samplesInSecond = 0;
 		g_previousTime += 1.0;
 	}
 }
 
-template<typename T>
-void SetCloudProperties(Grid3D<T>* grid)
+void SetCloudProperties(glm::uvec3 voxelCount, glm::dvec3 voxelSize, float majorant)
 {
 	glm::vec3 cloudSize{
-		grid->GetVoxelSize().x * grid->GetVoxelCount().x * g_cloudProperties.baseScaling,
-		grid->GetVoxelSize().y * grid->GetVoxelCount().y * g_cloudProperties.baseScaling,
-		grid->GetVoxelSize().z * grid->GetVoxelCount().z * g_cloudProperties.baseScaling };
+		voxelSize.x * voxelCount.x * g_cloudProperties.baseScaling,
+		voxelSize.y * voxelCount.y * g_cloudProperties.baseScaling,
+		voxelSize.z * voxelCount.z * g_cloudProperties.baseScaling };
 
-	g_cloudProperties.maxExtinction = std::max(grid->GetMajorant(), 0.01f);
-	g_cloudProperties.voxelCount = glm::uvec4(grid->GetVoxelCount(), 0);
+	g_cloudProperties.maxExtinction = std::max(majorant, 0.01f);
+	g_cloudProperties.voxelCount = glm::uvec4(voxelCount, 0);
 	g_cloudProperties.bounds[0] = glm::vec4(
 		-cloudSize.x / 2,
 		-cloudSize.y / 2,
@@ -162,14 +273,33 @@ void SetCloudProperties(Grid3D<T>* grid)
 	g_photonMapProperties.SetBounds(g_cloudProperties.bounds);
 }
 
+template<typename T>
+void SetCloudProperties(Grid3D<T>* grid)
+{
+	SetCloudProperties(grid->GetVoxelCount(), grid->GetVoxelSize(), grid->GetMajorant());
+}
 
 bool LoadCloudFile(const std::string filename)
 {
 	std::cout << "Loading cloud file...";
 
+	std::string path = "../models/" + filename;
+	Grid3D<float>* cloudData = nullptr;
+	GridFileHeader header;
+	bool loaded = false;
+	if (g_keepCloudData)
+	{
+		cloudData = Grid3D<float>::Load(path);
+		loaded = cloudData != nullptr;
+	}
+	else
+	{
+		// Only the header is read here, the voxels are streamed to the device in UpdateCloudData
+		MappedFile file(path);
+		loaded = file.IsOpen() && ReadGridFileHeader(file.GetData(), file.GetSize(), header);
+	}
 
-	Grid3D<float>* cloudData = Grid3D<float>::Load("../models/" + filename);
-	if (!cloudData)
+	if (!loaded)
 	{
 		std::cout << " ERROR: Failed to load file \"" + filename + "\" in models folder" << std::endl;
 		return false;
@@ -180,10 +310,19 @@ bool LoadCloudFile(const std::string filename)
 		delete g_cloudData;
 	}
 	g_cloudData = cloudData;
+	g_cloudFilePath = path;
 
 	g_UICurrentCloudFile = filename;
 
-	SetCloudProperties(g_cloudData);
+	if (g_cloudData)
+	{
+		SetCloudProperties(g_cloudData);
+	}
+	else
+	{
+		// Majorant is known once the volume has been streamed
+		SetCloudProperties(glm::uvec3(header.sizeX, header.sizeY, header.sizeZ), glm::dvec3(header.voxelSizeX, header.voxelSizeY, header.voxelSizeZ), 0.f);
+	}
 
 	std::cout << "OK" << std::endl;
 	return true;
@@ -194,6 +333,39 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 	std::cout << "Button pressed";
 }
 
+void UpdateAdaptiveSampling()
+{
+	// The tile list follows the resolution of the moment image
+	g_adaptiveSamplingTechnique->SetFrameReferences(g_momentImage, g_momentImageView, g_swapchain);
+
+	auto momentImageInfo = initializers::DescriptorImageInfo(VK_NULL_HANDLE, g_momentImageView->GetImageView(), VK_IMAGE_LAYOUT_GENERAL);
+	auto tileListInfo = g_adaptiveSamplingTechnique->GetTileListInfo();
+	g_pathTracingTechnique->QueueUpdateAdaptiveSampling(momentImageInfo, tileListInfo);
+	g_photonMappingTechnique->QueueUpdateAdaptiveSampling(momentImageInfo, tileListInfo);
+	g_photonBeamsTechnique->QueueUpdateAdaptiveSampling(momentImageInfo, tileListInfo);
+	g_resolveTechnique->QueueUpdateAdaptiveSampling(momentImageInfo, tileListInfo);
+
+	g_pathTracingTechnique->UpdateDescriptorSets();
+	g_photonMappingTechnique->UpdateDescriptorSets();
+	g_photonBeamsTechnique->UpdateDescriptorSets();
+	g_resolveTechnique->UpdateDescriptorSets();
+}
+
+void UpdateAccumulation()
+{
+	// The accumulation buffer follows the resolution of the result image
+	g_resolveTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+
+	auto accumulationInfo = g_resolveTechnique->GetAccumulationInfo();
+	g_pathTracingTechnique->QueueUpdateAccumulation(accumulationInfo);
+	g_photonMappingTechnique->QueueUpdateAccumulation(accumulationInfo);
+	g_photonBeamsTechnique->QueueUpdateAccumulation(accumulationInfo);
+
+	g_pathTracingTechnique->UpdateDescriptorSets();
+	g_photonMappingTechnique->UpdateDescriptorSets();
+	g_photonBeamsTechnique->UpdateDescriptorSets();
+}
+
 void SetRenderTechnique(ERenderTechnique renderTechnique)
 {
 	g_photonMappingTechnique->FreeResources();
@@ -211,18 +383,56 @@ void SetRenderTechnique(ERenderTechnique renderTechnique)
 	case ERenderTechnique::PhotonBeams:
 		g_currentTechnique = g_photonBeamsTechnique;
 		g_photonBeamsTechnique->AllocateResources();
-		for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-		{
-			g_photonBeamsTechnique->UpdatePhotonMapProperties(g_photonMapPropertiesBuffer, i);
-		}
-		g_photonBeamsTechnique->UpdateDescriptorSets();
+		g_photonBeamsTechnique->UpdatePhotonMapProperties(g_photonMapPropertiesBuffer);
 		break;
 	}
 }
 
+bool IsFrameFinished(unsigned int frameSlot)
+{
+	// A slot recorded again since only signals once the newer frame, and with it the older one, is done
+	return vkGetFenceStatus(g_device->GetDevice(), g_inFlightFences[frameSlot].GetFence()) == VK_SUCCESS;
+}
+
+// The phase function of the scattering shaders is specialized, a new phase g may select other pipelines
+void UpdatePermutations()
+{
+	for (RenderTechnique* technique : std::vector<RenderTechnique*>{ g_shadowVolumeTechnique, g_pathTracingTechnique, g_photonMappingTechnique, g_photonBeamsTechnique, g_adaptiveSamplingTechnique, g_resolveTechnique })
+	{
+		technique->UpdatePermutations(g_parameters);
+	}
+}
+
+void SwapShadowVolume()
+{
+	g_shadowVolumeTechnique->SwapVolumes();
+
+	// Both volumes are bound, the push constants recorded with each frame select the front one.
+	// Frames in flight keep sampling the old volume and its light direction
+	g_pushConstants.shadowVolume = g_shadowVolumeTechnique->GetFrontIndex();
+	g_pushConstants.lightDirection = g_rebuildLightDirection;
+
+	g_pushConstants.frameCount = 1;
+	g_renderStartTime = GetTime();
+}
+
+void BeginShadowVolumeRebuild(unsigned int sliceCount)
+{
+	unsigned int back = g_shadowVolumeTechnique->GetBackIndex();
+	g_shadowVolumePropertiesBuffers[back]->SetData();
+
+	// Update shadow volume descriptor set
+	auto bufferInfo = initializers::DescriptorBufferInfo(g_shadowVolumePropertiesBuffers[back]->GetBuffer(), 0, g_shadowVolumePropertiesBuffers[back]->GetSize());
+	g_shadowVolumeTechnique->QueueUpdateShadowVolume(bufferInfo, back);
+	g_shadowVolumeTechnique->UpdateDescriptorSets();
+
+	g_shadowVolumeTechnique->BeginRebuild(sliceCount);
+	g_shadowVolumeRebuildPending = false;
+}
+
 void UpdateShadowVolume()
 {
-	g_photonMapProperties.lightDirection = glm::normalize(glm::vec4(g_UILightDirection, 0));
+	g_rebuildLightDirection = glm::normalize(glm::vec4(g_UILightDirection, 0));
 	if (g_currentTechnique == g_photonBeamsTechnique)
 	{
 		g_shadowVolumeProperties.SetLightDirection(g_cameraProperties.GetFwd());
@@ -233,34 +443,25 @@ void UpdateShadowVolume()
 	}
 
 	g_shadowVolumeProperties.SetOrigin(g_cloudProperties.bounds[0], g_cloudProperties.bounds[1]);
-	g_shadowVolumePropertiesBuffer->SetData();
 
-	// Update shadow volume descriptor set
-	auto bufferInfo = initializers::DescriptorBufferInfo(g_shadowVolumePropertiesBuffer->GetBuffer(), 0, g_shadowVolumePropertiesBuffer->GetSize());
-	g_shadowVolumeTechnique->QueueUpdateShadowVolume(bufferInfo, 0);
-	g_shadowVolumeTechnique->UpdateDescriptorSets();
-
-	// Wait until any calculations are done
-	vkQueueWaitIdle(g_device->GetComputeQueue());
+	// Without a volume to show in the meantime, or for a fixed frame count, it is built at once
+	if (g_headless || !g_shadowVolumeTechnique->HasVolume())
+	{
+		vkQueueWaitIdle(g_device->GetComputeQueue());
+		BeginShadowVolumeRebuild(1);
 
-	// Send commands for updating volume
-	VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
-	g_shadowVolumeTechnique->RecordDrawCommands(commandBuffer, 0);
-	utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+		VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
+		g_shadowVolumeTechnique->RecordDrawCommands(commandBuffer, 0);
+		utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
 
-	// Update render technique descriptor set
-	for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-	{
-		g_pathTracingTechnique->QueueUpdateShadowVolume(bufferInfo, i);
-		g_photonMappingTechnique->QueueUpdateShadowVolume(bufferInfo, i);
-		g_photonBeamsTechnique->QueueUpdateShadowVolume(bufferInfo, i);
+		SwapShadowVolume();
+		return;
 	}
-	g_pathTracingTechnique->UpdateDescriptorSets();
-	g_photonMappingTechnique->UpdateDescriptorSets();
-	g_photonBeamsTechnique->UpdateDescriptorSets();
 
-	g_pushConstants.frameCount = 1;
-	g_renderStartTime = glfwGetTime();
+	// The front volume and its light direction stay in use until the rebuilt volume is swapped in.
+	// A rebuild in progress is dropped, the back volume is written again once its last frame finished
+	g_shadowVolumeTechnique->CancelRebuild();
+	g_shadowVolumeRebuildPending = true;
 }
 
 void UpdateCloudData()
@@ -272,27 +473,97 @@ void UpdateCloudData()
 		delete g_cloudImage;
 		delete g_cloudImageView;
 		delete g_cloudSampler;
+		delete g_majorantImageView;
+		delete g_majorantImage;
 	}
 
+	// Distant clouds are tracked through coarser mips, chosen from the ray cone of the pixel
+	VkExtent3D cloudExtent = { static_cast<uint32_t>(g_cloudProperties.voxelCount.x), static_cast<uint32_t>(g_cloudProperties.voxelCount.y), static_cast<uint32_t>(g_cloudProperties.voxelCount.z) };
+	uint32_t cloudMipLevels = g_cloudMipmaps ? utilities::GetMipLevelCount(cloudExtent) : 1;
 	g_cloudImage = new VulkanImage(
 		g_device,
 		VK_FORMAT_R32_SFLOAT,
-		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-		static_cast<uint32_t>(g_cloudProperties.voxelCount.x),
-		static_cast<uint32_t>(g_cloudProperties.voxelCount.y),
-		static_cast<uint32_t>(g_cloudProperties.voxelCount.z));
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		cloudExtent.width,
+		cloudExtent.height,
+		cloudExtent.depth,
+		cloudMipLevels);
 	g_cloudImageView = new VulkanImageView(g_device, g_cloudImage);
-	g_cloudSampler = new VulkanSampler(g_device);
+	g_cloudSampler = new VulkanSampler(g_device, static_cast<float>(cloudMipLevels - 1));
 
 	{
-		VulkanBuffer stagingBuffer(g_device, g_cloudData->GetData(), g_cloudData->GetElementSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, g_cloudData->GetSize());
-		stagingBuffer.SetData();
+		// Upload slab by slab through a fixed set of staging buffers, the next slab is decoded while the previous ones are copied
+		const VkExtent3D extent = g_cloudImage->GetExtent();
+		const size_t sliceVoxelCount = static_cast<size_t>(extent.width) * extent.height;
+		const VkDeviceSize sliceSize = sliceVoxelCount * sizeof(float);
+		VulkanStagingRing stagingRing(g_device, g_computeCommandPool, std::max(CLOUD_STAGING_SLOT_SIZE, sliceSize), CLOUD_STAGING_SLOT_COUNT);
+		const uint32_t slabDepth = static_cast<uint32_t>(stagingRing.GetSlotSize() / sliceSize);
+
+		// Without a host copy the voxels are decoded from the file one slab at a time
+		MappedFile file(g_cloudData ? std::string() : g_cloudFilePath);
+		GridFileHeader header;
+		if (!g_cloudData && (!file.IsOpen() || !ReadGridFileHeader(file.GetData(), file.GetSize(), header)))
+		{
+			throw std::runtime_error("Failed to stream cloud file " + g_cloudFilePath);
+		}
 
-		VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
-		utilities::CmdTransitionImageLayout(commandBuffer, g_cloudImage->GetImage(), g_cloudImage->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		utilities::CmdCopyBufferToImage(commandBuffer, stagingBuffer.GetBuffer(), g_cloudImage->GetImage(), g_cloudImage->GetExtent());
-		utilities::CmdTransitionImageLayout(commandBuffer, g_cloudImage->GetImage(), g_cloudImage->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-		utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+		// The brick majorants are gathered from the same slabs. They are read from cached host memory, never from the staging memory
+		const glm::uvec3 voxelCount = glm::uvec3(g_cloudProperties.voxelCount);
+		Grid3D<float>* majorants = Grid3D<float>::CreateBrickGrid(voxelCount, glm::dvec3(1), g_cloudProperties.majorantBrickSize);
+		std::vector<float> decodedSlab(g_cloudData ? 0 : slabDepth * sliceVoxelCount);
+
+		float majorant = 0.f;
+		for (uint32_t z = 0; z < extent.depth; z += slabDepth)
+		{
+			uint32_t depth = std::min(slabDepth, extent.depth - z);
+			const float* slab = nullptr;
+			if (g_cloudData)
+			{
+				slab = static_cast<float*>(g_cloudData->GetData()) + z * sliceVoxelCount;
+			}
+			else
+			{
+				majorant = std::max(majorant, Grid3D<float>::ReadSlab(file, header, z, z + depth, decodedSlab.data()));
+				slab = decodedSlab.data();
+			}
+
+			memcpy(stagingRing.Acquire(), slab, depth * sliceSize);
+			stagingRing.SubmitCopyToImage(g_cloudImage, z, depth, z == 0, z + depth == extent.depth);
+
+			Grid3D<float>::AccumulateBrickMajorants(slab, voxelCount, z, z + depth, g_cloudProperties.majorantBrickSize, *majorants);
+		}
+		stagingRing.Flush();
+
+		// Coarser mips blend in voxels further away, so each level gets its own majorants
+		Grid3D<float>* levelMajorants = Grid3D<float>::CreateLevelMajorants(*majorants, voxelCount, g_cloudProperties.majorantBrickSize, cloudMipLevels);
+		delete majorants;
+		majorants = levelMajorants;
+
+		// Majorant grid is small, a single staging copy is enough
+		g_majorantImage = new VulkanImage(
+			g_device,
+			VK_FORMAT_R32_SFLOAT,
+			VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+			majorants->GetVoxelCount().x,
+			majorants->GetVoxelCount().y,
+			majorants->GetVoxelCount().z);
+		g_majorantImageView = new VulkanImageView(g_device, g_majorantImage);
+		{
+			VulkanBuffer stagingBuffer(g_device, majorants->GetData(), majorants->GetElementSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, majorants->GetSize());
+			stagingBuffer.SetData();
+
+			VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
+			utilities::CmdTransitionImageLayout(commandBuffer, g_majorantImage->GetImage(), g_majorantImage->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+			utilities::CmdCopyBufferToImage(commandBuffer, stagingBuffer.GetBuffer(), g_majorantImage->GetImage(), g_majorantImage->GetExtent());
+			utilities::CmdTransitionImageLayout(commandBuffer, g_majorantImage->GetImage(), g_majorantImage->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+		}
+		delete majorants;
+
+		if (!g_cloudData)
+		{
+			g_cloudProperties.maxExtinction = std::max(majorant, 0.01f);
+		}
 
 		vkDeviceWaitIdle(g_device->GetDevice());
 		{
@@ -301,34 +572,34 @@ void UpdateCloudData()
 
 			auto cloudBufferInfo = initializers::DescriptorBufferInfo(g_cloudPropertiesBuffer->GetBuffer(), 0, g_cloudPropertiesBuffer->GetSize());
 			auto cloudImageInfo = initializers::DescriptorImageInfo(g_cloudSampler->GetSampler(), g_cloudImageView->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			auto majorantImageInfo = initializers::DescriptorImageInfo(g_cloudSampler->GetSampler(), g_majorantImageView->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-			for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-			{
-				g_pathTracingTechnique->QueueUpdateCloudDataSampler(cloudImageInfo, i);
-				g_pathTracingTechnique->QueueUpdateCloudData(cloudBufferInfo, i);
+			g_pathTracingTechnique->QueueUpdateCloudDataSampler(cloudImageInfo);
+			g_pathTracingTechnique->QueueUpdateCloudData(cloudBufferInfo);
+			g_pathTracingTechnique->QueueUpdateMajorantSampler(majorantImageInfo);
 
-				g_photonMappingTechnique->QueueUpdateCloudDataSampler(cloudImageInfo, i);
-				g_photonMappingTechnique->QueueUpdateCloudData(cloudBufferInfo, i);
+			g_photonMappingTechnique->QueueUpdateCloudDataSampler(cloudImageInfo);
+			g_photonMappingTechnique->QueueUpdateCloudData(cloudBufferInfo);
+			g_photonMappingTechnique->QueueUpdateMajorantSampler(majorantImageInfo);
+
+			g_photonBeamsTechnique->QueueUpdateCloudDataSampler(cloudImageInfo);
+			g_photonBeamsTechnique->QueueUpdateCloudData(cloudBufferInfo);
+			g_photonBeamsTechnique->QueueUpdateMajorantSampler(majorantImageInfo);
 
-				g_photonBeamsTechnique->QueueUpdateCloudDataSampler(cloudImageInfo, i);
-				g_photonBeamsTechnique->QueueUpdateCloudData(cloudBufferInfo, i);
-			}
 			g_pathTracingTechnique->UpdateDescriptorSets();
 			g_photonMappingTechnique->UpdateDescriptorSets();
 			g_photonBeamsTechnique->UpdateDescriptorSets();
 
-			g_shadowVolumeTechnique->QueueUpdateCloudData(cloudBufferInfo, 0);
-			g_shadowVolumeTechnique->QueueUpdateCloudDataSampler(cloudImageInfo, 0);
+			g_shadowVolumeTechnique->QueueUpdateCloudData(cloudBufferInfo);
+			g_shadowVolumeTechnique->QueueUpdateCloudDataSampler(cloudImageInfo);
+
 			g_shadowVolumeTechnique->UpdateDescriptorSets();
 		}
 
 		g_photonMappingTechnique->FreeResources();
 		g_photonMappingTechnique->AllocateResources(g_photonMapPropertiesBuffer);
 
-		for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-		{
-			g_photonBeamsTechnique->UpdatePhotonMapProperties(g_photonMapPropertiesBuffer, i);
-		}
+		g_photonBeamsTechnique->UpdatePhotonMapProperties(g_photonMapPropertiesBuffer);
 
 		UpdateShadowVolume();
 	}
@@ -357,23 +628,45 @@ void ClearSwapchain()
 	delete g_swapchain;
 	g_swapchain = nullptr;
 
-	// Recreate result images
-	for (unsigned int i = 0; i < g_resultImages.size(); i++)
-	{
-		delete g_resultImages[i];
-		delete g_resultImageViews[i];
+	// Recreate result image
+	delete g_resultImage;
+	delete g_resultImageView;
+	delete g_momentImage;
+	delete g_momentImageView;
 
-		g_resultImages[i] = nullptr;
-		g_resultImageViews[i] = nullptr;
-	}
+	g_resultImage = nullptr;
+	g_resultImageView = nullptr;
+	g_momentImage = nullptr;
+	g_momentImageView = nullptr;
 
 	g_graphicsFinishedSemaphores.clear();
-	g_resultImages.clear();
-    g_resultImageViews.clear();
 
 	std::cout << "OK" << std::endl;
 }
 
+void CreateResultImage()
+{
+	g_resultImage = new VulkanImage(g_device,
+		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+		static_cast<uint32_t>(g_cameraProperties.GetWidth()),
+		static_cast<uint32_t>(g_cameraProperties.GetHeight()));
+	g_resultImageView = new VulkanImageView(g_device, g_resultImage);
+
+	g_momentImage = new VulkanImage(g_device,
+		VK_FORMAT_R32G32B32A32_SFLOAT,
+		VK_IMAGE_USAGE_STORAGE_BIT,
+		static_cast<uint32_t>(g_cameraProperties.GetWidth()),
+		static_cast<uint32_t>(g_cameraProperties.GetHeight()));
+	g_momentImageView = new VulkanImageView(g_device, g_momentImage);
+
+	// Transition to general layout since they will be written to in the rendering techniques
+	VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
+	utilities::CmdTransitionImageLayout(commandBuffer, g_resultImage->GetImage(), g_resultImage->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	utilities::CmdTransitionImageLayout(commandBuffer, g_momentImage->GetImage(), g_momentImage->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+}
+
 void CreateSwapchain()
 {
 	vkDeviceWaitIdle(g_device->GetDevice());
@@ -402,24 +695,7 @@ void CreateSwapchain()
 	}
 
 	// Compute result image and view
-	for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-	{
-		VulkanImage* image = new VulkanImage(g_device,
-			VK_FORMAT_R32G32B32A32_SFLOAT,
-			VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
-			static_cast<uint32_t>(g_cameraProperties.GetWidth()),
-			static_cast<uint32_t>(g_cameraProperties.GetHeight()));
-		g_resultImages.push_back(image);
-		g_resultImageViews.push_back(new VulkanImageView(g_device, image));
-	}
-
-	// Transition to general layout since they will be written to in the rendering techniques
-	VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
-	for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-	{
-		utilities::CmdTransitionImageLayout(commandBuffer, g_resultImages[i]->GetImage(), g_resultImages[i]->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-	}
-	utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+	CreateResultImage();
 
 	// Create framebuffers for ImGUI if already present
 	if (g_imguiLayer)
@@ -432,7 +708,7 @@ void CreateSwapchain()
 	}
 
 	// Per-swapchain-image semaphore for presentation completion (unique per image)
-	for (size_t i = 0; i < g_swapchain->GetImageCount(); i++)
+	for (size_t i = 0; i < GetPresentImageCount(); i++)
 	{
 		g_graphicsFinishedSemaphores.emplace_back(g_device);
 	}
@@ -455,15 +731,20 @@ void Clear()
 
 	// Shadow Volume
 	delete g_shadowVolumeTechnique;
-	delete g_shadowVolumePropertiesBuffer;
-	delete g_shadowVolumeImageView;
-	delete g_shadowVolumeImage;
+	for (unsigned int i = 0; i < g_shadowVolumeImages.size(); i++)
+	{
+		delete g_shadowVolumePropertiesBuffers[i];
+		delete g_shadowVolumeImageViews[i];
+		delete g_shadowVolumeImages[i];
+	}
 	delete g_shadowVolumeSampler;
 
 	// Cloud Memory Allocations
 	delete g_cloudImageView;
 	delete g_cloudSampler;
 	delete g_cloudImage;
+	delete g_majorantImageView;
+	delete g_majorantImage;
 	delete g_cameraPropertiesBuffer;
 	delete g_cloudPropertiesBuffer;
 	delete g_parametersBuffer;
@@ -473,17 +754,27 @@ void Clear()
 	delete g_pathTracingTechnique;
 	delete g_photonMappingTechnique;
 	delete g_photonBeamsTechnique;
+	delete g_adaptiveSamplingTechnique;
+	delete g_resolveTechnique;
+	delete g_profiler;
 	delete g_computeCommandPool;
 	delete g_computeDescriptorPool;
 
+	// Keeps the pipelines compiled this run for the next start
+	g_pipelineCache->Save();
+	delete g_pipelineCache;
+
 	// Vulkan General Resources
 	delete g_device;
 	delete g_physicalDevice;
 	delete g_surface;
 	delete g_instance;
 
-	glfwDestroyWindow(g_window);
-	glfwTerminate();
+	if (g_window)
+	{
+		glfwDestroyWindow(g_window);
+		glfwTerminate();
+	}
 
 	std::cout << "OK" << std::endl;
 }
@@ -499,9 +790,16 @@ void UpdateUI()
 		ImGui::Text("FrameCount: %i", g_pushConstants.frameCount);
 		ImGui::Text("Elapsed time: %.2f", g_pushConstants.time - g_renderStartTime);
 		ImGui::Text("ms/frame: %.2f", g_UISecondsPerFrame);
+		ImGui::Text("Samples/s: %.0f (%i per present)", g_UISamplesPerSecond, g_samplesPerPresent);
+		ImGui::Text("Unconverged tiles: %u/%u", g_adaptiveSamplingTechnique->GetUnconvergedTileCount(), g_adaptiveSamplingTechnique->GetTileCount());
+		if (g_shadowVolumeTechnique->IsRebuilding())
+		{
+			ImGui::Text("Shadow volume rebuild: %.0f%%", 100.f * g_shadowVolumeTechnique->GetRebuildProgress());
+		}
 	}
 	ImGui::End();
 
+	g_imguiLayer->ShowPassTimes(g_profiler->GetPassTimes());
 
 	ImGui::Begin("Cloud File");
 	{
@@ -535,14 +833,41 @@ void UpdateUI()
 
 		ImGui::Text("Lighting");
 		ImGui::InputFloat3("Direction ", &g_UILightDirection[0]);
+		ImGui::SameLine();
+		if (ImGui::Button("Rebuild"))
+		{
+			// Only the shadow volume follows the light, the frames in flight are not waited for
+			UpdateShadowVolume();
+		}
 		ImGui::SliderFloat("Intensity ", &g_parameters.lightIntensity, 0, 10);
 
 		ImGui::Separator();
 		ImGui::Text("Cloud");
 		ImGui::SliderFloat("Density", &g_cloudProperties.densityScaling, 0, 1000);
 
+		ImGui::Separator();
+		ImGui::Text("Adaptive Sampling");
+		if (ImGui::InputFloat("Target error", &g_adaptiveTargetError))
+		{
+			g_adaptiveSamplingTechnique->SetTargetError(g_adaptiveTargetError);
+		}
+
+		ImGui::Separator();
+		ImGui::Text("Accumulation");
+		ImGui::Combo("Mode", &g_UIAccumulationMode, ACCUMULATION_MODE_NAMES, IM_ARRAYSIZE(ACCUMULATION_MODE_NAMES));
+
+		ImGui::Separator();
+		ImGui::Text("Presentation");
+		if (ImGui::SliderInt("Samples per present", &g_samplesPerPresent, 1, MAX_SAMPLES_PER_PRESENT))
+		{
+			g_adaptiveSamplesPerPresent = static_cast<float>(g_samplesPerPresent);
+		}
+		ImGui::InputFloat("Present budget (ms)", &g_presentBudget);
+
 		if (ImGui::Button("Apply"))
 		{
+			// Restarts the accumulation with the shadow volume update
+			g_pushConstants.accumulationMode = static_cast<EAccumulationMode>(g_UIAccumulationMode);
 
 			if (g_UIPreviousResolution != g_UICurrentResolution)
 			{
@@ -554,9 +879,11 @@ void UpdateUI()
 			}
 
 			// Set frame references again
-			g_pathTracingTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
-			g_photonMappingTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
-			g_photonBeamsTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
+			g_pathTracingTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+			g_photonMappingTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+			g_photonBeamsTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+			UpdateAccumulation();
+			UpdateAdaptiveSampling();
 
 			// Recreate command buffers
 			g_computeCommandPool->AllocateCommandBuffers(g_swapchain->GetImageCount());
@@ -564,6 +891,7 @@ void UpdateUI()
 
 			// Update data in memory
 			g_parameters.SetPhaseG(g_UIPhaseG);
+			UpdatePermutations();
 			g_cameraProperties.SetFOV(g_UIFov);
 			g_cameraProperties.SetRotation(g_UICameraRotate);
 
@@ -579,16 +907,14 @@ void UpdateUI()
 			auto cameraPropertiesInfo = initializers::DescriptorBufferInfo(g_cameraPropertiesBuffer->GetBuffer(), 0, g_cameraPropertiesBuffer->GetSize());
 			auto cloudBufferInfo = initializers::DescriptorBufferInfo(g_cloudPropertiesBuffer->GetBuffer(), 0, g_cloudPropertiesBuffer->GetSize());
 
-			for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
-			{
-				g_photonMappingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo, i);
-				g_photonMappingTechnique->QueueUpdateParameters(parametersInfo, i);
-				g_photonMappingTechnique->QueueUpdateCloudData(cloudBufferInfo, i);
+			g_photonMappingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo);
+			g_photonMappingTechnique->QueueUpdateParameters(parametersInfo);
+			g_photonMappingTechnique->QueueUpdateCloudData(cloudBufferInfo);
+
+			g_pathTracingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo);
+			g_pathTracingTechnique->QueueUpdateParameters(parametersInfo);
+			g_pathTracingTechnique->QueueUpdateCloudData(cloudBufferInfo);
 
-				g_pathTracingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo, i);
-				g_pathTracingTechnique->QueueUpdateParameters(parametersInfo, i);
-				g_pathTracingTechnique->QueueUpdateCloudData(cloudBufferInfo, i);
-			}
 			g_photonMappingTechnique->UpdateDescriptorSets();
 			g_pathTracingTechnique->UpdateDescriptorSets();
 
@@ -602,6 +928,17 @@ void UpdateUI()
 
 void DrawFrame()
 {
+	// The rebuilt shadow volume replaces the one in use once the frame with its last slice finished
+	if (g_shadowVolumeTechnique->IsRebuildRecorded() && IsFrameFinished(g_shadowVolumeTechnique->GetLastSliceFrame()))
+	{
+		SwapShadowVolume();
+	}
+
+	if (g_shadowVolumeRebuildPending && IsFrameFinished(g_shadowVolumeTechnique->GetBackReleaseFrame()))
+	{
+		BeginShadowVolumeRebuild(g_shadowVolumeSliceCount);
+	}
+
 	// Wait for queue to finish if it is still running, and restore fence to original state
 	vkWaitForFences(g_device->GetDevice(), 1, &g_inFlightFences[g_currentFrameIdx].GetFence(), VK_TRUE, UINT64_MAX);
 
@@ -621,6 +958,11 @@ void DrawFrame()
 	// Mark the image as now being in use by this frame
 	g_imagesInFlight[imageIndex] = g_inFlightFences[g_currentFrameIdx].GetFence();
 
+	// The fence of this slot signalled, so are its readbacks
+	g_shadowVolumeTechnique->PrepareFrame(g_currentFrameIdx);
+	g_adaptiveSamplingTechnique->PrepareFrame(g_currentFrameIdx);
+	g_currentTechnique->PrepareFrame(g_currentFrameIdx);
+
 	// Submit compute command buffer to queue
 	{
 		VkCommandBuffer commandBuffer = g_computeCommandPool->GetCommandBuffers()[imageIndex];
@@ -628,7 +970,30 @@ void DrawFrame()
 		vkResetCommandBuffer(commandBuffer, 0);
 		VkCommandBufferBeginInfo beginInfo = initializers::CommandBufferBeginInfo();
 		vkBeginCommandBuffer(commandBuffer, &beginInfo);
-		g_currentTechnique->RecordDrawCommands(commandBuffer, imageIndex);
+
+		// Frames in flight accumulate into the same buffers and result image, the previous frame has to finish writing them
+		VkMemoryBarrier frameBarrier = initializers::MemBarrier(VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &frameBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+
+		g_profiler->CmdBeginFrame(commandBuffer);
+		g_shadowVolumeTechnique->RecordDrawCommands(commandBuffer, imageIndex);
+
+		// The push constants are copied when a sample is recorded, so each one gets its own seed and frame count
+		for (int sample = 0; sample < g_samplesPerPresent; sample++)
+		{
+			if (sample > 0)
+			{
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &frameBarrier, 0, VK_NULL_HANDLE, 0, VK_NULL_HANDLE);
+			}
+
+			g_pushConstants.seed = std::rand();
+			g_adaptiveSamplingTechnique->RecordDrawCommands(commandBuffer, imageIndex);
+			g_currentTechnique->RecordDrawCommands(commandBuffer, imageIndex);
+			g_pushConstants.frameCount++;
+		}
+		g_samplesInSecond += g_samplesPerPresent;
+
+		g_resolveTechnique->RecordDrawCommands(commandBuffer, imageIndex);
 		ValidCheck(vkEndCommandBuffer(commandBuffer));
 
 		std::vector<VkCommandBuffer> commandBuffers{ commandBuffer };
@@ -668,9 +1033,11 @@ void DrawFrame()
 		info.renderArea.extent.height = g_cameraProperties.GetHeight();
 		info.clearValueCount = 1;
 		info.pClearValues = &clearValue;
+		g_profiler->CmdBeginPass(commandBuffer, "ImGui");
 		vkCmdBeginRenderPass(commandBuffer, &info, VK_SUBPASS_CONTENTS_INLINE);
 		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
 		vkCmdEndRenderPass(commandBuffer);
+		g_profiler->CmdEndPass(commandBuffer);
 		ValidCheck(vkEndCommandBuffer(commandBuffer));
 
 		std::vector<VkCommandBuffer> commandBuffers{ commandBuffer };
@@ -711,6 +1078,102 @@ void DrawFrame()
 	g_currentFrameIdx = (g_currentFrameIdx + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void RenderHeadless(unsigned int frameCount, const std::string& outputFile)
+{
+	std::cout << "Rendering " << frameCount << " frames headless..." << std::endl;
+
+	VkCommandBuffer commandBuffer = g_computeCommandPool->GetCommandBuffers()[0];
+	VulkanFence& fence = g_inFlightFences[0];
+
+	std::ofstream profileFile;
+	if (!g_profileOutputFile.empty())
+	{
+		profileFile.open(g_profileOutputFile);
+		g_profiler->SetCSVOutput(&profileFile);
+	}
+
+	double startTime = GetTime();
+
+	unsigned int renderedFrames = 0;
+	for (; renderedFrames < frameCount; renderedFrames++)
+	{
+		UpdateTime();
+		g_pushConstants.seed = std::rand();
+
+		g_adaptiveSamplingTechnique->PrepareFrame(0);
+		g_currentTechnique->PrepareFrame(0);
+
+		vkResetFences(g_device->GetDevice(), 1, &fence.GetFence());
+		vkResetCommandBuffer(commandBuffer, 0);
+		VkCommandBufferBeginInfo beginInfo = initializers::CommandBufferBeginInfo();
+		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+		g_profiler->CmdBeginFrame(commandBuffer);
+		g_adaptiveSamplingTechnique->RecordDrawCommands(commandBuffer, 0);
+		g_currentTechnique->RecordDrawCommands(commandBuffer, 0);
+		ValidCheck(vkEndCommandBuffer(commandBuffer));
+
+		// Frames accumulate into the same image, so each one has to finish before the next is recorded
+		VkSubmitInfo computeSubmit = initializers::SubmitInfo();
+		computeSubmit.pCommandBuffers = &commandBuffer;
+		computeSubmit.commandBufferCount = 1;
+		ValidCheck(vkQueueSubmit(g_device->GetComputeQueue(), 1, &computeSubmit, fence.GetFence()));
+		vkWaitForFences(g_device->GetDevice(), 1, &fence.GetFence(), VK_TRUE, UINT64_MAX);
+
+		g_pushConstants.frameCount++;
+
+		// Every pixel reached the target error before this frame, it did not sample anything
+		if (g_adaptiveSamplingTechnique->ReadUnconvergedTileCount() == 0)
+		{
+			std::cout << "Converged to a relative error of " << g_adaptiveTargetError << std::endl;
+			break;
+		}
+	}
+
+	double elapsedTime = GetTime() - startTime;
+	std::cout << "Rendered " << renderedFrames << " frames in " << elapsedTime << "s (" << 1000.0 * elapsedTime / std::max(renderedFrames, 1u) << " ms/frame)" << std::endl;
+
+	// Read back the converged image
+	VulkanImage* resultImage = g_resultImage;
+	VkExtent3D extent = resultImage->GetExtent();
+	std::vector<glm::vec4> pixels(size_t(extent.width) * extent.height);
+	VulkanBuffer readbackBuffer(g_device, pixels.data(), sizeof(glm::vec4), VK_BUFFER_USAGE_TRANSFER_DST_BIT, pixels.size());
+
+	VkCommandBuffer readbackCommandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
+	g_resolveTechnique->RecordDrawCommands(readbackCommandBuffer, 0);
+	utilities::CmdTransitionImageLayout(readbackCommandBuffer, resultImage->GetImage(), resultImage->GetFormat(), VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	utilities::CmdCopyImageToBuffer(readbackCommandBuffer, resultImage->GetImage(), readbackBuffer.GetBuffer(), extent);
+	utilities::CmdTransitionImageLayout(readbackCommandBuffer, resultImage->GetImage(), resultImage->GetFormat(), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+	utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, readbackCommandBuffer);
+	readbackBuffer.GetData();
+
+	utilities::SaveImage(outputFile, extent.width, extent.height, pixels);
+	std::cout << "Saved result to \"" << outputFile << "\"" << std::endl;
+
+	// The resolve is timed with the last frame
+	if (profileFile.is_open())
+	{
+		g_profiler->Flush();
+		g_profiler->SetCSVOutput(nullptr);
+		std::cout << "Saved pass times to \"" << g_profileOutputFile << "\"" << std::endl;
+	}
+}
+
+// Scales the samples of the next present by how far the last one was from the budget
+void UpdateSamplesPerPresent()
+{
+	double presentTime = g_pushConstants.time - g_previousPresentTime;
+	g_previousPresentTime = g_pushConstants.time;
+	if (g_presentBudget <= 0 || presentTime <= 0)
+	{
+		return;
+	}
+
+	// Limited per present, the time of the frames in flight lags behind the sample count
+	float scale = glm::clamp(static_cast<float>(g_presentBudget / (1000.0 * presentTime)), 0.5f, 2.f);
+	g_adaptiveSamplesPerPresent = glm::clamp(g_adaptiveSamplesPerPresent * scale, 1.f, static_cast<float>(MAX_SAMPLES_PER_PRESENT));
+	g_samplesPerPresent = static_cast<int>(g_adaptiveSamplesPerPresent + 0.5f);
+}
+
 void RenderLoop()
 {
 	std::cout << "Render Loop started" << std::endl;
@@ -719,13 +1182,11 @@ void RenderLoop()
 		glfwPollEvents();
 		UpdateTime();
 
-		g_pushConstants.seed = std::rand();
-
 		if (!glfwGetWindowAttrib(g_window, GLFW_ICONIFIED))
 		{
 			UpdateUI();
 			DrawFrame();
-			g_pushConstants.frameCount++;
+			UpdateSamplesPerPresent();
 			g_framesInSecond++;
 		}
 	}
@@ -769,15 +1230,23 @@ bool InitializeVulkan()
 	VulkanConfiguration config{};
 	config.applicationName = "Cloud Renderer";
 	config.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+	config.headless = g_headless;
 
 	// Instance
 	g_instance = new VulkanInstance(config);
 
 	// Surface
-	g_surface = new VulkanSurface(g_instance, g_window);
+	if (!g_headless)
+	{
+		g_surface = new VulkanSurface(g_instance, g_window);
+	}
 
 	// Physical Device
-	const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	std::vector<const char*> deviceExtensions;
+	if (!g_headless)
+	{
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
 	g_physicalDevice = VulkanPhysicalDevice::CreatePhysicalDevice(g_instance, g_surface, deviceExtensions);
 	if (!g_physicalDevice)
 	{
@@ -788,6 +1257,10 @@ bool InitializeVulkan()
 	// Device
 	g_device = new VulkanDevice(g_instance, g_surface, g_physicalDevice);
 
+	// Every technique pipeline is created through the cache
+	g_pipelineCache = new VulkanPipelineCache(g_device, PIPELINE_CACHE_PATH);
+	g_device->SetPipelineCache(g_pipelineCache);
+
 	// Command Pool
 	g_computeCommandPool = new VulkanCommandPool(g_device, g_physicalDevice->GetQueueFamilyIndices().computeFamily);
 	g_graphicsCommandPool = new VulkanCommandPool(g_device, g_physicalDevice->GetQueueFamilyIndices().graphicsFamily);
@@ -798,9 +1271,25 @@ bool InitializeVulkan()
 	g_parametersBuffer = new VulkanBuffer(g_device, &g_parameters, sizeof(Parameters), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 	g_photonMapPropertiesBuffer = new VulkanBuffer(g_device, &g_photonMapProperties, sizeof(PhotonMapProperties), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
 
-	g_shadowVolumePropertiesBuffer = new VulkanBuffer(g_device, &g_shadowVolumeProperties, sizeof(ShadowVolumeProperties), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-	g_shadowVolumeImage = new VulkanImage(g_device, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, g_shadowVolumeProperties.voxelAxisCount, g_shadowVolumeProperties.voxelAxisCount, g_shadowVolumeProperties.voxelAxisCount);
-	g_shadowVolumeImageView = new VulkanImageView(g_device, g_shadowVolumeImage);
+	// The shadow volume shader writes r16f and r32f alike
+	if (!g_physicalDevice->GetPhyisicalDeviceFeatures().shaderStorageImageWriteWithoutFormat)
+	{
+		throw std::runtime_error("Shadow volume needs shaderStorageImageWriteWithoutFormat");
+	}
+
+	// The estimates select the front shadow volume out of both by a push constant
+	if (!g_physicalDevice->GetPhyisicalDeviceFeatures().shaderSampledImageArrayDynamicIndexing || !g_physicalDevice->GetPhyisicalDeviceFeatures().shaderUniformBufferArrayDynamicIndexing)
+	{
+		throw std::runtime_error("Shadow volume needs shaderSampledImageArrayDynamicIndexing and shaderUniformBufferArrayDynamicIndexing");
+	}
+
+	// Front and back shadow volume, both properties buffers share the host copy of the volume being rebuilt
+	for (unsigned int i = 0; i < 2; i++)
+	{
+		g_shadowVolumePropertiesBuffers.push_back(new VulkanBuffer(g_device, &g_shadowVolumeProperties, sizeof(ShadowVolumeProperties), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT));
+		g_shadowVolumeImages.push_back(new VulkanImage(g_device, g_shadowVolumeFormat, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, g_shadowVolumeProperties.voxelAxisCount, g_shadowVolumeProperties.voxelAxisCount, g_shadowVolumeProperties.voxelAxisCount));
+		g_shadowVolumeImageViews.push_back(new VulkanImageView(g_device, g_shadowVolumeImages.back()));
+	}
 	g_shadowVolumeSampler = new VulkanSampler(g_device);
 
 	g_cameraPropertiesBuffer->SetData();
@@ -811,46 +1300,80 @@ bool InitializeVulkan()
 	g_shadowVolumeTechnique = new RenderTechniqueSV(g_device, &g_shadowVolumeProperties, &g_pushConstants);
 	g_pathTracingTechnique = new RenderTechniquePT(g_device, g_swapchain, &g_cameraProperties, &g_pushConstants);
 	g_photonMappingTechnique = new RenderTechniquePPM(g_device, g_swapchain, &g_cameraProperties, &g_photonMapProperties, &g_pushConstants, 10);
-	g_photonBeamsTechnique = new RenderTechniquePPB(g_device, &g_pushConstants, &g_cameraProperties, 200);
+	g_photonBeamsTechnique = new RenderTechniquePPB(g_device, &g_pushConstants, &g_cameraProperties, 200, g_beamCapacity, g_beamBVHWidth);
+	g_adaptiveSamplingTechnique = new RenderTechniqueAS(g_device, &g_pushConstants);
+	g_adaptiveSamplingTechnique->SetTargetError(g_adaptiveTargetError);
+	g_resolveTechnique = new RenderTechniqueRS(g_device, &g_cameraProperties, &g_pushConstants);
+
+	// One frame more than can be in flight, so the oldest frame in the ring has finished when it is read back.
+	// Every sample of a present is profiled, plus one sample's worth for the passes recorded once per present
+	g_profiler = new VulkanTimestampProfiler(g_device, MAX_FRAMES_IN_FLIGHT + 1, MAX_PROFILED_PASSES_PER_SAMPLE * (MAX_SAMPLES_PER_PRESENT + 1));
+	for (RenderTechnique* technique : std::vector<RenderTechnique*>{ g_shadowVolumeTechnique, g_pathTracingTechnique, g_photonMappingTechnique, g_photonBeamsTechnique, g_adaptiveSamplingTechnique, g_resolveTechnique })
+	{
+		technique->SetProfiler(g_profiler);
+	}
+	UpdatePermutations();
 
-	// Create swapchain
-	CreateSwapchain();
-	if (!g_imguiLayer)
+	// Create swapchain, or only the result images if there is nothing to present to
+	if (g_headless)
 	{
-		InitializeImGUI();
+		CreateResultImage();
+	}
+	else
+	{
+		CreateSwapchain();
+		if (!g_imguiLayer)
+		{
+			InitializeImGUI();
+		}
 	}
 
-	// Compute Descriptor Pool
+	// Compute Descriptor Pool, the sets do not depend on the swapchain image
 	std::vector<VkDescriptorPoolSize> poolSizes;
-	for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
+	g_pathTracingTechnique->GetDescriptorPoolSizes(poolSizes);
+	g_photonMappingTechnique->GetDescriptorPoolSizes(poolSizes);
+	g_photonBeamsTechnique->GetDescriptorPoolSizes(poolSizes);
+	g_adaptiveSamplingTechnique->GetDescriptorPoolSizes(poolSizes);
+	g_resolveTechnique->GetDescriptorPoolSizes(poolSizes);
+	for (unsigned int i = 0; i < g_shadowVolumeImages.size(); i++)
 	{
-		g_pathTracingTechnique->GetDescriptorPoolSizes(poolSizes);
-        g_photonMappingTechnique->GetDescriptorPoolSizes(poolSizes);
-        g_photonBeamsTechnique->GetDescriptorPoolSizes(poolSizes);		
+		g_shadowVolumeTechnique->GetDescriptorPoolSizes(poolSizes);
 	}
-    g_shadowVolumeTechnique->GetDescriptorPoolSizes(poolSizes);
 
-	uint32_t requiredSets = g_shadowVolumeTechnique->GetRequiredSetCount() +
-		(g_pathTracingTechnique->GetRequiredSetCount() + g_photonMappingTechnique->GetRequiredSetCount() + g_photonBeamsTechnique->GetRequiredSetCount()) * g_swapchain->GetImageCount();
+	uint32_t requiredSets = g_shadowVolumeTechnique->GetRequiredSetCount() * static_cast<uint32_t>(g_shadowVolumeImages.size()) +
+		(g_pathTracingTechnique->GetRequiredSetCount() + g_photonMappingTechnique->GetRequiredSetCount() + g_photonBeamsTechnique->GetRequiredSetCount() +
+			g_adaptiveSamplingTechnique->GetRequiredSetCount() + g_resolveTechnique->GetRequiredSetCount());
 	g_computeDescriptorPool = new VulkanDescriptorPool(g_device, poolSizes, requiredSets);
 
-	g_computeDescriptorPool->AllocateSets(g_pathTracingTechnique, g_swapchain->GetImageCount());
-	g_computeDescriptorPool->AllocateSets(g_photonMappingTechnique, g_swapchain->GetImageCount());
-	g_computeDescriptorPool->AllocateSets(g_photonBeamsTechnique, g_swapchain->GetImageCount());
-	g_computeDescriptorPool->AllocateSets(g_shadowVolumeTechnique, 1);
+	g_computeDescriptorPool->AllocateSets(g_pathTracingTechnique);
+	g_computeDescriptorPool->AllocateSets(g_photonMappingTechnique);
+	g_computeDescriptorPool->AllocateSets(g_photonBeamsTechnique);
+	g_computeDescriptorPool->AllocateSets(g_adaptiveSamplingTechnique);
+	g_computeDescriptorPool->AllocateSets(g_resolveTechnique);
+	g_computeDescriptorPool->AllocateSets(g_shadowVolumeTechnique, static_cast<unsigned int>(g_shadowVolumeImages.size()));
 
-	g_pathTracingTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
-	g_photonMappingTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
-	g_photonBeamsTechnique->SetFrameReferences(g_resultImages, g_resultImageViews, g_swapchain);
+	g_pathTracingTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+	g_photonMappingTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+	g_photonBeamsTechnique->SetFrameReferences(g_resultImage, g_resultImageView, g_swapchain);
+	UpdateAccumulation();
+	UpdateAdaptiveSampling();
 
 	// Recreate command buffers
-	g_computeCommandPool->AllocateCommandBuffers(g_swapchain->GetImageCount());
-	g_graphicsCommandPool->AllocateCommandBuffers(g_swapchain->GetImageCount());
+	g_computeCommandPool->AllocateCommandBuffers(GetPresentImageCount());
+	g_graphicsCommandPool->AllocateCommandBuffers(GetPresentImageCount());
 
-	// Set shadow volume output image
-	std::vector<VulkanImage*> shadowImg{ g_shadowVolumeImage };
-	std::vector<VulkanImageView*> shadowView{ g_shadowVolumeImageView };
-	g_shadowVolumeTechnique->SetFrameReferences(shadowImg, shadowView, nullptr);
+	// Set shadow volume output images
+	g_shadowVolumeTechnique->SetVolumes(g_shadowVolumeImages, g_shadowVolumeImageViews);
+
+	// Both volumes stay in the general layout, the estimates bind the one being rebuilt as well
+	{
+		VkCommandBuffer commandBuffer = utilities::BeginSingleTimeCommands(g_device, g_computeCommandPool);
+		for (VulkanImage* image : g_shadowVolumeImages)
+		{
+			utilities::CmdTransitionImageLayout(commandBuffer, image->GetImage(), image->GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+		}
+		utilities::EndSingleTimeCommands(g_device, g_computeCommandPool, commandBuffer);
+	}
 
 	// Transfer cloud data to device image and make it readable by the shader
 	UpdateCloudData();
@@ -858,35 +1381,44 @@ bool InitializeVulkan()
 	// Update descriptor sets
 	auto parameterInfo = initializers::DescriptorBufferInfo(g_parametersBuffer->GetBuffer(), 0, g_parametersBuffer->GetSize());
 	auto cameraPropertiesInfo = initializers::DescriptorBufferInfo(g_cameraPropertiesBuffer->GetBuffer(), 0, g_cameraPropertiesBuffer->GetSize());
-	auto shadowImageInfo = initializers::DescriptorImageInfo(g_shadowVolumeSampler->GetSampler(), g_shadowVolumeImageView->GetImageView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-	for (unsigned int i = 0; i < g_swapchain->GetImageCount(); i++)
+	std::vector<VkDescriptorBufferInfo> shadowVolumeInfos;
+	std::vector<VkDescriptorImageInfo> shadowVolumeImageInfos;
+	for (unsigned int v = 0; v < g_shadowVolumeImages.size(); v++)
 	{
-		g_pathTracingTechnique->QueueUpdateParameters(parameterInfo, i);
-		g_pathTracingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo, i);
-		g_pathTracingTechnique->QueueUpdateShadowVolumeSampler(shadowImageInfo, i);
+		shadowVolumeInfos.push_back(initializers::DescriptorBufferInfo(g_shadowVolumePropertiesBuffers[v]->GetBuffer(), 0, g_shadowVolumePropertiesBuffers[v]->GetSize()));
+		shadowVolumeImageInfos.push_back(initializers::DescriptorImageInfo(g_shadowVolumeSampler->GetSampler(), g_shadowVolumeImageViews[v]->GetImageView(), VK_IMAGE_LAYOUT_GENERAL));
+	}
 
-		g_photonMappingTechnique->QueueUpdateParameters(parameterInfo, i);
-		g_photonMappingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo, i);
-		g_photonMappingTechnique->QueueUpdateShadowVolumeSampler(shadowImageInfo, i);
+	g_pathTracingTechnique->QueueUpdateParameters(parameterInfo);
+	g_pathTracingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo);
 
-		g_photonBeamsTechnique->QueueUpdateParameters(parameterInfo, i);
-		g_photonBeamsTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo, i);
-		g_photonBeamsTechnique->QueueUpdateShadowVolumeSampler(shadowImageInfo, i);
+	g_photonMappingTechnique->QueueUpdateParameters(parameterInfo);
+	g_photonMappingTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo);
+
+	g_photonBeamsTechnique->QueueUpdateParameters(parameterInfo);
+	g_photonBeamsTechnique->QueueUpdateCameraProperties(cameraPropertiesInfo);
+
+	for (unsigned int v = 0; v < g_shadowVolumeImages.size(); v++)
+	{
+		g_pathTracingTechnique->QueueUpdateShadowVolume(shadowVolumeInfos[v], v);
+		g_pathTracingTechnique->QueueUpdateShadowVolumeSampler(shadowVolumeImageInfos[v], v);
+		g_photonMappingTechnique->QueueUpdateShadowVolume(shadowVolumeInfos[v], v);
+		g_photonMappingTechnique->QueueUpdateShadowVolumeSampler(shadowVolumeImageInfos[v], v);
+		g_photonBeamsTechnique->QueueUpdateShadowVolume(shadowVolumeInfos[v], v);
+		g_photonBeamsTechnique->QueueUpdateShadowVolumeSampler(shadowVolumeImageInfos[v], v);
 	}
 	g_photonBeamsTechnique->UpdateDescriptorSets();
 	g_pathTracingTechnique->UpdateDescriptorSets();
 	g_photonMappingTechnique->UpdateDescriptorSets();
 
-	shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-	g_shadowVolumeTechnique->QueueUpdateShadowVolumeSampler(shadowImageInfo, 0);
-	g_shadowVolumeTechnique->UpdateDescriptorSets();
-
 	// Create framebuffers for ImGUI
-	g_framebuffers.resize(g_swapchainImageViews.size());
-	for (size_t i = 0; i < g_framebuffers.size(); i++)
+	if (g_imguiLayer)
 	{
-		g_framebuffers[i] = new VulkanFramebuffer(g_device, g_imguiLayer->GetRenderPass(), &g_swapchainImageViews[i], g_swapchain);
+		g_framebuffers.resize(g_swapchainImageViews.size());
+		for (size_t i = 0; i < g_framebuffers.size(); i++)
+		{
+			g_framebuffers[i] = new VulkanFramebuffer(g_device, g_imguiLayer->GetRenderPass(), &g_swapchainImageViews[i], g_swapchain);
+		}
 	}
 
 	// Semaphores (GPU-GPU) and Fences (CPU-GPU)
@@ -902,7 +1434,7 @@ bool InitializeVulkan()
 		g_computeFinishedSemaphores.emplace_back(g_device);
 	}	
 
-	g_imagesInFlight.resize(g_swapchain->GetSwapchainImages().size(), VK_NULL_HANDLE);
+	g_imagesInFlight.resize(GetPresentImageCount(), VK_NULL_HANDLE);
 
 	std::cout << "OK" << std::endl;
 
@@ -924,6 +1456,41 @@ bool InitializeGLFW()
 	return true;
 }
 
+void RenderCPU(unsigned int frameCount, const std::string& outputFile)
+{
+	// The CPU path tracer reads the host copy of the cloud
+	g_keepCloudData = true;
+	g_cloudData = new Grid3D<float>(100, 100, 100, .01, .01, .01);
+	SetCloudProperties(g_cloudData);
+	LoadCloudFile(CLOUD_FILE_PATH);
+	g_cameraProperties.SetFOV(g_UIFov);
+
+	// A full resolution shadow volume would not fit a preview budget
+	g_shadowVolumeProperties.voxelAxisCount = CPU_SHADOW_VOLUME_AXIS_COUNT;
+	g_shadowVolumeProperties.SetLightDirection(g_UILightDirection);
+	g_shadowVolumeProperties.SetOrigin(g_cloudProperties.bounds[0], g_cloudProperties.bounds[1]);
+
+	CPUPathTracer pathTracer(g_cloudData, 0, g_cpuPacketTracking);
+	pathTracer.UpdateShadowVolume(g_cloudProperties, g_shadowVolumeProperties);
+
+	std::cout << "Rendering " << frameCount << " frames on the CPU..." << std::endl;
+	g_pushConstants.frameCount = 1;
+	double startTime = GetTime();
+
+	for (unsigned int i = 0; i < frameCount; i++)
+	{
+		g_pushConstants.seed = std::rand();
+		pathTracer.Render(g_cameraProperties, g_cloudProperties, g_parameters, g_pushConstants);
+		g_pushConstants.frameCount++;
+	}
+
+	double elapsedTime = GetTime() - startTime;
+	std::cout << "Rendered " << frameCount << " frames in " << elapsedTime << "s (" << 1000.0 * elapsedTime / std::max(frameCount, 1u) << " ms/frame)" << std::endl;
+
+	utilities::SaveImage(outputFile, pathTracer.GetWidth(), pathTracer.GetHeight(), pathTracer.GetResult());
+	std::cout << "Saved result to \"" << outputFile << "\"" << std::endl;
+}
+
 void StartSimulation(ERenderTechnique technique)
 {
 	// Create default data
@@ -932,7 +1499,10 @@ void StartSimulation(ERenderTechnique technique)
 	g_cameraProperties.SetFOV(g_UIFov);
 
 	// Initialize Framework
-	InitializeGLFW();
+	if (!g_headless)
+	{
+		InitializeGLFW();
+	}
 	InitializeVulkan();
 
 	SetRenderTechnique(technique);
@@ -940,15 +1510,209 @@ void StartSimulation(ERenderTechnique technique)
 	LoadCloudFile(CLOUD_FILE_PATH);
 	UpdateCloudData();
 
-	RenderLoop();
+	if (g_headless)
+	{
+		RenderHeadless(g_headlessFrameCount, g_headlessOutputFile);
+	}
+	else
+	{
+		RenderLoop();
+	}
 }
 
-int main()
+void PrintUsage()
+{
+	std::cout << "Usage: CloudRendering-Vulkan [--headless] [--technique pt|ppm|ppb] [--frames N] [--output file.pfm|file.ppm] [--cloud file] [--resolution WxH] [--cpu] [--cpu-packets] [--beam-capacity N] [--beam-bvh-width 2|4|8] [--target-error E] [--accumulation mean|compensated] [--shadow-volume-resolution N] [--shadow-volume-format r16f|r32f] [--shadow-volume-slices N] [--no-density-mips] [--samples-per-present N] [--present-budget ms] [--profile file.csv] [--tests] [--benchmarks]" << std::endl;
+}
+
+bool ParseArguments(int argc, char** argv, ERenderTechnique& outTechnique)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (argument == "--headless")
+		{
+			g_headless = true;
+		}
+		else if (argument == "--tests")
+		{
+			g_runTests = true;
+		}
+		else if (argument == "--benchmarks")
+		{
+			g_runBenchmarks = true;
+		}
+		else if (argument == "--cpu")
+		{
+			g_cpuRender = true;
+		}
+		else if (argument == "--cpu-packets")
+		{
+			g_cpuRender = true;
+			g_cpuPacketTracking = true;
+		}
+		else if (argument == "--technique" && hasValue)
+		{
+			std::string technique = argv[++i];
+			if (technique == "pt")
+			{
+				outTechnique = ERenderTechnique::PathTracing;
+			}
+			else if (technique == "ppm")
+			{
+				outTechnique = ERenderTechnique::PhotonMapping;
+			}
+			else if (technique == "ppb")
+			{
+				outTechnique = ERenderTechnique::PhotonBeams;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (argument == "--frames" && hasValue)
+		{
+			g_headlessFrameCount = static_cast<unsigned int>(std::stoul(argv[++i]));
+		}
+		else if (argument == "--output" && hasValue)
+		{
+			g_headlessOutputFile = argv[++i];
+		}
+		else if (argument == "--beam-capacity" && hasValue)
+		{
+			g_beamCapacity = std::stoull(argv[++i]);
+		}
+		else if (argument == "--beam-bvh-width" && hasValue)
+		{
+			g_beamBVHWidth = static_cast<unsigned int>(std::stoul(argv[++i]));
+			if (g_beamBVHWidth != 2 && g_beamBVHWidth != 4 && g_beamBVHWidth != 8)
+			{
+				return false;
+			}
+		}
+		else if (argument == "--target-error" && hasValue)
+		{
+			g_adaptiveTargetError = std::stof(argv[++i]);
+		}
+		else if (argument == "--accumulation" && hasValue)
+		{
+			std::string mode = argv[++i];
+			if (mode == "mean")
+			{
+				g_pushConstants.accumulationMode = EAccumulationMode::RunningMean;
+			}
+			else if (mode == "compensated")
+			{
+				g_pushConstants.accumulationMode = EAccumulationMode::CompensatedSum;
+			}
+			else
+			{
+				std::cout << "Unknown accumulation mode \"" << mode << "\"" << std::endl;
+				return false;
+			}
+			g_UIAccumulationMode = static_cast<int>(g_pushConstants.accumulationMode);
+		}
+		else if (argument == "--shadow-volume-resolution" && hasValue)
+		{
+			g_shadowVolumeProperties.voxelAxisCount = std::max(static_cast<unsigned int>(std::stoul(argv[++i])), 2u);
+		}
+		else if (argument == "--shadow-volume-format" && hasValue)
+		{
+			std::string format = argv[++i];
+			if (format == "r16f")
+			{
+				g_shadowVolumeFormat = VK_FORMAT_R16_SFLOAT;
+			}
+			else if (format == "r32f")
+			{
+				g_shadowVolumeFormat = VK_FORMAT_R32_SFLOAT;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else if (argument == "--shadow-volume-slices" && hasValue)
+		{
+			g_shadowVolumeSliceCount = std::max(static_cast<unsigned int>(std::stoul(argv[++i])), 1u);
+		}
+		else if (argument == "--samples-per-present" && hasValue)
+		{
+			g_samplesPerPresent = glm::clamp(std::stoi(argv[++i]), 1, MAX_SAMPLES_PER_PRESENT);
+			g_adaptiveSamplesPerPresent = static_cast<float>(g_samplesPerPresent);
+		}
+		else if (argument == "--present-budget" && hasValue)
+		{
+			g_presentBudget = std::max(std::stof(argv[++i]), 0.f);
+		}
+		else if (argument == "--profile" && hasValue)
+		{
+			g_profileOutputFile = argv[++i];
+		}
+		else if (argument == "--no-density-mips")
+		{
+			g_cloudMipmaps = false;
+		}
+		else if (argument == "--cloud" && hasValue)
+		{
+			CLOUD_FILE_PATH = argv[++i];
+		}
+		else if (argument == "--resolution" && hasValue)
+		{
+			int width = 0, height = 0;
+			if (sscanf_s(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+			{
+				return false;
+			}
+			g_cameraProperties.SetResolution(width, height);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int main(int argc, char** argv)
 {
 	// Seed random
 	std::srand(0);
 
-    StartSimulation(ERenderTechnique::PathTracing);
+	ERenderTechnique technique = ERenderTechnique::PathTracing;
+	if (!ParseArguments(argc, argv, technique))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// CPU side tests and benchmarks, no Vulkan needed
+	if (g_runTests || g_runBenchmarks)
+	{
+		if (g_runTests)
+		{
+			tests::RunTests();
+		}
+		if (g_runBenchmarks)
+		{
+			tests::RunBenchmarks();
+		}
+		return 0;
+	}
+
+	// Path tracing on the CPU, no Vulkan needed
+	if (g_cpuRender)
+	{
+		RenderCPU(g_headlessFrameCount, g_headlessOutputFile);
+		delete g_cloudData;
+		return 0;
+	}
+
+    StartSimulation(technique);
 
 	Clear();
 
@@ -7,10 +7,17 @@
 #include <fstream>
 #include <vector>
 #include <set>
+#include <map>
 #include <string>
 #include <ctime>
+#include <chrono>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <future>
 #include <unordered_map>
+#include <immintrin.h>
 
 #define NOMINMAX // disable windows min and max functions
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -0,0 +1,45 @@
+// Shared by PathTracer.comp, PPM_PE.comp and PPB_PE.comp. The including shader declares
+// cameraProperties, resultImage, momentImage, tiles, accumulation, pushConstants and
+// the LUMINANCE and ACCUMULATION_* constants before the include
+
+// Pixel of this invocation, the workgroups only cover the unconverged tiles
+ivec2 getTilePixel()
+{
+    uint tile = tiles[gl_WorkGroupID.x];
+    return ivec2(uvec2(tile & 0xFFFFu, tile >> 16) * gl_WorkGroupSize.xy + gl_LocalInvocationID.xy);
+}
+
+// Accumulates the sample, with the luminance moments for the convergence test of AdaptiveTiles.comp
+void accumulateSample(in const ivec2 pixelCoord, in const vec4 result)
+{
+    bool restart = pushConstants.frameCount <= 1;
+    vec4 moments = restart ? vec4(0) : imageLoad(momentImage, pixelCoord);
+
+    float luminance = dot(result.rgb, LUMINANCE);
+    moments.z += 1.0f;
+    moments.x += (luminance - moments.x) / moments.z;
+    moments.y += (luminance * luminance - moments.y) / moments.z;
+    imageStore(momentImage, pixelCoord, moments);
+
+    if(pushConstants.accumulationMode == ACCUMULATION_COMPENSATED_SUM)
+    {
+        // Kahan summation, precise keeps the compiler from folding the compensation away
+        uint idx = uint(pixelCoord.x + pixelCoord.y * imageSize(resultImage).x);
+        AccumulationTexel texel = restart ? AccumulationTexel(vec4(0), vec4(0)) : accumulation[idx];
+        precise vec4 y = result - texel.compensation;
+        precise vec4 t = texel.sum + y;
+        precise vec4 compensation = (t - texel.sum) - y;
+        accumulation[idx] = AccumulationTexel(t, compensation);
+        return;
+    }
+
+    // Running mean, rounded again with every sample
+    vec4 resultOld = restart ? vec4(0) : imageLoad(resultImage, pixelCoord);
+    imageStore(resultImage, pixelCoord, resultOld + (result - resultOld) / moments.z);
+}
+
+// Angle between the rays of neighbouring pixels, the ray cone of a pixel widens by it per unit distance
+float pixelSpreadAngle()
+{
+    return cameraProperties.pixelSizeY / cameraProperties.nearPlane;
+}
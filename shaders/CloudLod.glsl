@@ -0,0 +1,16 @@
+// Shared by the tracing and estimate shaders. The including shader declares cloudSampler and
+// cloudProperties before the include
+
+// Mip level matching the footprint of a ray cone of the given width, a voxel wide footprint is the full resolution
+float cloudLod(in float coneWidth)
+{
+    vec3 voxelSize = (cloudProperties.bounds[1] - cloudProperties.bounds[0]).xyz / vec3(cloudProperties.voxelCount.xyz);
+    return log2(max(coneWidth / max(max(voxelSize.x, voxelSize.y), voxelSize.z), 1.0f));
+}
+
+// Density averaged over the footprint of a ray cone of the given width
+float sampleCloudLod(in vec3 pos, in float coneWidth)
+{
+    vec3 normalizedIdx = ((vec4(pos,0) - cloudProperties.bounds[0])/(cloudProperties.bounds[1] - cloudProperties.bounds[0])).xyz;
+    return textureLod(cloudSampler, normalizedIdx, cloudLod(coneWidth)).x;
+}
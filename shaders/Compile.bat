@@ -1,2 +1,15 @@
-for /F %%i in ('dir /b ^| findstr /v /i "\.bat$" ^| findstr /v /i "\.spv$"') do %VULKAN_SDK%\Bin\glslc.exe "%%i" -o "%cd%\%%i.spv"
-pause
\ No newline at end of file
+@echo off
+setlocal EnableDelayedExpansion
+rem SPIR-V as comma separated words, included by the techniques to embed the shaders into the binary
+rem A header is only regenerated when it is missing or older than its .comp or any .glsl, so an unchanged shader does not rebuild the techniques
+for %%i in (*.comp) do (
+    set stale=1
+    if exist "%%i.h" (
+        for /F %%f in ('dir /b /o:d "%%i.h" "%%i" *.glsl') do set newest=%%f
+        if "!newest!"=="%%i.h" set stale=0
+    )
+    if !stale!==1 (
+        echo %%i
+        %VULKAN_SDK%\Bin\glslc.exe -mfmt=num "%%i" -o "%cd%\%%i.h" || exit /b 1
+    )
+)
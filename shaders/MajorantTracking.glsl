@@ -0,0 +1,73 @@
+// Shared by PathTracer.comp, PPM_PT.comp and PPB_PT.comp. The including shader declares Ray, FLT_MAX,
+// majorantSampler and generateRandomNumber, and includes CloudLod.glsl before the include
+
+// Local delta tracking: the ray walks the brick grid with a 3D DDA and samples free flights
+// with the majorant of the current brick. Free flights are memoryless, so a flight that leaves
+// a brick is restarted at its boundary with the next majorant. Empty bricks are crossed in one step.
+// Returns true on a real collision before dist, t is the collision distance or dist otherwise.
+// The density is read from the mip matching the ray cone, which has traveled pathLength up to the ray origin
+// and widens by spreadAngle per unit distance. A spread of 0 reads the full resolution.
+// Coarser mips blend in voxels further away, so the majorants of every level are stacked along z, level 0 first
+bool trackMajorantGrid(in Ray ray, in float dist, in float pathLength, in float spreadAngle, out float t)
+{
+    ivec3 brickCount = textureSize(majorantSampler, 0);
+    int levelCount = textureQueryLevels(cloudSampler);
+    brickCount.z /= levelCount;
+    vec3 cloudSize = (cloudProperties.bounds[1] - cloudProperties.bounds[0]).xyz;
+    vec3 toGrid = vec3(cloudProperties.voxelCount.xyz) / (float(cloudProperties.majorantBrickSize) * cloudSize);
+
+    // Ray in brick grid space, t stays in world units
+    vec3 gridPos = (ray.pos - cloudProperties.bounds[0].xyz) * toGrid;
+    vec3 gridDir = ray.dir * toGrid;
+    ivec3 brick = clamp(ivec3(floor(gridPos)), ivec3(0), brickCount - 1);
+    ivec3 brickStep = ivec3(sign(gridDir));
+    vec3 tDelta = vec3(FLT_MAX);
+    vec3 tNext = vec3(FLT_MAX);
+    for (int i = 0; i < 3; i++)
+    {
+        if (brickStep[i] != 0)
+        {
+            tDelta[i] = abs(1.0f / gridDir[i]);
+            tNext[i] = (brick[i] + max(brickStep[i], 0) - gridPos[i]) / gridDir[i];
+        }
+    }
+
+    float densityToExtinction = cloudProperties.densityScaling / cloudProperties.baseScaling;
+    t = 0;
+    while (t < dist)
+    {
+        float tBrickExit = min(min(min(tNext.x, tNext.y), tNext.z), dist);
+        // The cone is widest at the brick exit, lookups between two levels are bounded by the coarser one
+        int level = min(int(ceil(cloudLod((pathLength + tBrickExit) * spreadAngle))), levelCount - 1);
+        float majorant = texelFetch(majorantSampler, ivec3(brick.xy, brick.z + level * brickCount.z), 0).x;
+        if (majorant > 0)
+        {
+            while (true)
+            {
+                t += -log(generateRandomNumber()) / (majorant * densityToExtinction);
+                if (t >= tBrickExit)
+                {
+                    break;
+                }
+
+                if (generateRandomNumber() < sampleCloudLod(ray.pos + t * ray.dir, (pathLength + t) * spreadAngle) / majorant)
+                {
+                    return true;
+                }
+            }
+        }
+
+        // Step into the neighbouring brick through the closest face
+        t = tBrickExit;
+        int axis = tNext.x < tNext.y ? (tNext.x < tNext.z ? 0 : 2) : (tNext.y < tNext.z ? 1 : 2);
+        brick[axis] += brickStep[axis];
+        if (brick[axis] < 0 || brick[axis] >= brickCount[axis])
+        {
+            break;
+        }
+        tNext[axis] += tDelta[axis];
+    }
+
+    t = dist;
+    return false;
+}